@@ -45,6 +45,7 @@
  *****************************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
 #include "qat_utils.h"
@@ -67,52 +68,281 @@
 
 static pthread_mutex_t mem_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-void qaeCryptoMemFree(void *ptr)
+/*
+ * Per thread cache of pinned memory blocks.
+ *
+ * Every block handed out is preceded by a QAT_BYTE_ALIGNMENT sized header
+ * recording the size class it belongs to. Blocks of the cached size classes
+ * are kept on a free list of the thread that frees them instead of being
+ * returned to USDM, and a thread whose list is empty refills it with a
+ * batch of blocks taken under a single acquisition of mem_mutex. When a
+ * list grows beyond its limit half of it is returned to USDM in one go.
+ * Allocations larger than the biggest class bypass the cache.
+ */
+#define QAE_CACHE_NUM_CLASSES      10
+#define QAE_CACHE_MIN_SHIFT        6
+#define QAE_CACHE_NO_CLASS         -1
+#define QAE_CACHE_HDR_SIZE         QAT_BYTE_ALIGNMENT
+/* bytes worth of blocks kept per size class and thread */
+#define QAE_CACHE_BYTES_PER_CLASS  0x40000
+#define QAE_CACHE_MIN_BLOCKS       4
+#define QAE_CACHE_SIG_ALLOC        0xA1A2A3A4
+#define QAE_CACHE_SIG_FREE         0xF1F2F3F4
+
+#define QAE_CACHE_CLASS_SIZE(i)    (1 << ((i) + QAE_CACHE_MIN_SHIFT))
+
+typedef struct _qae_cache_hdr {
+    struct _qae_cache_hdr *next;
+    int class_index;
+    unsigned int sig;
+} qae_cache_hdr;
+
+typedef struct _qae_cache_list {
+    qae_cache_hdr *head;
+    int count;
+} qae_cache_list;
+
+typedef struct _qae_thread_cache {
+    qae_cache_list lists[QAE_CACHE_NUM_CLASSES];
+} qae_thread_cache;
+
+static pthread_key_t qae_cache_key;
+static pthread_once_t qae_cache_once = PTHREAD_ONCE_INIT;
+static int qae_cache_key_valid = 0;
+
+/* maximum number of blocks cached for a size class */
+static inline int qae_cache_max_blocks(int class_index)
+{
+    int max = QAE_CACHE_BYTES_PER_CLASS / QAE_CACHE_CLASS_SIZE(class_index);
+    return max < QAE_CACHE_MIN_BLOCKS ? QAE_CACHE_MIN_BLOCKS : max;
+}
+
+/* number of blocks moved to or from USDM at once */
+static inline int qae_cache_batch(int class_index)
+{
+    return qae_cache_max_blocks(class_index) / 2;
+}
+
+/* size class serving an allocation, QAE_CACHE_NO_CLASS if too large */
+static inline int qae_cache_class(size_t memsize)
+{
+    int i;
+
+    for (i = 0; i < QAE_CACHE_NUM_CLASSES; i++) {
+        if (memsize <= QAE_CACHE_CLASS_SIZE(i))
+            return i;
+    }
+    return QAE_CACHE_NO_CLASS;
+}
+
+/* allocate a block from USDM, must be called with mem_mutex held */
+static qae_cache_hdr *qae_cache_usdm_alloc(size_t memsize, int class_index)
+{
+    qae_cache_hdr *hdr = NULL;
+
+    hdr = qaeMemAllocNUMA(memsize + QAE_CACHE_HDR_SIZE, 0, QAT_BYTE_ALIGNMENT);
+    if (hdr == NULL)
+        return NULL;
+    hdr->next = NULL;
+    hdr->class_index = class_index;
+    hdr->sig = QAE_CACHE_SIG_FREE;
+    return hdr;
+}
+
+/* return a list of blocks to USDM under a single lock */
+static void qae_cache_usdm_free_list(qae_cache_hdr *hdr)
 {
+    qae_cache_hdr *next = NULL;
+    void *ptr = NULL;
     int rc;
 
-    MEM_DEBUG("%s: Address: %p\n", __func__, ptr);
+    if (hdr == NULL)
+        return;
 
-    if (NULL == ptr) {
-        MEM_WARN("qaeCryptoMemFree trying to free NULL pointer.\n");
+    if ((rc = pthread_mutex_lock(&mem_mutex)) != 0) {
+        MEM_ERROR("pthread_mutex_lock: %s\n", strerror(rc));
         return;
     }
+    while (hdr != NULL) {
+        next = hdr->next;
+        ptr = hdr;
+        qaeMemFreeNUMA(&ptr);
+        hdr = next;
+    }
+    if ((rc = pthread_mutex_unlock(&mem_mutex)) != 0)
+        MEM_ERROR("pthread_mutex_unlock: %s\n", strerror(rc));
+}
+
+/* thread exit handler giving all the cached blocks back to USDM */
+static void qae_cache_destroy(void *arg)
+{
+    qae_thread_cache *cache = (qae_thread_cache *)arg;
+    int i;
+
+    if (cache == NULL)
+        return;
+    for (i = 0; i < QAE_CACHE_NUM_CLASSES; i++)
+        qae_cache_usdm_free_list(cache->lists[i].head);
+    free(cache);
+}
+
+static void qae_cache_key_init(void)
+{
+    int rc;
+
+    if ((rc = pthread_key_create(&qae_cache_key, qae_cache_destroy)) != 0) {
+        MEM_WARN("pthread_key_create: %s, cache disabled\n", strerror(rc));
+        return;
+    }
+    qae_cache_key_valid = 1;
+}
+
+/* get the cache of the calling thread, creating it on first use */
+static qae_thread_cache *qae_cache_get(void)
+{
+    qae_thread_cache *cache = NULL;
+
+    pthread_once(&qae_cache_once, qae_cache_key_init);
+    if (!qae_cache_key_valid)
+        return NULL;
+
+    cache = (qae_thread_cache *)pthread_getspecific(qae_cache_key);
+    if (cache == NULL) {
+        cache = calloc(1, sizeof(qae_thread_cache));
+        if (cache == NULL)
+            return NULL;
+        if (pthread_setspecific(qae_cache_key, cache) != 0) {
+            free(cache);
+            return NULL;
+        }
+    }
+    return cache;
+}
+
+/* refill an empty list with a batch of blocks from USDM */
+static void qae_cache_refill(qae_cache_list *list, int class_index)
+{
+    qae_cache_hdr *hdr = NULL;
+    int i, rc;
+    int batch = qae_cache_batch(class_index);
 
     MEM_DEBUG("%s: pthread_mutex_lock\n", __func__);
     if ((rc = pthread_mutex_lock(&mem_mutex)) != 0) {
         MEM_ERROR("pthread_mutex_lock: %s\n", strerror(rc));
         return;
     }
+    for (i = 0; i < batch; i++) {
+        hdr = qae_cache_usdm_alloc(QAE_CACHE_CLASS_SIZE(class_index),
+                                   class_index);
+        if (hdr == NULL)
+            break;
+        hdr->next = list->head;
+        list->head = hdr;
+        list->count++;
+    }
+    if ((rc = pthread_mutex_unlock(&mem_mutex)) != 0)
+        MEM_ERROR("pthread_mutex_unlock: %s\n", strerror(rc));
+    MEM_DEBUG("%s: pthread_mutex_unlock\n", __func__);
+}
 
-    qaeMemFreeNUMA(&ptr);
+/* give half of a list that has grown beyond its limit back to USDM */
+static void qae_cache_trim(qae_cache_list *list, int class_index)
+{
+    qae_cache_hdr *release = NULL;
+    qae_cache_hdr *hdr = NULL;
+    int keep = qae_cache_max_blocks(class_index) - qae_cache_batch(class_index);
 
-    if ((rc = pthread_mutex_unlock(&mem_mutex)) != 0) {
-        MEM_ERROR("pthread_mutex_unlock: %s\n", strerror(rc));
+    while (list->count > keep) {
+        hdr = list->head;
+        list->head = hdr->next;
+        hdr->next = release;
+        release = hdr;
+        list->count--;
+    }
+    qae_cache_usdm_free_list(release);
+}
+
+void qaeCryptoMemFree(void *ptr)
+{
+    qae_cache_hdr *hdr = NULL;
+    qae_thread_cache *cache = NULL;
+    qae_cache_list *list = NULL;
+
+    MEM_DEBUG("%s: Address: %p\n", __func__, ptr);
+
+    if (NULL == ptr) {
+        MEM_WARN("qaeCryptoMemFree trying to free NULL pointer.\n");
         return;
     }
-    MEM_DEBUG("%s: pthread_mutex_unlock\n", __func__);
+
+    hdr = (qae_cache_hdr *)((unsigned char *)ptr - QAE_CACHE_HDR_SIZE);
+    if (hdr->sig != QAE_CACHE_SIG_ALLOC) {
+        MEM_ERROR("%s error trying to free memory that hasn't been alloc'd %p\n",
+                  __func__, ptr);
+        return;
+    }
+    hdr->sig = QAE_CACHE_SIG_FREE;
+    hdr->next = NULL;
+
+    if (hdr->class_index == QAE_CACHE_NO_CLASS ||
+        (cache = qae_cache_get()) == NULL) {
+        qae_cache_usdm_free_list(hdr);
+        return;
+    }
+
+    list = &cache->lists[hdr->class_index];
+    hdr->next = list->head;
+    list->head = hdr;
+    list->count++;
+    if (list->count > qae_cache_max_blocks(hdr->class_index))
+        qae_cache_trim(list, hdr->class_index);
 }
 
 void *qaeCryptoMemAlloc(size_t memsize, const char *file, int line)
 {
-    CpaStatus status = CPA_STATUS_SUCCESS;
     int rc;
-    void *pAddress = NULL;
+    int class_index = qae_cache_class(memsize);
+    qae_cache_hdr *hdr = NULL;
+    qae_thread_cache *cache = NULL;
+    qae_cache_list *list = NULL;
 
-    MEM_DEBUG("%s: pthread_mutex_lock\n", __func__);
-    if ((rc = pthread_mutex_lock(&mem_mutex)) != 0) {
-        MEM_ERROR("pthread_mutex_lock: %s\n", strerror(rc));
-        return NULL;
+    if (class_index != QAE_CACHE_NO_CLASS &&
+        (cache = qae_cache_get()) != NULL) {
+        list = &cache->lists[class_index];
+        if (list->head == NULL)
+            qae_cache_refill(list, class_index);
+        if ((hdr = list->head) != NULL) {
+            list->head = hdr->next;
+            list->count--;
+        }
+    } else {
+        MEM_DEBUG("%s: pthread_mutex_lock\n", __func__);
+        if ((rc = pthread_mutex_lock(&mem_mutex)) != 0) {
+            MEM_ERROR("pthread_mutex_lock: %s\n", strerror(rc));
+            return NULL;
+        }
+
+        hdr = qae_cache_usdm_alloc(class_index == QAE_CACHE_NO_CLASS ?
+                                   memsize :
+                                   QAE_CACHE_CLASS_SIZE(class_index),
+                                   class_index);
+
+        if ((rc = pthread_mutex_unlock(&mem_mutex)) != 0) {
+            MEM_ERROR("pthread_mutex_unlock: %s\n", strerror(rc));
+        }
+        MEM_DEBUG("%s: pthread_mutex_unlock\n", __func__);
     }
 
-    pAddress = qaeMemAllocNUMA(memsize, 0, QAT_BYTE_ALIGNMENT);
-    MEM_DEBUG("%s: Address: %p Size: %d File: %s:%d\n", __func__, pAddress,
-          memsize, file, line);
-    if ((rc = pthread_mutex_unlock(&mem_mutex)) != 0) {
-        MEM_ERROR("pthread_mutex_unlock: %s\n", strerror(rc));
+    if (hdr == NULL) {
+        MEM_WARN("%s: pinned memory allocation failure\n", __func__);
+        return NULL;
     }
-    MEM_DEBUG("%s: pthread_mutex_unlock\n", __func__);
-    return pAddress;
+    hdr->next = NULL;
+    hdr->sig = QAE_CACHE_SIG_ALLOC;
+
+    MEM_DEBUG("%s: Address: %p Size: %d File: %s:%d\n", __func__,
+              (unsigned char *)hdr + QAE_CACHE_HDR_SIZE, memsize, file, line);
+    return (unsigned char *)hdr + QAE_CACHE_HDR_SIZE;
 }
 
 void *qaeCryptoMemRealloc(void *ptr, size_t memsize, const char *file,
@@ -183,6 +413,15 @@ CpaPhysicalAddr qaeCryptoMemV2P(void *v)
 
 void qaeCryptoAtFork()
 {
+    qae_thread_cache *cache = NULL;
+
+    /*
+     * The blocks cached by the forking thread belong to the parent's
+     * mappings, forget about them rather than hand them out in the child.
+     */
+    if (qae_cache_key_valid &&
+        (cache = pthread_getspecific(qae_cache_key)) != NULL)
+        memset(cache, 0, sizeof(qae_thread_cache));
     qaeAtFork();
 }
 
@@ -87,6 +87,26 @@
  */
 #define QAT_EPOLL_TIMEOUT_IN_MS 1000
 
+/*
+ * The largest pinned memory arena in MB that can be requested through
+ * SET_CONTIG_MEM_ARENA_SIZE, this matches the limit of the qat_contig_mem
+ * driver.
+ */
+#define QAT_CONTIG_MEM_ARENA_MAX_SIZE_IN_MB 1024
+
+/*
+ * The largest number of requests a thread can queue before they are
+ * submitted, and the default time in microseconds a queued request waits
+ * for the rest of its batch.
+ */
+#define QAT_BATCH_MAX_SIZE 64
+#define QAT_BATCH_TIMEOUT_IN_US 50
+
+/* Behavior of qat_batch_flush_all */
+#define QAT_BATCH_FLUSH_EXPIRED 0
+#define QAT_BATCH_FLUSH_ALL 1
+#define QAT_BATCH_FAIL_ALL 2
+
 /* Behavior of qat_engine_finish_int */
 #define QAT_RETAIN_GLOBALS 0
 #define QAT_RESET_GLOBALS 1
@@ -107,10 +127,12 @@
 
 /* Local Includes */
 #include "qat_ciphers.h"
+#include "qat_digests.h"
 #include "qat_rsa.h"
 #include "qat_dsa.h"
 #include "qat_dh.h"
 #include "qat_ec.h"
+#include "qat_asym_common.h"
 #include "e_qat.h"
 #include "qat_utils.h"
 #include "e_qat_err.h"
@@ -182,9 +204,53 @@ static pthread_mutex_t qat_engine_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static unsigned int engine_inited = 0;
 static unsigned int instance_started[MAX_CRYPTO_INSTANCES] = {0};
+/* QAT_SYM_CAP_* flags of each instance and of any instance */
+static unsigned int instance_sym_caps[MAX_CRYPTO_INSTANCES] = {0};
+static unsigned int qat_sym_caps = 0;
 static useconds_t qat_poll_interval = QAT_POLL_PERIOD_IN_NS;
 static int qat_epoll_timeout = QAT_EPOLL_TIMEOUT_IN_MS;
 static int qat_max_retry_count = QAT_CRYPTO_NUM_POLLING_RETRIES;
+static int qat_session_instances = 1;
+
+/* Submission policy of the requests the rings are full for */
+static long qat_retry_fixed(unsigned int retry, int async);
+static qat_retry_policy_func qat_retry_policy = qat_retry_fixed;
+/* Time in us a request waiting for ring space may take before falling back
+ * to software, 0 for no limit. Only applies to the qat_perform_op() callers
+ * which have a software fallback.
+ */
+static unsigned long qat_request_deadline = 0;
+static qat_request_stats qat_req_stats;
+
+/* Requests of a thread waiting to be submitted back-to-back */
+typedef struct {
+    CpaInstanceHandle instanceHandle;
+    CpaCySymCbFunc pSymCb;
+    void *pCallbackTag;
+    const CpaCySymOpData *pOpData;
+    const CpaBufferList *pSrcBuffer;
+    CpaBufferList *pDstBuffer;
+    CpaBoolean *pVerifyResult;
+} QAT_BATCH_REQ;
+
+typedef struct qat_batch_queue_st {
+    pthread_mutex_t mutex;
+    struct qat_batch_queue_st *prev;
+    struct qat_batch_queue_st *next;
+    /* Time the oldest queued request was queued at */
+    struct timespec first_req_time;
+    unsigned int head;
+    unsigned int count;
+    QAT_BATCH_REQ req[QAT_BATCH_MAX_SIZE];
+} QAT_BATCH_QUEUE;
+
+/* Submission batching is disabled when the batch size is below 2 */
+static unsigned int qat_batch_size = 0;
+static unsigned int qat_batch_timeout = QAT_BATCH_TIMEOUT_IN_US;
+static pthread_once_t qat_batch_queue_once = PTHREAD_ONCE_INIT;
+static pthread_key_t qat_batch_queue_key;
+static pthread_mutex_t qat_batch_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static QAT_BATCH_QUEUE *qat_batch_list = NULL;
 
 
 int getQatMsgRetryCount()
@@ -192,6 +258,11 @@ int getQatMsgRetryCount()
     return qat_max_retry_count;
 }
 
+int getQatSessionInstances()
+{
+    return qat_session_instances;
+}
+
 useconds_t getQatPollInterval()
 {
     return qat_poll_interval;
@@ -205,12 +276,18 @@ int qat_is_event_driven()
 #ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
 int setQatSmallPacketThreshold(unsigned char *cipher_name, int threshold)
 {
+    int nid;
+
     if(threshold < 0)
         threshold = 0;
     else if (threshold > 16384)
         threshold = 16384;
     DEBUG("[%s] Set small packet threshold for %s: %d\n", __func__, cipher_name, threshold);
-    return qat_pkt_threshold_table_set_threshold(OBJ_sn2nid(cipher_name),threshold);
+    nid = OBJ_sn2nid((const char *)cipher_name);
+    /* The short names of the AES-GCM ciphers are not their usual names */
+    if (nid == NID_undef)
+        nid = OBJ_ln2nid((const char *)cipher_name);
+    return qat_pkt_threshold_table_set_threshold(nid, threshold);
 }
 
 #endif
@@ -279,6 +356,79 @@ CpaInstanceHandle get_next_inst(void)
     return instanceHandle;
 }
 
+/******************************************************************************
+* function:
+*         qat_sym_cap_supported(unsigned int cap)
+*
+* @param cap [IN] - QAT_SYM_CAP_* flags
+*
+* description:
+*   Return 1 if at least one instance supports all the given symmetric
+*   capabilities, 0 otherwise.
+*
+******************************************************************************/
+int qat_sym_cap_supported(unsigned int cap)
+{
+    ENGINE* e = NULL;
+    int ret = 0;
+
+    e = ENGINE_by_id(engine_qat_id);
+    if(e == NULL)
+        return 0;
+
+    if (qat_engine_init(e))
+        ret = (qat_sym_caps & cap) == cap;
+
+    ENGINE_free(e);
+    return ret;
+}
+
+/******************************************************************************
+* function:
+*         get_next_inst_with_cap(unsigned int cap)
+*
+* @param cap [IN] - QAT_SYM_CAP_* flags
+*
+* description:
+*   Return the next instance handle supporting all the given symmetric
+*   capabilities, or NULL if there is none. The instance bound to the
+*   thread is used when it has the capabilities.
+*
+******************************************************************************/
+CpaInstanceHandle get_next_inst_with_cap(unsigned int cap)
+{
+    CpaInstanceHandle instanceHandle = NULL;
+    int i, inst;
+
+    if (cap == 0)
+        return get_next_inst();
+
+    if (!qat_sym_cap_supported(cap))
+        return NULL;
+
+    if (1 == enable_instance_for_thread) {
+        instanceHandle = pthread_getspecific(qatInstanceForThread);
+        for (i = 0; instanceHandle != NULL && i < numInstances; i++) {
+            if (qatInstanceHandles[i] == instanceHandle &&
+                (instance_sym_caps[i] & cap) == cap)
+                return instanceHandle;
+        }
+        instanceHandle = NULL;
+    }
+
+    pthread_mutex_lock(&qat_instance_mutex);
+    for (i = 0; i < numInstances; i++) {
+        inst = (currInst + i) % numInstances;
+        if ((instance_sym_caps[inst] & cap) == cap) {
+            instanceHandle = qatInstanceHandles[inst];
+            currInst = (inst + 1) % numInstances;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&qat_instance_mutex);
+    return instanceHandle;
+}
+
 static void engine_fork_handler(void)
 {
     /* Reset the engine preserving the value of global variables */
@@ -308,15 +458,92 @@ static void engine_fork_handler(void)
 void qat_set_instance_for_thread(long instanceNum)
 {
     int rc;
+    CpaInstanceHandle instanceHandle = qatInstanceHandles[instanceNum %
+                                                          numInstances];
+#ifdef USE_QAT_CONTIG_MEM
+    CpaInstanceInfo2 instanceInfo;
+#endif
 
     if ((rc =
-         pthread_setspecific(qatInstanceForThread,
-                             qatInstanceHandles[instanceNum %
-                                                numInstances])) != 0) {
+         pthread_setspecific(qatInstanceForThread, instanceHandle)) != 0) {
         fprintf(stderr, "pthread_setspecific: %s\n", strerror(rc));
         return;
     }
     enable_instance_for_thread = 1;
+
+#ifdef USE_QAT_CONTIG_MEM
+    /* Allocate the thread's buffers on the socket of its instance */
+    if (cpaCyInstanceGetInfo2(instanceHandle, &instanceInfo) ==
+        CPA_STATUS_SUCCESS)
+        qaeCryptoMemSetThreadNode((int) instanceInfo.nodeAffinity);
+#endif
+}
+
+/******************************************************************************
+* function:
+*         qat_elapsed_us(const struct timespec *start)
+*
+* @param start [IN] - CLOCK_MONOTONIC time to measure from
+*
+* description:
+*   Return the time in us elapsed since start.
+*
+******************************************************************************/
+static unsigned long qat_elapsed_us(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000UL +
+           (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/******************************************************************************
+* function:
+*         qat_op_submitted(struct op_done *opDone)
+*
+* @param opDone [IN] - op_done the request was submitted with
+*
+* description:
+*   Account for a request accepted by an instance. The time of the first
+*   request of opDone is kept to measure the latency once it completes.
+*
+******************************************************************************/
+static void qat_op_submitted(struct op_done *opDone)
+{
+    if (__sync_fetch_and_add(&opDone->submitted, 1) == 0)
+        clock_gettime(CLOCK_MONOTONIC, &opDone->submit_time);
+    __sync_fetch_and_add(&qat_req_stats.submitted, 1);
+    __sync_fetch_and_add(&qat_req_stats.in_flight, 1);
+}
+
+/******************************************************************************
+* function:
+*         qat_op_completed(struct op_done *opDone)
+*
+* @param opDone [IN] - op_done the requests were submitted with
+*
+* description:
+*   Account for the completion of the requests submitted with opDone. It is
+*   called once they are all done, when opDone is cleaned up.
+*
+******************************************************************************/
+static void qat_op_completed(struct op_done *opDone)
+{
+    unsigned long latency, max;
+
+    if (opDone->submitted == 0)
+        return;
+
+    latency = qat_elapsed_us(&opDone->submit_time);
+    __sync_fetch_and_sub(&qat_req_stats.in_flight, opDone->submitted);
+    __sync_fetch_and_add(&qat_req_stats.completed, opDone->submitted);
+    __sync_fetch_and_add(&qat_req_stats.latency_samples, 1);
+    __sync_fetch_and_add(&qat_req_stats.latency_total_us, latency);
+    while ((max = qat_req_stats.latency_max_us) < latency &&
+           !__sync_bool_compare_and_swap(&qat_req_stats.latency_max_us, max,
+                                         latency));
+    opDone->submitted = 0;
 }
 
 /******************************************************************************
@@ -337,6 +564,8 @@ void initOpDone(struct op_done *opDone)
 
     opDone->flag = 0;
     opDone->verifyResult = CPA_FALSE;
+    opDone->deadline = 0;
+    opDone->submitted = 0;
 
     opDone->job = ASYNC_get_current_job();
 
@@ -366,6 +595,8 @@ int initOpDonePipe(struct op_done_pipe *opdpipe, unsigned int npipes)
 
     opdpipe->opDone.flag = 0;
     opdpipe->opDone.verifyResult = CPA_TRUE;
+    opdpipe->opDone.deadline = 0;
+    opdpipe->opDone.submitted = 0;
     opdpipe->opDone.job = ASYNC_get_current_job();
 
     /* Setup async notification if using async jobs. */
@@ -400,6 +631,7 @@ void cleanupOpDone(struct op_done *opDone)
      * Donot change this value.
      */
 
+    qat_op_completed(opDone);
     if (opDone->job) {
         opDone->job = NULL;
     }
@@ -423,6 +655,7 @@ void cleanupOpDonePipe(struct op_done_pipe *opdone)
     opdone->num_pipes = 0;
     opdone->num_submitted = 0;
     opdone->num_processed = 0;
+    qat_op_completed(&opdone->opDone);
     if (opdone->opDone.job)
         opdone->opDone.job = NULL;
 }
@@ -470,6 +703,208 @@ void qat_crypto_callbackFn(void *callbackTag, CpaStatus status,
     }
 }
 
+/******************************************************************************
+* function:
+*         qat_retry_fixed(unsigned int retry, int async)
+*
+* @param retry [IN] - Number of the retry, starting at 1
+* @param async [IN] - Set if the request is submitted by an async job
+*
+* description:
+*   Default retry policy. Synchronous requests wait for the poll interval,
+*   staggered a little, and give up after the max retry count. Asynchronous
+*   requests retry each time the job is resumed.
+*
+******************************************************************************/
+static long qat_retry_fixed(unsigned int retry, int async)
+{
+    if (async)
+        return 0;
+    if (qat_max_retry_count != QAT_INFINITE_MAX_NUM_RETRIES &&
+        retry > (unsigned int)qat_max_retry_count)
+        return -1;
+    return qat_poll_interval + (retry % QAT_RETRY_BACKOFF_MODULO_DIVISOR);
+}
+
+/******************************************************************************
+* function:
+*         qat_retry_exponential(unsigned int retry, int async)
+*
+* @param retry [IN] - Number of the retry, starting at 1
+* @param async [IN] - Set if the request is submitted by an async job
+*
+* description:
+*   Retry policy doubling the wait of synchronous requests from the poll
+*   interval up to QAT_RETRY_BACKOFF_MAX_US, so that threads back off from
+*   a saturated instance. The retries are limited as for the default policy.
+*
+******************************************************************************/
+static long qat_retry_exponential(unsigned int retry, int async)
+{
+    unsigned long delay;
+
+    if (async)
+        return 0;
+    if (qat_max_retry_count != QAT_INFINITE_MAX_NUM_RETRIES &&
+        retry > (unsigned int)qat_max_retry_count)
+        return -1;
+    delay = (unsigned long)qat_poll_interval << (retry < 11 ? retry - 1 : 10);
+    return delay < QAT_RETRY_BACKOFF_MAX_US ? delay : QAT_RETRY_BACKOFF_MAX_US;
+}
+
+/******************************************************************************
+* function:
+*         CpaStatus qat_submit_op(struct op_done *opDone,
+*                                 CpaInstanceHandle instanceHandle,
+*                                 qat_submit_func submit, void *args)
+*
+* @param opDone         [IN] - op_done passed as callback tag
+* @param instanceHandle [IN] - Instance handle, NULL to use the next
+*                              instance for each attempt
+* @param submit         [IN] - Function submitting the request
+* @param args           [IN] - Parameters of the request passed to submit
+*
+* description:
+*   Submit a request, retrying while the rings of the instance are full as
+*   the retry policy allows. A synchronous caller sleeps between retries and
+*   an asynchronous job is paused. If the deadline of opDone passes before
+*   the request is accepted QAT_STATUS_EXPIRED is returned, the request
+*   can then be done in software. Once submitted a request cannot be
+*   cancelled, its buffers are in use until the callback is called.
+*
+******************************************************************************/
+CpaStatus qat_submit_op(struct op_done *opDone,
+                        CpaInstanceHandle instanceHandle,
+                        qat_submit_func submit, void *args)
+{
+    CpaStatus status;
+    CpaInstanceHandle inst = instanceHandle;
+    struct timespec start;
+    unsigned int retry = 0;
+    long delay;
+
+    if (opDone->deadline != 0)
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (;;) {
+        if (instanceHandle == NULL && (inst = get_next_inst()) == NULL) {
+            WARN("[%s] instanceHandle is NULL\n", __func__);
+            return CPA_STATUS_FAIL;
+        }
+        status = submit(inst, opDone, args);
+        if (status != CPA_STATUS_RETRY)
+            break;
+
+        /* GET_NUM_OP_RETRIES only counts the synchronous retries */
+        if (opDone->job == NULL)
+            __sync_fetch_and_add(&qatPerformOpRetries, 1);
+        __sync_fetch_and_add(&qat_req_stats.retries, 1);
+        if (opDone->deadline != 0 &&
+            qat_elapsed_us(&start) >= opDone->deadline) {
+            DEBUG("[%s] Request expired after %u retries\n", __func__, retry);
+            __sync_fetch_and_add(&qat_req_stats.expired, 1);
+            return QAT_STATUS_EXPIRED;
+        }
+        if ((delay = qat_retry_policy(++retry, opDone->job != NULL)) < 0)
+            break;
+        if (opDone->job != NULL) {
+            if ((qat_wake_job(opDone->job, 0) == 0) ||
+                (qat_pause_job(opDone->job, 0) == 0)) {
+                status = CPA_STATUS_FAIL;
+                break;
+            }
+        } else {
+            usleep((useconds_t) delay);
+        }
+    }
+
+    if (status == CPA_STATUS_SUCCESS)
+        qat_op_submitted(opDone);
+    return status;
+}
+
+/******************************************************************************
+* function:
+*         qat_wait_op(struct op_done *opDone)
+*
+* @param opDone [IN] - op_done the request was submitted with
+*
+* description:
+*   Wait for the callback of a submitted request. An asynchronous job is
+*   paused until it is woken by the callback. If qat_pause_job fails the
+*   thread yields and keeps waiting, the buffers of the request in flight
+*   must not be released before it completes.
+*
+******************************************************************************/
+void qat_wait_op(struct op_done *opDone)
+{
+    do {
+        if (opDone->job) {
+            if (qat_pause_job(opDone->job, 0) == 0)
+                pthread_yield();
+        } else {
+            pthread_yield();
+        }
+    } while (!opDone->flag);
+}
+
+/******************************************************************************
+* function:
+*         CpaStatus qat_perform_op(CpaInstanceHandle instanceHandle,
+*                                  qat_submit_func submit, void *args,
+*                                  int fallback, CpaBoolean *verifyResult)
+*
+* @param instanceHandle [IN]  - Instance handle, NULL to use the next
+*                               instance for each attempt
+* @param submit         [IN]  - Function submitting the request
+* @param args           [IN]  - Parameters of the request passed to submit
+* @param fallback       [IN]  - Set if the caller can do the operation in
+*                               software, the request deadline then applies
+* @param verifyResult   [OUT] - Result of the request set by the callback
+*
+* description:
+*   Submit a request and wait for it to complete. The status of the
+*   submission is returned, QAT_STATUS_EXPIRED if the deadline passed
+*   first, and verifyResult tells whether the request succeeded once it
+*   completed.
+*
+******************************************************************************/
+CpaStatus qat_perform_op(CpaInstanceHandle instanceHandle,
+                         qat_submit_func submit, void *args, int fallback,
+                         CpaBoolean *verifyResult)
+{
+    struct op_done op_done;
+    CpaStatus status;
+
+    *verifyResult = CPA_FALSE;
+    initOpDone(&op_done);
+    if (fallback)
+        op_done.deadline = qat_request_deadline;
+    if (op_done.job && qat_setup_async_event_notification(0) == 0) {
+        WARN("[%s] Failed to setup async event notifications\n", __func__);
+        cleanupOpDone(&op_done);
+        return CPA_STATUS_FAIL;
+    }
+
+    status = qat_submit_op(&op_done, instanceHandle, submit, args);
+    if (status == CPA_STATUS_SUCCESS)
+        qat_wait_op(&op_done);
+    cleanupOpDone(&op_done);
+
+    *verifyResult = op_done.verifyResult;
+    return status;
+}
+
+static CpaStatus qat_sym_submit(CpaInstanceHandle instanceHandle,
+                                void *callbackTag, void *args)
+{
+    QAT_BATCH_REQ *req = (QAT_BATCH_REQ *)args;
+
+    return cpaCySymPerformOp(instanceHandle, callbackTag, req->pOpData,
+                             req->pSrcBuffer, req->pDstBuffer,
+                             req->pVerifyResult);
+}
+
 /******************************************************************************
 * function:
 *         CpaStatus myPerformOp(const CpaInstanceHandle  instanceHandle,
@@ -479,7 +914,6 @@ void qat_crypto_callbackFn(void *callbackTag, CpaStatus status,
 *                     CpaBufferList             *pDstBuffer,
 *                     CpaBoolean                *pVerifyResult)
 *
-* @param ih [IN] - Instance handle
 * @param instanceHandle [IN]  - Instance handle
 * @param pCallbackTag   [IN]  - Pointer to op_done struct
 * @param pOpData        [IN]  - Operation parameters
@@ -497,35 +931,256 @@ CpaStatus myPerformOp(const CpaInstanceHandle instanceHandle,
                       const CpaBufferList * pSrcBuffer,
                       CpaBufferList * pDstBuffer, CpaBoolean * pVerifyResult)
 {
-    CpaStatus status;
-    struct op_done *opDone = (struct op_done *)pCallbackTag;
-    unsigned int uiRetry = 0;
-    do {
-        status = cpaCySymPerformOp(instanceHandle,
-                                   pCallbackTag,
-                                   pOpData,
-                                   pSrcBuffer, pDstBuffer, pVerifyResult);
-        if (status == CPA_STATUS_RETRY) {
-            if (opDone->job) {
-                if ((qat_wake_job(opDone->job, 0) == 0) ||
-                    (qat_pause_job(opDone->job, 0) == 0)) {
-                    status = CPA_STATUS_FAIL;
-                    break;
-                }
-            } else {
-                qatPerformOpRetries++;
-                if (uiRetry >= qat_max_retry_count
-                    && qat_max_retry_count != QAT_INFINITE_MAX_NUM_RETRIES) {
-                    break;
-                }
-                uiRetry++;
-                usleep(qat_poll_interval +
-                       (uiRetry % QAT_RETRY_BACKOFF_MODULO_DIVISOR));
+    QAT_BATCH_REQ req;
+
+    req.pOpData = pOpData;
+    req.pSrcBuffer = pSrcBuffer;
+    req.pDstBuffer = pDstBuffer;
+    req.pVerifyResult = pVerifyResult;
+    return qat_submit_op((struct op_done *)pCallbackTag, instanceHandle,
+                         qat_sym_submit, &req);
+}
+
+/******************************************************************************
+* function:
+*         qat_batch_flush(QAT_BATCH_QUEUE *q, int fail)
+*
+* @param q    [IN] - Queue of the requests, with its mutex held
+* @param fail [IN] - Complete the requests with an error instead of
+*                    submitting them
+*
+* description:
+*   Submit the queued requests back-to-back in the order they were queued.
+*   The flush stops when the instance rings are full and the remaining
+*   requests are submitted by the next flush. A request that cannot be
+*   submitted is completed with an error through its callback so the job
+*   waiting for it is woken.
+*
+******************************************************************************/
+static void qat_batch_flush(QAT_BATCH_QUEUE *q, int fail)
+{
+    QAT_BATCH_REQ *req;
+    CpaStatus status = CPA_STATUS_FAIL;
+
+    while (q->count > 0) {
+        req = &q->req[q->head];
+        if (!fail) {
+            status = cpaCySymPerformOp(req->instanceHandle,
+                                       req->pCallbackTag, req->pOpData,
+                                       req->pSrcBuffer, req->pDstBuffer,
+                                       req->pVerifyResult);
+            if (status == CPA_STATUS_RETRY) {
+                __sync_fetch_and_add(&qat_req_stats.retries, 1);
+                break;
             }
+            if (status == CPA_STATUS_SUCCESS)
+                qat_op_submitted((struct op_done *)req->pCallbackTag);
         }
+        if (fail || status != CPA_STATUS_SUCCESS) {
+            WARN("[%s] Queued request failed, status=%d\n", __func__, status);
+            req->pSymCb(req->pCallbackTag, CPA_STATUS_FAIL,
+                        CPA_CY_SYM_OP_ALGORITHM_CHAINING,
+                        (void *)req->pOpData, req->pDstBuffer, CPA_FALSE);
+        }
+        q->head = (q->head + 1) % QAT_BATCH_MAX_SIZE;
+        q->count--;
     }
-    while (status == CPA_STATUS_RETRY);
-    return status;
+}
+
+/******************************************************************************
+* function:
+*         qat_batch_expired(QAT_BATCH_QUEUE *q)
+*
+* @param q [IN] - Queue of the requests, with its mutex held
+*
+* description:
+*   Return 1 if the oldest queued request has waited for the batch timeout.
+*
+******************************************************************************/
+static int qat_batch_expired(QAT_BATCH_QUEUE *q)
+{
+    struct timespec now;
+    long elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - q->first_req_time.tv_sec) * 1000000L +
+              (now.tv_nsec - q->first_req_time.tv_nsec) / 1000;
+    return elapsed >= (long)qat_batch_timeout;
+}
+
+/******************************************************************************
+* function:
+*         qat_batch_flush_all(int force)
+*
+* @param force [IN] - QAT_BATCH_FLUSH_EXPIRED, QAT_BATCH_FLUSH_ALL or
+*                     QAT_BATCH_FAIL_ALL
+*
+* description:
+*   Flush the queues of all threads. The polling threads flush the
+*   requests that have waited for the batch timeout, so that a thread which
+*   stops queuing requests does not leave them waiting.
+*
+******************************************************************************/
+static void qat_batch_flush_all(int force)
+{
+    QAT_BATCH_QUEUE *q;
+
+    /* Nothing to lock for unless a thread has queued requests */
+    if (qat_batch_list == NULL)
+        return;
+
+    pthread_mutex_lock(&qat_batch_list_mutex);
+    for (q = qat_batch_list; q != NULL; q = q->next) {
+        if (q->count == 0)
+            continue;
+        pthread_mutex_lock(&q->mutex);
+        if (q->count > 0 &&
+            (force != QAT_BATCH_FLUSH_EXPIRED || qat_batch_expired(q)))
+            qat_batch_flush(q, force == QAT_BATCH_FAIL_ALL);
+        pthread_mutex_unlock(&q->mutex);
+    }
+    pthread_mutex_unlock(&qat_batch_list_mutex);
+}
+
+static void qat_batch_queue_free(void *queue)
+{
+    QAT_BATCH_QUEUE *q = (QAT_BATCH_QUEUE *)queue;
+
+    pthread_mutex_lock(&qat_batch_list_mutex);
+    if (q->prev != NULL)
+        q->prev->next = q->next;
+    else
+        qat_batch_list = q->next;
+    if (q->next != NULL)
+        q->next->prev = q->prev;
+    pthread_mutex_unlock(&qat_batch_list_mutex);
+
+    pthread_mutex_lock(&q->mutex);
+    qat_batch_flush(q, 0);
+    /* The thread is exiting, nothing will submit what is left */
+    qat_batch_flush(q, 1);
+    pthread_mutex_unlock(&q->mutex);
+    pthread_mutex_destroy(&q->mutex);
+    OPENSSL_free(q);
+}
+
+static void qat_batch_queue_make_key(void)
+{
+    int err;
+
+    if ((err = pthread_key_create(&qat_batch_queue_key,
+                                  qat_batch_queue_free)) != 0)
+        WARN("pthread_key_create: %s\n", strerror(err));
+}
+
+/******************************************************************************
+* function:
+*         qat_batch_queue_get(void)
+*
+* description:
+*   Return the submission queue of the calling thread, creating it on first
+*   use. NULL is returned if it cannot be created.
+*
+******************************************************************************/
+static QAT_BATCH_QUEUE *qat_batch_queue_get(void)
+{
+    QAT_BATCH_QUEUE *q;
+
+    pthread_once(&qat_batch_queue_once, qat_batch_queue_make_key);
+    if ((q = pthread_getspecific(qat_batch_queue_key)) != NULL)
+        return q;
+
+    if ((q = OPENSSL_zalloc(sizeof(*q))) == NULL) {
+        WARN("[%s] Failed to allocate the submission queue\n", __func__);
+        return NULL;
+    }
+    pthread_mutex_init(&q->mutex, NULL);
+    if (pthread_setspecific(qat_batch_queue_key, q) != 0) {
+        WARN("[%s] Failed to set the submission queue\n", __func__);
+        pthread_mutex_destroy(&q->mutex);
+        OPENSSL_free(q);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&qat_batch_list_mutex);
+    q->next = qat_batch_list;
+    if (qat_batch_list != NULL)
+        qat_batch_list->prev = q;
+    qat_batch_list = q;
+    pthread_mutex_unlock(&qat_batch_list_mutex);
+    return q;
+}
+
+/******************************************************************************
+* function:
+*         CpaStatus qat_batch_perform_op(const CpaInstanceHandle instanceHandle,
+*                     CpaCySymCbFunc             pSymCb,
+*                     void *                     pCallbackTag,
+*                     const CpaCySymOpData      *pOpData,
+*                     const CpaBufferList       *pSrcBuffer,
+*                     CpaBufferList             *pDstBuffer,
+*                     CpaBoolean                *pVerifyResult)
+*
+* @param instanceHandle [IN]  - Instance handle
+* @param pSymCb         [IN]  - Callback of the session
+* @param pCallbackTag   [IN]  - Pointer to op_done struct
+* @param pOpData        [IN]  - Operation parameters
+* @param pSrcBuffer     [IN]  - Source buffer list
+* @param pDstBuffer     [OUT] - Destination buffer list
+* @param pVerifyResult  [OUT] - Whether hash verified or not
+*
+* description:
+*   Same as myPerformOp, except that when submission batching is enabled
+*   the requests of asynchronous jobs are queued per thread. The queue is
+*   submitted back-to-back once it holds the batch size or its oldest
+*   request has waited for the batch timeout, so that requests of many
+*   connections share the polling and the wakeups. The caller must wait for
+*   the callback as usual.
+*
+******************************************************************************/
+CpaStatus qat_batch_perform_op(const CpaInstanceHandle instanceHandle,
+                               CpaCySymCbFunc pSymCb,
+                               void *pCallbackTag,
+                               const CpaCySymOpData * pOpData,
+                               const CpaBufferList * pSrcBuffer,
+                               CpaBufferList * pDstBuffer,
+                               CpaBoolean * pVerifyResult)
+{
+    struct op_done *opDone = (struct op_done *)pCallbackTag;
+    QAT_BATCH_QUEUE *q = NULL;
+    QAT_BATCH_REQ *req;
+
+    if (qat_batch_size < 2 || opDone->job == NULL ||
+        (q = qat_batch_queue_get()) == NULL)
+        return myPerformOp(instanceHandle, pCallbackTag, pOpData,
+                           pSrcBuffer, pDstBuffer, pVerifyResult);
+
+    pthread_mutex_lock(&q->mutex);
+    if (q->count >= qat_batch_size)
+        qat_batch_flush(q, 0);
+    if (q->count == QAT_BATCH_MAX_SIZE) {
+        /* The rings are full, let myPerformOp retry */
+        pthread_mutex_unlock(&q->mutex);
+        return myPerformOp(instanceHandle, pCallbackTag, pOpData,
+                           pSrcBuffer, pDstBuffer, pVerifyResult);
+    }
+
+    if (q->count == 0)
+        clock_gettime(CLOCK_MONOTONIC, &q->first_req_time);
+    req = &q->req[(q->head + q->count) % QAT_BATCH_MAX_SIZE];
+    req->instanceHandle = instanceHandle;
+    req->pSymCb = pSymCb;
+    req->pCallbackTag = pCallbackTag;
+    req->pOpData = pOpData;
+    req->pSrcBuffer = pSrcBuffer;
+    req->pDstBuffer = pDstBuffer;
+    req->pVerifyResult = pVerifyResult;
+    q->count++;
+
+    if (q->count >= qat_batch_size || qat_batch_expired(q))
+        qat_batch_flush(q, 0);
+    pthread_mutex_unlock(&q->mutex);
+    return CPA_STATUS_SUCCESS;
 }
 
 static void qat_fd_cleanup(ASYNC_WAIT_CTX *ctx, const void *key,
@@ -673,6 +1328,7 @@ static void *sendPoll_ns(void *ih)
 
     while (keep_polling) {
         reqTime.tv_nsec = qat_poll_interval;
+        qat_batch_flush_all(QAT_BATCH_FLUSH_EXPIRED);
         /* Poll for 0 means process all packets on the instance */
         status = icp_sal_CyPollInstance(instanceHandle, 0);
 
@@ -718,7 +1374,12 @@ static void *eventPoll_ns(void *ih)
         int n = 0;
         int i = 0;
 
-        n = epoll_wait(internal_efd, events, MAX_EVENTS, qat_epoll_timeout);
+        /* Wake up in time to submit the queued requests */
+        n = epoll_wait(internal_efd, events, MAX_EVENTS,
+                       qat_batch_size > 1 ?
+                       (int)(qat_batch_timeout + 999) / 1000 :
+                       qat_epoll_timeout);
+        qat_batch_flush_all(QAT_BATCH_FLUSH_EXPIRED);
         for (i = 0; i < n; ++i) {
             if (events[i].events & EPOLLIN) {
                 /*  poll for 0 means process all packets on the ET ring */
@@ -745,6 +1406,8 @@ static CpaStatus poll_instances(void)
     CpaInstanceHandle instanceHandle = NULL;
     CpaStatus internal_status = CPA_STATUS_SUCCESS,
         ret_status = CPA_STATUS_SUCCESS;
+
+    qat_batch_flush_all(QAT_BATCH_FLUSH_EXPIRED);
     if (enable_instance_for_thread)
         instanceHandle = pthread_getspecific(qatInstanceForThread);
     if (instanceHandle) {
@@ -834,6 +1497,10 @@ static int qat_engine_init(ENGINE *e)
     int instNum, err;
     CpaStatus status = CPA_STATUS_SUCCESS;
     CpaBoolean limitDevAccess = CPA_FALSE;
+    CpaCySymCapabilitiesInfo symCapabilities;
+#ifdef QAT_HKDF
+    CpaCyCapabilitiesInfo cyCapabilities;
+#endif
 
     pthread_mutex_lock(&qat_engine_mutex);
     if(engine_inited) {
@@ -995,6 +1662,23 @@ static int qat_engine_init(ENGINE *e)
             return 0;
         }
 
+        /* Record the algorithms that differ between device generations */
+        instance_sym_caps[instNum] = 0;
+        if (cpaCySymQueryCapabilities(qatInstanceHandles[instNum],
+                                      &symCapabilities) == CPA_STATUS_SUCCESS
+            && CPA_BITMAP_BIT_TEST(symCapabilities.ciphers,
+                                   CPA_CY_SYM_CIPHER_CHACHA)
+            && CPA_BITMAP_BIT_TEST(symCapabilities.hashes,
+                                   CPA_CY_SYM_HASH_POLY))
+            instance_sym_caps[instNum] |= QAT_SYM_CAP_CHACHAPOLY;
+#ifdef QAT_HKDF
+        if (cpaCyQueryCapabilities(qatInstanceHandles[instNum],
+                                   &cyCapabilities) == CPA_STATUS_SUCCESS
+            && cyCapabilities.hkdfSupported)
+            instance_sym_caps[instNum] |= QAT_SYM_CAP_HKDF;
+#endif
+        qat_sym_caps |= instance_sym_caps[instNum];
+
         if (0 == enable_external_polling && !qat_is_event_driven()) {
             /* Create the polling threads */
             if (qat_create_thread(&icp_polling_threads[instNum], NULL,
@@ -1028,6 +1712,12 @@ static int qat_engine_init(ENGINE *e)
             return 0;
         }
     }
+#ifdef USE_QAT_CONTIG_MEM
+    /* Create any pinned memory slabs requested up front so that the first
+       requests do not pay for slab creation */
+    qaeCryptoMemPrealloc();
+#endif
+
     /* Reset currInst */
     currInst = 0;
     engine_inited = 1;
@@ -1047,6 +1737,20 @@ static int qat_engine_init(ENGINE *e)
 #define QAT_CMD_DISABLE_EVENT_DRIVEN_POLLING_MODE (ENGINE_CMD_BASE + 9)
 #define QAT_CMD_SET_EPOLL_TIMEOUT (ENGINE_CMD_BASE + 10)
 #define QAT_CMD_SET_CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD (ENGINE_CMD_BASE + 11)
+#define QAT_CMD_SET_CONTIG_MEM_ARENA_SIZE (ENGINE_CMD_BASE + 12)
+#define QAT_CMD_SET_CONTIG_MEM_PREALLOC (ENGINE_CMD_BASE + 13)
+#define QAT_CMD_SET_CONTIG_MEM_RETENTION_TIME (ENGINE_CMD_BASE + 14)
+#define QAT_CMD_GET_CONTIG_MEM_STATS (ENGINE_CMD_BASE + 15)
+#define QAT_CMD_SET_CONTIG_MEM_LAZY_FORK (ENGINE_CMD_BASE + 16)
+#define QAT_CMD_GET_PINNED_MEM_FUNCS (ENGINE_CMD_BASE + 17)
+#define QAT_CMD_SET_SUBMISSION_BATCH_SIZE (ENGINE_CMD_BASE + 18)
+#define QAT_CMD_SET_SUBMISSION_BATCH_TIMEOUT (ENGINE_CMD_BASE + 19)
+#define QAT_CMD_SET_CRYPTO_SMALL_PACKET_OFFLOAD_ADAPTIVE (ENGINE_CMD_BASE + 20)
+#define QAT_CMD_GET_CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD (ENGINE_CMD_BASE + 21)
+#define QAT_CMD_SET_CHAINED_CIPHER_INSTANCES (ENGINE_CMD_BASE + 22)
+#define QAT_CMD_SET_RETRY_POLICY (ENGINE_CMD_BASE + 23)
+#define QAT_CMD_SET_REQUEST_DEADLINE (ENGINE_CMD_BASE + 24)
+#define QAT_CMD_GET_REQUEST_STATS (ENGINE_CMD_BASE + 25)
 
 static const ENGINE_CMD_DEFN qat_cmd_defns[] = {
     {
@@ -1109,6 +1813,76 @@ static const ENGINE_CMD_DEFN qat_cmd_defns[] = {
      "SET_CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD",
      "Set QAT small packet threshold",
      ENGINE_CMD_FLAG_STRING},
+    {
+     QAT_CMD_SET_CONTIG_MEM_ARENA_SIZE,
+     "SET_CONTIG_MEM_ARENA_SIZE",
+     "Set the size in MB of the pinned memory arena",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {
+     QAT_CMD_SET_CONTIG_MEM_PREALLOC,
+     "SET_CONTIG_MEM_PREALLOC",
+     "Set the number of pinned memory slabs to create per slot size",
+     ENGINE_CMD_FLAG_STRING},
+    {
+     QAT_CMD_SET_CONTIG_MEM_RETENTION_TIME,
+     "SET_CONTIG_MEM_RETENTION_TIME",
+     "Set the time in ms empty pinned memory slabs are retained for",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {
+     QAT_CMD_GET_CONTIG_MEM_STATS,
+     "GET_CONTIG_MEM_STATS",
+     "Get the pinned memory allocator statistics",
+     ENGINE_CMD_FLAG_NO_INPUT},
+    {
+     QAT_CMD_SET_CONTIG_MEM_LAZY_FORK,
+     "SET_CONTIG_MEM_LAZY_FORK",
+     "Discard the parent's pinned memory slabs in a child process",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {
+     QAT_CMD_GET_PINNED_MEM_FUNCS,
+     "GET_PINNED_MEM_FUNCS",
+     "Get the functions to allocate buffers of pinned memory",
+     ENGINE_CMD_FLAG_NO_INPUT},
+    {
+     QAT_CMD_SET_SUBMISSION_BATCH_SIZE,
+     "SET_SUBMISSION_BATCH_SIZE",
+     "Set the number of requests a thread queues before submitting them",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {
+     QAT_CMD_SET_SUBMISSION_BATCH_TIMEOUT,
+     "SET_SUBMISSION_BATCH_TIMEOUT",
+     "Set the time in us a queued request waits for its batch",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {
+     QAT_CMD_SET_CRYPTO_SMALL_PACKET_OFFLOAD_ADAPTIVE,
+     "SET_CRYPTO_SMALL_PACKET_OFFLOAD_ADAPTIVE",
+     "Learn the QAT small packet thresholds from the cost of the operations",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {
+     QAT_CMD_GET_CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD,
+     "GET_CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD",
+     "Get the QAT small packet thresholds used by this thread",
+     ENGINE_CMD_FLAG_NO_INPUT},
+    {
+     QAT_CMD_SET_CHAINED_CIPHER_INSTANCES,
+     "SET_CHAINED_CIPHER_INSTANCES",
+     "Set the number of instances the records of a cipher ctx are spread over",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {
+     QAT_CMD_SET_RETRY_POLICY,
+     "SET_RETRY_POLICY",
+     "Set the policy retrying the requests the instance rings are full for",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {
+     QAT_CMD_SET_REQUEST_DEADLINE,
+     "SET_REQUEST_DEADLINE",
+     "Set the time in us a request may wait before it is done in software",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {
+     QAT_CMD_GET_REQUEST_STATS,
+     "GET_REQUEST_STATS",
+     "Get the request submission statistics",
+     ENGINE_CMD_FLAG_NO_INPUT},
     {0, NULL, NULL, 0}
 };
 
@@ -1243,6 +2017,57 @@ qat_engine_ctrl(ENGINE *e, int cmd, long i, void *p, void (*f) (void))
         qat_poll_interval = (useconds_t) i;
         break;
 
+    case QAT_CMD_SET_SUBMISSION_BATCH_SIZE:
+        BREAK_IF(i < 0 || i > QAT_BATCH_MAX_SIZE,
+                "The submission batch size is out of range, using default value\n")
+        DEBUG("[%s] Set submission batch size = %ld\n", __func__, i);
+        qat_batch_size = (unsigned int) i;
+        /* Submit what was queued with the previous size */
+        if (qat_batch_size < 2)
+            qat_batch_flush_all(QAT_BATCH_FLUSH_ALL);
+        break;
+
+    case QAT_CMD_SET_SUBMISSION_BATCH_TIMEOUT:
+        BREAK_IF(i < 1 || i > 1000000,
+                "The submission batch timeout is out of range, using default value\n")
+        DEBUG("[%s] Set submission batch timeout = %ld us\n", __func__, i);
+        qat_batch_timeout = (unsigned int) i;
+        break;
+
+    case QAT_CMD_SET_CHAINED_CIPHER_INSTANCES:
+        BREAK_IF(i < 1 || i > QAT_MAX_SESSION_INSTANCES, \
+                "The number of chained cipher instances is out of range\n");
+        DEBUG("[%s] Set chained cipher instances = %ld\n", __func__, i);
+        qat_session_instances = (int) i;
+        break;
+
+    case QAT_CMD_SET_RETRY_POLICY:
+        if (f != NULL) {
+            DEBUG("[%s] Set custom retry policy\n", __func__);
+            qat_retry_policy = (qat_retry_policy_func) f;
+            break;
+        }
+        BREAK_IF(i != QAT_RETRY_POLICY_FIXED &&
+                 i != QAT_RETRY_POLICY_EXPONENTIAL, \
+                "The retry policy is invalid\n");
+        DEBUG("[%s] Set retry policy = %ld\n", __func__, i);
+        qat_retry_policy = i == QAT_RETRY_POLICY_FIXED ? qat_retry_fixed :
+                                                         qat_retry_exponential;
+        break;
+
+    case QAT_CMD_SET_REQUEST_DEADLINE:
+        BREAK_IF(i < 0 || i > 10000000, \
+                "The request deadline is out of range\n");
+        DEBUG("[%s] Set request deadline = %ld us\n", __func__, i);
+        qat_request_deadline = (unsigned long) i;
+        break;
+
+    case QAT_CMD_GET_REQUEST_STATS:
+        BREAK_IF(p == NULL, \
+                "GET_REQUEST_STATS failed as the input parameter was NULL\n");
+        memcpy(p, &qat_req_stats, sizeof(qat_req_stats));
+        break;
+
     case QAT_CMD_SET_EPOLL_TIMEOUT:
         BREAK_IF(i < 1 || i > 10000,
                 "The epoll timeout value is out of range, using default value\n")
@@ -1288,6 +2113,125 @@ qat_engine_ctrl(ENGINE *e, int cmd, long i, void *p, void (*f) (void))
 #endif
         break;
 
+    case QAT_CMD_SET_CRYPTO_SMALL_PACKET_OFFLOAD_ADAPTIVE:
+#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
+        BREAK_IF(i != 0 && i != 1, \
+                "SET_CRYPTO_SMALL_PACKET_OFFLOAD_ADAPTIVE failed as the value was not 0 or 1\n");
+        DEBUG("[%s] Set adaptive small packet threshold = %ld\n", __func__, i);
+        qat_pkt_threshold_table_set_adaptive((int) i);
+#else
+        WARN("QAT_CMD_SET_CRYPTO_SMALL_PACKET_OFFLOAD_ADAPTIVE is not supported\n");
+        retVal = 0;
+#endif
+        break;
+
+    case QAT_CMD_GET_CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD:
+#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
+        BREAK_IF(p == NULL || i <= 0, \
+                "GET_CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD failed as the buffer was invalid\n");
+        BREAK_IF(qat_pkt_threshold_table_get_learned((char *)p, (size_t) i) == 0, \
+                "GET_CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD failed as the buffer was too small\n");
+#else
+        WARN("QAT_CMD_GET_CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD is not supported\n");
+        retVal = 0;
+#endif
+        break;
+
+    case QAT_CMD_SET_CONTIG_MEM_ARENA_SIZE:
+#ifdef USE_QAT_CONTIG_MEM
+        BREAK_IF(engine_inited, \
+                "SET_CONTIG_MEM_ARENA_SIZE failed as the engine is already initialized\n");
+        BREAK_IF(i < 0 || i > QAT_CONTIG_MEM_ARENA_MAX_SIZE_IN_MB, \
+                "SET_CONTIG_MEM_ARENA_SIZE failed as the size is out of range\n");
+        DEBUG("[%s] Set pinned memory arena size = %ld MB\n", __func__, i);
+        BREAK_IF(!qaeCryptoMemSetArenaSize((size_t) i << 20), \
+                "SET_CONTIG_MEM_ARENA_SIZE failed as pinned memory is already in use\n");
+#else
+        WARN("QAT_CMD_SET_CONTIG_MEM_ARENA_SIZE is not supported\n");
+        retVal = 0;
+#endif
+        break;
+
+    case QAT_CMD_SET_CONTIG_MEM_PREALLOC:
+#ifdef USE_QAT_CONTIG_MEM
+        if(p) {
+            char *token;
+            while((token = strsep((char **)&p, ","))) {
+                char *size_token = strsep(&token,":");
+                char *count_token = strsep(&token,":");
+                if(size_token && count_token) {
+                    int ok;
+
+                    /* Every entry is applied, any bad one fails the ctrl */
+                    if (strcasecmp(size_token, "MAX") == 0)
+                        ok = qaeCryptoMemSetPrealloc(0, atoi(count_token));
+                    else
+                        ok = qaeCryptoMemSetPrealloc(atoi(size_token),
+                                                     atoi(count_token));
+                    if (!ok) {
+                        WARN("Invalid parameter!\n");
+                        retVal = 0;
+                    }
+                } else {
+                    WARN("Invalid parameter!\n");
+                    retVal = 0;
+                }
+            }
+        } else {
+            WARN("Invalid parameter!\n");
+            retVal = 0;
+        }
+#else
+        WARN("QAT_CMD_SET_CONTIG_MEM_PREALLOC is not supported\n");
+        retVal = 0;
+#endif
+        break;
+
+    case QAT_CMD_SET_CONTIG_MEM_RETENTION_TIME:
+#ifdef USE_QAT_CONTIG_MEM
+        BREAK_IF(i < 0 || i > 3600000, \
+                "The retention time value is out of range, using default value\n");
+        DEBUG("[%s] Set pinned memory retention time = %ld ms\n", __func__, i);
+        qaeCryptoMemSetRetentionTime((unsigned long) i);
+#else
+        WARN("QAT_CMD_SET_CONTIG_MEM_RETENTION_TIME is not supported\n");
+        retVal = 0;
+#endif
+        break;
+
+    case QAT_CMD_GET_CONTIG_MEM_STATS:
+#ifdef USE_QAT_CONTIG_MEM
+        BREAK_IF(p == NULL, \
+                "GET_CONTIG_MEM_STATS failed as the input parameter was NULL\n");
+        BREAK_IF(i <= 0, \
+                "GET_CONTIG_MEM_STATS failed as the number of entries was invalid\n");
+        BREAK_IF(qaeCryptoMemGetStats((qae_mem_class_stats *)p, (int) i) == 0, \
+                "GET_CONTIG_MEM_STATS failed as no statistics are available\n");
+#else
+        WARN("QAT_CMD_GET_CONTIG_MEM_STATS is not supported\n");
+        retVal = 0;
+#endif
+        break;
+
+    case QAT_CMD_SET_CONTIG_MEM_LAZY_FORK:
+#ifdef USE_QAT_CONTIG_MEM
+        BREAK_IF(i != 0 && i != 1, \
+                "SET_CONTIG_MEM_LAZY_FORK failed as the value was not 0 or 1\n");
+        DEBUG("[%s] Set pinned memory lazy fork = %ld\n", __func__, i);
+        qaeCryptoMemSetLazyFork((int) i);
+#else
+        WARN("QAT_CMD_SET_CONTIG_MEM_LAZY_FORK is not supported\n");
+        retVal = 0;
+#endif
+        break;
+
+    case QAT_CMD_GET_PINNED_MEM_FUNCS:
+        BREAK_IF(p == NULL, \
+                "GET_PINNED_MEM_FUNCS failed as the input parameter was NULL\n");
+        ((qat_pinned_mem_funcs *)p)->alloc = qat_pinned_buf_alloc;
+        ((qat_pinned_mem_funcs *)p)->free = qat_pinned_buf_free;
+        break;
+
     default:
         WARN("CTRL command not implemented\n");
         retVal = 0;
@@ -1319,6 +2263,8 @@ static int qat_engine_finish_int(ENGINE *e, int reset_globals)
     DEBUG("[%s] ---- Engine Finishing...\n\n", __func__);
 
     pthread_mutex_lock(&qat_engine_mutex);
+    /* Nothing will submit the queued requests once the instances stop */
+    qat_batch_flush_all(QAT_BATCH_FAIL_ALL);
     keep_polling = 0;
 
     if (qatInstanceHandles) {
@@ -1390,6 +2336,9 @@ static int qat_engine_finish_int(ENGINE *e, int reset_globals)
     keep_polling = 1;
     currInst = 0;
     qatPerformOpRetries = 0;
+    memset(&qat_req_stats, 0, sizeof(qat_req_stats));
+    qat_sym_caps = 0;
+    memset(instance_sym_caps, 0, sizeof(instance_sym_caps));
 
     /* Reset the configuration global variables (to their default values) only
      * if requested, i.e. when we are not re-initializing the engine after
@@ -1401,6 +2350,11 @@ static int qat_engine_finish_int(ENGINE *e, int reset_globals)
         enable_instance_for_thread = 0;
         qat_poll_interval = QAT_POLL_PERIOD_IN_NS;
         qat_max_retry_count = QAT_CRYPTO_NUM_POLLING_RETRIES;
+        qat_batch_size = 0;
+        qat_batch_timeout = QAT_BATCH_TIMEOUT_IN_US;
+        qat_session_instances = 1;
+        qat_retry_policy = qat_retry_fixed;
+        qat_request_deadline = 0;
     }
 
     pthread_mutex_unlock(&qat_engine_mutex);
@@ -1440,10 +2394,12 @@ static int qat_engine_destroy(ENGINE *e)
 {
     DEBUG("[%s] ---- Destroying Engine...\n\n", __func__);
     qat_free_ciphers();
+    qat_free_digests();
     qat_free_EC_methods();
     qat_free_DH_methods();
     qat_free_DSA_methods();
     qat_free_RSA_methods();
+    qat_free_asym_reqs();
 #ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
     CRYPTO_THREAD_cleanup_local(&qat_pkt_threshold_table_key);
 #endif
@@ -1493,6 +2449,7 @@ static int bind_qat(ENGINE *e, const char *id)
      * as this function will be called by a single thread.
      */
     qat_create_ciphers();
+    qat_create_digests();
 #ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
     CRYPTO_THREAD_run_once(&qat_pkt_threshold_table_once,qat_pkt_threshold_table_make_key);
 #endif
@@ -1523,6 +2480,11 @@ static int bind_qat(ENGINE *e, const char *id)
         goto end;
     }
 
+    if (!ENGINE_set_digests(e, qat_digests)) {
+        WARN("ENGINE_set_digests failed\n");
+        goto end;
+    }
+
     if (!ENGINE_set_pkey_meths(e, qat_PRF_pkey_methods)) {
         WARN("ENGINE_set_pkey_meths failed\n");
         goto end;
@@ -50,11 +50,13 @@
 # include <openssl/aes.h>
 # include <sys/types.h>
 # include <unistd.h>
+# include <time.h>
 
 # include "cpa.h"
 # include "cpa_types.h"
 # include "cpa_cy_sym.h"
 # include "cpa_cy_drbg.h"
+# include "cpa_cy_key.h"
 
 # include "qat_ciphers.h"
 # include <openssl/async.h>
@@ -122,6 +124,11 @@
  */
 #define QAT_MAX_PIPELINES   SSL_MAX_PIPELINES
 
+/* Max number of instances the records of a chained cipher ctx are spread
+ * over.
+ */
+#define QAT_MAX_SESSION_INSTANCES 8
+
 /* These are QAT API operation parameters */
 typedef struct qat_op_params_t {
     CpaCySymOpData op_data;
@@ -129,22 +136,64 @@ typedef struct qat_op_params_t {
     CpaBufferList dst_sgl;
     CpaFlatBuffer src_fbuf[2];
     CpaFlatBuffer dst_fbuf[2];
+    /* Payload buffer which is kept across records and only grown when a
+     * larger record is processed. It is not used when the record is in
+     * a pinned buffer supplied by the application.
+     */
+    Cpa8U *payload_buf;
+    Cpa32U payload_buf_len;
 } qat_op_params;
 
+/* Pinned memory functions returned by the GET_PINNED_MEM_FUNCS engine ctrl.
+ * Records located in buffers obtained with alloc are processed in place
+ * by the chained ciphers without being copied.
+ */
+typedef struct qat_pinned_mem_funcs_t {
+    void *(*alloc)(size_t size);
+    void (*free)(void *ptr);
+} qat_pinned_mem_funcs;
+
+/* EVP_CIPHER_CTX_ctrl() request selecting the encrypt-then-MAC order of
+ * RFC 7366 for the chained ciphers when arg is not 0. It is sent after
+ * each EVP_CipherInit_ex() as the MAC-then-encrypt order is restored then.
+ * libssl never sends it, only applications building their own records do.
+ */
+# define EVP_CTRL_QAT_ENCRYPT_THEN_MAC 0x1000
+
 typedef struct qat_chained_ctx_t {
     /* Crypto */
     unsigned char *hmac_key;
+    /* Whether records are encrypted then MACed */
+    int etm;
 #ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
     /* Pointer for context data that will be used by
      * Small packet offload feature. */
     void *sw_ctx_data;
 #endif
+    /* Software cipher context used by AEAD ciphers for small packets and
+     * for the messages that cannot be offloaded. */
+    EVP_CIPHER_CTX *sw_ctx;
+    /* AES-CBC context keyed once for decryption, used to decrypt the last
+     * blocks of the TLS records to read their padding. */
+    EVP_CIPHER_CTX *pad_ctx;
     /* QAT Session Params */
     CpaInstanceHandle instanceHandle;
     CpaCySymSessionSetupData *session_data;
     CpaCySymSessionCtx session_ctx;
+    /* Size of the pinned memory of session_ctx */
+    Cpa32U session_ctx_size;
     int init_flags;
 
+    /* Further instances the session is registered on, the records are
+     * spread over these and instanceHandle in turn.
+     */
+    CpaInstanceHandle spread_inst[QAT_MAX_SESSION_INSTANCES - 1];
+    CpaCySymSessionCtx spread_sess[QAT_MAX_SESSION_INSTANCES - 1];
+    Cpa32U spread_size[QAT_MAX_SESSION_INSTANCES - 1];
+    unsigned int num_spread;
+    /* Instance of the next record, 0 for instanceHandle */
+    unsigned int next_inst;
+
     unsigned int aad_ctr;
     char aad[QAT_MAX_PIPELINES][TLS_VIRT_HDR_SIZE];
 
@@ -162,50 +211,86 @@ typedef struct qat_chained_ctx_t {
     unsigned int numpipes;
     unsigned int npipes_last_used;
     unsigned long total_op;
+
+    /* AEAD message state. The AAD supplied through EVP_CipherUpdate()
+     * is kept in pinned memory, the session is initialised for the AAD
+     * length and direction in use.
+     */
+    unsigned char msg_iv[AEAD_IV_LEN];
+    unsigned char tag[AEAD_TAG_LEN];
+    int tag_len;
+    Cpa8U *aad_buf;
+    unsigned int aad_buf_len;
+    unsigned int aad_len;
+    int sess_aad_len;
+    int sess_enc;
 } qat_chained_ctx;
 
-/* qat_buffer structure for partial hash */
-typedef struct qat_buffer_t {
-    struct qat_buffer_t *next;  /* next buffer in the list */
-    void *data;                 /* point to data buffer */
-    int len;                    /* length of data */
-} qat_buffer;
-
-/* Qat ctx structure declaration */
-typedef struct qat_ctx_t {
-    int paramNID;               /* algorithm nid */
-    CpaCySymSessionCtx ctx;     /* session context */
-    unsigned char hashResult[SHA512_DIGEST_LENGTH];
-    /* hash digest result */
-    int enc;                    /* encryption flag */
-    int init;                   /* has been initialised */
-    int copiedCtx;              /* whether this is a copied context for
-                                 * initialisation purposes */
+/* The data of the raw ciphers is copied to a list of flat buffers each
+ * filling a 32KB slot of the pinned memory allocator with its header.
+ * Larger inputs are split into requests of QAT_CIPHER_MAX_REQ_LEN bytes.
+ */
+# define QAT_CIPHER_SGL_BUF_SIZE    (32768 - 256)
+# define QAT_CIPHER_MAX_SGL_BUFS    32
+# define QAT_CIPHER_MAX_REQ_LEN     (QAT_CIPHER_SGL_BUF_SIZE * \
+                                     QAT_CIPHER_MAX_SGL_BUFS)
+
+typedef struct qat_cipher_ctx_t {
+    /* Context data of the software implementation, used for small
+     * requests and partial blocks. The IV and the partial block state
+     * live in the EVP_CIPHER_CTX and are shared with it.
+     */
+    void *sw_ctx_data;
+    /* QAT Session Params */
     CpaInstanceHandle instanceHandle;
-    Cpa32U nodeId;
-    /*
-     * the memory for the private meta data must be allocated as contiguous
-     * memory. The cpaCyBufferListGetMetaSize() will return the size (in
-     * bytes) for memory allocation routine to allocate the private meta data
-     * memory
+    CpaCySymSessionSetupData *session_data;
+    CpaCySymSessionCtx session_ctx;
+    int init_flags;
+
+    /* QAT Operation Params. The flat buffers are allocated as needed
+     * and kept across calls.
      */
-    void *srcPrivateMetaData;   /* meta data pointer */
-    void *dstPrivateMetaData;   /* meta data pointer */
-    /*
-     * For partial operations, we maintain a linked list of buffers to be
-     * processed in the final function.
+    CpaCySymOpData op_data;
+    CpaBufferList sgl;
+    CpaFlatBuffer fbuf[QAT_CIPHER_MAX_SGL_BUFS];
+    unsigned int num_bufs;
+    /* Buffer for data processed in place in a pinned buffer */
+    CpaFlatBuffer pinned_fbuf;
+} qat_cipher_ctx;
+
+/* The updates of a digest are coalesced into pinned staging buffers each
+ * filling a 32KB slot of the pinned memory allocator with its header. The
+ * size is a multiple of the block size of all the supported digests.
+ */
+# define QAT_DIGEST_BUF_SIZE        (32768 - 256)
+# define QAT_DIGEST_MAX_BUFS        8
+# define QAT_DIGEST_MAX_STAGED      (QAT_DIGEST_BUF_SIZE * QAT_DIGEST_MAX_BUFS)
+
+typedef struct qat_digest_ctx_t {
+    /* QAT Session Params */
+    CpaInstanceHandle instanceHandle;
+    CpaCySymSessionCtx session_ctx;
+    int init_flags;
+    /* Set while the session holds the state of a partly hashed message */
+    int partial;
+
+    /* QAT Operation Params. The staging buffers are allocated as needed,
+     * when they are full and more data follows they are sent as a partial
+     * packet.
      */
-    qat_buffer *first;          /* first buffer pointer for partial op */
-    qat_buffer *last;           /* last buffer pointe for partial op */
-    int buff_count;             /* buffer count */
-    int buff_total_bytes;       /* total number of bytes in buffer */
-    int failed_submission;      /* flag as a failed submission to aid cleanup */
-    /* Request tracking stats */
-    Cpa64U noRequests;
-    Cpa64U noResponses;
-    CpaCySymSessionSetupData *session_data;
-    Cpa32U meta_size;
-} qat_ctx;
+    CpaCySymOpData op_data;
+    CpaBufferList sgl;
+    CpaFlatBuffer fbuf[QAT_DIGEST_MAX_BUFS];
+    unsigned int num_bufs;
+    size_t staged;
+    /* A message is staged in sw_buf, on the heap, until it grows above the
+     * small packet offload threshold. It is then moved to the pinned
+     * staging buffers and pinned is set until the next message.
+     */
+    unsigned char *sw_buf;
+    size_t sw_buf_size;
+    int pinned;
+} qat_digest_ctx;
 
 /* Struct for tracking threaded QAT operation completion. */
 struct op_done {
@@ -214,6 +299,11 @@ struct op_done {
     int flag;
     CpaBoolean verifyResult;
     ASYNC_JOB *job;
+    /* Time in us the request may wait for ring space, 0 for no limit */
+    unsigned long deadline;
+    /* Requests submitted with this struct and time of the first one */
+    unsigned int submitted;
+    struct timespec submit_time;
 };
 
 /* Use this variant of op_done to track QAT chained cipher
@@ -229,7 +319,58 @@ struct op_done_pipe {
     unsigned int num_processed;
 };
 
+/* Submits one request on instanceHandle with callbackTag passed to the
+ * callback, args holds the parameters of the request.
+ */
+typedef CpaStatus (*qat_submit_func)(CpaInstanceHandle instanceHandle,
+                                     void *callbackTag, void *args);
+
+/* Retry policy, returns the time in us to wait before the retry-th
+ * submission of a request the rings were full for, or -1 to give up. The
+ * requests of asynchronous jobs pause the job instead of sleeping.
+ */
+typedef long (*qat_retry_policy_func)(unsigned int retry, int async);
+
+# define QAT_RETRY_POLICY_FIXED       0
+# define QAT_RETRY_POLICY_EXPONENTIAL 1
+# define QAT_RETRY_BACKOFF_MAX_US     1000
+
+/* Returned when the deadline of a request passes before it is submitted */
+# define QAT_STATUS_EXPIRED           (-100)
+
+/* Parameters of an asymmetric request passed to its submit function */
+typedef struct {
+    void *opData;
+    CpaFlatBuffer *out1;
+    CpaFlatBuffer *out2;
+    CpaBoolean *pStatus;
+} qat_asym_args;
+
+/* Request statistics returned by GET_REQUEST_STATS */
+typedef struct {
+    unsigned long submitted;
+    unsigned long completed;
+    unsigned long in_flight;
+    unsigned long retries;
+    unsigned long expired;
+    /* Submission to completion time of the waits, one sample each */
+    unsigned long latency_samples;
+    unsigned long latency_total_us;
+    unsigned long latency_max_us;
+} qat_request_stats;
+
+/* Symmetric capabilities not supported by every device generation */
+# define QAT_SYM_CAP_CHACHAPOLY 0x0001
+# define QAT_SYM_CAP_HKDF       0x0002
+
+/* The HKDF key generation API is only present in the newer QAT drivers */
+# ifdef CPA_CY_HKDF_KEY_MAX_SECRET_SZ
+#  define QAT_HKDF
+# endif
+
 CpaInstanceHandle get_next_inst(void);
+CpaInstanceHandle get_next_inst_with_cap(unsigned int cap);
+int qat_sym_cap_supported(unsigned int cap);
 void initOpDone(struct op_done *opDone);
 void cleanupOpDone(struct op_done *opDone);
 int  initOpDonePipe(struct op_done_pipe *opDone, unsigned int npipes);
@@ -242,10 +383,24 @@ CpaStatus myPerformOp(const CpaInstanceHandle instanceHandle,
                       void *pCallbackTag, const CpaCySymOpData * pOpData,
                       const CpaBufferList * pSrcBuffer,
                       CpaBufferList * pDstBuffer, CpaBoolean * pVerifyResult);
+CpaStatus qat_batch_perform_op(const CpaInstanceHandle instanceHandle,
+                               CpaCySymCbFunc pSymCb, void *pCallbackTag,
+                               const CpaCySymOpData * pOpData,
+                               const CpaBufferList * pSrcBuffer,
+                               CpaBufferList * pDstBuffer,
+                               CpaBoolean * pVerifyResult);
+CpaStatus qat_submit_op(struct op_done *opDone,
+                        CpaInstanceHandle instanceHandle,
+                        qat_submit_func submit, void *args);
+void qat_wait_op(struct op_done *opDone);
+CpaStatus qat_perform_op(CpaInstanceHandle instanceHandle,
+                         qat_submit_func submit, void *args, int fallback,
+                         CpaBoolean *verifyResult);
 int qat_setup_async_event_notification(int notificationNo);
 int qat_pause_job(ASYNC_JOB *job, int notificationNo);
 int qat_wake_job(ASYNC_JOB *job, int notificationNo);
 useconds_t getQatPollInterval();
 int getQatMsgRetryCount();
+int getQatSessionInstances();
 int getEnableExternalPolling();
 #endif   /* E_QAT_H */
@@ -114,6 +114,8 @@
 
 /* maxmium slot size */
 #define MAX_ALLOC (SLAB_SIZE - sizeof(qat_contig_mem_config) - sizeof(qae_slab) - QAE_BYTE_ALIGNMENT)
+/* pool_index of the slot header of a large allocation */
+#define LARGE_POOL_INDEX   -2
 #define MAX_EMPTY_SLAB     128
 
 #define IN_EMPTY_LIST      0
@@ -139,7 +141,6 @@ typedef struct _qae_slot {
     int line;
 } qae_slot;
 
-afjdklj;
 typedef struct _qae_slab {
     qat_contig_mem_config memCfg;
     /* this field has two meanings:
@@ -160,6 +161,34 @@ typedef struct _qae_slab {
 /* head of a cyclic doubly linked list, reused qae_slab data structure */
 typedef qae_slab qae_slab_pool;
 
+/*
+ * Allocations larger than MAX_ALLOC get a physically contiguous region of
+ * their own, a power of two pages in size. The region starts with the
+ * driver's qat_contig_mem_config header followed by a qae_slot header
+ * marking it as large, so that the free path can tell it apart from a slot.
+ * V2P can't find the header of a large region by masking the address, so
+ * the regions are kept in a table sorted by address and searched instead.
+ * The table is shared by all threads as a buffer may be translated by
+ * another thread than the one which allocated it.
+ */
+#define LARGE_HDR_SIZE     ((sizeof(qat_contig_mem_config) + sizeof(qae_slot) \
+                             + QAE_BYTE_ALIGNMENT - 1) & \
+                            ~(QAE_BYTE_ALIGNMENT - 1))
+
+typedef struct _qae_large_region {
+    unsigned char *base;
+    size_t len;
+    CpaPhysicalAddr phys;
+} qae_large_region;
+
+static qae_large_region *crypto_large_regions = NULL;
+static int crypto_large_count = 0;
+static int crypto_large_capacity = 0;
+/* lowest and highest address covered by a large region */
+static unsigned char *crypto_large_min = NULL;
+static unsigned char *crypto_large_max = NULL;
+static pthread_rwlock_t crypto_large_lock = PTHREAD_RWLOCK_INITIALIZER;
+
 static pthread_key_t qae_key;
 static pthread_once_t qae_key_once = PTHREAD_ONCE_INIT;
 
@@ -342,7 +371,8 @@ static qae_slab *crypto_create_slab(int size, int pool_index, int memfd)
 {
     int i = 0;
     int nslot = 0;
-    qat_contig_mem_config qmcfg = { 0, (uintptr_t) NULL, 0, (uintptr_t) NULL };
+    qat_contig_mem_config qmcfg = { 0, (uintptr_t) NULL, 0, (uintptr_t) NULL,
+                                    QAT_CONTIG_MEM_ANY_NODE };
     qae_slab *result = NULL;
     qae_slab *slb = NULL;
     qae_slot *slt = NULL;
@@ -436,6 +466,323 @@ static qae_slab *crypto_get_empty_slab(int size, int pool_index,
     return result;
 }
 
+/*****************************************************************************
+ * function:
+ *         crypto_large_find(const void *ptr)
+ *
+ * @param[in] ptr, address to look up
+ * @retval int, index of the region containing ptr, -1 if there is none
+ *
+ * @description
+ *      binary search of the large region table. Must be called with
+ *      crypto_large_lock held.
+ *
+ *****************************************************************************/
+static int crypto_large_find(const void *ptr)
+{
+    const unsigned char *p = (const unsigned char *)ptr;
+    int lo = 0;
+    int hi = crypto_large_count - 1;
+    int mid;
+
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (p < crypto_large_regions[mid].base)
+            hi = mid - 1;
+        else if (p >= crypto_large_regions[mid].base +
+                      crypto_large_regions[mid].len)
+            lo = mid + 1;
+        else
+            return mid;
+    }
+    return -1;
+}
+
+/* recompute the address bounds of the table, crypto_large_lock held */
+static void crypto_large_update_bounds(void)
+{
+    qae_large_region *last = NULL;
+
+    if (crypto_large_count == 0) {
+        crypto_large_min = NULL;
+        crypto_large_max = NULL;
+        return;
+    }
+    last = &crypto_large_regions[crypto_large_count - 1];
+    crypto_large_min = crypto_large_regions[0].base;
+    crypto_large_max = last->base + last->len;
+}
+
+/* add a region to the table keeping it sorted, 1 on success */
+static int crypto_large_insert(unsigned char *base, size_t len,
+                               CpaPhysicalAddr phys)
+{
+    qae_large_region *regions = NULL;
+    int i, rc, ret = 0;
+
+    if ((rc = pthread_rwlock_wrlock(&crypto_large_lock)) != 0) {
+        MEM_ERROR("pthread_rwlock_wrlock: %s\n", strerror(rc));
+        return 0;
+    }
+
+    if (crypto_large_count == crypto_large_capacity) {
+        regions = realloc(crypto_large_regions,
+                          (crypto_large_capacity + 16) *
+                          sizeof(qae_large_region));
+        if (regions == NULL)
+            goto exit;
+        crypto_large_regions = regions;
+        crypto_large_capacity += 16;
+    }
+
+    for (i = crypto_large_count;
+         i > 0 && crypto_large_regions[i - 1].base > base; i--)
+        crypto_large_regions[i] = crypto_large_regions[i - 1];
+    crypto_large_regions[i].base = base;
+    crypto_large_regions[i].len = len;
+    crypto_large_regions[i].phys = phys;
+    crypto_large_count++;
+    crypto_large_update_bounds();
+    ret = 1;
+
+ exit:
+    if ((rc = pthread_rwlock_unlock(&crypto_large_lock)) != 0)
+        MEM_ERROR("pthread_rwlock_unlock: %s\n", strerror(rc));
+    return ret;
+}
+
+/* remove the region starting at base from the table */
+static void crypto_large_remove(unsigned char *base)
+{
+    int i, rc;
+
+    if ((rc = pthread_rwlock_wrlock(&crypto_large_lock)) != 0) {
+        MEM_ERROR("pthread_rwlock_wrlock: %s\n", strerror(rc));
+        return;
+    }
+    if ((i = crypto_large_find(base)) >= 0) {
+        memmove(&crypto_large_regions[i], &crypto_large_regions[i + 1],
+                (crypto_large_count - i - 1) * sizeof(qae_large_region));
+        crypto_large_count--;
+        crypto_large_update_bounds();
+    }
+    if ((rc = pthread_rwlock_unlock(&crypto_large_lock)) != 0)
+        MEM_ERROR("pthread_rwlock_unlock: %s\n", strerror(rc));
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_large_v2p(void *v, CpaPhysicalAddr *phys)
+ *
+ * @param[in] v, virtual address to translate
+ * @param[out] phys, the physical address of v
+ * @retval int, 1 if v lies within a large region, 0 otherwise
+ *
+ * @description
+ *      translate an address of a large allocation
+ *
+ *****************************************************************************/
+static int crypto_large_v2p(void *v, CpaPhysicalAddr *phys)
+{
+    int i, rc, found = 0;
+
+    /* cheap bounds check so that slab memory does not take the lock */
+    if (crypto_large_count == 0 ||
+        (unsigned char *)v < crypto_large_min ||
+        (unsigned char *)v >= crypto_large_max)
+        return 0;
+
+    if ((rc = pthread_rwlock_rdlock(&crypto_large_lock)) != 0) {
+        MEM_ERROR("pthread_rwlock_rdlock: %s\n", strerror(rc));
+        return 0;
+    }
+    if ((i = crypto_large_find(v)) >= 0) {
+        *phys = crypto_large_regions[i].phys +
+                (CpaPhysicalAddr)((unsigned char *)v -
+                                  crypto_large_regions[i].base);
+        found = 1;
+    }
+    if ((rc = pthread_rwlock_unlock(&crypto_large_lock)) != 0)
+        MEM_ERROR("pthread_rwlock_unlock: %s\n", strerror(rc));
+    return found;
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_alloc_large(size_t size, const char *file, int line,
+ *                            int memfd)
+ *
+ * @param[in] size, the size of the memory block required
+ * @param[in] file, the C source filename of the call site
+ * @param[in] line, the line number within the C source file of the call site
+ * @param[in] memfd, the file descriptor of the memory driver
+ *
+ * @description
+ *      allocate a block too large for a slab in a region of its own
+ *      retval pointer to the allocated block
+ *
+ *****************************************************************************/
+static void *crypto_alloc_large(size_t size, const char *file, int line,
+                                int memfd)
+{
+    qat_contig_mem_config qmcfg = { 0, (uintptr_t) NULL, 0, (uintptr_t) NULL,
+                                    QAT_CONTIG_MEM_ANY_NODE };
+    unsigned char *base = NULL;
+    qae_slot *slt = NULL;
+    size_t len = PAGE_SIZE;
+
+    while (len < size + LARGE_HDR_SIZE)
+        len <<= 1;
+    if (len > QAT_CONTIG_MEM_MAX_ALLOC) {
+        MEM_ERROR("%s Allocation of %zu bytes is too big\n", __func__, size);
+        return NULL;
+    }
+
+#ifdef USE_QAT_CONTIG_MEM
+    qmcfg.length = len;
+    if (ioctl(memfd, QAT_CONTIG_MEM_MALLOC, &qmcfg) == -1) {
+        static char errmsg[LINE_MAX];
+
+        snprintf(errmsg, LINE_MAX, "ioctl QAT_CONTIG_MEM_MALLOC(%d)",
+                 qmcfg.length);
+        perror(errmsg);
+        return NULL;
+    }
+    if ((base = mmap(NULL, len * QAT_CONTIG_MEM_MMAP_ADJUSTMENT,
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED,
+                     memfd, qmcfg.virtualAddress)) == MAP_FAILED) {
+        static char errmsg[LINE_MAX];
+        snprintf(errmsg, LINE_MAX, "mmap: %d %s", errno, strerror(errno));
+        perror(errmsg);
+        if (ioctl(memfd, QAT_CONTIG_MEM_FREE, &qmcfg) == -1)
+            perror("ioctl QAT_CONTIG_MEM_FREE");
+        return NULL;
+    }
+#endif
+    if (base == NULL)
+        return NULL;
+
+    if (!crypto_large_insert(base, len, (CpaPhysicalAddr)qmcfg.physicalAddress)) {
+        MEM_ERROR("%s failed to record region %p\n", __func__, base);
+#ifdef USE_QAT_CONTIG_MEM
+        munmap(base, len);
+        if (ioctl(memfd, QAT_CONTIG_MEM_FREE, &qmcfg) == -1)
+            perror("ioctl QAT_CONTIG_MEM_FREE");
+#endif
+        return NULL;
+    }
+
+    slt = (qae_slot *)(base + LARGE_HDR_SIZE - sizeof(qae_slot));
+    slt->next = NULL;
+    slt->sig = SIG_ALLOC;
+    slt->pool_index = LARGE_POOL_INDEX;
+    slt->slab = NULL;
+    slt->file = strdup(file);
+    slt->line = line;
+    MEM_DEBUG("%s region %p of %zu bytes for %zu bytes\n", __func__, base,
+              len, size);
+    return base + LARGE_HDR_SIZE;
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_free_large(qae_slot *slt, int memfd)
+ *
+ * @param[in] slt, the slot header of the large allocation
+ * @param[in] memfd, the file descriptor of the memory driver
+ *
+ * @description
+ *      give the region of a large allocation back to the kernel
+ *
+ *****************************************************************************/
+static void crypto_free_large(qae_slot *slt, int memfd)
+{
+    unsigned char *base = (unsigned char *)slt + sizeof(qae_slot) -
+                          LARGE_HDR_SIZE;
+    qat_contig_mem_config qmcfg = *((qat_contig_mem_config *)base);
+
+    if (slt->sig != SIG_ALLOC) {
+        MEM_ERROR("%s error trying to free slot that hasn't been alloc'd %p\n",
+                  __func__, slt);
+        return;
+    }
+    slt->sig = SIG_FREE;
+    free(slt->file);
+
+    crypto_large_remove(base);
+#ifdef USE_QAT_CONTIG_MEM
+    MEM_DEBUG("%s do munmap of %p\n", __func__, base);
+    if (munmap(base, qmcfg.length) == -1) {
+        perror("munmap");
+        exit(EXIT_FAILURE);
+    }
+    if (ioctl(memfd, QAT_CONTIG_MEM_FREE, &qmcfg) == -1) {
+        perror("ioctl QAT_CONTIG_MEM_FREE");
+        exit(EXIT_FAILURE);
+    }
+#endif
+}
+
+/*****************************************************************************
+ * function:
+ *         fork_large_regions(int memfd)
+ *
+ * @param[in] memfd, file descriptor for the memory driver
+ *
+ * @description
+ *      allocate and remap the large regions following a fork
+ *
+ *****************************************************************************/
+static void fork_large_regions(int memfd)
+{
+#ifdef USE_QAT_CONTIG_MEM
+    qat_contig_mem_config qmcfg;
+    qae_large_region *region = NULL;
+    unsigned char *new_base = NULL;
+    unsigned char *remap = NULL;
+    int i, rc;
+
+    if ((rc = pthread_rwlock_wrlock(&crypto_large_lock)) != 0) {
+        MEM_ERROR("pthread_rwlock_wrlock: %s\n", strerror(rc));
+        return;
+    }
+
+    for (i = 0; i < crypto_large_count; i++) {
+        region = &crypto_large_regions[i];
+        qmcfg = *((qat_contig_mem_config *)region->base);
+        if (ioctl(memfd, QAT_CONTIG_MEM_MALLOC, &qmcfg) == -1) {
+            perror("ioctl QAT_CONTIG_MEM_MALLOC");
+            exit(EXIT_FAILURE);
+        }
+        if ((new_base = mmap(NULL, region->len * QAT_CONTIG_MEM_MMAP_ADJUSTMENT,
+                             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED,
+                             memfd, qmcfg.virtualAddress)) == MAP_FAILED) {
+            static char errmsg[LINE_MAX];
+            snprintf(errmsg, LINE_MAX, "mmap: %d %s", errno, strerror(errno));
+            perror(errmsg);
+            exit(EXIT_FAILURE);
+        }
+        memcpy(new_base + sizeof(qat_contig_mem_config),
+               region->base + sizeof(qat_contig_mem_config),
+               region->len - sizeof(qat_contig_mem_config));
+        if (munmap(region->base, region->len) == -1) {
+            perror("munmap");
+            exit(EXIT_FAILURE);
+        }
+        remap = mremap(new_base, region->len, region->len,
+                       MREMAP_FIXED | MREMAP_MAYMOVE, region->base);
+        if ((remap == MAP_FAILED) || (remap != region->base)) {
+            perror("mremap");
+            exit(EXIT_FAILURE);
+        }
+        region->phys = (CpaPhysicalAddr)qmcfg.physicalAddress;
+    }
+
+    if ((rc = pthread_rwlock_unlock(&crypto_large_lock)) != 0)
+        MEM_ERROR("pthread_rwlock_unlock: %s\n", strerror(rc));
+#endif
+}
+
 /*****************************************************************************
  * function:
  *         crypto_alloc_from_slab(int size, const char *file, int line)
@@ -465,6 +812,10 @@ static void *crypto_alloc_from_slab(int size, const char *file, int line)
         tls_ptr = (qae_slab_pools_local *)pthread_getspecific(qae_key);
     }
 
+    if (size + sizeof(qae_slot) + QAE_BYTE_ALIGNMENT > MAX_ALLOC)
+        return crypto_alloc_large(size, file, line,
+                                  tls_ptr->crypto_qat_contig_memfd);
+
     size += sizeof(qae_slot);
     size += QAE_BYTE_ALIGNMENT;
 
@@ -585,6 +936,11 @@ static void crypto_free_to_slab(void *ptr)
         return;
     }
 
+    if (slt->pool_index == LARGE_POOL_INDEX) {
+        crypto_free_large(slt, tls_ptr->crypto_qat_contig_memfd);
+        return;
+    }
+
     qae_slab *slb = slt->slab;
     int i = slt->pool_index;
 
@@ -661,7 +1017,11 @@ static int crypto_slot_get_size(void *ptr)
         return 0;
     }
     qae_slot *slt = (void *)((unsigned char *)ptr - sizeof(qae_slot));
-    if (slt->pool_index == (NUM_SLOT_SIZE - 1)) {
+    if (slt->pool_index == LARGE_POOL_INDEX) {
+        return ((qat_contig_mem_config *)((unsigned char *)ptr -
+                                          LARGE_HDR_SIZE))->length -
+               LARGE_HDR_SIZE;
+    } else if (slt->pool_index == (NUM_SLOT_SIZE - 1)) {
         return MAX_ALLOC;
     } else if (slt->pool_index >= 0 && slt->pool_index <= NUM_SLOT_SIZE - 2) {
         return slot_sizes_available[slt->pool_index] - sizeof(qae_slot) -
@@ -688,7 +1048,8 @@ void fork_slab_list(qae_slab_pool * list, int memfd)
     qae_slab *old_slb = list->next;
     qae_slab *new_slb = NULL;
     qat_contig_mem_config qmcfg =
-        { 0, (uintptr_t) NULL, SLAB_SIZE, (uintptr_t) NULL };
+        { 0, (uintptr_t) NULL, SLAB_SIZE, (uintptr_t) NULL,
+          QAT_CONTIG_MEM_ANY_NODE };
 
     while (count < list->slot_size) {
 #ifdef USE_QAT_CONTIG_MEM
@@ -890,6 +1251,121 @@ static void crypto_init(void)
 #endif
 }
 
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemSetArenaSize(size_t size)
+ *
+ * @param[in] size, size in bytes of the arena to reserve
+ * @retval int, 1 if size is 0 (no arena), otherwise 0
+ *
+ * @description
+ *      the arena is shared by all threads so it is not supported by the
+ *      thread local allocator
+ *
+ *****************************************************************************/
+int qaeCryptoMemSetArenaSize(size_t size)
+{
+    MEM_WARN("%s: arena not supported with the multi thread allocator\n",
+             __func__);
+    return size == 0;
+}
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemSetRetentionTime(unsigned long retention_ms)
+ *
+ * @param[in] retention_ms, length in ms of the retention period
+ *
+ * @description
+ *      the thread local allocator keeps its fixed limit on empty slabs
+ *
+ *****************************************************************************/
+void qaeCryptoMemSetRetentionTime(unsigned long retention_ms)
+{
+    MEM_WARN("%s: not supported with the multi thread allocator\n", __func__);
+}
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemSetLazyFork(int enable)
+ *
+ * @param[in] enable, 1 to discard the parent's slabs in a child
+ *
+ * @description
+ *      the thread local allocator always remaps the slabs following a fork
+ *
+ *****************************************************************************/
+void qaeCryptoMemSetLazyFork(int enable)
+{
+    MEM_WARN("%s: not supported with the multi thread allocator\n", __func__);
+}
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemSetThreadNode(int node)
+ *
+ * @param[in] node, NUMA node to allocate from
+ * @retval int, always 0
+ *
+ * @description
+ *      the thread local allocator does not keep per node pools
+ *
+ *****************************************************************************/
+int qaeCryptoMemSetThreadNode(int node)
+{
+    MEM_WARN("%s: not supported with the multi thread allocator\n", __func__);
+    return 0;
+}
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemGetStats(qae_mem_class_stats *stats, int num)
+ *
+ * @param[out] stats, array receiving the statistics of each size class
+ * @param[in] num, number of entries in the array
+ * @retval int, always 0
+ *
+ * @description
+ *      statistics are not collected by the thread local allocator
+ *
+ *****************************************************************************/
+int qaeCryptoMemGetStats(qae_mem_class_stats *stats, int num)
+{
+    return 0;
+}
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemSetPrealloc(int slot_size, int num_slabs)
+ *
+ * @param[in] slot_size, slot size of the class
+ * @param[in] num_slabs, number of slabs to create
+ * @retval int, 1 if num_slabs is 0, otherwise 0
+ *
+ * @description
+ *      slabs are owned by the thread that creates them so they can not be
+ *      created up front by the thread initialising the engine
+ *
+ *****************************************************************************/
+int qaeCryptoMemSetPrealloc(int slot_size, int num_slabs)
+{
+    MEM_WARN("%s: preallocation not supported with the multi thread allocator\n",
+             __func__);
+    return num_slabs == 0;
+}
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemPrealloc(void)
+ *
+ * @description
+ *      nothing to do for the thread local allocator
+ *
+ *****************************************************************************/
+void qaeCryptoMemPrealloc(void)
+{
+}
+
 /*****************************************************************************
  * function:
  *         qaeCryptoAtFork()
@@ -904,6 +1380,7 @@ void qaeCryptoAtFork()
     qae_slab_pools_local *tls_ptr =
                     (qae_slab_pools_local *)pthread_getspecific(qae_key);
 
+    fork_large_regions(tls_ptr->crypto_qat_contig_memfd);
     fork_slab_list(&tls_ptr->full_slab_list,tls_ptr->crypto_qat_contig_memfd);
     for(i = 0;i < NUM_SLOT_SIZE; i++) {
         fork_slab_list(&tls_ptr->empty_slab_list[i],
@@ -931,11 +1408,16 @@ CpaPhysicalAddr qaeCryptoMemV2P(void *v)
    qat_contig_mem_config *memCfg = NULL;
    void *pVirtPageAddress = NULL;
    ptrdiff_t offset = 0;
+   CpaPhysicalAddr phys = 0;
    if(v == NULL) {
        MEM_WARN("%s: NULL address passed to function\n", __func__);
        return (CpaPhysicalAddr) 0;
    }
 
+   /* must come before the header lookup which may land in a large region */
+   if (crypto_large_v2p(v, &phys))
+       return phys;
+
    /* Get the physical address contained in the slab
       header using the fact the slabs are aligned in
       virtual address space */
@@ -63,6 +63,7 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
 
 #ifdef QAT_MEM_DEBUG
 # define MEM_DEBUG(...) fprintf(stderr, __VA_ARGS__)
@@ -127,7 +128,23 @@ static pthread_mutex_t crypto_bsal = PTHREAD_MUTEX_INITIALIZER;
 
 /* maxmium slot size */
 #define MAX_ALLOC (SLAB_SIZE - sizeof(qae_slab) - QAE_BYTE_ALIGNMENT)
+/* pool_index of the slot header of a large allocation */
+#define LARGE_POOL_INDEX   -2
+/* hard limit on the number of empty slabs kept per size class */
 #define MAX_EMPTY_SLAB     128
+/* default time in ms between two trims of the empty slab lists */
+#define DEFAULT_RETENTION_MS 10000
+
+/*
+ * Slabs are kept in separate pools for each NUMA node so that the buffers
+ * used with a QAT device can live on the device's socket. Pool 0 holds the
+ * slabs allocated without a node preference and pool n + 1 those allocated
+ * on node n. Each thread allocates from the pool set with
+ * qaeCryptoMemSetThreadNode(), pool 0 by default.
+ */
+#define MAX_NUMA_NODES     8
+#define NUM_NODE_POOLS     (MAX_NUMA_NODES + 1)
+#define NODE_POOL_ANY      0
 
 #define IN_EMPTY_LIST      0
 #define IN_AVAILABLE_LIST  1
@@ -170,17 +187,135 @@ typedef struct _qae_slab {
     int list_index;
     /* indicate which process alloc this slab */
     pid_t pid;
+    /* index of the NUMA node pool the slab belongs to */
+    int node_pool;
 } qae_slab;
 
 /* head of a cyclic doubly linked list, reused qae_slab data structure */
 typedef qae_slab qae_slab_pool;
 
+/* number of empty slabs per size class to create up front */
+static int crypto_prealloc_slabs[NUM_SLOT_SIZE] = { 0 };
+/*
+ * node pools to create them in: pool 0 and the pools a thread has been
+ * bound to with qaeCryptoMemSetThreadNode()
+ */
+static int crypto_prealloc_pools[NUM_NODE_POOLS] = { 1 };
+
+/*
+ * Empty slabs are retained according to the demand seen over the last
+ * retention period rather than released as soon as a slab becomes empty.
+ * Each period the number of empty slabs kept for a size class is cut down
+ * to what is needed to get back to the peak number of live slabs seen
+ * during the period (and never below the preallocation target). Trimming
+ * is amortised over the free path so no extra thread is needed.
+ */
+typedef struct _qae_slab_class_stats {
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long slabs_created;
+    unsigned long slabs_released;
+    /* allocations per second over the last retention period */
+    unsigned long alloc_rate;
+    /* allocations since the start of the retention period */
+    unsigned long window_allocs;
+    int full_slabs;
+    int peak_live_slabs;
+    /* peak number of live slabs since the start of the retention period */
+    int window_peak_live;
+} qae_slab_class_stats;
+
+static qae_slab_class_stats crypto_class_stats[NUM_SLOT_SIZE];
+static unsigned long crypto_retention_ms = DEFAULT_RETENTION_MS;
+static unsigned long crypto_last_trim = 0;
+
+/*
+ * Optional arena of pinned memory. When an arena size has been set before
+ * the allocator is initialised, one arena is reserved from the driver and
+ * mapped once, and slabs are then carved out of it using a bitmap so that
+ * creating or releasing a slab needs neither an ioctl nor a change to the
+ * page tables. Slabs only fall back to an ioctl/mmap pair of their own once
+ * the arena is exhausted. The physical address of every arena slab is kept
+ * in a table so that V2P for arena memory is a simple index.
+ */
+#define ARENA_BITS_PER_WORD (sizeof(unsigned long) * CHAR_BIT)
+#define ARENA_MAP_WORDS(n)  (((n) + ARENA_BITS_PER_WORD - 1) / \
+                             ARENA_BITS_PER_WORD)
+
+/* arena size requested through qaeCryptoMemSetArenaSize() */
+static size_t crypto_arena_size = 0;
+static unsigned char *crypto_arena_base = NULL;
+static size_t crypto_arena_len = 0;
+static int crypto_arena_nslabs = 0;
+static int crypto_arena_free_slabs = 0;
+/* word of the bitmap to start the next search from */
+static int crypto_arena_hint = 0;
+/* one bit per slab, set when the slab is in use */
+static unsigned long *crypto_arena_map = NULL;
+/* physical address of each slab in the arena */
+static CpaPhysicalAddr *crypto_arena_phys = NULL;
+
+/*
+ * Allocations larger than MAX_ALLOC get a physically contiguous region of
+ * their own, a power of two pages in size. The region starts with the
+ * driver's qat_contig_mem_config header followed by a qae_slot header
+ * marking it as large, so that the free path can tell it apart from a slot.
+ * V2P can't find the header of a large region by masking the address, so
+ * the regions are kept in a table sorted by address and searched instead.
+ */
+#define LARGE_HDR_SIZE     ((sizeof(qat_contig_mem_config) + sizeof(qae_slot) \
+                             + QAE_BYTE_ALIGNMENT - 1) & \
+                            ~(QAE_BYTE_ALIGNMENT - 1))
+
+typedef struct _qae_large_region {
+    unsigned char *base;
+    size_t len;
+    CpaPhysicalAddr phys;
+} qae_large_region;
+
+static qae_large_region *crypto_large_regions = NULL;
+static int crypto_large_count = 0;
+static int crypto_large_capacity = 0;
+/* lowest and highest address covered by a large region */
+static unsigned char *crypto_large_min = NULL;
+static unsigned char *crypto_large_max = NULL;
+static pthread_rwlock_t crypto_large_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/*
+ * In lazy fork mode a child does not copy and remap the slabs inherited
+ * from its parent, which it cannot use for DMA. It starts with empty pools
+ * and the inherited slabs are unmapped by a detached thread, so that the
+ * cost of a fork does not depend on the size of the parent's pools. Memory
+ * allocated before the fork must not be used or freed by the child.
+ */
+static int crypto_lazy_fork = 0;
+
+/*
+ * Slabs and arena inherited from the parent across a fork. The slab lists
+ * are linked through the shared slabs, which the parent keeps updating, so
+ * the slab addresses are copied out when the child starts and the lists
+ * are never walked afterwards.
+ */
+typedef struct _qae_inherited_slabs {
+    qae_slab **slabs;
+    int slab_count;
+    unsigned char *arena_base;
+    size_t arena_len;
+    qae_large_region *large_regions;
+    int large_count;
+} qae_inherited_slabs;
+
 /* slab list containing full used slabs */
 static qae_slab_pool full_slab_list;
-/* array of slab lists containing empty slabs by slot size */
-static qae_slab_pool empty_slab_list[NUM_SLOT_SIZE];
-/* array of slab lists containing partially used slabs by slot size */
-static qae_slab_pool available_slab_list[NUM_SLOT_SIZE];
+/* array of slab lists containing empty slabs by node and slot size */
+static qae_slab_pool empty_slab_list[NUM_NODE_POOLS][NUM_SLOT_SIZE];
+/* array of slab lists containing partially used slabs by node and slot size */
+static qae_slab_pool available_slab_list[NUM_NODE_POOLS][NUM_SLOT_SIZE];
+
+/* thread specific node pool, stored as the pool index */
+static pthread_key_t crypto_node_key;
+static pthread_once_t crypto_node_once = PTHREAD_ONCE_INIT;
+static int crypto_node_key_valid = 0;
 
 /* init the head node of a linked list */
 static void init_pool(qae_slab_pool *list)
@@ -206,6 +341,20 @@ static qae_slab * get_node_from_head(qae_slab_pool *list)
     return ret;
 }
 
+/* fetch the tail node from a list */
+static qae_slab * get_node_from_tail(qae_slab_pool *list)
+{
+    qae_slab *ret = NULL;
+    if(list->slot_size <= 0)
+        return ret;
+    ret = list->prev;
+    ret->prev->next = (qae_slab *)list;
+    list->prev = ret->prev;
+    ret->next = ret->prev = NULL;
+    list->slot_size--;
+    return ret;
+}
+
 /* remove the node from a list */
 static unsigned int remove_node_from_list(qae_slab_pool *list, qae_slab *node)
 {
@@ -242,6 +391,530 @@ static void insert_node_at_head(qae_slab_pool *list, qae_slab *node)
 }
 
 static void crypto_init(void);
+static void crypto_free_slab(qae_slab *slb);
+
+/* monotonic time in ms, only used for the retention policy */
+static unsigned long crypto_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (unsigned long)ts.tv_sec * 1000UL +
+           (unsigned long)ts.tv_nsec / 1000000UL;
+}
+
+/* number of slabs of a size class holding allocated slots */
+static inline int crypto_live_slabs(int pool_index)
+{
+    int n, live = crypto_class_stats[pool_index].full_slabs;
+
+    for (n = 0; n < NUM_NODE_POOLS; n++)
+        live += available_slab_list[n][pool_index].slot_size;
+    return live;
+}
+
+/* number of empty slabs of a size class */
+static inline int crypto_empty_slabs(int pool_index)
+{
+    int n, empty = 0;
+
+    for (n = 0; n < NUM_NODE_POOLS; n++)
+        empty += empty_slab_list[n][pool_index].slot_size;
+    return empty;
+}
+
+static void crypto_node_key_init(void)
+{
+    int rc;
+
+    if ((rc = pthread_key_create(&crypto_node_key, NULL)) != 0) {
+        MEM_WARN("pthread_key_create: %s\n", strerror(rc));
+        return;
+    }
+    crypto_node_key_valid = 1;
+}
+
+/* node pool the calling thread allocates from */
+static inline int crypto_thread_node_pool(void)
+{
+    if (!crypto_node_key_valid)
+        return NODE_POOL_ANY;
+    return (int)(intptr_t)pthread_getspecific(crypto_node_key);
+}
+
+/* record the number of live slabs of a size class after it has grown */
+static inline void crypto_update_peak(int pool_index)
+{
+    qae_slab_class_stats *st = &crypto_class_stats[pool_index];
+    int live = crypto_live_slabs(pool_index);
+
+    if (live > st->window_peak_live)
+        st->window_peak_live = live;
+    if (live > st->peak_live_slabs)
+        st->peak_live_slabs = live;
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_trim_empty_slabs(void)
+ *
+ * @description
+ *      release the empty slabs that are not needed to get back to the peak
+ *      demand of the retention period which has just ended. The least
+ *      recently used slabs, at the tail of the empty lists, are released
+ *      first. Does nothing until a full retention period has elapsed since
+ *      the last trim. Must be called with crypto_bsal held.
+ *
+ *****************************************************************************/
+static void crypto_trim_empty_slabs(void)
+{
+    qae_slab_class_stats *st = NULL;
+    qae_slab *slb = NULL;
+    unsigned long now = crypto_now_ms();
+    unsigned long elapsed = now - crypto_last_trim;
+    int i, n, live, keep, empty, floor;
+
+    if (elapsed < crypto_retention_ms)
+        return;
+    crypto_last_trim = now;
+
+    for (i = 0; i < NUM_SLOT_SIZE; i++) {
+        st = &crypto_class_stats[i];
+        live = crypto_live_slabs(i);
+        keep = st->window_peak_live - live;
+
+        /*
+         * the node pools go first, a preallocated pool keeps its
+         * preallocated slabs
+         */
+        empty = crypto_empty_slabs(i);
+        for (n = NUM_NODE_POOLS - 1; n >= 0 && empty > keep; n--) {
+            floor = crypto_prealloc_pools[n] ? crypto_prealloc_slabs[i] : 0;
+            while (empty > keep &&
+                   empty_slab_list[n][i].slot_size > floor &&
+                   (slb = get_node_from_tail(&empty_slab_list[n][i]))
+                   != NULL) {
+                crypto_free_slab(slb);
+                st->slabs_released++;
+                empty--;
+            }
+        }
+
+        st->alloc_rate = elapsed ? st->window_allocs * 1000UL / elapsed : 0;
+        st->window_allocs = 0;
+        st->window_peak_live = live;
+    }
+}
+
+/* check whether an address lies within the arena */
+static inline int crypto_arena_contains(const void *ptr)
+{
+    return crypto_arena_base != NULL &&
+           (const unsigned char *)ptr >= crypto_arena_base &&
+           (const unsigned char *)ptr < crypto_arena_base + crypto_arena_len;
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_arena_get_slab(void)
+ *
+ * @retval qae_slab*, a pointer to an unused arena slab or NULL if the arena
+ *                    does not exist or is exhausted.
+ *
+ * @description
+ *      take a slab out of the arena, must be called with crypto_bsal held
+ *
+ *****************************************************************************/
+static qae_slab *crypto_arena_get_slab(void)
+{
+    int i, word, bit, nwords;
+
+    if (crypto_arena_free_slabs <= 0)
+        return NULL;
+
+    nwords = ARENA_MAP_WORDS(crypto_arena_nslabs);
+    for (i = 0; i < nwords; i++) {
+        word = (crypto_arena_hint + i) % nwords;
+        if (crypto_arena_map[word] == ~0UL)
+            continue;
+        bit = __builtin_ctzl(~crypto_arena_map[word]);
+        crypto_arena_map[word] |= 1UL << bit;
+        crypto_arena_hint = word;
+        crypto_arena_free_slabs--;
+        return (qae_slab *)(crypto_arena_base +
+                            (word * ARENA_BITS_PER_WORD + bit) * SLAB_SIZE);
+    }
+    return NULL;
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_arena_put_slab(qae_slab *slb)
+ *
+ * @param[in] slb, pointer to a slab within the arena
+ *
+ * @description
+ *      give a slab back to the arena, must be called with crypto_bsal held
+ *
+ *****************************************************************************/
+static void crypto_arena_put_slab(qae_slab *slb)
+{
+    size_t idx = ((unsigned char *)slb - crypto_arena_base) / SLAB_SIZE;
+
+    crypto_arena_map[idx / ARENA_BITS_PER_WORD] &=
+        ~(1UL << (idx % ARENA_BITS_PER_WORD));
+    crypto_arena_free_slabs++;
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_arena_map_phys(void)
+ *
+ * @description
+ *      fill the physical address table from the chunk headers written by
+ *      the driver at the start of each arena slab
+ *
+ *****************************************************************************/
+static void crypto_arena_map_phys(void)
+{
+    int i;
+
+    for (i = 0; i < crypto_arena_nslabs; i++) {
+        crypto_arena_phys[i] = (CpaPhysicalAddr)
+            ((qat_contig_mem_config *)(crypto_arena_base +
+                                       (size_t)i * SLAB_SIZE))->physicalAddress;
+    }
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_arena_init(void)
+ *
+ * @description
+ *      reserve and map the arena if an arena size has been set. On any
+ *      failure the allocator carries on creating slabs individually.
+ *
+ *****************************************************************************/
+static void crypto_arena_init(void)
+{
+#ifdef USE_QAT_CONTIG_MEM
+    qat_contig_mem_config qmcfg = { 0, (uintptr_t) NULL, 0, (uintptr_t) NULL,
+                                    QAT_CONTIG_MEM_ANY_NODE };
+    unsigned char *base = NULL;
+    unsigned long *map = NULL;
+    CpaPhysicalAddr *phys = NULL;
+    int nslabs, nwords, i;
+
+    /*
+     * An arena inherited from the parent across a fork is simply forgotten,
+     * it stays mapped in the same way as the parent's individual slabs.
+     */
+    free(crypto_arena_map);
+    free(crypto_arena_phys);
+    crypto_arena_map = NULL;
+    crypto_arena_phys = NULL;
+    crypto_arena_base = NULL;
+    crypto_arena_len = 0;
+    crypto_arena_nslabs = 0;
+    crypto_arena_free_slabs = 0;
+    crypto_arena_hint = 0;
+
+    if (crypto_arena_size == 0)
+        return;
+
+    qmcfg.length = crypto_arena_size;
+    if (ioctl(crypto_qat_contig_memfd, QAT_CONTIG_MEM_ARENA_CREATE, &qmcfg)
+        == -1) {
+        MEM_WARN("%s: ioctl QAT_CONTIG_MEM_ARENA_CREATE(%d) failed: %s\n",
+                 __func__, qmcfg.length, strerror(errno));
+        return;
+    }
+
+    /*
+     * The length is doubled as for the slabs, the driver then trims the
+     * mapping down to the arena itself, which is what is unmapped later.
+     */
+    if ((base = mmap(NULL,
+                     (size_t)qmcfg.length * QAT_CONTIG_MEM_MMAP_ADJUSTMENT,
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED,
+                     crypto_qat_contig_memfd,
+                     QAT_CONTIG_MEM_ARENA_MMAP_OFFSET)) == MAP_FAILED) {
+        MEM_WARN("%s: mmap of arena failed: %s\n", __func__, strerror(errno));
+        goto err;
+    }
+
+    nslabs = qmcfg.length / SLAB_SIZE;
+    nwords = ARENA_MAP_WORDS(nslabs);
+    map = calloc(nwords, sizeof(unsigned long));
+    phys = malloc(nslabs * sizeof(CpaPhysicalAddr));
+    if (map == NULL || phys == NULL) {
+        MEM_WARN("%s: failed to allocate arena tables\n", __func__);
+        goto err;
+    }
+
+    /* mark the bits past the end of the arena as permanently in use */
+    for (i = nslabs; i < nwords * ARENA_BITS_PER_WORD; i++)
+        map[i / ARENA_BITS_PER_WORD] |= 1UL << (i % ARENA_BITS_PER_WORD);
+
+    crypto_arena_base = base;
+    crypto_arena_len = (size_t)qmcfg.length;
+    crypto_arena_nslabs = nslabs;
+    crypto_arena_free_slabs = nslabs;
+    crypto_arena_map = map;
+    crypto_arena_phys = phys;
+    crypto_arena_map_phys();
+    MEM_DEBUG("%s: arena of %d slabs mapped at %p\n", __func__, nslabs, base);
+    return;
+
+ err:
+    free(map);
+    free(phys);
+    if (base != NULL && base != MAP_FAILED)
+        munmap(base, (size_t)qmcfg.length);
+    if (ioctl(crypto_qat_contig_memfd, QAT_CONTIG_MEM_ARENA_FREE, &qmcfg)
+        == -1)
+        perror("ioctl QAT_CONTIG_MEM_ARENA_FREE");
+#endif
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_fork_arena(void)
+ *
+ * @description
+ *      give the calling process an arena of its own following a fork. A new
+ *      arena is created on a new file descriptor, the contents of the slabs
+ *      in use are copied over and the new arena is remapped at the address
+ *      of the old one so that existing pointers remain valid.
+ *
+ *****************************************************************************/
+static void crypto_fork_arena(void)
+{
+#ifdef USE_QAT_CONTIG_MEM
+    int fd = FD_ERROR;
+    int i, rc;
+    unsigned char *new_base = NULL;
+    unsigned char *remap = NULL;
+    qat_contig_mem_config qmcfg = { 0, (uintptr_t) NULL, 0, (uintptr_t) NULL,
+                                    QAT_CONTIG_MEM_ANY_NODE };
+
+    if (crypto_arena_base == NULL)
+        return;
+
+    if ((rc = pthread_mutex_lock(&crypto_bsal)) != 0) {
+        MEM_ERROR("pthread_mutex_lock: %s\n", strerror(rc));
+        return;
+    }
+
+    /* The arena belongs to the open file, so the child needs its own */
+    if ((fd = open("/dev/qat_contig_mem", O_RDWR)) == FD_ERROR) {
+        perror("open qat_contig_mem");
+        exit(EXIT_FAILURE);
+    }
+
+    qmcfg.length = crypto_arena_len;
+    if (ioctl(fd, QAT_CONTIG_MEM_ARENA_CREATE, &qmcfg) == -1) {
+        perror("ioctl QAT_CONTIG_MEM_ARENA_CREATE");
+        exit(EXIT_FAILURE);
+    }
+
+    if ((new_base = mmap(NULL,
+                         (size_t)qmcfg.length * QAT_CONTIG_MEM_MMAP_ADJUSTMENT,
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, fd,
+                         QAT_CONTIG_MEM_ARENA_MMAP_OFFSET)) == MAP_FAILED) {
+        static char errmsg[LINE_MAX];
+        snprintf(errmsg, LINE_MAX, "mmap: %d %s", errno, strerror(errno));
+        perror(errmsg);
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < crypto_arena_nslabs; i++) {
+        if (!(crypto_arena_map[i / ARENA_BITS_PER_WORD] &
+              (1UL << (i % ARENA_BITS_PER_WORD))))
+            continue;
+        memcpy(new_base + (size_t)i * SLAB_SIZE +
+               sizeof(qat_contig_mem_config),
+               crypto_arena_base + (size_t)i * SLAB_SIZE +
+               sizeof(qat_contig_mem_config),
+               SLAB_SIZE - sizeof(qat_contig_mem_config));
+    }
+
+    if (munmap(crypto_arena_base, crypto_arena_len) == -1) {
+        perror("munmap");
+        exit(EXIT_FAILURE);
+    }
+    remap = mremap(new_base, crypto_arena_len, crypto_arena_len,
+                   MREMAP_FIXED | MREMAP_MAYMOVE, crypto_arena_base);
+    if ((remap == MAP_FAILED) || (remap != crypto_arena_base)) {
+        perror("mremap");
+        exit(EXIT_FAILURE);
+    }
+    crypto_arena_map_phys();
+
+    close(crypto_qat_contig_memfd);
+    crypto_qat_contig_memfd = fd;
+
+    if ((rc = pthread_mutex_unlock(&crypto_bsal)) != 0)
+        MEM_ERROR("pthread_mutex_unlock: %s\n", strerror(rc));
+#endif
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_collect_slab_list(qae_inherited_slabs *inh,
+ *                                  qae_slab_pool *list)
+ *
+ * @param[in] inh, the slabs inherited from the parent
+ * @param[in] list, one of the inherited slab lists
+ *
+ * @description
+ *      record the slabs of an inherited list to be unmapped. Slabs belonging
+ *      to the arena are left to be unmapped with the arena.
+ *
+ *****************************************************************************/
+static void crypto_collect_slab_list(qae_inherited_slabs *inh,
+                                     qae_slab_pool *list)
+{
+    qae_slab *slb = list->next;
+    int count;
+
+    for (count = 0; count < list->slot_size; count++, slb = slb->next) {
+        if (inh->arena_base != NULL &&
+            (unsigned char *)slb >= inh->arena_base &&
+            (unsigned char *)slb < inh->arena_base + inh->arena_len)
+            continue;
+        inh->slabs[inh->slab_count++] = slb;
+    }
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_unmap_inherited(void *arg)
+ *
+ * @param[in] arg, the qae_inherited_slabs to release
+ *
+ * @description
+ *      thread routine unmapping everything inherited from the parent
+ *
+ *****************************************************************************/
+static void *crypto_unmap_inherited(void *arg)
+{
+    qae_inherited_slabs *inh = (qae_inherited_slabs *)arg;
+    int i;
+
+    for (i = 0; i < inh->slab_count; i++) {
+        if (munmap(inh->slabs[i], SLAB_SIZE) == -1)
+            MEM_WARN("%s: munmap of %p failed: %s\n", __func__,
+                     inh->slabs[i], strerror(errno));
+    }
+    free(inh->slabs);
+    for (i = 0; i < inh->large_count; i++) {
+        if (munmap(inh->large_regions[i].base,
+                   inh->large_regions[i].len) == -1)
+            MEM_WARN("%s: munmap of %p failed: %s\n", __func__,
+                     inh->large_regions[i].base, strerror(errno));
+    }
+    free(inh->large_regions);
+    if (inh->arena_base != NULL &&
+        munmap(inh->arena_base, inh->arena_len) == -1)
+        MEM_WARN("%s: munmap of arena failed: %s\n", __func__,
+                 strerror(errno));
+    MEM_DEBUG("%s: inherited slabs unmapped\n", __func__);
+    free(inh);
+    return NULL;
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_discard_inherited(void)
+ *
+ * @description
+ *      start the child of a fork with empty pools, handing the slabs
+ *      inherited from the parent to a detached thread to be unmapped
+ *
+ *****************************************************************************/
+static void crypto_discard_inherited(void)
+{
+    qae_inherited_slabs *inh = NULL;
+    int count, i, n;
+    pthread_attr_t attr;
+    pthread_t tid;
+
+    count = full_slab_list.slot_size;
+    for (n = 0; n < NUM_NODE_POOLS; n++) {
+        for (i = 0; i < NUM_SLOT_SIZE; i++)
+            count += empty_slab_list[n][i].slot_size +
+                     available_slab_list[n][i].slot_size;
+    }
+
+    inh = malloc(sizeof(qae_inherited_slabs));
+    if (inh != NULL &&
+        (inh->slabs = malloc((count + 1) * sizeof(qae_slab *))) == NULL) {
+        free(inh);
+        inh = NULL;
+    }
+    if (inh != NULL) {
+        inh->slab_count = 0;
+        inh->arena_base = crypto_arena_base;
+        inh->arena_len = crypto_arena_len;
+        crypto_collect_slab_list(inh, &full_slab_list);
+        for (n = 0; n < NUM_NODE_POOLS; n++) {
+            for (i = 0; i < NUM_SLOT_SIZE; i++) {
+                crypto_collect_slab_list(inh, &empty_slab_list[n][i]);
+                crypto_collect_slab_list(inh, &available_slab_list[n][i]);
+            }
+        }
+        inh->large_regions = crypto_large_regions;
+        inh->large_count = crypto_large_count;
+        crypto_large_regions = NULL;
+        crypto_large_count = 0;
+        crypto_large_capacity = 0;
+        crypto_large_min = NULL;
+        crypto_large_max = NULL;
+    } else {
+        MEM_WARN("%s: inherited slabs left mapped\n", __func__);
+    }
+
+#ifdef USE_QAT_CONTIG_MEM
+    /*
+     * The parent's allocations belong to the inherited file so they must not
+     * be freed through it, only our reference to the file is dropped.
+     */
+    if (crypto_qat_contig_memfd != FD_ERROR) {
+        close(crypto_qat_contig_memfd);
+        crypto_qat_contig_memfd = FD_ERROR;
+    }
+#endif
+    crypto_init();
+
+    if (inh == NULL)
+        return;
+
+    if (pthread_attr_init(&attr) != 0 ||
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0 ||
+        pthread_create(&tid, &attr, crypto_unmap_inherited, inh) != 0) {
+        MEM_WARN("%s: unmapping inherited slabs synchronously\n", __func__);
+        crypto_unmap_inherited(inh);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_init_child(void)
+ *
+ * @description
+ *      initialise the allocator in the child of a fork that did not call
+ *      qaeCryptoAtFork()
+ *
+ *****************************************************************************/
+static void crypto_init_child(void)
+{
+    if (crypto_lazy_fork)
+        crypto_discard_inherited();
+    else
+        crypto_init();
+}
 
 /******************************************************************************
 * function:
@@ -328,11 +1001,12 @@ void copyFreePinnedMemory(void *uptr, void *kptr, int size)
 
 /*****************************************************************************
  * function:
- *         crypto_create_slab(int size, int pool_index)
+ *         crypto_create_slab(int size, int pool_index, int node_pool)
  *
  * @param[in] size, the size of the slots within the slab. Note that this is
  *                  not the size of the slab itself
  * @param[in] pool_index, the index of the slot pool
+ * @param[in] node_pool, the index of the NUMA node pool
  * @retval qae_slab*, a pointer to the new slab.
  *
  * @description
@@ -340,27 +1014,34 @@ void copyFreePinnedMemory(void *uptr, void *kptr, int size)
  *      retval pointer to the new slab
  *
  *****************************************************************************/
-static qae_slab *crypto_create_slab(int size, int pool_index)
+static qae_slab *crypto_create_slab(int size, int pool_index, int node_pool)
 {
     int i = 0;
     int nslot = 0;
-    qat_contig_mem_config qmcfg = { 0, (uintptr_t) NULL, 0, (uintptr_t) NULL };
+    qat_contig_mem_config qmcfg = { 0, (uintptr_t) NULL, 0, (uintptr_t) NULL,
+                                    QAT_CONTIG_MEM_ANY_NODE };
     qae_slab *result = NULL;
     qae_slab *slb = NULL;
     qae_slot *slt = NULL;
     QAE_UINT alignment;
 
     qmcfg.length = SLAB_SIZE;
+    qmcfg.node = node_pool - 1;
+    /* the arena is not tied to a node */
+    if (node_pool == NODE_POOL_ANY)
+        slb = crypto_arena_get_slab();
 #ifdef USE_QAT_CONTIG_MEM
-    if (ioctl(crypto_qat_contig_memfd, QAT_CONTIG_MEM_MALLOC, &qmcfg) == -1) {
+    if (slb != NULL) {
+        MEM_DEBUG("%s slab %p taken from arena\n", __func__, slb);
+    } else if (ioctl(crypto_qat_contig_memfd, QAT_CONTIG_MEM_MALLOC, &qmcfg)
+               == -1) {
         static char errmsg[LINE_MAX];
 
         snprintf(errmsg, LINE_MAX, "ioctl QAT_CONTIG_MEM_MALLOC(%d)",
                  qmcfg.length);
         perror(errmsg);
         goto exit;
-    }
-    if ((slb =
+    } else if ((slb =
          mmap(NULL, qmcfg.length*QAT_CONTIG_MEM_MMAP_ADJUSTMENT,
               PROT_READ | PROT_WRITE,
               MAP_SHARED | MAP_LOCKED, crypto_qat_contig_memfd,
@@ -377,6 +1058,7 @@ static qae_slab *crypto_create_slab(int size, int pool_index)
     slb->sig = SIG_ALLOC;
     slb->used_slots = 0;
     slb->pid = getpid();
+    slb->node_pool = node_pool;
 
     for (i = sizeof(qae_slab); SLAB_SIZE - i >= size; i += size) {
         slt = (qae_slot *) ((unsigned char *)slb + i);
@@ -393,44 +1075,363 @@ static qae_slab *crypto_create_slab(int size, int pool_index)
         nslot++;
         slt->slab = slb;
     }
-    slb->total_slots = nslot;
-    /*
-     * Make sure the update of the slab list is the last thing to be done.
-     * This means it is not necessary to lock against anyone iterating the
-     * list from the head
-     */
+    slb->total_slots = nslot;
+    crypto_class_stats[pool_index].slabs_created++;
+    /*
+     * Make sure the update of the slab list is the last thing to be done.
+     * This means it is not necessary to lock against anyone iterating the
+     * list from the head
+     */
+
+    result = slb;
+    MEM_DEBUG("%s slab %p last slot is %p, count is %d\n", __func__, slb, slt,
+          nslot);
+ exit:
+    return result;
+}
+
+
+/*****************************************************************************
+ * function:
+ *         crypto_get_empty_slab(int size, int pool_index, int node_pool)
+ *
+ * @param[in] size, the size of the slots within the slab. Note that this is
+ *                  not the size of the slab itself
+ * @param[in] pool_index, index of slot pools
+ * @param[in] node_pool, index of the NUMA node pool
+ * @retval qae_slab*, a pointer to the new slab.
+ *
+ * @description
+ *     request a slab from the empty slab list, if empty slab list has no slab
+ *     available, then create a new slab
+ *     retval pointer to the new slab
+ *
+ ******************************************************************************/
+static qae_slab *crypto_get_empty_slab(int size, int pool_index,
+                                       int node_pool)
+{
+    qae_slab *result = NULL;
+    result = get_node_from_head(&empty_slab_list[node_pool][pool_index]);
+    if(result == NULL) {
+        result = crypto_create_slab(size, pool_index, node_pool);
+    }
+    return result;
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_large_find(const void *ptr)
+ *
+ * @param[in] ptr, address to look up
+ * @retval int, index of the region containing ptr, -1 if there is none
+ *
+ * @description
+ *      binary search of the large region table. Must be called with
+ *      crypto_large_lock held.
+ *
+ *****************************************************************************/
+static int crypto_large_find(const void *ptr)
+{
+    const unsigned char *p = (const unsigned char *)ptr;
+    int lo = 0;
+    int hi = crypto_large_count - 1;
+    int mid;
+
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (p < crypto_large_regions[mid].base)
+            hi = mid - 1;
+        else if (p >= crypto_large_regions[mid].base +
+                      crypto_large_regions[mid].len)
+            lo = mid + 1;
+        else
+            return mid;
+    }
+    return -1;
+}
+
+/* recompute the address bounds of the table, crypto_large_lock held */
+static void crypto_large_update_bounds(void)
+{
+    qae_large_region *last = NULL;
+
+    if (crypto_large_count == 0) {
+        crypto_large_min = NULL;
+        crypto_large_max = NULL;
+        return;
+    }
+    last = &crypto_large_regions[crypto_large_count - 1];
+    crypto_large_min = crypto_large_regions[0].base;
+    crypto_large_max = last->base + last->len;
+}
+
+/* add a region to the table keeping it sorted, 1 on success */
+static int crypto_large_insert(unsigned char *base, size_t len,
+                               CpaPhysicalAddr phys)
+{
+    qae_large_region *regions = NULL;
+    int i, rc, ret = 0;
+
+    if ((rc = pthread_rwlock_wrlock(&crypto_large_lock)) != 0) {
+        MEM_ERROR("pthread_rwlock_wrlock: %s\n", strerror(rc));
+        return 0;
+    }
+
+    if (crypto_large_count == crypto_large_capacity) {
+        regions = realloc(crypto_large_regions,
+                          (crypto_large_capacity + 16) *
+                          sizeof(qae_large_region));
+        if (regions == NULL)
+            goto exit;
+        crypto_large_regions = regions;
+        crypto_large_capacity += 16;
+    }
+
+    for (i = crypto_large_count;
+         i > 0 && crypto_large_regions[i - 1].base > base; i--)
+        crypto_large_regions[i] = crypto_large_regions[i - 1];
+    crypto_large_regions[i].base = base;
+    crypto_large_regions[i].len = len;
+    crypto_large_regions[i].phys = phys;
+    crypto_large_count++;
+    crypto_large_update_bounds();
+    ret = 1;
+
+ exit:
+    if ((rc = pthread_rwlock_unlock(&crypto_large_lock)) != 0)
+        MEM_ERROR("pthread_rwlock_unlock: %s\n", strerror(rc));
+    return ret;
+}
+
+/* remove the region starting at base from the table */
+static void crypto_large_remove(unsigned char *base)
+{
+    int i, rc;
+
+    if ((rc = pthread_rwlock_wrlock(&crypto_large_lock)) != 0) {
+        MEM_ERROR("pthread_rwlock_wrlock: %s\n", strerror(rc));
+        return;
+    }
+    if ((i = crypto_large_find(base)) >= 0) {
+        memmove(&crypto_large_regions[i], &crypto_large_regions[i + 1],
+                (crypto_large_count - i - 1) * sizeof(qae_large_region));
+        crypto_large_count--;
+        crypto_large_update_bounds();
+    }
+    if ((rc = pthread_rwlock_unlock(&crypto_large_lock)) != 0)
+        MEM_ERROR("pthread_rwlock_unlock: %s\n", strerror(rc));
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_large_v2p(void *v, CpaPhysicalAddr *phys)
+ *
+ * @param[in] v, virtual address to translate
+ * @param[out] phys, the physical address of v
+ * @retval int, 1 if v lies within a large region, 0 otherwise
+ *
+ * @description
+ *      translate an address of a large allocation
+ *
+ *****************************************************************************/
+static int crypto_large_v2p(void *v, CpaPhysicalAddr *phys)
+{
+    int i, rc, found = 0;
+
+    /* cheap bounds check so that slab memory does not take the lock */
+    if (crypto_large_count == 0 ||
+        (unsigned char *)v < crypto_large_min ||
+        (unsigned char *)v >= crypto_large_max)
+        return 0;
+
+    if ((rc = pthread_rwlock_rdlock(&crypto_large_lock)) != 0) {
+        MEM_ERROR("pthread_rwlock_rdlock: %s\n", strerror(rc));
+        return 0;
+    }
+    if ((i = crypto_large_find(v)) >= 0) {
+        *phys = crypto_large_regions[i].phys +
+                (CpaPhysicalAddr)((unsigned char *)v -
+                                  crypto_large_regions[i].base);
+        found = 1;
+    }
+    if ((rc = pthread_rwlock_unlock(&crypto_large_lock)) != 0)
+        MEM_ERROR("pthread_rwlock_unlock: %s\n", strerror(rc));
+    return found;
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_alloc_large(size_t size, const char *file, int line)
+ *
+ * @param[in] size, the size of the memory block required
+ * @param[in] file, the C source filename of the call site
+ * @param[in] line, the line number within the C source file of the call site
+ *
+ * @description
+ *      allocate a block too large for a slab in a region of its own
+ *      retval pointer to the allocated block
+ *
+ *****************************************************************************/
+static void *crypto_alloc_large(size_t size, const char *file, int line)
+{
+    qat_contig_mem_config qmcfg = { 0, (uintptr_t) NULL, 0, (uintptr_t) NULL,
+                                    QAT_CONTIG_MEM_ANY_NODE };
+    unsigned char *base = NULL;
+    qae_slot *slt = NULL;
+    size_t len = PAGE_SIZE;
+    int n = crypto_thread_node_pool();
+
+    while (len < size + LARGE_HDR_SIZE)
+        len <<= 1;
+    if (len > QAT_CONTIG_MEM_MAX_ALLOC) {
+        MEM_ERROR("%s Allocation of %zu bytes is too big\n", __func__, size);
+        return NULL;
+    }
+
+#ifdef USE_QAT_CONTIG_MEM
+    qmcfg.length = len;
+    qmcfg.node = n - 1;
+    if (ioctl(crypto_qat_contig_memfd, QAT_CONTIG_MEM_MALLOC, &qmcfg) == -1) {
+        static char errmsg[LINE_MAX];
+
+        snprintf(errmsg, LINE_MAX, "ioctl QAT_CONTIG_MEM_MALLOC(%d)",
+                 qmcfg.length);
+        perror(errmsg);
+        return NULL;
+    }
+    if ((base = mmap(NULL, len * QAT_CONTIG_MEM_MMAP_ADJUSTMENT,
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED,
+                     crypto_qat_contig_memfd,
+                     qmcfg.virtualAddress)) == MAP_FAILED) {
+        static char errmsg[LINE_MAX];
+        snprintf(errmsg, LINE_MAX, "mmap: %d %s", errno, strerror(errno));
+        perror(errmsg);
+        if (ioctl(crypto_qat_contig_memfd, QAT_CONTIG_MEM_FREE, &qmcfg) == -1)
+            perror("ioctl QAT_CONTIG_MEM_FREE");
+        return NULL;
+    }
+#endif
+    if (base == NULL)
+        return NULL;
+
+    if (!crypto_large_insert(base, len, (CpaPhysicalAddr)qmcfg.physicalAddress)) {
+        MEM_ERROR("%s failed to record region %p\n", __func__, base);
+#ifdef USE_QAT_CONTIG_MEM
+        munmap(base, len);
+        if (ioctl(crypto_qat_contig_memfd, QAT_CONTIG_MEM_FREE, &qmcfg) == -1)
+            perror("ioctl QAT_CONTIG_MEM_FREE");
+#endif
+        return NULL;
+    }
+
+    slt = (qae_slot *)(base + LARGE_HDR_SIZE - sizeof(qae_slot));
+    slt->next = NULL;
+    slt->sig = SIG_ALLOC;
+    slt->pool_index = LARGE_POOL_INDEX;
+    slt->slab = NULL;
+    slt->file = strdup(file);
+    slt->line = line;
+    MEM_DEBUG("%s region %p of %zu bytes for %zu bytes\n", __func__, base,
+              len, size);
+    return base + LARGE_HDR_SIZE;
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_free_large(qae_slot *slt)
+ *
+ * @param[in] slt, the slot header of the large allocation
+ *
+ * @description
+ *      give the region of a large allocation back to the kernel
+ *
+ *****************************************************************************/
+static void crypto_free_large(qae_slot *slt)
+{
+    unsigned char *base = (unsigned char *)slt + sizeof(qae_slot) -
+                          LARGE_HDR_SIZE;
+    qat_contig_mem_config qmcfg = *((qat_contig_mem_config *)base);
+
+    if (slt->sig != SIG_ALLOC) {
+        MEM_ERROR("%s error trying to free slot that hasn't been alloc'd %p\n",
+                  __func__, slt);
+        return;
+    }
+    slt->sig = SIG_FREE;
+    free(slt->file);
 
-    result = slb;
-    MEM_DEBUG("%s slab %p last slot is %p, count is %d\n", __func__, slb, slt,
-          nslot);
- exit:
-    return result;
+    crypto_large_remove(base);
+#ifdef USE_QAT_CONTIG_MEM
+    MEM_DEBUG("%s do munmap of %p\n", __func__, base);
+    if (munmap(base, qmcfg.length) == -1) {
+        perror("munmap");
+        exit(EXIT_FAILURE);
+    }
+    if (ioctl(crypto_qat_contig_memfd, QAT_CONTIG_MEM_FREE, &qmcfg) == -1) {
+        perror("ioctl QAT_CONTIG_MEM_FREE");
+        exit(EXIT_FAILURE);
+    }
+#endif
 }
 
-
 /*****************************************************************************
  * function:
- *         crypto_get_empty_slab(int size, int pool_index)
- *
- * @param[in] size, the size of the slots within the slab. Note that this is
- *                  not the size of the slab itself
- * @param[in] pool_index, index of slot pools
- * @retval qae_slab*, a pointer to the new slab.
+ *         fork_large_regions(void)
  *
  * @description
- *     request a slab from the empty slab list, if empty slab list has no slab
- *     available, then create a new slab
- *     retval pointer to the new slab
+ *      allocate and remap the large regions following a fork
  *
- ******************************************************************************/
-static qae_slab *crypto_get_empty_slab(int size, int pool_index)
+ *****************************************************************************/
+static void fork_large_regions(void)
 {
-    qae_slab *result = NULL;
-    result = get_node_from_head(&empty_slab_list[pool_index]);
-    if(result == NULL) {
-        result = crypto_create_slab(size,pool_index);
+#ifdef USE_QAT_CONTIG_MEM
+    qat_contig_mem_config qmcfg;
+    qae_large_region *region = NULL;
+    unsigned char *new_base = NULL;
+    unsigned char *remap = NULL;
+    int i, rc;
+
+    if ((rc = pthread_rwlock_wrlock(&crypto_large_lock)) != 0) {
+        MEM_ERROR("pthread_rwlock_wrlock: %s\n", strerror(rc));
+        return;
     }
-    return result;
+
+    for (i = 0; i < crypto_large_count; i++) {
+        region = &crypto_large_regions[i];
+        qmcfg = *((qat_contig_mem_config *)region->base);
+        if (ioctl(crypto_qat_contig_memfd, QAT_CONTIG_MEM_MALLOC, &qmcfg)
+            == -1) {
+            perror("ioctl QAT_CONTIG_MEM_MALLOC");
+            exit(EXIT_FAILURE);
+        }
+        if ((new_base = mmap(NULL, region->len * QAT_CONTIG_MEM_MMAP_ADJUSTMENT,
+                             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED,
+                             crypto_qat_contig_memfd,
+                             qmcfg.virtualAddress)) == MAP_FAILED) {
+            static char errmsg[LINE_MAX];
+            snprintf(errmsg, LINE_MAX, "mmap: %d %s", errno, strerror(errno));
+            perror(errmsg);
+            exit(EXIT_FAILURE);
+        }
+        memcpy(new_base + sizeof(qat_contig_mem_config),
+               region->base + sizeof(qat_contig_mem_config),
+               region->len - sizeof(qat_contig_mem_config));
+        if (munmap(region->base, region->len) == -1) {
+            perror("munmap");
+            exit(EXIT_FAILURE);
+        }
+        remap = mremap(new_base, region->len, region->len,
+                       MREMAP_FIXED | MREMAP_MAYMOVE, region->base);
+        if ((remap == MAP_FAILED) || (remap != region->base)) {
+            perror("mremap");
+            exit(EXIT_FAILURE);
+        }
+        region->phys = (CpaPhysicalAddr)qmcfg.physicalAddress;
+    }
+
+    if ((rc = pthread_rwlock_unlock(&crypto_large_lock)) != 0)
+        MEM_ERROR("pthread_rwlock_unlock: %s\n", strerror(rc));
+#endif
 }
 
 /*****************************************************************************
@@ -452,12 +1453,20 @@ static void *crypto_alloc_from_slab(int size, const char *file, int line)
     qae_slot *slt;
     int slot_size;
     void *result = NULL;
+    qae_slab_pool *available = NULL;
     int rc;
     int i;
+    int n = crypto_thread_node_pool();
 
     if (!crypto_inited)
         crypto_init();
 
+    if (size + sizeof(qae_slot) + QAE_BYTE_ALIGNMENT > MAX_ALLOC) {
+        if (full_slab_list.pid != getpid())
+            crypto_init_child();
+        return crypto_alloc_large(size, file, line);
+    }
+
     size += sizeof(qae_slot);
     size += QAE_BYTE_ALIGNMENT;
 
@@ -479,8 +1488,9 @@ static void *crypto_alloc_from_slab(int size, const char *file, int line)
         }
     }
 
-    if (available_slab_list[i].pid != getpid())
-        crypto_init();
+    available = &available_slab_list[n][i];
+    if (available->pid != getpid())
+        crypto_init_child();
 
     MEM_DEBUG("%s: pthread_mutex_lock\n", __func__);
     if ((rc = pthread_mutex_lock(&crypto_bsal)) != 0) {
@@ -488,11 +1498,11 @@ static void *crypto_alloc_from_slab(int size, const char *file, int line)
         return result;
     }
 
-    if(available_slab_list[i].slot_size > 0) {
-        slt = available_slab_list[i].next->next_slot;
+    if(available->slot_size > 0) {
+        slt = available->next->next_slot;
     } else {
         /* no free slots need to allocate new slab */
-        slb = crypto_get_empty_slab(slot_size, i);
+        slb = crypto_get_empty_slab(slot_size, i, n);
 
         if (NULL == slb) {
             MEM_ERROR("%s error, create_slab failed - memory allocation error\n",
@@ -505,7 +1515,8 @@ static void *crypto_alloc_from_slab(int size, const char *file, int line)
         /*allocate a new slab, add it into the available slab list*/
         slt = slb->next_slot;
         slb->list_index = IN_AVAILABLE_LIST;
-        insert_node_at_head(&available_slab_list[i],slb);
+        insert_node_at_head(available,slb);
+        crypto_update_peak(i);
     }
 
     slb = slt->slab;
@@ -520,15 +1531,18 @@ static void *crypto_alloc_from_slab(int size, const char *file, int line)
 
    /* increase the reference couter */
     slb->used_slots++;
+    crypto_class_stats[i].allocs++;
+    crypto_class_stats[i].window_allocs++;
     /* get the available slot from the head of available slab list */
     slb->next_slot = slt->next;
     slt->next = NULL;
     /* if current slab has no slot available, remove the slab from
      * available slab list and add it to the full slab list */
     if(slb->used_slots >= slb->total_slots) {
-        remove_node_from_list(&available_slab_list[i],slb);
+        remove_node_from_list(available,slb);
         insert_node_at_end(&full_slab_list,slb);
         slb->list_index = IN_FULL_LIST;
+        crypto_class_stats[i].full_slabs++;
     }
 
     result = (void *)((unsigned char *)slt + sizeof(qae_slot));
@@ -555,6 +1569,12 @@ static void crypto_free_slab(qae_slab *slb)
 {
     qat_contig_mem_config qmcfg;
 
+    if (crypto_arena_contains(slb)) {
+        MEM_DEBUG("%s return %p to arena\n", __func__, slb);
+        crypto_arena_put_slab(slb);
+        return;
+    }
+
 #ifdef USE_QAT_CONTIG_MEM
     MEM_DEBUG("%s do munmap  of %p\n", __func__, slb);
     qmcfg = *((qat_contig_mem_config *) slb);
@@ -589,8 +1609,14 @@ static void crypto_free_to_slab(void *ptr)
         goto exit;
     }
 
+    if (slt->pool_index == LARGE_POOL_INDEX) {
+        crypto_free_large(slt);
+        return;
+    }
+
     qae_slab *slb = slt->slab;
     int i = slt->pool_index;
+    int n = slb->node_pool;
     int rc;
 
     if ((rc = pthread_mutex_lock(&crypto_bsal)) != 0) {
@@ -615,26 +1641,29 @@ static void crypto_free_to_slab(void *ptr)
     slb->next_slot = slt;
     /* decrease the reference count */
     slb->used_slots--;
+    crypto_class_stats[i].frees++;
     /* if the used_slots is 0, this slab is empty, it should be
      * processed properly */
     if(slb->used_slots == 0) {
         /* remove this slab from the slab list */
         switch(slb->list_index) {
             case IN_AVAILABLE_LIST:
-                remove_node_from_list(&available_slab_list[i],slb);
+                remove_node_from_list(&available_slab_list[n][i],slb);
                 break;
             case IN_FULL_LIST:
                 remove_node_from_list(&full_slab_list,slb);
+                crypto_class_stats[i].full_slabs--;
                 break;
             default:
                 break;
         }
         /* free slab or assign it to the head of the empty slab list */
-        if(empty_slab_list[i].slot_size >= MAX_EMPTY_SLAB) {
+        if(empty_slab_list[n][i].slot_size >= MAX_EMPTY_SLAB) {
             crypto_free_slab(slb);
+            crypto_class_stats[i].slabs_released++;
             slb = NULL;
         } else {
-            insert_node_at_head(&empty_slab_list[i],slb);
+            insert_node_at_head(&empty_slab_list[n][i],slb);
             slb->list_index = IN_EMPTY_LIST;
         }
     } else {
@@ -644,14 +1673,17 @@ static void crypto_free_to_slab(void *ptr)
         switch(slb->list_index) {
             case IN_FULL_LIST:
                 remove_node_from_list(&full_slab_list,slb);
-                insert_node_at_end(&available_slab_list[i],slb);
+                insert_node_at_end(&available_slab_list[n][i],slb);
                 slt->slab->list_index = IN_AVAILABLE_LIST;
+                crypto_class_stats[i].full_slabs--;
                 break;
             default:
                 break;
         }
     }
 
+    crypto_trim_empty_slabs();
+
  exit:
     if ((rc = pthread_mutex_unlock(&crypto_bsal)) != 0)
         MEM_ERROR("pthread_mutex_unlock: %s\n", strerror(rc));
@@ -676,7 +1708,11 @@ static int crypto_slot_get_size(void *ptr)
         return 0;
     }
     qae_slot *slt = (void *)((unsigned char *)ptr - sizeof(qae_slot));
-    if (slt->pool_index == (NUM_SLOT_SIZE - 1)) {
+    if (slt->pool_index == LARGE_POOL_INDEX) {
+        return ((qat_contig_mem_config *)((unsigned char *)ptr -
+                                          LARGE_HDR_SIZE))->length -
+               LARGE_HDR_SIZE;
+    } else if (slt->pool_index == (NUM_SLOT_SIZE - 1)) {
         return MAX_ALLOC;
     } else if (slt->pool_index >= 0 && slt->pool_index <= NUM_SLOT_SIZE - 2) {
         return slot_sizes_available[slt->pool_index] - sizeof(qae_slot) -
@@ -708,10 +1744,18 @@ void fork_slab_list(qae_slab_pool * list)
     qae_slab *old_slb = list->next;
     qae_slab *new_slb = NULL;
     qat_contig_mem_config qmcfg =
-        { 0, (uintptr_t) NULL, SLAB_SIZE, (uintptr_t) NULL };
+        { 0, (uintptr_t) NULL, SLAB_SIZE, (uintptr_t) NULL,
+          QAT_CONTIG_MEM_ANY_NODE };
 
     while (count < list->slot_size) {
+        /* arena slabs are handled as a whole by crypto_fork_arena() */
+        if (crypto_arena_contains(old_slb)) {
+            old_slb = old_slb->next;
+            count++;
+            continue;
+        }
 #ifdef USE_QAT_CONTIG_MEM
+        qmcfg.node = old_slb->node_pool - 1;
         if (ioctl(crypto_qat_contig_memfd, QAT_CONTIG_MEM_MALLOC, &qmcfg)
             == -1) {
             static char errmsg[LINE_MAX];
@@ -770,9 +1814,6 @@ static void crypto_free_slab_list(qae_slab_pool *list)
 {
     qae_slab *slb, *s_next_slab;
     int rc;
-#ifdef USE_QAT_CONTIG_MEM
-    qat_contig_mem_config qmcfg;
-#endif
 
     if ((rc = pthread_mutex_lock(&crypto_bsal)) != 0) {
         MEM_ERROR("pthread_mutex_lock: %s\n", strerror(rc));
@@ -785,21 +1826,7 @@ static void crypto_free_slab_list(qae_slab_pool *list)
         /* need to save this off before unmapping. This is why we can't have
            slb = slb->next_slab in the for loop above. */
         s_next_slab = slb->next;
-#ifdef USE_QAT_CONTIG_MEM
-        MEM_DEBUG("%s do munmap  of %p\n", __func__, slb);
-        qmcfg = *((qat_contig_mem_config *) slb);
-
-        if (munmap(slb, SLAB_SIZE) == -1) {
-            perror("munmap");
-            exit(EXIT_FAILURE);
-        }
-        MEM_DEBUG("%s ioctl free of %p\n", __func__, slb);
-        if (ioctl(crypto_qat_contig_memfd, QAT_CONTIG_MEM_FREE, &qmcfg)
-            == -1) {
-            perror("ioctl QAT_CONTIG_MEM_FREE");
-            exit(EXIT_FAILURE);
-        }
-#endif
+        crypto_free_slab(slb);
         list->slot_size--;
     }
 
@@ -820,9 +1847,11 @@ static void crypto_free_slab_list(qae_slab_pool *list)
  ******************************************************************************/
 void crypto_free_empty_slab_list()
 {
-    int i;
-    for(i = 0; i < NUM_SLOT_SIZE; i++) {
-        crypto_free_slab_list(&empty_slab_list[i]);
+    int i, n;
+    for (n = 0; n < NUM_NODE_POOLS; n++) {
+        for(i = 0; i < NUM_SLOT_SIZE; i++) {
+            crypto_free_slab_list(&empty_slab_list[n][i]);
+        }
     }
 
 }
@@ -870,11 +1899,13 @@ void crypto_cleanup_slabs(void)
 {
     crypto_free_empty_slab_list();
 #ifdef QAT_MEM_DEBUG
-    int i;
+    int i, n;
     /* stat of available slab list*/
-    for(i = 0;  i < NUM_SLOT_SIZE; i++) {
-        fprintf(stderr,"available_slab_list[%d]:\n",i);
-        slab_list_stat(&available_slab_list[i]);
+    for (n = 0; n < NUM_NODE_POOLS; n++) {
+        for(i = 0;  i < NUM_SLOT_SIZE; i++) {
+            fprintf(stderr,"available_slab_list[%d][%d]:\n",n,i);
+            slab_list_stat(&available_slab_list[n][i]);
+        }
     }
     /*stat of full slab list*/
     fprintf(stderr,"full_slab_list:\n");
@@ -893,38 +1924,330 @@ void crypto_cleanup_slabs(void)
 static void crypto_init(void)
 {
     int i = 0;
+    int n = 0;
     MEM_WARN("QAT Contig memory Warnings enabled.\n");
     MEM_DEBUG("QAT Contig memory Debug enabled.\n");
-    for(i = 0 ; i < NUM_SLOT_SIZE ; i++) {
-        init_pool(&available_slab_list[i]);
-        init_pool(&empty_slab_list[i]);
+    for (n = 0; n < NUM_NODE_POOLS; n++) {
+        for(i = 0 ; i < NUM_SLOT_SIZE ; i++) {
+            init_pool(&available_slab_list[n][i]);
+            init_pool(&empty_slab_list[n][i]);
+        }
     }
     init_pool(&full_slab_list);
+    memset(crypto_class_stats, 0, sizeof(crypto_class_stats));
+    crypto_last_trim = crypto_now_ms();
 #ifdef USE_QAT_CONTIG_MEM
     if ((crypto_qat_contig_memfd = open("/dev/qat_contig_mem", O_RDWR)) == FD_ERROR) {
         perror("open qat_contig_mem");
         exit(EXIT_FAILURE);
     }
 #endif
+    crypto_arena_init();
     atexit(crypto_cleanup_slabs);
     crypto_inited = 1;
 }
 
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemSetArenaSize(size_t size)
+ *
+ * @param[in] size, size in bytes of the arena to reserve, 0 disables it
+ * @retval int, 1 on success, 0 if the allocator is already initialised or
+ *              the size is larger than the driver supports
+ *
+ * @description
+ *      set the size of the pinned memory arena reserved when the allocator
+ *      is initialised
+ *
+ *****************************************************************************/
+int qaeCryptoMemSetArenaSize(size_t size)
+{
+    if (crypto_inited) {
+        MEM_WARN("%s: allocator already initialised\n", __func__);
+        return 0;
+    }
+    if (size > (size_t)QAT_CONTIG_MEM_ARENA_MAX_CHUNKS *
+               QAT_CONTIG_MEM_ARENA_CHUNK_SIZE) {
+        MEM_WARN("%s: arena size %zu too large\n", __func__, size);
+        return 0;
+    }
+    crypto_arena_size = size;
+    return 1;
+}
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemSetRetentionTime(unsigned long retention_ms)
+ *
+ * @param[in] retention_ms, length in ms of the retention period
+ *
+ * @description
+ *      set how long empty slabs are retained before the empty slab lists are
+ *      trimmed back to the recent demand
+ *
+ *****************************************************************************/
+void qaeCryptoMemSetRetentionTime(unsigned long retention_ms)
+{
+    int rc;
+
+    if ((rc = pthread_mutex_lock(&crypto_bsal)) != 0) {
+        MEM_ERROR("pthread_mutex_lock: %s\n", strerror(rc));
+        return;
+    }
+    crypto_retention_ms = retention_ms;
+    if ((rc = pthread_mutex_unlock(&crypto_bsal)) != 0)
+        MEM_ERROR("pthread_mutex_unlock: %s\n", strerror(rc));
+}
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemSetLazyFork(int enable)
+ *
+ * @param[in] enable, 1 to discard the parent's slabs in a child, 0 to copy
+ *                    and remap them
+ *
+ * @description
+ *      select how the allocator is set up in the child of a fork
+ *
+ *****************************************************************************/
+void qaeCryptoMemSetLazyFork(int enable)
+{
+    crypto_lazy_fork = enable ? 1 : 0;
+}
+
+/*****************************************************************************
+ * function:
+ *         crypto_prealloc_pool(int node_pool)
+ *
+ * @param[in] node_pool, the node pool to fill
+ *
+ * @description
+ *      create the empty slabs requested with qaeCryptoMemSetPrealloc() in a
+ *      node pool, must be called with crypto_bsal held
+ *
+ *****************************************************************************/
+static void crypto_prealloc_pool(int node_pool)
+{
+    qae_slab *slb = NULL;
+    qae_slab_pool *empty = NULL;
+    int i, size;
+
+    for (i = 0; i < NUM_SLOT_SIZE; i++) {
+        size = (i == NUM_SLOT_SIZE - 1) ? MAX_ALLOC : slot_sizes_available[i];
+        empty = &empty_slab_list[node_pool][i];
+        while (empty->slot_size < crypto_prealloc_slabs[i]) {
+            if ((slb = crypto_create_slab(size, i, node_pool)) == NULL) {
+                MEM_WARN("%s: only %d of %d slabs created for class %d "
+                         "of pool %d\n", __func__, empty->slot_size,
+                         crypto_prealloc_slabs[i], i, node_pool);
+                break;
+            }
+            slb->list_index = IN_EMPTY_LIST;
+            insert_node_at_head(empty, slb);
+        }
+    }
+}
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemSetThreadNode(int node)
+ *
+ * @param[in] node, NUMA node to allocate from, QAT_CONTIG_MEM_ANY_NODE for
+ *                  no preference
+ * @retval int, 1 on success, 0 if the node is not supported
+ *
+ * @description
+ *      select the NUMA node the calling thread allocates pinned memory from.
+ *      The preallocated slabs are created in the node's pool the first time
+ *      a thread is bound to it.
+ *
+ *****************************************************************************/
+int qaeCryptoMemSetThreadNode(int node)
+{
+    int rc;
+
+    if (node != QAT_CONTIG_MEM_ANY_NODE &&
+        (node < 0 || node >= MAX_NUMA_NODES)) {
+        MEM_WARN("%s: unsupported node %d\n", __func__, node);
+        return 0;
+    }
+
+    pthread_once(&crypto_node_once, crypto_node_key_init);
+    if (!crypto_node_key_valid)
+        return 0;
+    if ((rc = pthread_setspecific(crypto_node_key,
+                                  (void *)(intptr_t)(node + 1))) != 0) {
+        MEM_ERROR("pthread_setspecific: %s\n", strerror(rc));
+        return 0;
+    }
+
+    /*
+     * Fill the pool of the node the first time a thread is bound to it,
+     * qaeCryptoMemPrealloc() does it if the allocator is not ready yet.
+     */
+    if ((rc = pthread_mutex_lock(&crypto_bsal)) != 0) {
+        MEM_ERROR("pthread_mutex_lock: %s\n", strerror(rc));
+        return 1;
+    }
+    if (!crypto_prealloc_pools[node + 1]) {
+        crypto_prealloc_pools[node + 1] = 1;
+        if (crypto_inited && full_slab_list.pid == getpid())
+            crypto_prealloc_pool(node + 1);
+    }
+    if ((rc = pthread_mutex_unlock(&crypto_bsal)) != 0)
+        MEM_ERROR("pthread_mutex_unlock: %s\n", strerror(rc));
+    return 1;
+}
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemGetStats(qae_mem_class_stats *stats, int num)
+ *
+ * @param[out] stats, array receiving the statistics of each size class
+ * @param[in] num, number of entries in the array
+ * @retval int, number of entries filled in
+ *
+ * @description
+ *      take a snapshot of the statistics of the slab allocator
+ *
+ *****************************************************************************/
+int qaeCryptoMemGetStats(qae_mem_class_stats *stats, int num)
+{
+    qae_slab_class_stats *st = NULL;
+    int i, rc;
+
+    if (stats == NULL || num <= 0)
+        return 0;
+    if (num > NUM_SLOT_SIZE)
+        num = NUM_SLOT_SIZE;
+
+    if ((rc = pthread_mutex_lock(&crypto_bsal)) != 0) {
+        MEM_ERROR("pthread_mutex_lock: %s\n", strerror(rc));
+        return 0;
+    }
+
+    for (i = 0; i < num; i++) {
+        st = &crypto_class_stats[i];
+        stats[i].slot_size = (i == NUM_SLOT_SIZE - 1) ?
+                             0 : slot_sizes_available[i];
+        if (crypto_inited && full_slab_list.pid == getpid()) {
+            stats[i].live_slabs = crypto_live_slabs(i);
+            stats[i].empty_slabs = crypto_empty_slabs(i);
+        } else {
+            stats[i].live_slabs = 0;
+            stats[i].empty_slabs = 0;
+        }
+        stats[i].full_slabs = st->full_slabs;
+        stats[i].peak_live_slabs = st->peak_live_slabs;
+        stats[i].allocs = st->allocs;
+        stats[i].frees = st->frees;
+        stats[i].alloc_rate = st->alloc_rate;
+        stats[i].slabs_created = st->slabs_created;
+        stats[i].slabs_released = st->slabs_released;
+    }
+
+    if ((rc = pthread_mutex_unlock(&crypto_bsal)) != 0)
+        MEM_ERROR("pthread_mutex_unlock: %s\n", strerror(rc));
+    return num;
+}
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemSetPrealloc(int slot_size, int num_slabs)
+ *
+ * @param[in] slot_size, slot size of the class, 0 for the largest class
+ * @param[in] num_slabs, number of empty slabs to keep ready for the class
+ * @retval int, 1 on success, 0 if the slot size or number is invalid
+ *
+ * @description
+ *      set how many slabs qaeCryptoMemPrealloc() creates for a size class
+ *
+ *****************************************************************************/
+int qaeCryptoMemSetPrealloc(int slot_size, int num_slabs)
+{
+    int i;
+
+    if (num_slabs < 0 || num_slabs > MAX_EMPTY_SLAB) {
+        MEM_WARN("%s: invalid number of slabs %d\n", __func__, num_slabs);
+        return 0;
+    }
+
+    if (slot_size == 0) {
+        crypto_prealloc_slabs[NUM_SLOT_SIZE - 1] = num_slabs;
+        return 1;
+    }
+
+    for (i = 0; i < sizeof(slot_sizes_available) / sizeof(int); i++) {
+        if (slot_size == slot_sizes_available[i]) {
+            crypto_prealloc_slabs[i] = num_slabs;
+            return 1;
+        }
+    }
+
+    MEM_WARN("%s: invalid slot size %d\n", __func__, slot_size);
+    return 0;
+}
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemPrealloc(void)
+ *
+ * @description
+ *      create the empty slabs requested with qaeCryptoMemSetPrealloc() so
+ *      that the first allocations of the process, or of a child following
+ *      a fork, do not pay for slab creation. They are created in pool 0 and
+ *      in the pool of each node a thread has been bound to.
+ *
+ *****************************************************************************/
+void qaeCryptoMemPrealloc(void)
+{
+    int n, rc;
+
+    if (!crypto_inited)
+        crypto_init();
+    else if (full_slab_list.pid != getpid())
+        crypto_init_child();
+
+    if ((rc = pthread_mutex_lock(&crypto_bsal)) != 0) {
+        MEM_ERROR("pthread_mutex_lock: %s\n", strerror(rc));
+        return;
+    }
+
+    for (n = 0; n < NUM_NODE_POOLS; n++) {
+        if (crypto_prealloc_pools[n])
+            crypto_prealloc_pool(n);
+    }
+
+    if ((rc = pthread_mutex_unlock(&crypto_bsal)) != 0)
+        MEM_ERROR("pthread_mutex_unlock: %s\n", strerror(rc));
+}
+
 /*****************************************************************************
  * function:
  *         qaeCryptoAtFork()
  *
  * @description
- *      allocate and remap memory following a fork
+ *      allocate and remap memory following a fork, or in lazy fork mode
+ *      start over with empty pools
  *
  *****************************************************************************/
 void qaeCryptoAtFork()
 {
-    int i;
+    int i, n;
+
+    if (crypto_lazy_fork) {
+        if (crypto_inited)
+            crypto_discard_inherited();
+        return;
+    }
+    crypto_fork_arena();
+    fork_large_regions();
     fork_slab_list(&full_slab_list);
-    for(i = 0;i < NUM_SLOT_SIZE; i++) {
-        fork_slab_list(&empty_slab_list[i]);
-        fork_slab_list(&available_slab_list[i]);
+    for (n = 0; n < NUM_NODE_POOLS; n++) {
+        for(i = 0;i < NUM_SLOT_SIZE; i++) {
+            fork_slab_list(&empty_slab_list[n][i]);
+            fork_slab_list(&available_slab_list[n][i]);
+        }
     }
 }
 
@@ -945,11 +2268,22 @@ CpaPhysicalAddr qaeCryptoMemV2P(void *v)
    qat_contig_mem_config *memCfg = NULL;
    void *pVirtPageAddress = NULL;
    ptrdiff_t offset = 0;
+   CpaPhysicalAddr phys = 0;
    if(v == NULL) {
        MEM_WARN("%s: NULL address passed to function\n", __func__);
        return (CpaPhysicalAddr) 0;
    }
 
+   if (crypto_arena_contains(v)) {
+       offset = (unsigned char *)v - crypto_arena_base;
+       return crypto_arena_phys[offset / SLAB_SIZE] +
+              (CpaPhysicalAddr)(offset % SLAB_SIZE);
+   }
+
+   /* must come before the header lookup which may land in a large region */
+   if (crypto_large_v2p(v, &phys))
+       return phys;
+
    /* Get the physical address contained in the slab
       header using the fact the slabs are aligned in
       virtual address space */
@@ -61,6 +61,33 @@
 
 # define QAE_BYTE_ALIGNMENT 0x0040/* 64 bytes */
 
+/*
+ * number of slot size classes reported by qaeCryptoMemGetStats()
+ */
+# define QAE_MEM_NUM_SIZE_CLASSES 7
+
+/*
+ * statistics of one slot size class of the pinned memory allocator
+ */
+typedef struct _qae_mem_class_stats {
+    /* slot size in bytes, 0 for the class holding the largest allocations */
+    int slot_size;
+    /* slabs holding at least one allocated slot */
+    int live_slabs;
+    /* slabs retained with no allocated slot */
+    int empty_slabs;
+    /* live slabs with every slot allocated */
+    int full_slabs;
+    /* highest number of live slabs seen */
+    int peak_live_slabs;
+    unsigned long allocs;
+    unsigned long frees;
+    /* allocations per second over the last retention period */
+    unsigned long alloc_rate;
+    unsigned long slabs_created;
+    unsigned long slabs_released;
+} qae_mem_class_stats;
+
 /*****************************************************************************
  * function:
  *         qaeCryptoMemAlloc(size_t memsize, const char *file, int line);
@@ -161,6 +188,117 @@ void *copyAllocPinnedMemoryClean(void *ptr, size_t size, size_t original_size,
                                  const char *file, int line);
 void copyFreePinnedMemory(void *uptr, void *kptr, int size);
 
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemSetArenaSize(size_t size)
+ *
+ * @description
+ *      sets the size of the pinned memory arena reserved from the driver
+ *      when the allocator is initialised. Slabs are carved out of the arena
+ *      without any further system calls until it is exhausted.
+ *
+ * @param[in] size, the arena size in bytes, 0 disables the arena
+ *
+ * @retval 1 on success, 0 if the allocator is already initialised or the
+ *         size is not supported
+ *
+ *****************************************************************************/
+int qaeCryptoMemSetArenaSize(size_t size);
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemSetRetentionTime(unsigned long retention_ms)
+ *
+ * @description
+ *      sets the length of the period over which the demand for slabs is
+ *      tracked. At the end of each period empty slabs beyond those needed
+ *      to get back to the peak demand of the period are released.
+ *
+ * @param[in] retention_ms, the period in ms, 0 trims on every free
+ *
+ * @retval none
+ *
+ *****************************************************************************/
+void qaeCryptoMemSetRetentionTime(unsigned long retention_ms);
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemSetLazyFork(int enable)
+ *
+ * @description
+ *      selects how the allocator is set up in the child of a fork. By default
+ *      the slabs inherited from the parent are copied to new pinned memory
+ *      and remapped at the same addresses. In lazy mode the child starts with
+ *      empty pools and the inherited slabs are unmapped in the background, so
+ *      memory allocated before the fork must not be used by the child.
+ *
+ * @param[in] enable, 1 to enable lazy mode, 0 to disable it
+ *
+ * @retval none
+ *
+ *****************************************************************************/
+void qaeCryptoMemSetLazyFork(int enable);
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemSetThreadNode(int node)
+ *
+ * @description
+ *      selects the NUMA node the calling thread allocates pinned memory
+ *      from. Slabs are kept in a separate pool for each node.
+ *
+ * @param[in] node, the NUMA node, -1 for no preference
+ *
+ * @retval 1 on success, 0 if the node is not supported
+ *
+ *****************************************************************************/
+int qaeCryptoMemSetThreadNode(int node);
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemGetStats(qae_mem_class_stats *stats, int num)
+ *
+ * @description
+ *      retrieves the statistics of each slot size class
+ *
+ * @param[out] stats, array of at least num entries
+ * @param[in] num, number of entries in stats, QAE_MEM_NUM_SIZE_CLASSES
+ *            returns every class
+ *
+ * @retval the number of entries filled in
+ *
+ *****************************************************************************/
+int qaeCryptoMemGetStats(qae_mem_class_stats *stats, int num);
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemSetPrealloc(int slot_size, int num_slabs)
+ *
+ * @description
+ *      sets the number of empty slabs to create up front for the size class
+ *      with the given slot size
+ *
+ * @param[in] slot_size, the slot size of the class in bytes, 0 selects the
+ *            class used for the largest allocations
+ * @param[in] num_slabs, the number of slabs to create
+ *
+ * @retval 1 on success, 0 if the parameters are invalid
+ *
+ *****************************************************************************/
+int qaeCryptoMemSetPrealloc(int slot_size, int num_slabs);
+
+/*****************************************************************************
+ * function:
+ *         qaeCryptoMemPrealloc(void)
+ *
+ * @description
+ *      creates the slabs requested with qaeCryptoMemSetPrealloc(). This is
+ *      called when the engine is initialised, including in a child process
+ *      following a fork.
+ *
+ *****************************************************************************/
+void qaeCryptoMemPrealloc(void);
+
 void qaeCryptoAtFork();
 
 #endif
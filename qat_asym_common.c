@@ -53,8 +53,10 @@
 #endif
 
 #include <pthread.h>
+#include <string.h>
 
 #include <openssl/async.h>
+#include <openssl/crypto.h>
 #include <openssl/ossl_typ.h>
 #include <openssl/bn.h>
 
@@ -72,6 +74,277 @@
 
 #define QAT_PERFORMOP_RETRIES 3
 
+/* The request bundles of the completed operations are kept by each thread,
+ * up to QAT_ASYM_REQ_POOL_SIZE of each type, so that the next operation of
+ * the thread finds its op data, result buffers and BN_CTX ready to use.
+ */
+#define QAT_ASYM_REQ_POOL_SIZE 8
+
+typedef struct qat_asym_req_pool_s {
+    unsigned int count[QAT_ASYM_REQ_TYPES];
+    QAT_ASYM_REQ *head[QAT_ASYM_REQ_TYPES];
+    /* Set while the thread runs the software fallback of an operation */
+    int sw_fallback;
+    /* Process the pinned buffers of the pool belong to */
+    pid_t pid;
+} QAT_ASYM_REQ_POOL;
+
+static CRYPTO_ONCE qat_asym_req_pool_once = CRYPTO_ONCE_STATIC_INIT;
+static CRYPTO_THREAD_LOCAL qat_asym_req_pool_key;
+static int qat_asym_req_pool_key_set = 0;
+
+static void qat_asym_req_free(QAT_ASYM_REQ *req)
+{
+    int i;
+
+    for (i = 0; i < req->nresult; i++) {
+        if (req->result[i].pData != NULL)
+            qaeCryptoMemFree(req->result[i].pData);
+    }
+    BN_CTX_free(req->ctx);
+    OPENSSL_free(req);
+}
+
+/* Forget a pool inherited across a fork. Its pinned buffers belong to the
+ * parent, so only the heap memory of the pool is freed.
+ */
+static void qat_asym_req_pool_drop(QAT_ASYM_REQ_POOL *p)
+{
+    QAT_ASYM_REQ *req;
+    int type;
+
+    for (type = 0; type < QAT_ASYM_REQ_TYPES; type++) {
+        while ((req = p->head[type]) != NULL) {
+            p->head[type] = req->next;
+            BN_CTX_free(req->ctx);
+            OPENSSL_free(req);
+        }
+    }
+    OPENSSL_free(p);
+}
+
+static void qat_asym_req_pool_free(void *pool)
+{
+    QAT_ASYM_REQ_POOL *p = (QAT_ASYM_REQ_POOL *)pool;
+    QAT_ASYM_REQ *req;
+    int type;
+
+    if (p == NULL)
+        return;
+    if (p->pid != getpid()) {
+        qat_asym_req_pool_drop(p);
+        return;
+    }
+    for (type = 0; type < QAT_ASYM_REQ_TYPES; type++) {
+        while ((req = p->head[type]) != NULL) {
+            p->head[type] = req->next;
+            qat_asym_req_free(req);
+        }
+    }
+    OPENSSL_free(p);
+}
+
+static void qat_asym_req_pool_make_key(void)
+{
+    qat_asym_req_pool_key_set =
+        CRYPTO_THREAD_init_local(&qat_asym_req_pool_key,
+                                 qat_asym_req_pool_free);
+}
+
+/******************************************************************************
+* function:
+*         qat_asym_req_pool_get(int create)
+*
+* @param create [IN]  - 1 to create the pool of the thread if it has none
+*
+* description:
+*    This function returns the request pool of the calling thread, NULL if
+*  it has none or it cannot be created. A pool inherited from the parent
+*  process is dropped first.
+*
+******************************************************************************/
+static QAT_ASYM_REQ_POOL *qat_asym_req_pool_get(int create)
+{
+    QAT_ASYM_REQ_POOL *p;
+
+    if (!CRYPTO_THREAD_run_once(&qat_asym_req_pool_once,
+                                qat_asym_req_pool_make_key)
+        || !qat_asym_req_pool_key_set)
+        return NULL;
+    p = CRYPTO_THREAD_get_local(&qat_asym_req_pool_key);
+    if (p != NULL && p->pid != getpid()) {
+        CRYPTO_THREAD_set_local(&qat_asym_req_pool_key, NULL);
+        qat_asym_req_pool_drop(p);
+        p = NULL;
+    }
+    if (p != NULL || !create)
+        return p;
+
+    if ((p = OPENSSL_zalloc(sizeof(*p))) == NULL) {
+        WARN("[%s] Failed to allocate the request pool\n", __func__);
+        return NULL;
+    }
+    p->pid = getpid();
+    if (!CRYPTO_THREAD_set_local(&qat_asym_req_pool_key, p)) {
+        OPENSSL_free(p);
+        return NULL;
+    }
+    return p;
+}
+
+/******************************************************************************
+* function:
+*         qat_asym_req_get(int type, size_t op_size, Cpa32U buflen,
+*                          int nresult, int with_ctx)
+*
+* @param type     [IN]  - QAT_ASYM_REQ_xxx type of the operation
+* @param op_size  [IN]  - size of the op data of the operation
+* @param buflen   [IN]  - size of each result buffer
+* @param nresult  [IN]  - number of result buffers, at most
+*                         QAT_ASYM_REQ_MAX_RESULTS
+* @param with_ctx [IN]  - 1 when the operation needs a BN_CTX
+*
+* description:
+*    This function returns a request bundle with zeroed op data, taken from
+*  the pool of the calling thread when it holds one of the same shape,
+*  allocated otherwise. NULL is returned on failure. The bundle is given back
+*  with qat_asym_req_put() once the operation has completed.
+*
+******************************************************************************/
+QAT_ASYM_REQ *qat_asym_req_get(int type, size_t op_size, Cpa32U buflen,
+                               int nresult, int with_ctx)
+{
+    QAT_ASYM_REQ_POOL *p;
+    QAT_ASYM_REQ *req, **prev;
+    int i;
+
+    if ((p = qat_asym_req_pool_get(0)) != NULL) {
+        for (prev = &p->head[type]; (req = *prev) != NULL; prev = &req->next) {
+            if (req->buflen == buflen && req->nresult == nresult &&
+                (req->ctx != NULL) == (with_ctx != 0)) {
+                *prev = req->next;
+                p->count[type]--;
+                req->next = NULL;
+                /* The result lengths may have been updated by the API */
+                for (i = 0; i < nresult; i++)
+                    req->result[i].dataLenInBytes = buflen;
+                return req;
+            }
+        }
+    }
+
+    if ((req = OPENSSL_zalloc(QAT_ASYM_REQ_HDR_SIZE + op_size)) == NULL) {
+        WARN("[%s] Failed to allocate the request\n", __func__);
+        return NULL;
+    }
+    req->type = type;
+    req->op_size = op_size;
+    req->buflen = buflen;
+    req->nresult = nresult;
+    req->op_data = (char *)req + QAT_ASYM_REQ_HDR_SIZE;
+
+    if (with_ctx && (req->ctx = BN_CTX_new()) == NULL) {
+        WARN("[%s] Failed to allocate the BN_CTX\n", __func__);
+        qat_asym_req_free(req);
+        return NULL;
+    }
+    for (i = 0; i < nresult; i++) {
+        req->result[i].pData = qaeCryptoMemAlloc(buflen, __FILE__, __LINE__);
+        if (req->result[i].pData == NULL) {
+            WARN("[%s] Failed to allocate the result buffer\n", __func__);
+            qat_asym_req_free(req);
+            return NULL;
+        }
+        req->result[i].dataLenInBytes = buflen;
+    }
+    return req;
+}
+
+/******************************************************************************
+* function:
+*         qat_asym_req_put(QAT_ASYM_REQ *req)
+*
+* @param req [IN]  - request bundle, the buffers its op data points at
+*                    are already freed
+*
+* description:
+*    This function cleanses the result buffers and the op data of the
+*  request and keeps it in the pool of the calling thread, it is freed when
+*  the pool is full. The BN_CTX must have been ended.
+*
+******************************************************************************/
+void qat_asym_req_put(QAT_ASYM_REQ *req)
+{
+    QAT_ASYM_REQ_POOL *p;
+    int i;
+
+    if (req == NULL)
+        return;
+    for (i = 0; i < req->nresult; i++)
+        OPENSSL_cleanse(req->result[i].pData, req->buflen);
+    OPENSSL_cleanse(req->op_data, req->op_size);
+
+    if ((p = qat_asym_req_pool_get(1)) != NULL &&
+        p->count[req->type] < QAT_ASYM_REQ_POOL_SIZE) {
+        req->next = p->head[req->type];
+        p->head[req->type] = req;
+        p->count[req->type]++;
+        return;
+    }
+    qat_asym_req_free(req);
+}
+
+void qat_free_asym_reqs(void)
+{
+    QAT_ASYM_REQ_POOL *p;
+
+    /* Only the pool of this thread can be reached, the others are freed
+     * when their thread exits.
+     */
+    if ((p = qat_asym_req_pool_get(0)) != NULL) {
+        CRYPTO_THREAD_set_local(&qat_asym_req_pool_key, NULL);
+        qat_asym_req_pool_free(p);
+    }
+}
+
+/******************************************************************************
+* function:
+*         qat_asym_set_sw_fallback(int on)
+*
+* @param on [IN]  - 1 when the thread enters a software fallback, 0 when it
+*                   leaves it
+*
+* description:
+*    This function marks the calling thread as running the software
+*  implementation of an operation whose request expired. The modular
+*  exponentiations called back by OpenSSL are then done in software as well
+*  rather than sent to the instances the request could not get on.
+*
+******************************************************************************/
+void qat_asym_set_sw_fallback(int on)
+{
+    QAT_ASYM_REQ_POOL *p;
+
+    if ((p = qat_asym_req_pool_get(on)) != NULL)
+        p->sw_fallback = on;
+}
+
+/******************************************************************************
+* function:
+*         qat_asym_sw_fallback(void)
+*
+* description:
+*    This function returns 1 if the calling thread is running a software
+*  fallback, 0 otherwise.
+*
+******************************************************************************/
+int qat_asym_sw_fallback(void)
+{
+    QAT_ASYM_REQ_POOL *p;
+
+    return (p = qat_asym_req_pool_get(0)) != NULL && p->sw_fallback;
+}
+
 /******************************************************************************
 * function:
 *         qat_BN_to_FB(CpaFlatBuffer *fb,
@@ -109,6 +382,22 @@ int qat_BN_to_FB(CpaFlatBuffer * fb, const BIGNUM *bn)
     return 1;
 }
 
+static void qat_mod_exp_cb(void *pCallbackTag, CpaStatus status,
+                           void *pOpData, CpaFlatBuffer * pOut)
+{
+    qat_crypto_callbackFn(pCallbackTag, status, CPA_CY_SYM_OP_CIPHER, pOpData,
+                          NULL, CPA_TRUE);
+}
+
+static CpaStatus qat_mod_exp_submit(CpaInstanceHandle instanceHandle,
+                                    void *callbackTag, void *args)
+{
+    qat_asym_args *req = (qat_asym_args *)args;
+
+    return cpaCyLnModExp(instanceHandle, qat_mod_exp_cb, callbackTag,
+                         req->opData, req->out1);
+}
+
 /******************************************************************************
 * function:
 *         qat_mod_exp(BIGNUM * r, const BIGNUM * a, const BIGNUM * p,
@@ -120,7 +409,8 @@ int qat_BN_to_FB(CpaFlatBuffer * fb, const BIGNUM *bn)
 * @param mod  [IN] - Modulus used for mod_exp
 *
 * description:
-*   Bignum modular exponentiation function used in DH and DSA.
+*   Bignum modular exponentiation function used in DH and DSA. It is done
+*   in software if the request cannot be submitted before its deadline.
 *
 ******************************************************************************/
 int qat_mod_exp(BIGNUM *res, const BIGNUM *base, const BIGNUM *exp,
@@ -129,13 +419,11 @@ int qat_mod_exp(BIGNUM *res, const BIGNUM *base, const BIGNUM *exp,
 
     CpaCyLnModExpOpData opData;
     CpaFlatBuffer result = { 0, };
+    qat_asym_args req = { &opData, &result, NULL, NULL };
+    CpaBoolean verify = CPA_FALSE;
     CpaStatus status = 0;
+    BN_CTX *ctx = NULL;
     int retval = 1;
-    CpaInstanceHandle instanceHandle;
-    int qatPerformOpRetries = 0;
-    ASYNC_JOB *job = NULL;
-    int iMsgRetry = getQatMsgRetryCount();
-    useconds_t ulPollInterval = getQatPollInterval();
 
     DEBUG("%s\n", __func__);
 
@@ -160,44 +448,17 @@ int qat_mod_exp(BIGNUM *res, const BIGNUM *base, const BIGNUM *exp,
         goto exit;
     }
 
-    if (NULL == (instanceHandle = get_next_inst())) {
-        WARN("instanceHandle is NULL\n");
-        retval = 0;
-        goto exit;
-    }
-
-    if ((job = ASYNC_get_current_job()) != NULL) {
-        if (qat_setup_async_event_notification(0) == 0) {
-            WARN("Failed to setup async event notifications\n");
+    status = qat_perform_op(NULL, qat_mod_exp_submit, &req, 1, &verify);
+    if (status == QAT_STATUS_EXPIRED) {
+        DEBUG("[%s] Request expired, done in software\n", __func__);
+        if ((ctx = BN_CTX_new()) == NULL ||
+            !BN_mod_exp(res, base, exp, mod, ctx))
             retval = 0;
-            goto exit;
-        }
-    }
-
-    do {
-        status = cpaCyLnModExp(instanceHandle, NULL, NULL, &opData, &result);
-        if (status == CPA_STATUS_RETRY) {
-            if (job == NULL) {
-                usleep(ulPollInterval +
-                       (qatPerformOpRetries % QAT_RETRY_BACKOFF_MODULO_DIVISOR));
-                qatPerformOpRetries++;
-                if (iMsgRetry != QAT_INFINITE_MAX_NUM_RETRIES) {
-                    if (qatPerformOpRetries >= iMsgRetry) {
-                        break;
-                    }
-                }
-            } else {
-                if ((qat_wake_job(job, 0) == 0) ||
-                    (qat_pause_job(job, 0) == 0)) {
-                    status = CPA_STATUS_FAIL;
-                    break;
-                }
-            }
-        }
+        BN_CTX_free(ctx);
+        goto exit;
     }
-    while (status == CPA_STATUS_RETRY);
 
-    if (CPA_STATUS_SUCCESS != status) {
+    if (CPA_STATUS_SUCCESS != status || verify != CPA_TRUE) {
         WARN("cpaCyLnModExp failed, status=%d\n", status);
         retval = 0;
         goto exit;
@@ -50,6 +50,46 @@
 
 # include "cpa.h"
 
+/* Types of the request bundles kept by the per-thread pools */
+# define QAT_ASYM_REQ_EC_POINT_MUL      0
+# define QAT_ASYM_REQ_ECDSA_SIGN        1
+# define QAT_ASYM_REQ_ECDSA_VERIFY      2
+# define QAT_ASYM_REQ_DH_PHASE1         3
+# define QAT_ASYM_REQ_DH_PHASE2         4
+# define QAT_ASYM_REQ_DSA_SIGN          5
+# define QAT_ASYM_REQ_DSA_VERIFY        6
+# define QAT_ASYM_REQ_RSA_DECRYPT       7
+# define QAT_ASYM_REQ_RSA_ENCRYPT       8
+# define QAT_ASYM_REQ_TYPES             9
+
+# define QAT_ASYM_REQ_MAX_RESULTS       2
+
+/* Everything an asymmetric operation needs apart from its input data: the
+ * zeroed op data, result descriptors with pinned buffers of buflen bytes
+ * and optionally a BN_CTX. The op data follows the bundle in memory.
+ */
+typedef struct qat_asym_req_s {
+    struct qat_asym_req_s *next;
+    int type;
+    size_t op_size;
+    Cpa32U buflen;
+    int nresult;
+    void *op_data;
+    BN_CTX *ctx;
+    CpaFlatBuffer result[QAT_ASYM_REQ_MAX_RESULTS];
+} QAT_ASYM_REQ;
+
+# define QAT_ASYM_REQ_HDR_SIZE \
+                    ((sizeof(QAT_ASYM_REQ) + 15) & ~((size_t)15))
+# define qat_asym_req_of(op) \
+                    ((QAT_ASYM_REQ *)((char *)(op) - QAT_ASYM_REQ_HDR_SIZE))
+
+QAT_ASYM_REQ *qat_asym_req_get(int type, size_t op_size, Cpa32U buflen,
+                               int nresult, int with_ctx);
+void qat_asym_req_put(QAT_ASYM_REQ *req);
+void qat_free_asym_reqs(void);
+void qat_asym_set_sw_fallback(int on);
+int qat_asym_sw_fallback(void);
 int qat_BN_to_FB(CpaFlatBuffer * fb, const BIGNUM *bn);
 int qat_mod_exp(BIGNUM *r, const BIGNUM *a, const BIGNUM *p, const BIGNUM *m);
 
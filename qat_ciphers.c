@@ -82,12 +82,14 @@
 #include <openssl/evp.h>
 #include <openssl/aes.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
 #include <openssl/sha.h>
 #include <openssl/tls1.h>
 #include <openssl/async.h>
-#include <openssl/lhash.h>
 #include <openssl/ssl.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
 
 #ifdef OPENSSL_ENABLE_QAT_CIPHERS
 # ifdef OPENSSL_DISABLE_QAT_CIPHERS
@@ -105,6 +107,45 @@
                     hdr[12] = len & 0xff; \
                 } while(0)
 
+/* Offset of the computed AEAD tag in the 64 byte header block of a pipe,
+ * the AAD of TLS records is stored at the start of the block.
+ */
+#define QAT_AEAD_TAG_OFFSET       (QAT_BYTE_ALIGNMENT - AEAD_TAG_LEN)
+/* Longest AAD supported by the accelerator for AEAD ciphers */
+#define QAT_AEAD_MAX_AAD_LEN      240
+
+/* Inputs of the chained ciphers without TLS header are split into segments
+ * of QAT_CHAINED_SEG_LEN bytes whose payload buffers fit in a slot of the
+ * pinned memory allocator. Up to QAT_CHAINED_MAX_SEGS segments are decrypted
+ * concurrently, as pipes of one call.
+ */
+#define QAT_CHAINED_SEG_LEN       (64 * 1024)
+#define QAT_CHAINED_MAX_SEGS      8
+
+#define QAT_IS_CHACHAPOLY(nid)    ((nid) == NID_chacha20_poly1305)
+#define QAT_IS_AEAD(nid)          ((nid) == NID_aes_128_gcm || \
+                                   (nid) == NID_aes_256_gcm || \
+                                   QAT_IS_CHACHAPOLY(nid))
+#define QAT_IS_RAW(nid)           ((nid) == NID_aes_128_cbc || \
+                                   (nid) == NID_aes_256_cbc || \
+                                   (nid) == NID_aes_128_ctr || \
+                                   (nid) == NID_aes_256_ctr || \
+                                   (nid) == NID_aes_128_xts || \
+                                   (nid) == NID_aes_256_xts)
+/* Length of the explicit IV at the start of the TLS records of a cipher */
+#define QAT_AEAD_TLS_EIV_LEN(nid) \
+            (QAT_IS_CHACHAPOLY(nid) ? 0 : EVP_GCM_TLS_EXPLICIT_IV_LEN)
+
+/* OpenSSL has no nid for AES-256-CBC-HMAC-SHA384, one is allocated when
+ * the ciphers are created. Until then it is the only entry of info[] set to
+ * NID_undef. The nid has no object so it is left out of qat_cipher_nids[],
+ * the cipher is found by name instead. libssl never looks it up, it is
+ * only used by applications through the EVP API.
+ */
+static int qat_nid_aes_256_cbc_hmac_sha384 = NID_undef;
+#define QAT_IS_SHA384(nid)        ((nid) != NID_undef && \
+                                   (nid) == qat_nid_aes_256_cbc_hmac_sha384)
+
 #define FLATBUFF_ALLOC_AND_CHAIN(b1, b2, len) \
                 do { \
                     (b1).pData = qaeCryptoMemAlloc(len, __FILE__, __LINE__); \
@@ -128,11 +169,26 @@ static int qat_chained_ciphers_do_cipher(EVP_CIPHER_CTX *ctx,
                                          const unsigned char *in, size_t len);
 static int qat_chained_ciphers_ctrl(EVP_CIPHER_CTX *ctx, int type, int arg,
                                     void *ptr);
+static int qat_aead_init(EVP_CIPHER_CTX *ctx, const unsigned char *inkey,
+                        const unsigned char *iv, int enc);
+static int qat_aead_cleanup(EVP_CIPHER_CTX *ctx);
+static int qat_aead_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+                             const unsigned char *in, size_t len);
+static int qat_aead_ctrl(EVP_CIPHER_CTX *ctx, int type, int arg, void *ptr);
+static int qat_aead_sw_start(EVP_CIPHER_CTX *ctx);
+static int qat_cipher_init(EVP_CIPHER_CTX *ctx, const unsigned char *inkey,
+                           const unsigned char *iv, int enc);
+static int qat_cipher_cleanup(EVP_CIPHER_CTX *ctx);
+static int qat_cipher_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+                                const unsigned char *in, size_t len);
+static int qat_cipher_ctrl(EVP_CIPHER_CTX *ctx, int type, int arg, void *ptr);
 
 typedef struct _chained_info {
-    const int nid;
+    int nid;
     EVP_CIPHER *cipher;
     const int keylen;
+    /* Software implementation used by the cipher outside of the engine */
+    EVP_CIPHER *sw_cipher;
 } chained_info;
 
 static chained_info info[] = {
@@ -140,6 +196,18 @@ static chained_info info[] = {
     {NID_aes_128_cbc_hmac_sha256, NULL, AES_KEY_SIZE_128},
     {NID_aes_256_cbc_hmac_sha1, NULL, AES_KEY_SIZE_256},
     {NID_aes_256_cbc_hmac_sha256, NULL, AES_KEY_SIZE_256},
+    {NID_undef, NULL, AES_KEY_SIZE_256}, /* AES-256-CBC-HMAC-SHA384 */
+    {NID_aes_128_gcm, NULL, AES_KEY_SIZE_128},
+    {NID_aes_256_gcm, NULL, AES_KEY_SIZE_256},
+#ifdef QAT_CHACHAPOLY
+    {NID_chacha20_poly1305, NULL, CHACHAPOLY_KEY_SIZE},
+#endif
+    {NID_aes_128_cbc, NULL, AES_KEY_SIZE_128},
+    {NID_aes_256_cbc, NULL, AES_KEY_SIZE_256},
+    {NID_aes_128_ctr, NULL, AES_KEY_SIZE_128},
+    {NID_aes_256_ctr, NULL, AES_KEY_SIZE_256},
+    {NID_aes_128_xts, NULL, AES_XTS_KEY_SIZE_128},
+    {NID_aes_256_xts, NULL, AES_XTS_KEY_SIZE_256},
 };
 
 static const unsigned int num_cc = sizeof(info) / sizeof(chained_info);
@@ -150,6 +218,17 @@ int qat_cipher_nids[] = {
     NID_aes_128_cbc_hmac_sha256,
     NID_aes_256_cbc_hmac_sha1,
     NID_aes_256_cbc_hmac_sha256,
+    NID_aes_128_gcm,
+    NID_aes_256_gcm,
+#ifdef QAT_CHACHAPOLY
+    NID_chacha20_poly1305,
+#endif
+    NID_aes_128_cbc,
+    NID_aes_256_cbc,
+    NID_aes_128_ctr,
+    NID_aes_256_ctr,
+    NID_aes_128_xts,
+    NID_aes_256_xts,
 };
 
 /* Setup template for Session Setup Data as most of the fields
@@ -197,11 +276,18 @@ static const CpaCySymOpData template_opData = {
 
 static inline int get_digest_len(int nid)
 {
+    if (QAT_IS_SHA384(nid))
+        return SHA384_DIGEST_LENGTH;
     return (((nid) == NID_aes_128_cbc_hmac_sha1 ||
              (nid) == NID_aes_256_cbc_hmac_sha1) ?
             SHA_DIGEST_LENGTH : SHA256_DIGEST_LENGTH);
 }
 
+static inline int get_hmac_key_size(int nid)
+{
+    return QAT_IS_SHA384(nid) ? HMAC_SHA384_KEY_SIZE : HMAC_KEY_SIZE;
+}
+
 static inline const EVP_CIPHER *qat_chained_cipher_sw_impl(int nid)
 {
     switch (nid) {
@@ -213,7 +299,28 @@ static inline const EVP_CIPHER *qat_chained_cipher_sw_impl(int nid)
         return EVP_aes_128_cbc_hmac_sha256();
     case NID_aes_256_cbc_hmac_sha256:
         return EVP_aes_256_cbc_hmac_sha256();
+    case NID_aes_128_gcm:
+        return EVP_aes_128_gcm();
+    case NID_aes_256_gcm:
+        return EVP_aes_256_gcm();
+#ifdef QAT_CHACHAPOLY
+    case NID_chacha20_poly1305:
+        return EVP_chacha20_poly1305();
+#endif
+    case NID_aes_128_cbc:
+        return EVP_aes_128_cbc();
+    case NID_aes_256_cbc:
+        return EVP_aes_256_cbc();
+    case NID_aes_128_ctr:
+        return EVP_aes_128_ctr();
+    case NID_aes_256_ctr:
+        return EVP_aes_256_ctr();
+    case NID_aes_128_xts:
+        return EVP_aes_128_xts();
+    case NID_aes_256_xts:
+        return EVP_aes_256_xts();
     default:
+        /* OpenSSL has no AES-256-CBC-HMAC-SHA384 implementation */
         return NULL;
     }
 }
@@ -226,7 +333,9 @@ static inline void qat_chained_ciphers_free_qop(qat_op_params **pqop,
     if (pqop != NULL && ((qop = *pqop) != NULL)) {
         for (i = 0; i < *num_elem; i++) {
             QAT_CHK_QMFREE_FLATBUFF(qop[i].src_fbuf[0]);
-            QAT_CHK_QMFREE_FLATBUFF(qop[i].src_fbuf[1]);
+            /* The payload buffer holds the data of the last record */
+            QAT_CLEANSE_QMEMFREE_BUFF(qop[i].payload_buf,
+                                      qop[i].payload_buf_len);
             QAT_QMEMFREE_BUFF(qop[i].src_sgl.pPrivateMetaData);
             QAT_QMEMFREE_BUFF(qop[i].dst_sgl.pPrivateMetaData);
             QAT_QMEMFREE_BUFF(qop[i].op_data.pIv);
@@ -237,29 +346,19 @@ static inline void qat_chained_ciphers_free_qop(qat_op_params **pqop,
     }
 }
 
-static const EVP_CIPHER *qat_create_cipher_meth(int nid, int keylen)
+static const EVP_CIPHER *qat_create_aead_cipher_meth(int nid, int keylen)
 {
     EVP_CIPHER *c = NULL;
 
-#ifdef OPENSSL_DISABLE_QAT_CIPHERS
-    return qat_chained_cipher_sw_impl(nid);
-#endif
-        if (((c = EVP_CIPHER_meth_new(nid, AES_BLOCK_SIZE, keylen)) == NULL)
-            || !EVP_CIPHER_meth_set_iv_length(c, AES_IV_LEN)
-            || !EVP_CIPHER_meth_set_flags(c, QAT_CHAINED_FLAG)
-            || !EVP_CIPHER_meth_set_init(c, qat_chained_ciphers_init)
-            || !EVP_CIPHER_meth_set_do_cipher(c, qat_chained_ciphers_do_cipher)
-            || !EVP_CIPHER_meth_set_cleanup(c, qat_chained_ciphers_cleanup)
-            || !EVP_CIPHER_meth_set_impl_ctx_size(c, sizeof(qat_chained_ctx))
-            || !EVP_CIPHER_meth_set_set_asn1_params(c,
-                                                    EVP_CIPH_FLAG_DEFAULT_ASN1 ?
-                                                    NULL :
-                                                    EVP_CIPHER_set_asn1_iv)
-            || !EVP_CIPHER_meth_set_get_asn1_params(c,
-                                                    EVP_CIPH_FLAG_DEFAULT_ASN1 ?
-                                                    NULL :
-                                                    EVP_CIPHER_get_asn1_iv)
-            || !EVP_CIPHER_meth_set_ctrl(c, qat_chained_ciphers_ctrl)) {
+    if (((c = EVP_CIPHER_meth_new(nid, 1, keylen)) == NULL)
+        || !EVP_CIPHER_meth_set_iv_length(c, AEAD_IV_LEN)
+        || !EVP_CIPHER_meth_set_flags(c, QAT_IS_CHACHAPOLY(nid) ?
+                                      QAT_CHACHAPOLY_FLAGS : QAT_GCM_FLAGS)
+        || !EVP_CIPHER_meth_set_init(c, qat_aead_init)
+        || !EVP_CIPHER_meth_set_do_cipher(c, qat_aead_do_cipher)
+        || !EVP_CIPHER_meth_set_cleanup(c, qat_aead_cleanup)
+        || !EVP_CIPHER_meth_set_impl_ctx_size(c, sizeof(qat_chained_ctx))
+        || !EVP_CIPHER_meth_set_ctrl(c, qat_aead_ctrl)) {
         WARN("[%s]: Failed to create cipher methods for nid %d\n",
              __func__, nid);
         EVP_CIPHER_meth_free(c);
@@ -269,676 +368,1385 @@ static const EVP_CIPHER *qat_create_cipher_meth(int nid, int keylen)
     return c;
 }
 
-void qat_create_ciphers(void)
+static EVP_CIPHER *qat_create_sw_cipher_meth(int nid)
 {
-    int i;
+    const EVP_CIPHER *sw = qat_chained_cipher_sw_impl(nid);
+    EVP_CIPHER *c = NULL;
 
-    for (i = 0; i < num_cc; i++) {
-        if (info[i].cipher == NULL) {
-            info[i].cipher = (EVP_CIPHER *)
-                qat_create_cipher_meth(info[i].nid, info[i].keylen);
-        }
+    /* The copy has no nid so that EVP_CipherInit_ex() does not look for an
+     * engine implementing it, which would be this engine.
+     */
+    if (((c = EVP_CIPHER_meth_new(NID_undef, EVP_CIPHER_block_size(sw),
+                                  EVP_CIPHER_key_length(sw))) == NULL)
+        || !EVP_CIPHER_meth_set_iv_length(c, EVP_CIPHER_iv_length(sw))
+        || !EVP_CIPHER_meth_set_flags(c, EVP_CIPHER_flags(sw))
+        || !EVP_CIPHER_meth_set_init(c, EVP_CIPHER_meth_get_init(sw))
+        || !EVP_CIPHER_meth_set_do_cipher(c, EVP_CIPHER_meth_get_do_cipher(sw))
+        || !EVP_CIPHER_meth_set_cleanup(c, EVP_CIPHER_meth_get_cleanup(sw))
+        || !EVP_CIPHER_meth_set_impl_ctx_size(c, EVP_CIPHER_impl_ctx_size(sw))
+        || !EVP_CIPHER_meth_set_ctrl(c, EVP_CIPHER_meth_get_ctrl(sw))) {
+        WARN("[%s]: Failed to create software cipher methods for nid %d\n",
+             __func__, nid);
+        EVP_CIPHER_meth_free(c);
+        c = NULL;
     }
+
+    return c;
 }
 
-void qat_free_ciphers(void)
+static const EVP_CIPHER *qat_sw_cipher(int nid)
 {
     int i;
 
     for (i = 0; i < num_cc; i++) {
-        if (info[i].cipher != NULL) {
-#ifndef OPENSSL_DISABLE_QAT_CIPHERS
-            EVP_CIPHER_meth_free(info[i].cipher);
-#endif
-            info[i].cipher = NULL;
-        }
+        if (nid == info[i].nid)
+            return info[i].sw_cipher;
     }
+    return NULL;
 }
 
-#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
-# define CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT 2048
+static const EVP_CIPHER *qat_create_raw_cipher_meth(int nid, int keylen)
+{
+    EVP_CIPHER *c = NULL;
+    int block_size = 1;
+    unsigned long flags = QAT_RAW_CIPHER_FLAGS | EVP_CIPH_CTR_MODE;
+
+    if (nid == NID_aes_128_cbc || nid == NID_aes_256_cbc) {
+        block_size = AES_BLOCK_SIZE;
+        flags = QAT_RAW_CIPHER_FLAGS | EVP_CIPH_CBC_MODE;
+    } else if (nid == NID_aes_128_xts || nid == NID_aes_256_xts) {
+        flags = QAT_XTS_FLAGS;
+    }
 
-CRYPTO_ONCE qat_pkt_threshold_table_once = CRYPTO_ONCE_STATIC_INIT;
-CRYPTO_THREAD_LOCAL qat_pkt_threshold_table_key;
+    if (((c = EVP_CIPHER_meth_new(nid, block_size, keylen)) == NULL)
+        || !EVP_CIPHER_meth_set_iv_length(c, AES_IV_LEN)
+        || !EVP_CIPHER_meth_set_flags(c, flags)
+        || !EVP_CIPHER_meth_set_init(c, qat_cipher_init)
+        || !EVP_CIPHER_meth_set_do_cipher(c, qat_cipher_do_cipher)
+        || !EVP_CIPHER_meth_set_cleanup(c, qat_cipher_cleanup)
+        || !EVP_CIPHER_meth_set_impl_ctx_size(c, sizeof(qat_cipher_ctx))
+        || !EVP_CIPHER_meth_set_ctrl(c, qat_cipher_ctrl)) {
+        WARN("[%s]: Failed to create cipher methods for nid %d\n",
+             __func__, nid);
+        EVP_CIPHER_meth_free(c);
+        c = NULL;
+    }
 
-void qat_pkt_threshold_table_make_key(void)
+    return c;
+}
+
+static const EVP_CIPHER *qat_create_cipher_meth(int nid, int keylen)
 {
-    CRYPTO_THREAD_init_local(&qat_pkt_threshold_table_key,
-                             qat_free_pkt_threshold_table);
+    EVP_CIPHER *c = NULL;
+
+#ifdef OPENSSL_DISABLE_QAT_CIPHERS
+    return qat_chained_cipher_sw_impl(nid);
+#endif
+    if (QAT_IS_AEAD(nid))
+        return qat_create_aead_cipher_meth(nid, keylen);
+    if (QAT_IS_RAW(nid))
+        return qat_create_raw_cipher_meth(nid, keylen);
+
+    if (((c = EVP_CIPHER_meth_new(nid, AES_BLOCK_SIZE, keylen)) == NULL)
+        || !EVP_CIPHER_meth_set_iv_length(c, AES_IV_LEN)
+        || !EVP_CIPHER_meth_set_flags(c, QAT_CHAINED_FLAG)
+        || !EVP_CIPHER_meth_set_init(c, qat_chained_ciphers_init)
+        || !EVP_CIPHER_meth_set_do_cipher(c, qat_chained_ciphers_do_cipher)
+        || !EVP_CIPHER_meth_set_cleanup(c, qat_chained_ciphers_cleanup)
+        || !EVP_CIPHER_meth_set_impl_ctx_size(c, sizeof(qat_chained_ctx))
+        || !EVP_CIPHER_meth_set_set_asn1_params(c,
+                                                EVP_CIPH_FLAG_DEFAULT_ASN1 ?
+                                                NULL :
+                                                EVP_CIPHER_set_asn1_iv)
+        || !EVP_CIPHER_meth_set_get_asn1_params(c,
+                                                EVP_CIPH_FLAG_DEFAULT_ASN1 ?
+                                                NULL :
+                                                EVP_CIPHER_get_asn1_iv)
+        || !EVP_CIPHER_meth_set_ctrl(c, qat_chained_ciphers_ctrl)) {
+        WARN("[%s]: Failed to create cipher methods for nid %d\n",
+             __func__, nid);
+        EVP_CIPHER_meth_free(c);
+        c = NULL;
+    }
+
+    return c;
 }
 
-typedef struct cipher_threshold_table_s {
-    int nid;
-    int threshold;
-} PKT_THRESHOLD;
+void qat_create_ciphers(void)
+{
+    int i;
 
-DEFINE_LHASH_OF(PKT_THRESHOLD);
+#ifndef OPENSSL_DISABLE_QAT_CIPHERS
+    if (qat_nid_aes_256_cbc_hmac_sha384 == NID_undef) {
+        qat_nid_aes_256_cbc_hmac_sha384 = OBJ_new_nid(1);
+        for (i = 0; i < num_cc; i++) {
+            if (info[i].nid == NID_undef)
+                info[i].nid = qat_nid_aes_256_cbc_hmac_sha384;
+        }
+    }
+#endif
 
-PKT_THRESHOLD qat_pkt_threshold_table[] = {
-    {NID_aes_128_cbc_hmac_sha1, CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT},
-    {NID_aes_256_cbc_hmac_sha1, CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT},
-    {NID_aes_128_cbc_hmac_sha256,
-     CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT},
-    {NID_aes_256_cbc_hmac_sha256, CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT}
-};
+    for (i = 0; i < num_cc; i++) {
+        if (info[i].nid == NID_undef)
+            continue;
+        if (info[i].cipher == NULL) {
+            info[i].cipher = (EVP_CIPHER *)
+                qat_create_cipher_meth(info[i].nid, info[i].keylen);
+#ifndef OPENSSL_DISABLE_QAT_CIPHERS
+            /* Without a nid object the cipher is only found by name with
+             * EVP_get_cipherbyname() once added here.
+             */
+            if (QAT_IS_SHA384(info[i].nid) && info[i].cipher != NULL) {
+                OBJ_NAME_add(AES_256_CBC_HMAC_SHA384_SN,
+                             OBJ_NAME_TYPE_CIPHER_METH,
+                             (const char *)info[i].cipher);
+                OBJ_NAME_add(AES_256_CBC_HMAC_SHA384_LN,
+                             OBJ_NAME_TYPE_CIPHER_METH,
+                             (const char *)info[i].cipher);
+            }
+#endif
+        }
+#ifndef OPENSSL_DISABLE_QAT_CIPHERS
+        /* The AES-CBC copies decrypt the padding of the chained ciphers */
+        if (info[i].sw_cipher == NULL && (QAT_IS_AEAD(info[i].nid)
+                                          || info[i].nid == NID_aes_128_cbc
+                                          || info[i].nid == NID_aes_256_cbc))
+            info[i].sw_cipher = qat_create_sw_cipher_meth(info[i].nid);
+#endif
+    }
+}
 
-static int pkt_threshold_table_cmp(const PKT_THRESHOLD *a,
-                                   const PKT_THRESHOLD *b)
+/* The session contexts of the freed cipher contexts are kept by each thread,
+ * up to QAT_SESS_POOL_SIZE of them, so that new contexts of the thread skip
+ * the allocation of pinned memory. The pools are also linked in a list so
+ * that the engine can empty all of them when it is unloaded, each pool has
+ * its own lock for that purpose which is never contended otherwise. A child
+ * process drops the pools it inherits as their pinned memory belongs to the
+ * parent.
+ */
+#define QAT_SESS_POOL_SIZE 16
+
+typedef struct qat_sess_pool_s {
+    struct qat_sess_pool_s *next;
+    struct qat_sess_pool_s *prev;
+    pthread_mutex_t lock;
+    unsigned int count;
+    CpaCySymSessionCtx sctx[QAT_SESS_POOL_SIZE];
+    Cpa32U size[QAT_SESS_POOL_SIZE];
+} QAT_SESS_POOL;
+
+static CRYPTO_ONCE qat_sess_pool_once = CRYPTO_ONCE_STATIC_INIT;
+static CRYPTO_THREAD_LOCAL qat_sess_pool_key;
+static int qat_sess_pool_key_set = 0;
+static QAT_SESS_POOL *qat_sess_pools = NULL;
+static pthread_mutex_t qat_sess_pools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Free the session contexts held by a pool, its lock must be held */
+static void qat_sess_pool_empty(QAT_SESS_POOL *p)
 {
-    return (a->nid == b->nid) ? 0 : 1;
+    while (p->count > 0)
+        qaeCryptoMemFree(p->sctx[--p->count]);
 }
 
-static unsigned long pkt_threshold_table_hash(const PKT_THRESHOLD * a)
+static void qat_sess_pool_free(void *pool)
 {
-    return (unsigned long)(a->nid);
+    QAT_SESS_POOL *p = (QAT_SESS_POOL *)pool;
+
+    if (p == NULL)
+        return;
+    pthread_mutex_lock(&qat_sess_pools_lock);
+    if (p->prev != NULL)
+        p->prev->next = p->next;
+    else
+        qat_sess_pools = p->next;
+    if (p->next != NULL)
+        p->next->prev = p->prev;
+    pthread_mutex_unlock(&qat_sess_pools_lock);
+
+    qat_sess_pool_empty(p);
+    pthread_mutex_destroy(&p->lock);
+    OPENSSL_free(p);
 }
 
-LHASH_OF(PKT_THRESHOLD) *qat_create_pkt_threshold_table(void)
+static void qat_sess_pools_prepare(void)
 {
-    int i;
-    int tbl_size =
-        (sizeof(qat_pkt_threshold_table) / sizeof(qat_pkt_threshold_table[0]));
-    LHASH_OF(PKT_THRESHOLD) *ret = NULL;
-    ret =
-        lh_PKT_THRESHOLD_new(pkt_threshold_table_hash, pkt_threshold_table_cmp);
-    if (ret == NULL) {
-        return ret;
-    }
-    for (i = 0; i < tbl_size; i++) {
-        lh_PKT_THRESHOLD_insert(ret, &qat_pkt_threshold_table[i]);
-    }
-    return ret;
+    pthread_mutex_lock(&qat_sess_pools_lock);
 }
 
-int qat_pkt_threshold_table_set_threshold(int nid, int threshold)
+static void qat_sess_pools_parent(void)
 {
-    PKT_THRESHOLD entry, *ret;
-    LHASH_OF(PKT_THRESHOLD) *tbl = NULL;
-    if (NID_undef == nid) {
-        WARN("Unsupported NID\n");
-        return 0;
-    }
-    if ((tbl = CRYPTO_THREAD_get_local(&qat_pkt_threshold_table_key)) == NULL) {
-        tbl = qat_create_pkt_threshold_table();
-        if (tbl != NULL) {
-            CRYPTO_THREAD_set_local(&qat_pkt_threshold_table_key, tbl);
-        } else {
-            WARN("Create packet threshold table fail.\n");
-            return 0;
-        }
-    }
-    entry.nid = nid;
-    ret = lh_PKT_THRESHOLD_retrieve(tbl, &entry);
-    if (ret == NULL) {
-        WARN("Threshold entry retrieve failed for the NID : %d\n", entry.nid);
-        return 0;
-    }
-    ret->threshold = threshold;
-    lh_PKT_THRESHOLD_insert(tbl, ret);
-    return 1;
+    pthread_mutex_unlock(&qat_sess_pools_lock);
 }
 
-int qat_pkt_threshold_table_get_threshold(int nid)
+/* Drop the pools inherited by a child without freeing their pinned memory */
+static void qat_sess_pools_child(void)
 {
-    PKT_THRESHOLD entry, *ret;
-    LHASH_OF(PKT_THRESHOLD) *tbl = NULL;
-    if ((tbl = CRYPTO_THREAD_get_local(&qat_pkt_threshold_table_key)) == NULL) {
-        tbl = qat_create_pkt_threshold_table();
-        if (tbl != NULL) {
-            CRYPTO_THREAD_set_local(&qat_pkt_threshold_table_key, tbl);
-        } else {
-            WARN("Create packet threshold table fail.\n");
-            return 0;
-        }
-    }
-    entry.nid = nid;
-    ret = lh_PKT_THRESHOLD_retrieve(tbl, &entry);
-    if (ret == NULL) {
-        WARN("Threshold entry retrieve failed for the NID : %d\n", entry.nid);
-        return 0;
+    QAT_SESS_POOL *p;
+
+    while ((p = qat_sess_pools) != NULL) {
+        qat_sess_pools = p->next;
+        OPENSSL_free(p);
     }
-    return ret->threshold;
+    if (qat_sess_pool_key_set)
+        CRYPTO_THREAD_set_local(&qat_sess_pool_key, NULL);
+    pthread_mutex_unlock(&qat_sess_pools_lock);
 }
 
-void qat_free_pkt_threshold_table(void *thread_key)
+static void qat_sess_pool_make_key(void)
 {
-    LHASH_OF(PKT_THRESHOLD) *tbl = (LHASH_OF(PKT_THRESHOLD) *) thread_key;
-    if ((tbl = CRYPTO_THREAD_get_local(&qat_pkt_threshold_table_key))) {
-        lh_PKT_THRESHOLD_free(tbl);
+    qat_sess_pool_key_set = CRYPTO_THREAD_init_local(&qat_sess_pool_key,
+                                                     qat_sess_pool_free);
+    if (qat_sess_pool_key_set &&
+        pthread_atfork(qat_sess_pools_prepare, qat_sess_pools_parent,
+                       qat_sess_pools_child) != 0) {
+        WARN("[%s] Failed to register the fork handlers\n", __func__);
+        qat_sess_pool_key_set = 0;
     }
 }
 
-#endif
 /******************************************************************************
 * function:
-*         qat_chained_callbackFn(void *callbackTag, CpaStatus status,
-*                        const CpaCySymOp operationType, void *pOpData,
-*                        CpaBufferList * pDstBuffer, CpaBoolean verifyResult)
+*         qat_sess_pool_get(int create)
 *
-
-* @param pCallbackTag  [IN] -  Opaque value provided by user while making
-*                              individual function call. Cast to op_done_pipe.
-* @param status        [IN] -  Status of the operation.
-* @param operationType [IN] -  Identifies the operation type requested.
-* @param pOpData       [IN] -  Pointer to structure with input parameters.
-* @param pDstBuffer    [IN] -  Destination buffer to hold the data output.
-* @param verifyResult  [IN] -  Used to verify digest result.
+* @param create [IN]  - 1 to create the pool of the thread if it has none
 *
 * description:
-*   Callback function used by chained ciphers with pipeline support. This
-*   function is called when operation is completed for each pipeline. However
-*   the paused job is woken up when all the pipelines have been proccessed.
+*    This function returns the session context pool of the calling thread,
+*  NULL if it has none or it cannot be created.
 *
 ******************************************************************************/
-static void qat_chained_callbackFn(void *callbackTag, CpaStatus status,
-                                   const CpaCySymOp operationType,
-                                   void *pOpData, CpaBufferList *pDstBuffer,
-                                   CpaBoolean verifyResult)
+static QAT_SESS_POOL *qat_sess_pool_get(int create)
 {
-    struct op_done_pipe *opdone = (struct op_done_pipe *)callbackTag;
-    CpaBoolean res = CPA_FALSE;
+    QAT_SESS_POOL *p;
 
-    if (opdone == NULL) {
-        WARN("[%s] Callback Tag NULL!\n", __func__);
-        return;
+    if (!CRYPTO_THREAD_run_once(&qat_sess_pool_once, qat_sess_pool_make_key)
+        || !qat_sess_pool_key_set)
+        return NULL;
+    if ((p = CRYPTO_THREAD_get_local(&qat_sess_pool_key)) != NULL || !create)
+        return p;
+
+    if ((p = OPENSSL_zalloc(sizeof(*p))) == NULL) {
+        WARN("[%s] Failed to allocate the session context pool\n", __func__);
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    if (!CRYPTO_THREAD_set_local(&qat_sess_pool_key, p)) {
+        pthread_mutex_destroy(&p->lock);
+        OPENSSL_free(p);
+        return NULL;
     }
+    pthread_mutex_lock(&qat_sess_pools_lock);
+    p->next = qat_sess_pools;
+    if (qat_sess_pools != NULL)
+        qat_sess_pools->prev = p;
+    qat_sess_pools = p;
+    pthread_mutex_unlock(&qat_sess_pools_lock);
+    return p;
+}
 
-    opdone->num_processed++;
-    res = (status == CPA_STATUS_SUCCESS) && verifyResult ? CPA_TRUE : CPA_FALSE;
+/******************************************************************************
+* function:
+*         qat_sess_ctx_alloc(CpaInstanceHandle inst,
+*                            const CpaCySymSessionSetupData *ssd,
+*                            Cpa32U *size)
+*
+* @param inst   [IN]  - instance the session is initialised on
+* @param ssd    [IN]  - setup data of the session
+* @param size   [OUT] - size of the returned session context
+*
+* description:
+*    This function returns a session context for ssd on inst, taken from the
+*  pool of the calling thread when one is large enough, allocated otherwise.
+*  NULL is returned on failure.
+*
+******************************************************************************/
+static CpaCySymSessionCtx qat_sess_ctx_alloc(CpaInstanceHandle inst,
+                                             const CpaCySymSessionSetupData
+                                             *ssd, Cpa32U *size)
+{
+    QAT_SESS_POOL *p;
+    CpaCySymSessionCtx sctx = NULL;
+    Cpa32U sctx_size = 0;
+    unsigned int i;
 
-    /* If any single pipe processing failed, the entire operation
-     * is treated as failure. The default value of opDone.verifyResult
-     * is TRUE. Change it to false on Failure.
-     */
-    if (res == CPA_FALSE) {
-        DEBUG("[%s] Pipe %d failed( status %d, verifyResult %d)!\n",
-              __func__, opdone->num_processed, status, verifyResult);
-        opdone->opDone.verifyResult = CPA_FALSE;
+    if (cpaCySymSessionCtxGetSize(inst, ssd, &sctx_size) != CPA_STATUS_SUCCESS) {
+        WARN("[%s] Failed to get SessionCtx size.\n", __func__);
+        return NULL;
     }
 
-    /* The QAT API guarantees submission order for request
-     * i.e. first in first out. If not all requests have been
-     * submitted or processed, wait for more callbacks.
-     */
-    if ((opdone->num_submitted != opdone->num_pipes) ||
-        (opdone->num_submitted != opdone->num_processed))
-        return;
+    if ((p = qat_sess_pool_get(0)) != NULL) {
+        pthread_mutex_lock(&p->lock);
+        for (i = p->count; i-- > 0;) {
+            if (p->size[i] >= sctx_size) {
+                sctx = p->sctx[i];
+                *size = p->size[i];
+                p->count--;
+                p->sctx[i] = p->sctx[p->count];
+                p->size[i] = p->size[p->count];
+                break;
+            }
+        }
+        pthread_mutex_unlock(&p->lock);
+        if (sctx != NULL)
+            return sctx;
+    }
 
-    /* Mark job as done when all the requests have been submitted and
-     * subsequently processed.
-     */
-    opdone->opDone.flag = 1;
-    if (opdone->opDone.job) {
-        qat_wake_job(opdone->opDone.job, 0);
+    sctx = (CpaCySymSessionCtx) qaeCryptoMemAlloc(sctx_size, __FILE__,
+                                                  __LINE__);
+    if (sctx == NULL) {
+        WARN("[%s] QMEM alloc failed for session ctx!\n", __func__);
+        return NULL;
     }
+    *size = sctx_size;
+    return sctx;
 }
 
 /******************************************************************************
 * function:
-*         qat_ciphers(ENGINE *e,
-*                     const EVP_CIPHER **cipher,
-*                     const int **nids,
-*                     int nid)
+*         qat_sess_ctx_free(CpaCySymSessionCtx sctx, Cpa32U size)
 *
-* @param e      [IN] - OpenSSL engine pointer
-* @param cipher [IN] - cipher structure pointer
-* @param nids   [IN] - cipher function nids
-* @param nid    [IN] - cipher operation id
+* @param sctx   [IN]  - session context, the session is already removed
+* @param size   [IN]  - size of the session context
 *
 * description:
-*   Qat engine cipher operations registrar
+*    This function cleanses the session context and keeps it in the pool of
+*  the calling thread, it is freed when the pool is full.
+*
 ******************************************************************************/
-int qat_ciphers(ENGINE *e, const EVP_CIPHER **cipher, const int **nids, int nid)
+static void qat_sess_ctx_free(CpaCySymSessionCtx sctx, Cpa32U size)
+{
+    QAT_SESS_POOL *p;
+
+    if (sctx == NULL)
+        return;
+    OPENSSL_cleanse(sctx, size);
+    if ((p = qat_sess_pool_get(1)) != NULL) {
+        pthread_mutex_lock(&p->lock);
+        if (p->count < QAT_SESS_POOL_SIZE) {
+            p->sctx[p->count] = sctx;
+            p->size[p->count++] = size;
+            sctx = NULL;
+        }
+        pthread_mutex_unlock(&p->lock);
+    }
+    if (sctx != NULL)
+        qaeCryptoMemFree(sctx);
+}
+
+void qat_free_ciphers(void)
 {
     int i;
+    QAT_SESS_POOL *p;
 
-    /* No specific cipher => return a list of supported nids ... */
-    if (cipher == NULL) {
-        *nids = qat_cipher_nids;
-        /* num ciphers supported (size of array/size of 1 element) */
-        return (sizeof(qat_cipher_nids) / sizeof(qat_cipher_nids[0]));
+    /* The session contexts of every thread are freed, the pools themselves
+     * are freed when their thread exits.
+     */
+    pthread_mutex_lock(&qat_sess_pools_lock);
+    for (p = qat_sess_pools; p != NULL; p = p->next) {
+        pthread_mutex_lock(&p->lock);
+        qat_sess_pool_empty(p);
+        pthread_mutex_unlock(&p->lock);
     }
+    pthread_mutex_unlock(&qat_sess_pools_lock);
 
     for (i = 0; i < num_cc; i++) {
-        if (nid == info[i].nid) {
-            if (info[i].cipher == NULL)
-                qat_create_ciphers();
-            *cipher = info[i].cipher;
-            return 1;
+        if (info[i].cipher != NULL) {
+#ifndef OPENSSL_DISABLE_QAT_CIPHERS
+            if (QAT_IS_SHA384(info[i].nid)) {
+                OBJ_NAME_remove(AES_256_CBC_HMAC_SHA384_SN,
+                                OBJ_NAME_TYPE_CIPHER_METH);
+                OBJ_NAME_remove(AES_256_CBC_HMAC_SHA384_LN,
+                                OBJ_NAME_TYPE_CIPHER_METH);
+            }
+            EVP_CIPHER_meth_free(info[i].cipher);
+#endif
+            info[i].cipher = NULL;
+        }
+        if (info[i].sw_cipher != NULL) {
+            EVP_CIPHER_meth_free(info[i].sw_cipher);
+            info[i].sw_cipher = NULL;
         }
     }
+}
 
-    *cipher = NULL;
-    return 0;
+/* Timing of one operation taken to learn the small packet threshold */
+typedef struct qat_pkt_sample_s {
+    /* Index of the cipher in the threshold table, -1 when not sampling */
+    int idx;
+    int bucket;
+    /* Whether the caller runs in an asynchronous job */
+    int async;
+    /* Whether the operation was run in software */
+    int sw;
+    struct timespec start;
+    /* Time spent paused waiting for the accelerator, in ns */
+    long paused;
+} QAT_PKT_SAMPLE;
+
+#define QAT_PKT_SAMPLE_INIT { -1 }
+
+static inline long qat_pkt_sample_elapsed(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000000L +
+           (now.tv_nsec - start->tv_nsec);
 }
 
 /******************************************************************************
 * function:
-*         qat_setup_op_params(EVP_CIPHER_CTX *ctx)
-*
-* @param qctx    [IN]  - pointer to existing qat_chained_ctx
+*         qat_pkt_sample_pause_job(QAT_PKT_SAMPLE *sample, ASYNC_JOB *job)
 *
-* @retval 1      function succeeded
-* @retval 0      function failed
+* @param sample [IN] - sample of the operation or NULL
+* @param job    [IN] - job waiting for the operation
 *
 * description:
-*    This function initialises the flatbuffer and flat buffer list for use.
+*   Pause the job like qat_pause_job(). The time the job is paused is not
+*   spent by the thread on the operation so it is left out of the sample.
 *
 ******************************************************************************/
-static int qat_setup_op_params(EVP_CIPHER_CTX *ctx)
+static int qat_pkt_sample_pause_job(QAT_PKT_SAMPLE *sample, ASYNC_JOB *job)
 {
-    CpaCySymOpData *opd = NULL;
-    Cpa32U msize = 0;
-    qat_chained_ctx *qctx = qat_chained_data(ctx);
-    int i = 0;
-    unsigned int start;
+    struct timespec start;
+    int ret;
 
-    /* When no pipelines are used, numpipes = 1. The actual number of pipes are
-     * not known until the start of do_cipher.
-     */
-    if (PIPELINE_USED(qctx)) {
-        /* When Pipes have been previously used, the memory has been allocated
-         * for max supported pipes although initialised only for numpipes.
-         */
-        start = qctx->npipes_last_used;
-    } else {
-        start = 1;
-        /* When the context switches from using no pipes to using pipes,
-         * free the previous allocated memory.
-         */
-        if (qctx->qop != NULL && qctx->qop_len < qctx->numpipes) {
-            qat_chained_ciphers_free_qop(&qctx->qop, &qctx->qop_len);
-            DEBUG_PPL("[%s:%p] qop memory freed\n", __func__, ctx);
-        }
-    }
+    if (sample == NULL || sample->idx < 0)
+        return qat_pause_job(job, 0);
 
-    /* Allocate memory for qop depending on whether pipes are used or not.
-     * In case of pipes, allocate for the maximum supported pipes.
-     */
-    if (qctx->qop == NULL) {
-        if (PIPELINE_USED(qctx)) {
-            WARN("[%s] Pipeline used but no data allocated. \
-                  Possible memory leak", __func__);
-        }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = qat_pause_job(job, 0);
+    sample->paused += qat_pkt_sample_elapsed(&start);
+    return ret;
+}
 
-        qctx->qop_len = qctx->numpipes > 1 ? QAT_MAX_PIPELINES : 1;
-        qctx->qop = (qat_op_params *) OPENSSL_zalloc(sizeof(qat_op_params)
-                                                     * qctx->qop_len);
-        if (qctx->qop == NULL) {
-            WARN("[%s] Unable to allocate memory[%d bytes] for qat op params\n",
-                 __func__, sizeof(qat_op_params) * qctx->qop_len);
-            return 0;
-        }
-        /* start from 0 as New array of qat_op_params */
-        start = 0;
-    }
+#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
+# define CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT 2048
+# define CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_MAX 16384
+/* The adaptive threshold is learned for the sizes up to 64, 128, ... bytes */
+# define QAT_PKT_BUCKET_MIN 64
+# define QAT_PKT_NUM_BUCKETS 9
+# define QAT_PKT_BUCKET_MAX(b) (QAT_PKT_BUCKET_MIN << (b))
+/* One operation in QAT_PKT_SAMPLE_INTERVAL is timed, one in
+ * QAT_PKT_EXPLORE_INTERVAL is run on the path that is not preferred */
+# define QAT_PKT_SAMPLE_INTERVAL 16
+# define QAT_PKT_EXPLORE_INTERVAL 256
+/* Weight of a new sample in the average cost is 1/2^QAT_PKT_EWMA_SHIFT */
+# define QAT_PKT_EWMA_SHIFT 3
 
-    for (i = start; i < qctx->numpipes; i++) {
-        /* This is a whole block the size of the memory alignment. If the
-         * alignment was to become smaller than the header size
-         * (TLS_VIRT_HEADER_SIZE) which is unlikely then we would need to add
-         * some more logic here to work out how many blocks of size
-         * QAT_BYTE_ALIGNMENT we need to allocate to fit the header in.
-         */
-        FLATBUFF_ALLOC_AND_CHAIN(qctx->qop[i].src_fbuf[0],
-                                 qctx->qop[i].dst_fbuf[0], QAT_BYTE_ALIGNMENT);
-        if (qctx->qop[i].src_fbuf[0].pData == NULL) {
-            WARN("[%s] Unable to allocate memory for TLS header\n", __func__);
-            goto err;
-        }
-        memset(qctx->qop[i].src_fbuf[0].pData, 0, QAT_BYTE_ALIGNMENT);
+CRYPTO_ONCE qat_pkt_threshold_table_once = CRYPTO_ONCE_STATIC_INIT;
+CRYPTO_THREAD_LOCAL qat_pkt_threshold_table_key;
 
-        qctx->qop[i].src_fbuf[1].pData = NULL;
-        qctx->qop[i].dst_fbuf[1].pData = NULL;
+void qat_pkt_threshold_table_make_key(void)
+{
+    CRYPTO_THREAD_init_local(&qat_pkt_threshold_table_key,
+                             qat_free_pkt_threshold_table);
+}
 
-        qctx->qop[i].src_sgl.numBuffers = 2;
-        qctx->qop[i].src_sgl.pBuffers = qctx->qop[i].src_fbuf;
-        qctx->qop[i].src_sgl.pUserData = NULL;
-        qctx->qop[i].src_sgl.pPrivateMetaData = NULL;
+/* The index of a nid in this table is given by qat_pkt_threshold_idx() */
+static const int qat_pkt_threshold_nids[] = {
+    NID_aes_128_cbc_hmac_sha1,
+    NID_aes_256_cbc_hmac_sha1,
+    NID_aes_128_cbc_hmac_sha256,
+    NID_aes_256_cbc_hmac_sha256,
+    NID_aes_128_gcm,
+    NID_aes_256_gcm,
+    NID_aes_128_cbc,
+    NID_aes_256_cbc,
+    NID_aes_128_ctr,
+    NID_aes_256_ctr,
+    NID_aes_128_xts,
+    NID_aes_256_xts,
+    NID_sha1,
+    NID_sha256,
+    NID_sha384,
+    NID_sha512,
+#ifdef QAT_CHACHAPOLY
+    NID_chacha20_poly1305
+#endif
+};
 
-        qctx->qop[i].dst_sgl.numBuffers = 2;
-        qctx->qop[i].dst_sgl.pBuffers = qctx->qop[i].dst_fbuf;
-        qctx->qop[i].dst_sgl.pUserData = NULL;
-        qctx->qop[i].dst_sgl.pPrivateMetaData = NULL;
+# define QAT_PKT_THRESHOLD_NUM \
+    (sizeof(qat_pkt_threshold_nids) / sizeof(qat_pkt_threshold_nids[0]))
+
+/* Thresholds set with SET_CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD */
+static int qat_pkt_threshold[QAT_PKT_THRESHOLD_NUM] = {
+    CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT,
+    CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT,
+    CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT,
+    CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT,
+    CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT,
+    CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT,
+    CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT,
+    CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT,
+    CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT,
+    CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT,
+    CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT,
+    CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT,
+    CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT,
+    CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT,
+    CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT,
+    CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT,
+#ifdef QAT_CHACHAPOLY
+    CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_DEFAULT
+#endif
+};
 
-        /* setup meta data for buffer lists */
-        if (msize == 0 &&
-            cpaCyBufferListGetMetaSize(qctx->instanceHandle,
-                                       qctx->qop[i].src_sgl.numBuffers,
-                                       &msize) != CPA_STATUS_SUCCESS) {
-            WARN("[%s] --- cpaCyBufferListGetBufferSize failed.\n", __func__);
-            goto err;
-        }
+static int qat_pkt_threshold_adaptive = 0;
 
-        if (msize) {
-            qctx->qop[i].src_sgl.pPrivateMetaData =
-                qaeCryptoMemAlloc(msize, __FILE__, __LINE__);
-            qctx->qop[i].dst_sgl.pPrivateMetaData =
-                qaeCryptoMemAlloc(msize, __FILE__, __LINE__);
-            if (qctx->qop[i].src_sgl.pPrivateMetaData == NULL ||
-                qctx->qop[i].dst_sgl.pPrivateMetaData == NULL) {
-                WARN("[%s] QMEM alloc failed for PrivateData\n", __func__);
-                goto err;
-            }
-        }
+/* Average cost in ns of the operations of a size bucket run in hardware
+ * (index 0) and in software (index 1), 0 until an operation is timed.
+ */
+typedef struct qat_pkt_bucket_s {
+    unsigned int count;
+    unsigned int cost[2];
+} QAT_PKT_BUCKET;
+
+/* Per thread state of the adaptive threshold, kept separately for the
+ * synchronous (index 0) and asynchronous (index 1) callers. The states of
+ * all threads are linked so that their learned thresholds can be reported.
+ */
+typedef struct qat_pkt_threshold_state_s {
+    struct qat_pkt_threshold_state_s *next;
+    struct qat_pkt_threshold_state_s *prev;
+    QAT_PKT_BUCKET bucket[2][QAT_PKT_THRESHOLD_NUM][QAT_PKT_NUM_BUCKETS];
+    /* Learned thresholds, -1 until an operation of the cipher is timed */
+    int threshold[2][QAT_PKT_THRESHOLD_NUM];
+} QAT_PKT_THRESHOLD_STATE;
+
+static QAT_PKT_THRESHOLD_STATE *qat_pkt_threshold_states = NULL;
+static pthread_mutex_t qat_pkt_threshold_states_lock =
+    PTHREAD_MUTEX_INITIALIZER;
+
+static inline int qat_pkt_threshold_idx(int nid)
+{
+    switch (nid) {
+    case NID_aes_128_cbc_hmac_sha1:
+        return 0;
+    case NID_aes_256_cbc_hmac_sha1:
+        return 1;
+    case NID_aes_128_cbc_hmac_sha256:
+        return 2;
+    case NID_aes_256_cbc_hmac_sha256:
+        return 3;
+    case NID_aes_128_gcm:
+        return 4;
+    case NID_aes_256_gcm:
+        return 5;
+    case NID_aes_128_cbc:
+        return 6;
+    case NID_aes_256_cbc:
+        return 7;
+    case NID_aes_128_ctr:
+        return 8;
+    case NID_aes_256_ctr:
+        return 9;
+    case NID_aes_128_xts:
+        return 10;
+    case NID_aes_256_xts:
+        return 11;
+    case NID_sha1:
+        return 12;
+    case NID_sha256:
+        return 13;
+    case NID_sha384:
+        return 14;
+    case NID_sha512:
+        return 15;
+#ifdef QAT_CHACHAPOLY
+    case NID_chacha20_poly1305:
+        return 16;
+#endif
+    default:
+        return -1;
+    }
+}
 
-        opd = &qctx->qop[i].op_data;
+static inline int qat_pkt_bucket(size_t len)
+{
+    int b = 0;
 
-        /* Copy the opData template */
-        memcpy(opd, &template_opData, sizeof(template_opData));
+    while (b < QAT_PKT_NUM_BUCKETS - 1 && len > QAT_PKT_BUCKET_MAX(b))
+        b++;
+    return b;
+}
 
-        /* Update Opdata */
-        opd->sessionCtx = qctx->session_ctx;
-        opd->pIv = qaeCryptoMemAlloc(EVP_CIPHER_CTX_iv_length(ctx),
-                                     __FILE__, __LINE__);
-        if (opd->pIv == NULL) {
-            WARN("[%s] --- QMEM Mem Alloc failed for pIv for pipe %d.\n",
-                 __func__, i);
-            goto err;
-        }
+static QAT_PKT_THRESHOLD_STATE *qat_pkt_threshold_state(void)
+{
+    QAT_PKT_THRESHOLD_STATE *st = NULL;
+    int i;
 
-        opd->ivLenInBytes = (Cpa32U) EVP_CIPHER_CTX_iv_length(ctx);
+    if ((st = CRYPTO_THREAD_get_local(&qat_pkt_threshold_table_key)) != NULL)
+        return st;
+
+    st = OPENSSL_zalloc(sizeof(*st));
+    if (st == NULL) {
+        WARN("Create packet threshold table fail.\n");
+        return NULL;
+    }
+    for (i = 0; i < QAT_PKT_THRESHOLD_NUM; i++)
+        st->threshold[0][i] = st->threshold[1][i] = -1;
+    if (!CRYPTO_THREAD_set_local(&qat_pkt_threshold_table_key, st)) {
+        WARN("Create packet threshold table fail.\n");
+        OPENSSL_free(st);
+        return NULL;
     }
+    pthread_mutex_lock(&qat_pkt_threshold_states_lock);
+    st->next = qat_pkt_threshold_states;
+    if (qat_pkt_threshold_states != NULL)
+        qat_pkt_threshold_states->prev = st;
+    qat_pkt_threshold_states = st;
+    pthread_mutex_unlock(&qat_pkt_threshold_states_lock);
+    return st;
+}
 
-    DEBUG_PPL("[%s:%p] qop setup for %d elements\n",
-              __func__, ctx, qctx->qop_len);
+int qat_pkt_threshold_table_set_threshold(int nid, int threshold)
+{
+    int idx = qat_pkt_threshold_idx(nid);
+
+    if (idx < 0) {
+        WARN("Unsupported NID : %d\n", nid);
+        return 0;
+    }
+    qat_pkt_threshold[idx] = threshold;
     return 1;
+}
 
- err:
-    qat_chained_ciphers_free_qop(&qctx->qop, &qctx->qop_len);
-    return 0;
+int qat_pkt_threshold_table_get_threshold(int nid)
+{
+    int idx = qat_pkt_threshold_idx(nid);
+    int async = ASYNC_get_current_job() != NULL;
+    QAT_PKT_THRESHOLD_STATE *st = NULL;
+
+    if (idx < 0)
+        return 0;
+    if (qat_pkt_threshold_adaptive &&
+        (st = CRYPTO_THREAD_get_local(&qat_pkt_threshold_table_key)) != NULL
+        && st->threshold[async][idx] >= 0)
+        return st->threshold[async][idx];
+    return qat_pkt_threshold[idx];
+}
+
+void qat_pkt_threshold_table_set_adaptive(int adaptive)
+{
+    qat_pkt_threshold_adaptive = adaptive;
 }
 
 /******************************************************************************
 * function:
-*         qat_chained_ciphers_init(EVP_CIPHER_CTX *ctx,
-*                                    const unsigned char *inkey,
-*                                    const unsigned char *iv,
-*                                    int enc)
+*         qat_pkt_threshold_table_get_learned(char *buf, size_t len)
 *
-* @param ctx    [IN]  - pointer to existing ctx
-* @param inKey  [IN]  - input cipher key
-* @param iv     [IN]  - initialisation vector
-* @param enc    [IN]  - 1 encrypt 0 decrypt
+* @param buf [OUT] - buffer receiving the thresholds
+* @param len [IN]  - size of the buffer
 *
-* @retval 1      function succeeded
-* @retval 0      function failed
+* @retval 1      The thresholds were written to buf
+* @retval 0      The buffer is too small
 *
 * description:
-*    This function initialises the cipher and hash algorithm parameters for this
-*  EVP context.
+*   Report the threshold of each cipher for the operations run outside and
+*   within asynchronous jobs. A threshold is the average of the thresholds
+*   learned by all the threads, the set threshold when none has learned one.
 *
 ******************************************************************************/
-int qat_chained_ciphers_init(EVP_CIPHER_CTX *ctx,
-                             const unsigned char *inkey,
-                             const unsigned char *iv, int enc)
+int qat_pkt_threshold_table_get_learned(char *buf, size_t len)
 {
-    CpaCySymSessionSetupData *ssd = NULL;
-    Cpa32U sctx_size = 0;
-    CpaCySymSessionCtx sctx = NULL;
-    CpaStatus sts = 0;
-    qat_chained_ctx *qctx = NULL;
-    unsigned char *ckey = NULL;
-    int ckeylen;
-    int dlen;
-
-    if (ctx == NULL || inkey == NULL) {
-        WARN("[%s] ctx or inkey is NULL.\n", __func__);
-        return 0;
+    QAT_PKT_THRESHOLD_STATE *st = NULL;
+    size_t off = 0;
+    long sum[2][QAT_PKT_THRESHOLD_NUM] = {{0}};
+    int count[2][QAT_PKT_THRESHOLD_NUM] = {{0}};
+    int i, n, nid, async, learned, threshold[2];
+
+    pthread_mutex_lock(&qat_pkt_threshold_states_lock);
+    for (st = qat_pkt_threshold_states; st != NULL; st = st->next) {
+        for (async = 0; async < 2; async++) {
+            for (i = 0; i < QAT_PKT_THRESHOLD_NUM; i++) {
+                learned = __atomic_load_n(&st->threshold[async][i],
+                                          __ATOMIC_RELAXED);
+                if (learned >= 0) {
+                    sum[async][i] += learned;
+                    count[async][i]++;
+                }
+            }
+        }
     }
-
-    qctx = qat_chained_data(ctx);
-    if (qctx == NULL) {
-        WARN("[%s] --- qctx is NULL.\n", __func__);
-        return 0;
+    pthread_mutex_unlock(&qat_pkt_threshold_states_lock);
+
+    for (i = 0; i < QAT_PKT_THRESHOLD_NUM; i++) {
+        nid = qat_pkt_threshold_nids[i];
+        for (async = 0; async < 2; async++) {
+            threshold[async] = count[async][i] > 0 ?
+                               (int)(sum[async][i] / count[async][i]) :
+                               qat_pkt_threshold[i];
+        }
+        /* The short names of the AES-GCM ciphers are not their usual names */
+        n = snprintf(buf + off, len - off, "%s%s:%d:%d", i == 0 ? "" : ",",
+                     nid == NID_aes_128_gcm || nid == NID_aes_256_gcm ?
+                     OBJ_nid2ln(nid) : OBJ_nid2sn(nid),
+                     threshold[0], threshold[1]);
+        if (n < 0 || (size_t)n >= len - off) {
+            WARN("Buffer of %zu bytes too small for the thresholds\n", len);
+            return 0;
+        }
+        off += n;
     }
+    return 1;
+}
 
-    INIT_SEQ_CLEAR_ALL_FLAGS(qctx);
-
-    if (iv != NULL)
-        memcpy(EVP_CIPHER_CTX_iv_noconst(ctx), iv,
-               EVP_CIPHER_CTX_iv_length(ctx));
-    else
-        memset(EVP_CIPHER_CTX_iv_noconst(ctx), 0,
-               EVP_CIPHER_CTX_iv_length(ctx));
-
-    ckeylen = EVP_CIPHER_CTX_key_length(ctx);
-    ckey = OPENSSL_malloc(ckeylen);
-    if (ckey == NULL) {
-        WARN("[%s] --- unable to allocate memory for Cipher key.\n", __func__);
+/******************************************************************************
+* function:
+*         qat_pkt_threshold_sw(int nid, size_t len, QAT_PKT_SAMPLE *sample)
+*
+* @param nid    [IN]  - nid of the cipher
+* @param len    [IN]  - length of the operation
+* @param sample [OUT] - sample to pass to qat_pkt_sample_end() or NULL
+*
+* @retval 1      Run the operation in software
+* @retval 0      Offload the operation
+*
+* description:
+*   Compare the length of an operation to the small packet threshold of the
+*   cipher. With the adaptive threshold some operations are timed in sample
+*   and once in a while an operation is run on the path that costs more so
+*   that the costs of both paths keep being measured.
+*
+******************************************************************************/
+static int qat_pkt_threshold_sw(int nid, size_t len, QAT_PKT_SAMPLE *sample)
+{
+    int idx = qat_pkt_threshold_idx(nid);
+    QAT_PKT_THRESHOLD_STATE *st = NULL;
+    QAT_PKT_BUCKET *bk = NULL;
+    int async, b, sw;
+
+    if (sample != NULL)
+        sample->idx = -1;
+    if (idx < 0)
         return 0;
-    }
-    memcpy(ckey, inkey, ckeylen);
+    if (!qat_pkt_threshold_adaptive ||
+        len > CRYPTO_SMALL_PACKET_OFFLOAD_THRESHOLD_MAX ||
+        (st = qat_pkt_threshold_state()) == NULL)
+        return len <= qat_pkt_threshold[idx];
+
+    async = ASYNC_get_current_job() != NULL;
+    sw = len <= (st->threshold[async][idx] >= 0 ?
+                 st->threshold[async][idx] : qat_pkt_threshold[idx]);
+    if (sample == NULL)
+        return sw;
+
+    b = qat_pkt_bucket(len);
+    bk = &st->bucket[async][idx][b];
+    if (++bk->count % QAT_PKT_SAMPLE_INTERVAL != 0)
+        return sw;
+    if (bk->cost[!sw] == 0 || bk->count % QAT_PKT_EXPLORE_INTERVAL == 0)
+        sw = !sw;
+
+    sample->idx = idx;
+    sample->bucket = b;
+    sample->async = async;
+    sample->sw = sw;
+    sample->paused = 0;
+    clock_gettime(CLOCK_MONOTONIC, &sample->start);
+    return sw;
+}
 
-    memset(qctx, 0, sizeof(*qctx));
+/******************************************************************************
+* function:
+*         qat_pkt_sample_end(QAT_PKT_SAMPLE *sample, int ok)
+*
+* @param sample [IN] - sample started by qat_pkt_threshold_sw()
+* @param ok     [IN] - whether the operation succeeded
+*
+* description:
+*   Add the cost of a timed operation to the average of its size bucket and
+*   learn the threshold of the cipher again. The threshold is the largest
+*   bucket size up to which running the operations in software costs less,
+*   the threshold that was set is used for the buckets not timed yet.
+*
+******************************************************************************/
+static void qat_pkt_sample_end(QAT_PKT_SAMPLE *sample, int ok)
+{
+    QAT_PKT_THRESHOLD_STATE *st = NULL;
+    QAT_PKT_BUCKET *bk = NULL;
+    long cost;
+    int b, sw, threshold = 0;
 
-    qctx->numpipes = 1;
-    qctx->total_op = 0;
-    qctx->npipes_last_used = 1;
+    if (sample->idx < 0 || !ok ||
+        (st = CRYPTO_THREAD_get_local(&qat_pkt_threshold_table_key)) == NULL)
+        return;
 
-    qctx->hmac_key = OPENSSL_zalloc(HMAC_KEY_SIZE);
-    if (qctx->hmac_key == NULL) {
-        WARN("[%s] Unable to allocate memory for HMAC Key\n", __func__);
-        goto end;
-    }
-#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
-    const EVP_CIPHER *sw_cipher = GET_SW_CIPHER(ctx);
-    unsigned int sw_size = EVP_CIPHER_impl_ctx_size(sw_cipher);
-    if (sw_size != 0) {
-        qctx->sw_ctx_data = OPENSSL_zalloc(sw_size);
-        if (qctx->sw_ctx_data == NULL) {
-            WARN("[%s] Unable to allocate memory[ %d bytes] for sw_ctx_data\n",
-                 __func__, sw_size);
-            goto end;
-        }
-    }
+    cost = qat_pkt_sample_elapsed(&sample->start) - sample->paused;
+    if (cost <= 0)
+        cost = 1;
+    else if (cost > UINT_MAX)
+        cost = UINT_MAX;
 
-    EVP_CIPHER_CTX_set_cipher_data(ctx, qctx->sw_ctx_data);
-    EVP_CIPHER_meth_get_init(sw_cipher) (ctx, inkey, iv, enc);
-    EVP_CIPHER_CTX_set_cipher_data(ctx, qctx);
-#endif
+    bk = &st->bucket[sample->async][sample->idx][sample->bucket];
+    if (bk->cost[sample->sw] == 0)
+        bk->cost[sample->sw] = cost;
+    else
+        bk->cost[sample->sw] += (cost - (long)bk->cost[sample->sw])
+                                / (1 << QAT_PKT_EWMA_SHIFT);
 
-    ssd = OPENSSL_malloc(sizeof(CpaCySymSessionSetupData));
-    if (ssd == NULL) {
-        WARN("OPENSSL_malloc() failed for session setup data allocation.\n");
-        goto end;
+    for (b = 0; b < QAT_PKT_NUM_BUCKETS; b++) {
+        bk = &st->bucket[sample->async][sample->idx][b];
+        if (bk->cost[0] != 0 && bk->cost[1] != 0)
+            sw = bk->cost[1] <= bk->cost[0];
+        else
+            sw = QAT_PKT_BUCKET_MAX(b) <= qat_pkt_threshold[sample->idx];
+        if (!sw)
+            break;
+        threshold = QAT_PKT_BUCKET_MAX(b);
     }
+    /* Read by qat_pkt_threshold_table_get_learned() from other threads */
+    __atomic_store_n(&st->threshold[sample->async][sample->idx], threshold,
+                     __ATOMIC_RELAXED);
+    sample->idx = -1;
+}
 
-    qctx->session_data = ssd;
-
-    /* Copy over the template for most of the values */
-    memcpy(ssd, &template_ssd, sizeof(template_ssd));
+void qat_free_pkt_threshold_table(void *thread_key)
+{
+    QAT_PKT_THRESHOLD_STATE *st = (QAT_PKT_THRESHOLD_STATE *)thread_key;
 
-    /* Change constant values for decryption */
-    if (!enc) {
-        ssd->cipherSetupData.cipherDirection =
-            CPA_CY_SYM_CIPHER_DIRECTION_DECRYPT;
-        ssd->algChainOrder = CPA_CY_SYM_ALG_CHAIN_ORDER_CIPHER_THEN_HASH;
-        ssd->verifyDigest = CPA_TRUE;
-    }
+    if (st == NULL)
+        return;
+    pthread_mutex_lock(&qat_pkt_threshold_states_lock);
+    if (st->prev != NULL)
+        st->prev->next = st->next;
+    else
+        qat_pkt_threshold_states = st->next;
+    if (st->next != NULL)
+        st->next->prev = st->prev;
+    pthread_mutex_unlock(&qat_pkt_threshold_states_lock);
+    OPENSSL_free(st);
+}
 
-    ssd->cipherSetupData.cipherKeyLenInBytes = ckeylen;
-    ssd->cipherSetupData.pCipherKey = ckey;
+#else
+static inline void qat_pkt_sample_end(QAT_PKT_SAMPLE *sample, int ok)
+{
+}
+#endif
+/******************************************************************************
+* function:
+*         qat_chained_callbackFn(void *callbackTag, CpaStatus status,
+*                        const CpaCySymOp operationType, void *pOpData,
+*                        CpaBufferList * pDstBuffer, CpaBoolean verifyResult)
+*
 
-    dlen = get_digest_len(EVP_CIPHER_CTX_nid(ctx));
-
-    ssd->hashSetupData.digestResultLenInBytes = dlen;
-
-    if (dlen != SHA_DIGEST_LENGTH)
-        ssd->hashSetupData.hashAlgorithm = CPA_CY_SYM_HASH_SHA256;
-
-    ssd->hashSetupData.authModeSetupData.authKey = qctx->hmac_key;
+* @param pCallbackTag  [IN] -  Opaque value provided by user while making
+*                              individual function call. Cast to op_done_pipe.
+* @param status        [IN] -  Status of the operation.
+* @param operationType [IN] -  Identifies the operation type requested.
+* @param pOpData       [IN] -  Pointer to structure with input parameters.
+* @param pDstBuffer    [IN] -  Destination buffer to hold the data output.
+* @param verifyResult  [IN] -  Used to verify digest result.
+*
+* description:
+*   Callback function used by chained ciphers with pipeline support. This
+*   function is called when operation is completed for each pipeline. However
+*   the paused job is woken up when all the pipelines have been proccessed.
+*
+******************************************************************************/
+static void qat_chained_callbackFn(void *callbackTag, CpaStatus status,
+                                   const CpaCySymOp operationType,
+                                   void *pOpData, CpaBufferList *pDstBuffer,
+                                   CpaBoolean verifyResult)
+{
+    struct op_done_pipe *opdone = (struct op_done_pipe *)callbackTag;
+    CpaBoolean res = CPA_FALSE;
 
-    qctx->instanceHandle = get_next_inst();
-    if (qctx->instanceHandle == NULL) {
-        WARN("[%s] Failed to get QAT Instance Handle!.\n", __func__);
-        goto end;
+    if (opdone == NULL) {
+        WARN("[%s] Callback Tag NULL!\n", __func__);
+        return;
     }
 
-    sts = cpaCySymSessionCtxGetSize(qctx->instanceHandle, ssd, &sctx_size);
-    if (sts != CPA_STATUS_SUCCESS) {
-        WARN("[%s] Failed to get SessionCtx size.\n", __func__);
-        goto end;
-    }
+    opdone->num_processed++;
+    res = (status == CPA_STATUS_SUCCESS) && verifyResult ? CPA_TRUE : CPA_FALSE;
 
-    sctx = (CpaCySymSessionCtx) qaeCryptoMemAlloc(sctx_size, __FILE__,
-                                                  __LINE__);
-    if (sctx == NULL) {
-        WARN("[%s] QMEM alloc failed for session ctx!\n", __func__);
-        goto end;
+    /* If any single pipe processing failed, the entire operation
+     * is treated as failure. The default value of opDone.verifyResult
+     * is TRUE. Change it to false on Failure.
+     */
+    if (res == CPA_FALSE) {
+        DEBUG("[%s] Pipe %d failed( status %d, verifyResult %d)!\n",
+              __func__, opdone->num_processed, status, verifyResult);
+        opdone->opDone.verifyResult = CPA_FALSE;
     }
 
-    qctx->session_ctx = sctx;
+    /* The QAT API guarantees submission order for request
+     * i.e. first in first out. If not all requests have been
+     * submitted or processed, wait for more callbacks.
+     */
+    if ((opdone->num_submitted != opdone->num_pipes) ||
+        (opdone->num_submitted != opdone->num_processed))
+        return;
 
-    qctx->qop = NULL;
-    qctx->qop_len = 0;
+    /* Mark job as done when all the requests have been submitted and
+     * subsequently processed.
+     */
+    opdone->opDone.flag = 1;
+    if (opdone->opDone.job) {
+        qat_wake_job(opdone->opDone.job, 0);
+    }
+}
 
-    INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_QAT_CTX_INIT);
+/******************************************************************************
+* function:
+*         qat_ciphers(ENGINE *e,
+*                     const EVP_CIPHER **cipher,
+*                     const int **nids,
+*                     int nid)
+*
+* @param e      [IN] - OpenSSL engine pointer
+* @param cipher [IN] - cipher structure pointer
+* @param nids   [IN] - cipher function nids
+* @param nid    [IN] - cipher operation id
+*
+* description:
+*   Qat engine cipher operations registrar
+******************************************************************************/
+int qat_ciphers(ENGINE *e, const EVP_CIPHER **cipher, const int **nids, int nid)
+{
+    int i;
 
-    DEBUG_PPL("[%s:%p] qat chained cipher ctx %p initialised\n",
-              __func__, ctx, qctx);
-    return 1;
+    /* No specific cipher => return a list of supported nids ... */
+    if (cipher == NULL) {
+        *nids = qat_cipher_nids;
+        /* num ciphers supported (size of array/size of 1 element) */
+        return (sizeof(qat_cipher_nids) / sizeof(qat_cipher_nids[0]));
+    }
 
- end:
-    if (ssd != NULL)
-        QAT_CLEANSE_FREE_BUFF(ssd->cipherSetupData.pCipherKey, ckeylen);
-    QAT_CLEANSE_FREE_BUFF(qctx->hmac_key, HMAC_KEY_SIZE);
-    OPENSSL_free(qctx->session_data);
-    QAT_QMEMFREE_BUFF(qctx->session_ctx);
-#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
-    OPENSSL_free(qctx->sw_ctx_data);
+    for (i = 0; i < num_cc; i++) {
+        if (nid != NID_undef && nid == info[i].nid) {
+            if (info[i].cipher == NULL)
+                qat_create_ciphers();
+#ifndef OPENSSL_DISABLE_QAT_CIPHERS
+            /* Older devices have no ChaCha20-Poly1305 support, leave the
+             * cipher to OpenSSL when none of the instances has it.
+             */
+            if (QAT_IS_CHACHAPOLY(nid) &&
+                !qat_sym_cap_supported(QAT_SYM_CAP_CHACHAPOLY)) {
+                *cipher = qat_chained_cipher_sw_impl(nid);
+                return 1;
+            }
 #endif
+            *cipher = info[i].cipher;
+            return 1;
+        }
+    }
 
+    *cipher = NULL;
     return 0;
 }
 
 /******************************************************************************
 * function:
-*    qat_chained_ciphers_ctrl(EVP_CIPHER_CTX *ctx,
-*                             int type, int arg, void *ptr)
+*         qat_chained_spread_setup(qat_chained_ctx *qctx)
 *
-* @param ctx    [IN]  - pointer to existing ctx
-* @param type   [IN]  - type of request either
-*                       EVP_CTRL_AEAD_SET_MAC_KEY or EVP_CTRL_AEAD_TLS1_AAD
-* @param arg    [IN]  - size of the pointed to by ptr
-* @param ptr    [IN]  - input buffer contain the necessary parameters
+* @param qctx    [IN]  - pointer to existing qat_chained_ctx
 *
-* @retval x      The return value is dependent on the type of request being made
-*       EVP_CTRL_AEAD_SET_MAC_KEY return of 1 is success
-*       EVP_CTRL_AEAD_TLS1_AAD return value indicates the amount fo padding to
-*               be applied to the SSL/TLS record
-* @retval -1     function failed
+* description:
+*    This function allocates the session contexts of the instances other
+*  than instanceHandle that the records of qctx are spread over, up to the
+*  number set with SET_CHAINED_CIPHER_INSTANCES. Fewer instances are used
+*  when there are not enough distinct ones, for example when the instance
+*  is set for the thread.
+*
+******************************************************************************/
+static void qat_chained_spread_setup(qat_chained_ctx *qctx)
+{
+    CpaInstanceHandle inst = NULL;
+    unsigned int i;
+    unsigned int n = getQatSessionInstances();
+
+    qctx->num_spread = 0;
+    qctx->next_inst = 0;
+
+    while (qctx->num_spread + 1 < n) {
+        inst = get_next_inst();
+        if (inst == NULL || inst == qctx->instanceHandle)
+            return;
+        for (i = 0; i < qctx->num_spread; i++) {
+            if (qctx->spread_inst[i] == inst)
+                return;
+        }
+        qctx->spread_sess[qctx->num_spread] =
+            qat_sess_ctx_alloc(inst, qctx->session_data,
+                               &qctx->spread_size[qctx->num_spread]);
+        if (qctx->spread_sess[qctx->num_spread] == NULL)
+            return;
+        qctx->spread_inst[qctx->num_spread++] = inst;
+    }
+}
+
+/******************************************************************************
+* function:
+*         qat_chained_spread_free(qat_chained_ctx *qctx, unsigned int from)
+*
+* @param qctx    [IN]  - pointer to existing qat_chained_ctx
+* @param from    [IN]  - index of the first instance to stop using
 *
 * description:
-*    This function is a generic control interface provided by the EVP API. For
-*  chained requests this interface is used fro setting the hmac key value for
-*  authentication of the SSL/TLS record. The second type is used to specify the
-*  TLS virtual header which is used in the authentication calculationa nd to
-*  identify record payload size.
+*    This function frees the session contexts of the spread instances from
+*  the given one onwards, the records are no longer sent to them.
 *
 ******************************************************************************/
-int qat_chained_ciphers_ctrl(EVP_CIPHER_CTX *ctx, int type, int arg, void *ptr)
+static void qat_chained_spread_free(qat_chained_ctx *qctx, unsigned int from)
 {
-    qat_chained_ctx *qctx = NULL;
-    unsigned char *hmac_key = NULL;
-    CpaCySymSessionSetupData *ssd = NULL;
-    SHA_CTX hkey1;
-    SHA256_CTX hkey256;
-    CpaStatus sts;
-    char *hdr = NULL;
-    unsigned int len = 0;
-    int retVal = 0;
-    int dlen = 0;
+    unsigned int i;
 
-    if (ctx == NULL) {
-        WARN("[%s] --- ctx parameter is NULL.\n", __func__);
-        return -1;
+    for (i = from; i < qctx->num_spread; i++) {
+        qat_sess_ctx_free(qctx->spread_sess[i], qctx->spread_size[i]);
+        qctx->spread_sess[i] = NULL;
     }
+    if (from < qctx->num_spread)
+        qctx->num_spread = from;
+    qctx->next_inst = 0;
+}
 
-    qctx = qat_chained_data(ctx);
+/******************************************************************************
+* function:
+*         qat_chained_session_init(qat_chained_ctx *qctx)
+*
+* @param qctx    [IN]  - pointer to existing qat_chained_ctx
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function initialises the session on instanceHandle and on the
+*  spread instances. A spread instance on which the session cannot be
+*  initialised is no longer used.
+*
+******************************************************************************/
+static int qat_chained_session_init(qat_chained_ctx *qctx)
+{
+    CpaStatus sts;
+    unsigned int i;
 
-    if (qctx == NULL) {
-        WARN("[%s] --- qctx is NULL.\n", __func__);
-        return -1;
+    sts = cpaCySymInitSession(qctx->instanceHandle, qat_chained_callbackFn,
+                              qctx->session_data, qctx->session_ctx);
+    if (sts != CPA_STATUS_SUCCESS) {
+        WARN("[%s] cpaCySymInitSession failed! Status = %d\n", __func__, sts);
+        return 0;
     }
 
-    dlen = get_digest_len(EVP_CIPHER_CTX_nid(ctx));
-
-    switch (type) {
-    case EVP_CTRL_AEAD_SET_MAC_KEY:
-        hmac_key = qctx->hmac_key;
-        ssd = qctx->session_data;
+    for (i = 0; i < qctx->num_spread; i++) {
+        sts = cpaCySymInitSession(qctx->spread_inst[i], qat_chained_callbackFn,
+                                  qctx->session_data, qctx->spread_sess[i]);
+        if (sts != CPA_STATUS_SUCCESS) {
+            WARN("[%s] cpaCySymInitSession failed on instance %u! Status = %d\n",
+                 __func__, i + 1, sts);
+            qat_chained_spread_free(qctx, i);
+            break;
+        }
+    }
 
-        memset(hmac_key, 0, HMAC_KEY_SIZE);
+    INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_QAT_SESSION_INIT);
+    return 1;
+}
 
-        if (arg > HMAC_KEY_SIZE) {
-            if (dlen == SHA_DIGEST_LENGTH) {
-                SHA1_Init(&hkey1);
-                SHA1_Update(&hkey1, ptr, arg);
-                SHA1_Final(hmac_key, &hkey1);
-            } else {
-                SHA256_Init(&hkey256);
-                SHA256_Update(&hkey256, ptr, arg);
-                SHA256_Final(hmac_key, &hkey256);
-            }
-        } else {
-            memcpy(hmac_key, ptr, arg);
-            ssd->hashSetupData.authModeSetupData.authKeyLenInBytes = arg;
-        }
+/******************************************************************************
+* function:
+*         qat_chained_session_remove(qat_chained_ctx *qctx)
+*
+* @param qctx    [IN]  - pointer to existing qat_chained_ctx
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function removes the session from instanceHandle and from the
+*  spread instances.
+*
+******************************************************************************/
+static int qat_chained_session_remove(qat_chained_ctx *qctx)
+{
+    CpaStatus sts;
+    unsigned int i;
+    int ret = 1;
 
-        INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_HMAC_KEY_SET);
+    sts = cpaCySymRemoveSession(qctx->instanceHandle, qctx->session_ctx);
+    if (sts != CPA_STATUS_SUCCESS) {
+        WARN("[%s] cpaCySymRemoveSession FAILED, sts = %d.!\n", __func__, sts);
+        ret = 0;
+    }
 
-        sts = cpaCySymInitSession(qctx->instanceHandle,
-                                  qat_chained_callbackFn,
-                                  ssd, qctx->session_ctx);
+    for (i = 0; i < qctx->num_spread; i++) {
+        sts = cpaCySymRemoveSession(qctx->spread_inst[i],
+                                    qctx->spread_sess[i]);
         if (sts != CPA_STATUS_SUCCESS) {
-            WARN("[%s] --- cpaCySymInitSession failed.\n", __func__);
-            retVal = 0;
-        } else {
-            INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_QAT_SESSION_INIT);
-            retVal = 1;
+            WARN("[%s] cpaCySymRemoveSession FAILED, sts = %d.!\n",
+                 __func__, sts);
+            ret = 0;
         }
-        break;
+    }
+    return ret;
+}
 
-    case EVP_CTRL_AEAD_TLS1_AAD:
-        /* This returns the amount of padding required for
-           the send/encrypt direction.
-         */
-        if (arg != TLS_VIRT_HDR_SIZE || qctx->aad_ctr >= QAT_MAX_PIPELINES) {
-            WARN("[%s] Invalid argument for AEAD_TLS1_AAD.\n", __func__);
-            retVal = -1;
-            break;
-        }
-        hdr = GET_TLS_HDR(qctx, qctx->aad_ctr);
-        memcpy(hdr, ptr, TLS_VIRT_HDR_SIZE);
-        qctx->aad_ctr++;
-        if (qctx->aad_ctr > 1)
-            INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_PPL_AADCTR_SET);
+/******************************************************************************
+* function:
+*         qat_chained_meta_size(qat_chained_ctx *qctx, Cpa32U num_bufs,
+*                               Cpa32U *msize)
+*
+* @param qctx     [IN]  - pointer to existing qat_chained_ctx
+* @param num_bufs [IN]  - number of buffers of the buffer lists
+* @param msize    [OUT] - size of the buffer list metadata
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function returns the largest metadata size needed by the
+*  instances of qctx as the buffer lists are submitted to any of them.
+*
+******************************************************************************/
+static int qat_chained_meta_size(qat_chained_ctx *qctx, Cpa32U num_bufs,
+                                 Cpa32U *msize)
+{
+    Cpa32U size = 0;
+    unsigned int i;
 
-        len = GET_TLS_PAYLOAD_LEN(((char *)ptr));
-        if (GET_TLS_VERSION(((char *)ptr)) >= TLS1_1_VERSION)
-            len -= EVP_CIPHER_CTX_iv_length(ctx);
-        else if (qctx->aad_ctr > 1) {
-            /* pipelines are not supported for
-             * TLS version < TLS1.1
-             */
-            WARN("[%s] AAD already set for TLS1.0\n", __func__);
-            retVal = -1;
-            break;
+    if (cpaCyBufferListGetMetaSize(qctx->instanceHandle, num_bufs,
+                                   msize) != CPA_STATUS_SUCCESS)
+        return 0;
+    for (i = 0; i < qctx->num_spread; i++) {
+        if (cpaCyBufferListGetMetaSize(qctx->spread_inst[i], num_bufs,
+                                       &size) != CPA_STATUS_SUCCESS)
+            return 0;
+        if (size > *msize)
+            *msize = size;
+    }
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*         qat_setup_op_params(EVP_CIPHER_CTX *ctx)
+*
+* @param qctx    [IN]  - pointer to existing qat_chained_ctx
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function initialises the flatbuffer and flat buffer list for use.
+*
+******************************************************************************/
+static int qat_setup_op_params(EVP_CIPHER_CTX *ctx)
+{
+    CpaCySymOpData *opd = NULL;
+    Cpa32U msize = 0;
+    qat_chained_ctx *qctx = qat_chained_data(ctx);
+    int i = 0;
+    unsigned int start;
+
+    /* When no pipelines are used, numpipes = 1. The actual number of pipes are
+     * not known until the start of do_cipher.
+     */
+    if (PIPELINE_USED(qctx)) {
+        /* When Pipes have been previously used, the memory has been allocated
+         * for max supported pipes although initialised only for numpipes.
+         */
+        start = qctx->npipes_last_used;
+    } else {
+        start = 1;
+        /* When the context switches from using no pipes to using pipes,
+         * free the previous allocated memory.
+         */
+        if (qctx->qop != NULL && qctx->qop_len < qctx->numpipes) {
+            qat_chained_ciphers_free_qop(&qctx->qop, &qctx->qop_len);
+            DEBUG_PPL("[%s:%p] qop memory freed\n", __func__, ctx);
         }
+    }
 
-        if (EVP_CIPHER_CTX_encrypting(ctx))
-            retVal = (int)(((len + dlen + AES_BLOCK_SIZE)
-                            & -AES_BLOCK_SIZE) - len);
-        else
-            retVal = dlen;
+    /* Allocate memory for qop depending on whether pipes are used or not.
+     * In case of pipes, allocate for the maximum supported pipes.
+     */
+    if (qctx->qop == NULL) {
+        if (PIPELINE_USED(qctx)) {
+            WARN("[%s] Pipeline used but no data allocated. \
+                  Possible memory leak", __func__);
+        }
 
-        INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_TLS_HDR_SET);
-        break;
+        qctx->qop_len = qctx->numpipes > 1 ? QAT_MAX_PIPELINES : 1;
+        qctx->qop = (qat_op_params *) OPENSSL_zalloc(sizeof(qat_op_params)
+                                                     * qctx->qop_len);
+        if (qctx->qop == NULL) {
+            WARN("[%s] Unable to allocate memory[%d bytes] for qat op params\n",
+                 __func__, sizeof(qat_op_params) * qctx->qop_len);
+            return 0;
+        }
+        /* start from 0 as New array of qat_op_params */
+        start = 0;
+    }
 
-        /* All remaining cases are exclusive to pipelines and are not
-         * used with small packet offload feature.
+    for (i = start; i < qctx->numpipes; i++) {
+        /* This is a whole block the size of the memory alignment. If the
+         * alignment was to become smaller than the header size
+         * (TLS_VIRT_HEADER_SIZE) which is unlikely then we would need to add
+         * some more logic here to work out how many blocks of size
+         * QAT_BYTE_ALIGNMENT we need to allocate to fit the header in.
          */
+        FLATBUFF_ALLOC_AND_CHAIN(qctx->qop[i].src_fbuf[0],
+                                 qctx->qop[i].dst_fbuf[0], QAT_BYTE_ALIGNMENT);
+        if (qctx->qop[i].src_fbuf[0].pData == NULL) {
+            WARN("[%s] Unable to allocate memory for TLS header\n", __func__);
+            goto err;
+        }
+        memset(qctx->qop[i].src_fbuf[0].pData, 0, QAT_BYTE_ALIGNMENT);
+
+        qctx->qop[i].src_fbuf[1].pData = NULL;
+        qctx->qop[i].dst_fbuf[1].pData = NULL;
+        qctx->qop[i].payload_buf = NULL;
+        qctx->qop[i].payload_buf_len = 0;
+
+        qctx->qop[i].src_sgl.numBuffers = 2;
+        qctx->qop[i].src_sgl.pBuffers = qctx->qop[i].src_fbuf;
+        qctx->qop[i].src_sgl.pUserData = NULL;
+        qctx->qop[i].src_sgl.pPrivateMetaData = NULL;
+
+        qctx->qop[i].dst_sgl.numBuffers = 2;
+        qctx->qop[i].dst_sgl.pBuffers = qctx->qop[i].dst_fbuf;
+        qctx->qop[i].dst_sgl.pUserData = NULL;
+        qctx->qop[i].dst_sgl.pPrivateMetaData = NULL;
+
+        if (QAT_IS_AEAD(EVP_CIPHER_CTX_nid(ctx))) {
+            /* AEAD ciphers only process the payload, the header block
+             * holds the AAD and the computed tag instead.
+             */
+            qctx->qop[i].src_sgl.numBuffers = 1;
+            qctx->qop[i].src_sgl.pBuffers = &qctx->qop[i].src_fbuf[1];
+            qctx->qop[i].dst_sgl.numBuffers = 1;
+            qctx->qop[i].dst_sgl.pBuffers = &qctx->qop[i].dst_fbuf[1];
+        }
+
+        /* setup meta data for buffer lists */
+        if (msize == 0 &&
+            !qat_chained_meta_size(qctx, qctx->qop[i].src_sgl.numBuffers,
+                                   &msize)) {
+            WARN("[%s] --- cpaCyBufferListGetBufferSize failed.\n", __func__);
+            goto err;
+        }
+
+        if (msize) {
+            qctx->qop[i].src_sgl.pPrivateMetaData =
+                qaeCryptoMemAlloc(msize, __FILE__, __LINE__);
+            qctx->qop[i].dst_sgl.pPrivateMetaData =
+                qaeCryptoMemAlloc(msize, __FILE__, __LINE__);
+            if (qctx->qop[i].src_sgl.pPrivateMetaData == NULL ||
+                qctx->qop[i].dst_sgl.pPrivateMetaData == NULL) {
+                WARN("[%s] QMEM alloc failed for PrivateData\n", __func__);
+                goto err;
+            }
+        }
+
+        opd = &qctx->qop[i].op_data;
+
+        /* Copy the opData template */
+        memcpy(opd, &template_opData, sizeof(template_opData));
+
+        /* Update Opdata */
+        opd->sessionCtx = qctx->session_ctx;
+        opd->pIv = qaeCryptoMemAlloc(EVP_CIPHER_CTX_iv_length(ctx),
+                                     __FILE__, __LINE__);
+        if (opd->pIv == NULL) {
+            WARN("[%s] --- QMEM Mem Alloc failed for pIv for pipe %d.\n",
+                 __func__, i);
+            goto err;
+        }
+
+        opd->ivLenInBytes = (Cpa32U) EVP_CIPHER_CTX_iv_length(ctx);
+
+        if (QAT_IS_AEAD(EVP_CIPHER_CTX_nid(ctx))) {
+            opd->cryptoStartSrcOffsetInBytes = 0;
+            opd->pAdditionalAuthData = qctx->qop[i].src_fbuf[0].pData;
+            opd->pDigestResult = qctx->qop[i].src_fbuf[0].pData +
+                                 QAT_AEAD_TAG_OFFSET;
+        }
+    }
+
+    DEBUG_PPL("[%s:%p] qop setup for %d elements\n",
+              __func__, ctx, qctx->qop_len);
+    return 1;
+
+ err:
+    qat_chained_ciphers_free_qop(&qctx->qop, &qctx->qop_len);
+    return 0;
+}
+
+/******************************************************************************
+* function:
+*         qat_setup_payload(qat_op_params *qop, unsigned char *data, int len,
+*                           int copylen, int in_place)
+*
+* @param qop      [IN]  - operation parameters of the pipe
+* @param data     [IN]  - payload of the record
+* @param len      [IN]  - length of the payload processed by QAT
+* @param copylen  [IN]  - number of bytes of data to copy
+* @param in_place [IN]  - whether the output is written over the input
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function points the payload flat buffers of a pipe at pinned
+*  memory. A record processed in place in a buffer obtained from the pinned
+*  memory functions is used directly. Otherwise the data is copied into the
+*  payload buffer of the pipe which is kept across records and only
+*  reallocated when the record does not fit in it.
+*
+******************************************************************************/
+static int qat_setup_payload(qat_op_params *qop, unsigned char *data, int len,
+                             int copylen, int in_place)
+{
+    if (in_place && len > 0 && copylen == len &&
+        qat_pinned_buf_contains(data, len)) {
+        qop->src_fbuf[1].pData = data;
+        qop->dst_fbuf[1].pData = data;
+    } else {
+        if (qop->payload_buf == NULL || qop->payload_buf_len < len) {
+            QAT_CLEANSE_QMEMFREE_BUFF(qop->payload_buf, qop->payload_buf_len);
+            qop->payload_buf_len = 0;
+            qop->payload_buf = qaeCryptoMemAlloc(len > 0 ? len : 1,
+                                                 __FILE__, __LINE__);
+            if (qop->payload_buf == NULL) {
+                WARN("[%s] --- src/dst buffer allocation.\n", __func__);
+                qop->src_fbuf[1].pData = qop->dst_fbuf[1].pData = NULL;
+                return 0;
+            }
+            qop->payload_buf_len = len;
+        }
+        qop->src_fbuf[1].pData = qop->payload_buf;
+        qop->dst_fbuf[1].pData = qop->payload_buf;
+        if (copylen > 0)
+            memcpy(qop->payload_buf, data, copylen);
+    }
+    qop->src_fbuf[1].dataLenInBytes = len;
+    qop->dst_fbuf[1].dataLenInBytes = len;
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*         qat_set_pipeline_ctrl(qat_chained_ctx *qctx, int type, int arg,
+*                               void *ptr)
+*
+* @param qctx   [IN]  - pointer to the cipher context data
+* @param type   [IN]  - one of the EVP_CTRL_SET_PIPELINE_* requests
+* @param arg    [IN]  - number of pipes
+* @param ptr    [IN]  - array of buffers or lengths, one per pipe
+*
+* @retval 1      function succeeded
+* @retval -1     function failed
+*
+* description:
+*    This function records the pipeline buffers supplied through the
+*  EVP_CIPHER_CTX_ctrl() interface.
+*
+******************************************************************************/
+static int qat_set_pipeline_ctrl(qat_chained_ctx *qctx, int type, int arg,
+                                 void *ptr)
+{
+    switch (type) {
     case EVP_CTRL_SET_PIPELINE_OUTPUT_BUFS:
         if (arg > QAT_MAX_PIPELINES) {
             WARN("[%s] PIPELINE_OUTPUT_BUFS npipes(%d) > Max(%d).\n",
@@ -973,463 +1781,2869 @@ int qat_chained_ciphers_ctrl(EVP_CIPHER_CTX *ctx, int type, int arg, void *ptr)
         return 1;
 
     default:
-        WARN("[%s] --- unknown type parameter.\n", __func__);
         return -1;
     }
-
-#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
-    /* Openssl EVP implementation changes the size of payload encoded in TLS
-     * header pointed by ptr for EVP_CTRL_AEAD_TLS1_AAD, hence call is made
-     * here after ptr has been processed by engine implementation.
-     */
-    EVP_CIPHER_CTX_set_cipher_data(ctx, qctx->sw_ctx_data);
-    EVP_CIPHER_meth_get_ctrl(GET_SW_CIPHER(ctx)) (ctx, type, arg, ptr);
-    EVP_CIPHER_CTX_set_cipher_data(ctx, qctx);
-#endif
-    return retVal;
 }
 
 /******************************************************************************
 * function:
-*    qat_chained_ciphers_cleanup(EVP_CIPHER_CTX *ctx)
+*         qat_chained_ciphers_init(EVP_CIPHER_CTX *ctx,
+*                                    const unsigned char *inkey,
+*                                    const unsigned char *iv,
+*                                    int enc)
 *
 * @param ctx    [IN]  - pointer to existing ctx
+* @param inKey  [IN]  - input cipher key
+* @param iv     [IN]  - initialisation vector
+* @param enc    [IN]  - 1 encrypt 0 decrypt
 *
 * @retval 1      function succeeded
 * @retval 0      function failed
 *
 * description:
-*    This function will cleanup all allocated resources required to perfrom the
-*  cryptographic transform.
+*    This function initialises the cipher and hash algorithm parameters for this
+*  EVP context.
 *
 ******************************************************************************/
-int qat_chained_ciphers_cleanup(EVP_CIPHER_CTX *ctx)
+int qat_chained_ciphers_init(EVP_CIPHER_CTX *ctx,
+                             const unsigned char *inkey,
+                             const unsigned char *iv, int enc)
 {
-    qat_chained_ctx *qctx = NULL;
-    CpaStatus sts = 0;
     CpaCySymSessionSetupData *ssd = NULL;
-    int retVal = 1;
+    qat_chained_ctx *qctx = NULL;
+    EVP_CIPHER_CTX *pad_ctx = NULL;
+    unsigned char *ckey = NULL;
+    int ckeylen;
+    int dlen;
+    int rekey;
 
-    if (ctx == NULL) {
-        WARN("[%s] ctx parameter is NULL.\n", __func__);
+    if (ctx == NULL || inkey == NULL) {
+        WARN("[%s] ctx or inkey is NULL.\n", __func__);
         return 0;
     }
 
     qctx = qat_chained_data(ctx);
     if (qctx == NULL) {
-        WARN("[%s] qctx parameter is NULL.\n", __func__);
+        WARN("[%s] --- qctx is NULL.\n", __func__);
         return 0;
     }
-#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
-    OPENSSL_free(qctx->sw_ctx_data);
-#endif
-
-    /* ctx may be cleaned before it gets a chance to allocate qop */
-    qat_chained_ciphers_free_qop(&qctx->qop, &qctx->qop_len);
 
-    ssd = qctx->session_data;
-    if (ssd) {
-        if (INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_SESSION_INIT)) {
-            sts = cpaCySymRemoveSession(qctx->instanceHandle,
-                                        qctx->session_ctx);
-            if (sts != CPA_STATUS_SUCCESS) {
-                WARN("[%s] cpaCySymRemoveSession FAILED, sts = %d.!\n",
-                     __func__, sts);
-                retVal = 0;
-            }
-        }
-        QAT_QMEMFREE_BUFF(qctx->session_ctx);
-        QAT_CLEANSE_FREE_BUFF(ssd->hashSetupData.authModeSetupData.authKey,
-                              ssd->hashSetupData.authModeSetupData.
-                              authKeyLenInBytes);
-        QAT_CLEANSE_FREE_BUFF(ssd->cipherSetupData.pCipherKey,
-                              ssd->cipherSetupData.cipherKeyLenInBytes);
-        OPENSSL_free(ssd);
-    }
+    /* A context keyed again, as on renegotiation, keeps its memory and its
+     * session contexts. The session is set up again with the new keys when
+     * the HMAC key is set or on first use.
+     */
+    rekey = INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_CTX_INIT);
+    if (rekey && INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_SESSION_INIT) &&
+        !qat_chained_session_remove(qctx))
+        return 0;
 
     INIT_SEQ_CLEAR_ALL_FLAGS(qctx);
-    DEBUG_PPL("[%s:%p] EVP CTX cleaned up\n", __func__, ctx);
-    return retVal;
-}
 
-/******************************************************************************
-* function:
-*    qat_chained_ciphers_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
-*                                  const unsigned char *in, size_t len)
-*
-* @param ctx    [IN]  - pointer to existing ctx
-* @param out   [OUT]  - output buffer for transform result
+    if (iv != NULL)
+        memcpy(EVP_CIPHER_CTX_iv_noconst(ctx), iv,
+               EVP_CIPHER_CTX_iv_length(ctx));
+    else
+        memset(EVP_CIPHER_CTX_iv_noconst(ctx), 0,
+               EVP_CIPHER_CTX_iv_length(ctx));
+
+    ckeylen = EVP_CIPHER_CTX_key_length(ctx);
+
+    if (rekey) {
+        ssd = qctx->session_data;
+        ckey = ssd->cipherSetupData.pCipherKey;
+        memset(qctx->hmac_key, 0, get_hmac_key_size(EVP_CIPHER_CTX_nid(ctx)));
+        qat_chained_ciphers_free_qop(&qctx->qop, &qctx->qop_len);
+        qctx->etm = 0;
+        qctx->aad_ctr = 0;
+        qctx->p_in = NULL;
+        qctx->p_out = NULL;
+        qctx->p_inlen = NULL;
+        qctx->next_inst = 0;
+    } else {
+        ckey = OPENSSL_malloc(ckeylen);
+        if (ckey == NULL) {
+            WARN("[%s] --- unable to allocate memory for Cipher key.\n",
+                 __func__);
+            return 0;
+        }
+
+        /* The padding context is kept when the cipher is initialised again */
+        pad_ctx = qctx->pad_ctx;
+        memset(qctx, 0, sizeof(*qctx));
+        qctx->pad_ctx = pad_ctx;
+
+        qctx->hmac_key =
+            OPENSSL_zalloc(get_hmac_key_size(EVP_CIPHER_CTX_nid(ctx)));
+        if (qctx->hmac_key == NULL) {
+            WARN("[%s] Unable to allocate memory for HMAC Key\n", __func__);
+            goto end;
+        }
+    }
+    memcpy(ckey, inkey, ckeylen);
+
+    qctx->numpipes = 1;
+    qctx->total_op = 0;
+    qctx->npipes_last_used = 1;
+
+#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
+    /* Ciphers without a software implementation are always offloaded */
+    const EVP_CIPHER *sw_cipher = GET_SW_CIPHER(ctx);
+    if (sw_cipher != NULL) {
+        unsigned int sw_size = EVP_CIPHER_impl_ctx_size(sw_cipher);
+        if (sw_size != 0 && qctx->sw_ctx_data == NULL) {
+            qctx->sw_ctx_data = OPENSSL_zalloc(sw_size);
+            if (qctx->sw_ctx_data == NULL) {
+                WARN("[%s] Unable to allocate memory[ %d bytes] for sw_ctx_data\n",
+                     __func__, sw_size);
+                goto end;
+            }
+        }
+
+        EVP_CIPHER_CTX_set_cipher_data(ctx, qctx->sw_ctx_data);
+        EVP_CIPHER_meth_get_init(sw_cipher) (ctx, inkey, iv, enc);
+        EVP_CIPHER_CTX_set_cipher_data(ctx, qctx);
+    }
+#endif
+
+    if (ssd == NULL) {
+        ssd = OPENSSL_malloc(sizeof(CpaCySymSessionSetupData));
+        if (ssd == NULL) {
+            WARN("OPENSSL_malloc() failed for session setup data allocation.\n");
+            goto end;
+        }
+        qctx->session_data = ssd;
+    }
+
+    /* Copy over the template for most of the values */
+    memcpy(ssd, &template_ssd, sizeof(template_ssd));
+
+    /* Change constant values for decryption */
+    if (!enc) {
+        ssd->cipherSetupData.cipherDirection =
+            CPA_CY_SYM_CIPHER_DIRECTION_DECRYPT;
+        ssd->algChainOrder = CPA_CY_SYM_ALG_CHAIN_ORDER_CIPHER_THEN_HASH;
+        ssd->verifyDigest = CPA_TRUE;
+    }
+
+    ssd->cipherSetupData.cipherKeyLenInBytes = ckeylen;
+    ssd->cipherSetupData.pCipherKey = ckey;
+
+    if (!enc) {
+        /* Key schedule computed once per session instead of once per record */
+        if (qctx->pad_ctx == NULL
+            && (qctx->pad_ctx = EVP_CIPHER_CTX_new()) == NULL) {
+            WARN("[%s] Unable to allocate the padding cipher context\n",
+                 __func__);
+            goto end;
+        }
+        if (!EVP_DecryptInit_ex(qctx->pad_ctx,
+                                qat_sw_cipher(ckeylen == AES_KEY_SIZE_128 ?
+                                              NID_aes_128_cbc :
+                                              NID_aes_256_cbc),
+                                NULL, inkey, NULL)
+            || !EVP_CIPHER_CTX_set_padding(qctx->pad_ctx, 0)) {
+            WARN("[%s] Failed to key the padding cipher context\n", __func__);
+            goto end;
+        }
+    }
+
+    dlen = get_digest_len(EVP_CIPHER_CTX_nid(ctx));
+
+    ssd->hashSetupData.digestResultLenInBytes = dlen;
+
+    if (dlen == SHA384_DIGEST_LENGTH)
+        ssd->hashSetupData.hashAlgorithm = CPA_CY_SYM_HASH_SHA384;
+    else if (dlen != SHA_DIGEST_LENGTH)
+        ssd->hashSetupData.hashAlgorithm = CPA_CY_SYM_HASH_SHA256;
+
+    ssd->hashSetupData.authModeSetupData.authKey = qctx->hmac_key;
+
+    if (!rekey) {
+        qctx->instanceHandle = get_next_inst();
+        if (qctx->instanceHandle == NULL) {
+            WARN("[%s] Failed to get QAT Instance Handle!.\n", __func__);
+            goto end;
+        }
+
+        qctx->session_ctx = qat_sess_ctx_alloc(qctx->instanceHandle, ssd,
+                                               &qctx->session_ctx_size);
+        if (qctx->session_ctx == NULL)
+            goto end;
+
+        qat_chained_spread_setup(qctx);
+
+        qctx->qop = NULL;
+        qctx->qop_len = 0;
+    }
+
+    INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_QAT_CTX_INIT);
+
+    DEBUG_PPL("[%s:%p] qat chained cipher ctx %p initialised\n",
+              __func__, ctx, qctx);
+    return 1;
+
+ end:
+    QAT_CLEANSE_FREE_BUFF(ckey, ckeylen);
+    QAT_CLEANSE_FREE_BUFF(qctx->hmac_key,
+                          get_hmac_key_size(EVP_CIPHER_CTX_nid(ctx)));
+    OPENSSL_free(qctx->session_data);
+    qctx->session_data = NULL;
+    qat_sess_ctx_free(qctx->session_ctx, qctx->session_ctx_size);
+    qctx->session_ctx = NULL;
+    qat_chained_spread_free(qctx, 0);
+#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
+    OPENSSL_free(qctx->sw_ctx_data);
+    qctx->sw_ctx_data = NULL;
+#endif
+    EVP_CIPHER_CTX_free(qctx->pad_ctx);
+    qctx->pad_ctx = NULL;
+
+    return 0;
+}
+
+/******************************************************************************
+* function:
+*    qat_chained_copy_reset(qat_chained_ctx *out_qctx)
+*
+* @param out_qctx [IN]  - plain copy of a qat_chained_ctx
+*
+* description:
+*    This function drops the resources the plain copy made by
+*  EVP_CIPHER_CTX_copy() shares with its source, so that out_qctx can be
+*  cleaned up on its own whatever happens next. The state of the TLS record
+*  and of the AEAD message is kept, the pipeline buffers are not.
+*
+******************************************************************************/
+static void qat_chained_copy_reset(qat_chained_ctx *out_qctx)
+{
+    out_qctx->hmac_key = NULL;
+#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
+    out_qctx->sw_ctx_data = NULL;
+#endif
+    out_qctx->sw_ctx = NULL;
+    out_qctx->pad_ctx = NULL;
+    out_qctx->session_data = NULL;
+    out_qctx->session_ctx = NULL;
+    out_qctx->session_ctx_size = 0;
+    out_qctx->num_spread = 0;
+    out_qctx->next_inst = 0;
+    out_qctx->qop = NULL;
+    out_qctx->qop_len = 0;
+    out_qctx->p_in = NULL;
+    out_qctx->p_out = NULL;
+    out_qctx->p_inlen = NULL;
+    out_qctx->aad_buf = NULL;
+    out_qctx->aad_buf_len = 0;
+    out_qctx->sess_aad_len = -1;
+    CLEAR_PIPELINE(out_qctx);
+    INIT_SEQ_CLEAR_FLAG(out_qctx, INIT_SEQ_QAT_SESSION_INIT |
+                                  INIT_SEQ_PPL_USED);
+}
+
+/******************************************************************************
+* function:
+*    qat_chained_copy_session(const qat_chained_ctx *qctx,
+*                             qat_chained_ctx *out_qctx)
+*
+* @param qctx     [IN]  - source qat_chained_ctx
+* @param out_qctx [OUT] - qat_chained_ctx reset by qat_chained_copy_reset()
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function gives out_qctx its own session setup data, cipher key and
+*  session context on the instance of qctx. The QAT session is not shared,
+*  it is initialised for out_qctx on first use.
+*
+******************************************************************************/
+static int qat_chained_copy_session(const qat_chained_ctx *qctx,
+                                    qat_chained_ctx *out_qctx)
+{
+    const CpaCySymSessionSetupData *ssd = qctx->session_data;
+    CpaCySymSessionSetupData *out_ssd = NULL;
+
+    out_ssd = OPENSSL_memdup(ssd, sizeof(*ssd));
+    if (out_ssd == NULL) {
+        WARN("[%s] Failed to allocate session setup data\n", __func__);
+        return 0;
+    }
+    /* The keys are owned by qctx until they are duplicated */
+    out_ssd->cipherSetupData.pCipherKey = NULL;
+    out_ssd->hashSetupData.authModeSetupData.authKey = NULL;
+    out_qctx->session_data = out_ssd;
+
+    out_ssd->cipherSetupData.pCipherKey =
+        OPENSSL_memdup(ssd->cipherSetupData.pCipherKey,
+                       ssd->cipherSetupData.cipherKeyLenInBytes);
+    if (out_ssd->cipherSetupData.pCipherKey == NULL) {
+        WARN("[%s] Failed to allocate the cipher key\n", __func__);
+        return 0;
+    }
+
+    out_qctx->session_ctx = qat_sess_ctx_alloc(qctx->instanceHandle, out_ssd,
+                                               &out_qctx->session_ctx_size);
+    return out_qctx->session_ctx != NULL;
+}
+
+/******************************************************************************
+* function:
+*    qat_chained_ciphers_copy(EVP_CIPHER_CTX *ctx, EVP_CIPHER_CTX *out)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param out    [OUT] - destination ctx of the copy
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function copies the chained cipher ctx for EVP_CIPHER_CTX_copy().
+*  The copy gets its own keys, session setup data and QAT sessions on the
+*  instances of ctx. The padding key schedule and the software context are
+*  copied rather than computed again.
+*
+******************************************************************************/
+static int qat_chained_ciphers_copy(EVP_CIPHER_CTX *ctx, EVP_CIPHER_CTX *out)
+{
+    qat_chained_ctx *qctx = qat_chained_data(ctx);
+    qat_chained_ctx *out_qctx = NULL;
+    int hmac_key_size = get_hmac_key_size(EVP_CIPHER_CTX_nid(ctx));
+    unsigned int i;
+
+    if (out == NULL || (out_qctx = qat_chained_data(out)) == NULL) {
+        WARN("[%s] out or its qctx is NULL\n", __func__);
+        return 0;
+    }
+
+    /* The destination holds a plain copy of qctx at this point */
+    qat_chained_copy_reset(out_qctx);
+    if (!INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_CTX_INIT))
+        return 1;
+
+#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
+    if (qctx->sw_ctx_data != NULL) {
+        const EVP_CIPHER *sw = GET_SW_CIPHER(ctx);
+
+        out_qctx->sw_ctx_data =
+            OPENSSL_memdup(qctx->sw_ctx_data, EVP_CIPHER_impl_ctx_size(sw));
+        if (out_qctx->sw_ctx_data == NULL) {
+            WARN("[%s] Failed to allocate sw_ctx_data\n", __func__);
+            return 0;
+        }
+    }
+#endif
+
+    if (qctx->pad_ctx != NULL) {
+        if ((out_qctx->pad_ctx = EVP_CIPHER_CTX_new()) == NULL ||
+            !EVP_CIPHER_CTX_copy(out_qctx->pad_ctx, qctx->pad_ctx)) {
+            WARN("[%s] Failed to copy the padding cipher context\n",
+                 __func__);
+            return 0;
+        }
+    }
+
+    if (!qat_chained_copy_session(qctx, out_qctx))
+        return 0;
+
+    /* The HMAC key is freed through the session setup data */
+    out_qctx->hmac_key = OPENSSL_memdup(qctx->hmac_key, hmac_key_size);
+    if (out_qctx->hmac_key == NULL) {
+        WARN("[%s] Unable to allocate memory for HMAC Key\n", __func__);
+        return 0;
+    }
+    out_qctx->session_data->hashSetupData.authModeSetupData.authKey =
+        out_qctx->hmac_key;
+
+    /* The records of the copy are spread over the same instances */
+    for (i = 0; i < qctx->num_spread; i++) {
+        out_qctx->spread_sess[i] =
+            qat_sess_ctx_alloc(qctx->spread_inst[i], out_qctx->session_data,
+                               &out_qctx->spread_size[i]);
+        if (out_qctx->spread_sess[i] == NULL)
+            break;
+        out_qctx->spread_inst[i] = qctx->spread_inst[i];
+        out_qctx->num_spread++;
+    }
+
+    DEBUG_PPL("[%s:%p] qat chained cipher ctx %p copied to %p\n",
+              __func__, ctx, qctx, out_qctx);
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*    qat_chained_ciphers_ctrl(EVP_CIPHER_CTX *ctx,
+*                             int type, int arg, void *ptr)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param type   [IN]  - type of request either
+*                       EVP_CTRL_AEAD_SET_MAC_KEY, EVP_CTRL_AEAD_TLS1_AAD,
+*                       EVP_CTRL_QAT_ENCRYPT_THEN_MAC or EVP_CTRL_COPY
+* @param arg    [IN]  - size of the pointed to by ptr
+* @param ptr    [IN]  - input buffer contain the necessary parameters
+*
+* @retval x      The return value is dependent on the type of request being made
+*       EVP_CTRL_AEAD_SET_MAC_KEY return of 1 is success
+*       EVP_CTRL_AEAD_TLS1_AAD return value indicates the amount fo padding to
+*               be applied to the SSL/TLS record
+* @retval -1     function failed
+*
+* description:
+*    This function is a generic control interface provided by the EVP API. For
+*  chained requests this interface is used fro setting the hmac key value for
+*  authentication of the SSL/TLS record. The second type is used to specify the
+*  TLS virtual header which is used in the authentication calculationa nd to
+*  identify record payload size. The third type selects the encrypt-then-MAC
+*  order of RFC 7366 instead of MAC-then-encrypt. The last type copies the
+*  ctx for EVP_CIPHER_CTX_copy().
+*
+******************************************************************************/
+int qat_chained_ciphers_ctrl(EVP_CIPHER_CTX *ctx, int type, int arg, void *ptr)
+{
+    qat_chained_ctx *qctx = NULL;
+    unsigned char *hmac_key = NULL;
+    CpaCySymSessionSetupData *ssd = NULL;
+    SHA_CTX hkey1;
+    SHA256_CTX hkey256;
+    SHA512_CTX hkey384;
+    char *hdr = NULL;
+    unsigned int len = 0;
+    int retVal = 0;
+    int dlen = 0;
+
+    if (ctx == NULL) {
+        WARN("[%s] --- ctx parameter is NULL.\n", __func__);
+        return -1;
+    }
+
+    qctx = qat_chained_data(ctx);
+
+    if (qctx == NULL) {
+        WARN("[%s] --- qctx is NULL.\n", __func__);
+        return -1;
+    }
+
+    dlen = get_digest_len(EVP_CIPHER_CTX_nid(ctx));
+
+    switch (type) {
+    case EVP_CTRL_AEAD_SET_MAC_KEY:
+        hmac_key = qctx->hmac_key;
+        ssd = qctx->session_data;
+
+        memset(hmac_key, 0, get_hmac_key_size(EVP_CIPHER_CTX_nid(ctx)));
+
+        if (arg > get_hmac_key_size(EVP_CIPHER_CTX_nid(ctx))) {
+            if (dlen == SHA_DIGEST_LENGTH) {
+                SHA1_Init(&hkey1);
+                SHA1_Update(&hkey1, ptr, arg);
+                SHA1_Final(hmac_key, &hkey1);
+            } else if (dlen == SHA384_DIGEST_LENGTH) {
+                SHA384_Init(&hkey384);
+                SHA384_Update(&hkey384, ptr, arg);
+                SHA384_Final(hmac_key, &hkey384);
+            } else {
+                SHA256_Init(&hkey256);
+                SHA256_Update(&hkey256, ptr, arg);
+                SHA256_Final(hmac_key, &hkey256);
+            }
+        } else {
+            memcpy(hmac_key, ptr, arg);
+            ssd->hashSetupData.authModeSetupData.authKeyLenInBytes = arg;
+        }
+
+        INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_HMAC_KEY_SET);
+
+        /* A new MAC key replaces the session set up with the previous one */
+        if (INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_SESSION_INIT)) {
+            if (!qat_chained_session_remove(qctx))
+                return 0;
+            INIT_SEQ_CLEAR_FLAG(qctx, INIT_SEQ_QAT_SESSION_INIT);
+        }
+
+        retVal = qat_chained_session_init(qctx);
+        break;
+
+    case EVP_CTRL_AEAD_TLS1_AAD:
+        /* This returns the amount of padding required for
+           the send/encrypt direction.
+         */
+        if (arg != TLS_VIRT_HDR_SIZE || qctx->aad_ctr >= QAT_MAX_PIPELINES) {
+            WARN("[%s] Invalid argument for AEAD_TLS1_AAD.\n", __func__);
+            retVal = -1;
+            break;
+        }
+        hdr = GET_TLS_HDR(qctx, qctx->aad_ctr);
+        memcpy(hdr, ptr, TLS_VIRT_HDR_SIZE);
+        qctx->aad_ctr++;
+        if (qctx->aad_ctr > 1)
+            INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_PPL_AADCTR_SET);
+
+        len = GET_TLS_PAYLOAD_LEN(((char *)ptr));
+        if (GET_TLS_VERSION(((char *)ptr)) >= TLS1_1_VERSION)
+            len -= EVP_CIPHER_CTX_iv_length(ctx);
+        else if (qctx->aad_ctr > 1) {
+            /* pipelines are not supported for
+             * TLS version < TLS1.1
+             */
+            WARN("[%s] AAD already set for TLS1.0\n", __func__);
+            retVal = -1;
+            break;
+        }
+
+        if (!EVP_CIPHER_CTX_encrypting(ctx))
+            retVal = dlen;
+        else if (qctx->etm)
+            /* The MAC follows the padded payload */
+            retVal = (int)(((len + AES_BLOCK_SIZE) & -AES_BLOCK_SIZE)
+                           - len + dlen);
+        else
+            retVal = (int)(((len + dlen + AES_BLOCK_SIZE)
+                            & -AES_BLOCK_SIZE) - len);
+
+        INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_TLS_HDR_SET);
+        break;
+
+    case EVP_CTRL_QAT_ENCRYPT_THEN_MAC:
+        ssd = qctx->session_data;
+        if (ssd == NULL)
+            return -1;
+        qctx->etm = arg != 0;
+        /* The MAC covers the ciphertext, it is computed after encryption
+         * and verified before decryption.
+         */
+        if (EVP_CIPHER_CTX_encrypting(ctx) == qctx->etm)
+            ssd->algChainOrder = CPA_CY_SYM_ALG_CHAIN_ORDER_CIPHER_THEN_HASH;
+        else
+            ssd->algChainOrder = CPA_CY_SYM_ALG_CHAIN_ORDER_HASH_THEN_CIPHER;
+
+        /* The session is set up again with the new order on next use */
+        if (INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_SESSION_INIT)) {
+            if (!qat_chained_session_remove(qctx))
+                return -1;
+            INIT_SEQ_CLEAR_FLAG(qctx, INIT_SEQ_QAT_SESSION_INIT);
+        }
+        /* The software implementation has no encrypt-then-MAC mode */
+        return 1;
+
+        /* All remaining cases are exclusive to pipelines and are not
+         * used with small packet offload feature.
+         */
+    case EVP_CTRL_SET_PIPELINE_OUTPUT_BUFS:
+    case EVP_CTRL_SET_PIPELINE_INPUT_BUFS:
+    case EVP_CTRL_SET_PIPELINE_INPUT_LENS:
+        return qat_set_pipeline_ctrl(qctx, type, arg, ptr);
+
+    case EVP_CTRL_COPY:
+        /* The software context data is copied along with qctx */
+        return qat_chained_ciphers_copy(ctx, (EVP_CIPHER_CTX *)ptr);
+
+    default:
+        WARN("[%s] --- unknown type parameter.\n", __func__);
+        return -1;
+    }
+
+#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
+    /* Openssl EVP implementation changes the size of payload encoded in TLS
+     * header pointed by ptr for EVP_CTRL_AEAD_TLS1_AAD, hence call is made
+     * here after ptr has been processed by engine implementation.
+     */
+    if (GET_SW_CIPHER(ctx) != NULL) {
+        EVP_CIPHER_CTX_set_cipher_data(ctx, qctx->sw_ctx_data);
+        EVP_CIPHER_meth_get_ctrl(GET_SW_CIPHER(ctx)) (ctx, type, arg, ptr);
+        EVP_CIPHER_CTX_set_cipher_data(ctx, qctx);
+    }
+#endif
+    return retVal;
+}
+
+/******************************************************************************
+* function:
+*    qat_chained_ciphers_cleanup(EVP_CIPHER_CTX *ctx)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function will cleanup all allocated resources required to perfrom the
+*  cryptographic transform.
+*
+******************************************************************************/
+int qat_chained_ciphers_cleanup(EVP_CIPHER_CTX *ctx)
+{
+    qat_chained_ctx *qctx = NULL;
+    CpaCySymSessionSetupData *ssd = NULL;
+    int retVal = 1;
+
+    if (ctx == NULL) {
+        WARN("[%s] ctx parameter is NULL.\n", __func__);
+        return 0;
+    }
+
+    qctx = qat_chained_data(ctx);
+    if (qctx == NULL) {
+        WARN("[%s] qctx parameter is NULL.\n", __func__);
+        return 0;
+    }
+#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
+    OPENSSL_free(qctx->sw_ctx_data);
+#endif
+    EVP_CIPHER_CTX_free(qctx->pad_ctx);
+    qctx->pad_ctx = NULL;
+
+    /* ctx may be cleaned before it gets a chance to allocate qop */
+    qat_chained_ciphers_free_qop(&qctx->qop, &qctx->qop_len);
+
+    ssd = qctx->session_data;
+    if (ssd) {
+        if (INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_SESSION_INIT) &&
+            !qat_chained_session_remove(qctx))
+            retVal = 0;
+        qat_sess_ctx_free(qctx->session_ctx, qctx->session_ctx_size);
+        qctx->session_ctx = NULL;
+        qat_chained_spread_free(qctx, 0);
+        QAT_CLEANSE_FREE_BUFF(ssd->hashSetupData.authModeSetupData.authKey,
+                              ssd->hashSetupData.authModeSetupData.
+                              authKeyLenInBytes);
+        QAT_CLEANSE_FREE_BUFF(ssd->cipherSetupData.pCipherKey,
+                              ssd->cipherSetupData.cipherKeyLenInBytes);
+        OPENSSL_free(ssd);
+    }
+
+    INIT_SEQ_CLEAR_ALL_FLAGS(qctx);
+    DEBUG_PPL("[%s:%p] EVP CTX cleaned up\n", __func__, ctx);
+    return retVal;
+}
+
+/******************************************************************************
+* function:
+*    qat_chained_etm_check_pad(const unsigned char *data, int len)
+*
+* @param data   [IN]  - decrypted payload and padding of a record
+* @param len    [IN]  - length of data
+*
+* @retval 1      the padding is valid
+* @retval 0      the padding is invalid
+*
+* description:
+*    This function checks the padding of a record decrypted with
+*  encrypt-then-MAC.
+*
+******************************************************************************/
+static int qat_chained_etm_check_pad(const unsigned char *data, int len)
+{
+    int pad_len, i;
+
+    if (len <= 0)
+        return 0;
+    pad_len = data[len - 1];
+    if (pad_len >= len)
+        return 0;
+    for (i = len - pad_len - 1; i < len - 1; i++) {
+        if (data[i] != pad_len)
+            return 0;
+    }
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*    qat_chained_ciphers_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+*                                  const unsigned char *in, size_t len)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param out   [OUT]  - output buffer for transform result
+* @param in     [IN]  - input buffer
+* @param len    [IN]  - length of input buffer
+*
+* @retval 0      function failed
+* @retval 1      function succeeded
+*
+* description:
+*    This function performs the cryptographic transform according to the
+*  parameters setup during initialisation.
+*
+******************************************************************************/
+int qat_chained_ciphers_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+                                  const unsigned char *in, size_t len)
+{
+    CpaStatus sts = 0;
+    CpaCySymOpData *opd = NULL;
+    CpaBufferList *s_sgl = NULL;
+    CpaBufferList *d_sgl = NULL;
+    CpaFlatBuffer *d_fbuf = NULL;
+    int retVal = 0;
+    unsigned int pad_check = 1;
+    int pad_len = 0;
+    int plen = 0;
+    int plen_adj = 0;
+    struct op_done_pipe done;
+    QAT_PKT_SAMPLE sample = QAT_PKT_SAMPLE_INIT;
+    qat_chained_ctx *qctx = NULL;
+    unsigned char *inb, *outb;
+    unsigned char out_blk[QAT_TLS_PAD_BLK_LEN] = { 0x0 };
+    const unsigned char *in_blk = NULL;
+    unsigned int ivlen = 0;
+    unsigned int inst = 0;
+    int dlen, vtls, enc, i, buflen;
+    int discardlen = 0;
+    /* Length of the ciphertext of the record */
+    int ctlen = 0;
+    int maclen;
+    unsigned char *mac_data = NULL;
+    char *tls_hdr = NULL;
+    int pipe = 0;
+    int error = 0;
+    int in_place = 0;
+    unsigned char *seg_in[QAT_CHAINED_MAX_SEGS];
+    unsigned char *seg_out[QAT_CHAINED_MAX_SEGS];
+    size_t seg_len[QAT_CHAINED_MAX_SEGS];
+    size_t max_len, off;
+    int nseg = 1;
+
+    if (ctx == NULL) {
+        WARN("[%s] CTX parameter is NULL.\n", __func__);
+        return 0;
+    }
+
+    qctx = qat_chained_data(ctx);
+    if (qctx == NULL || !INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_CTX_INIT)) {
+        WARN("[%s] %s\n", __func__, qctx == NULL ? "QAT CTX NULL"
+             : "QAT Context not initialised");
+        return 0;
+    }
+
+    /* Pipeline initialisation requires multiple EVP_CIPHER_CTX_ctrl
+     * calls to set all required parameters. Check if all have been
+     * provided. For Pipeline, in and out buffers can be NULL as these
+     * are supplied through ctrl messages.
+     */
+    dlen = get_digest_len(EVP_CIPHER_CTX_nid(ctx));
+    /* With encrypt-then-MAC TLS records end with the MAC */
+    maclen = qctx->etm && TLS_HDR_SET(qctx) ? dlen : 0;
+
+    if (PIPELINE_INCOMPLETE_INIT(qctx) ||
+        (!PIPELINE_SET(qctx) && (in == NULL || out == NULL
+                                 || ((len - maclen) % AES_BLOCK_SIZE)))) {
+        WARN("[%s] %s \n", __func__,
+             PIPELINE_INCOMPLETE_INIT(qctx) ?
+             "Pipeline not initialised completely" :
+             (len - maclen) % AES_BLOCK_SIZE
+             ? "Buffer Length not multiple of AES block size"
+             : "in/out buffer null");
+        return 0;
+    }
+
+    /* Without TLS header the input is CBC data whose IV carries over from
+     * one call to the next. Longer inputs than a call handles are processed
+     * a part at a time, one segment when encrypting as each block is
+     * chained on the previous ciphertext.
+     */
+    if (!PIPELINE_SET(qctx) && !TLS_HDR_SET(qctx)) {
+        max_len = QAT_CHAINED_SEG_LEN;
+        if (!EVP_CIPHER_CTX_encrypting(ctx))
+            max_len *= QAT_CHAINED_MAX_SEGS;
+        if (len > max_len) {
+            for (off = 0; off < len; off += max_len) {
+                if (qat_chained_ciphers_do_cipher(ctx, out + off, in + off,
+                                                  len - off < max_len ?
+                                                  len - off : max_len) != 1)
+                    return 0;
+            }
+            return 1;
+        }
+    }
+
+    /* Digest verification is part of the session. When decrypting there
+     * is only a stored digest to verify in TLS records, so the session is
+     * set up again when switching between records and plain CBC data.
+     */
+    if (!EVP_CIPHER_CTX_encrypting(ctx) &&
+        qctx->session_data->verifyDigest != (TLS_HDR_SET(qctx) ? CPA_TRUE
+                                                               : CPA_FALSE)) {
+        if (INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_SESSION_INIT)) {
+            if (!qat_chained_session_remove(qctx))
+                return 0;
+            INIT_SEQ_CLEAR_FLAG(qctx, INIT_SEQ_QAT_SESSION_INIT);
+        }
+        qctx->session_data->verifyDigest = TLS_HDR_SET(qctx) ? CPA_TRUE
+                                                             : CPA_FALSE;
+    }
+
+    if (!INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_SESSION_INIT)) {
+        /* The qat session is initialized when HMAC key is set. In case
+         * HMAC key is not explicitly set, use default HMAC key of all zeros
+         * and initialise a qat session.
+         */
+        if (!qat_chained_session_init(qctx))
+            return 0;
+    }
+
+    enc = EVP_CIPHER_CTX_encrypting(ctx);
+    ivlen = EVP_CIPHER_CTX_iv_length(ctx);
+
+    /* Check and setup data structures for pipeline */
+    if (PIPELINE_SET(qctx)) {
+        /* All the aad data (tls header) should be present */
+        if (qctx->aad_ctr != qctx->numpipes) {
+            WARN("[%s] AAD data missing supplied %d of %d\n",
+                 __func__, qctx->aad_ctr, qctx->numpipes);
+            return 0;
+        }
+    } else {
+#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
+        /* Records are always offloaded when there is no software
+         * implementation of the cipher or of encrypt-then-MAC.
+         */
+        if (GET_SW_CIPHER(ctx) != NULL && !qctx->etm &&
+            qat_pkt_threshold_sw(EVP_CIPHER_CTX_nid(ctx), len, &sample)) {
+            EVP_CIPHER_CTX_set_cipher_data(ctx, qctx->sw_ctx_data);
+            retVal = EVP_CIPHER_meth_get_do_cipher(GET_SW_CIPHER(ctx))
+                     (ctx, out, in, len);
+            EVP_CIPHER_CTX_set_cipher_data(ctx, qctx);
+            goto cleanup;
+        }
+#endif
+        /* When no TLS AAD information is supplied, for example: speed,
+         * the payload length for encrypt/decrypt is equal to buffer len
+         * and the HMAC is to be discarded. Set the fake AAD hdr to avoid
+         * decision points in code for this special case handling.
+         */
+        if (!TLS_HDR_SET(qctx)) {
+            tls_hdr = GET_TLS_HDR(qctx, 0);
+            /* Mark an invalid tls version */
+            tls_hdr[9] = tls_hdr[10] = 0;
+            /* Set the payload length equal to entire length
+             * of buffer i.e. there is no space for HMAC in
+             * buffer.
+             */
+            SET_TLS_PAYLOAD_LEN(tls_hdr, 0);
+            plen = len;
+            /* Find the extra length for qat buffers to store the HMAC and
+             * padding which is later discarded when the result is copied out.
+             */
+            if (qctx->etm)
+                discardlen = ((len + AES_BLOCK_SIZE) & -AES_BLOCK_SIZE)
+                    - len + dlen;
+            else
+                discardlen = ((len + dlen + AES_BLOCK_SIZE) & -AES_BLOCK_SIZE)
+                    - len;
+            /* Decryption segments are processed concurrently */
+            if (!enc && len > QAT_CHAINED_SEG_LEN)
+                nseg = (len + QAT_CHAINED_SEG_LEN - 1) / QAT_CHAINED_SEG_LEN;
+            /* Pump-up the len by this amount */
+            len += discardlen;
+        }
+        /* If the same ctx is being re-used for multiple invocation
+         * of this function without setting EVP_CTRL for number of pipes,
+         * the PIPELINE_SET is true from previous invocation. Clear Pipeline
+         * when add_ctr is 1. This means user wants to switch from pipeline mode
+         * to non-pipeline mode for the same ctx.
+         */
+        CLEAR_PIPELINE(qctx);
+
+        if (nseg > 1) {
+            /* Each segment is a pipe with the same fake header */
+            for (i = 0; i < nseg; i++) {
+                off = (size_t)i * QAT_CHAINED_SEG_LEN;
+                seg_in[i] = (unsigned char *)in + off;
+                seg_out[i] = out + off;
+                seg_len[i] = (len - discardlen - off < QAT_CHAINED_SEG_LEN ?
+                              len - discardlen - off : QAT_CHAINED_SEG_LEN)
+                             + discardlen;
+                if (i > 0)
+                    memcpy(GET_TLS_HDR(qctx, i), tls_hdr, TLS_VIRT_HDR_SIZE);
+            }
+            qctx->numpipes = nseg;
+            qctx->p_in = seg_in;
+            qctx->p_out = seg_out;
+            qctx->p_inlen = seg_len;
+        } else {
+            /* setting these helps avoid decision branches when
+             * pipelines are not used.
+             */
+            qctx->p_in = (unsigned char **)&in;
+            qctx->p_out = &out;
+            qctx->p_inlen = &len;
+        }
+    }
+
+    DEBUG_PPL("[%s:%p] Start Cipher operation with num pipes %d\n",
+              __func__, ctx, qctx->numpipes);
+
+    if ((qat_setup_op_params(ctx) != 1) ||
+        (initOpDonePipe(&done, qctx->numpipes) != 1))
+        return 0;
+
+    do {
+        opd = &qctx->qop[pipe].op_data;
+        tls_hdr = GET_TLS_HDR(qctx, pipe);
+        vtls = GET_TLS_VERSION(tls_hdr);
+        d_fbuf = qctx->qop[pipe].dst_fbuf;
+        s_sgl = &qctx->qop[pipe].src_sgl;
+        d_sgl = &qctx->qop[pipe].src_sgl;
+        inb = &qctx->p_in[pipe][0];
+        outb = &qctx->p_out[pipe][0];
+        buflen = qctx->p_inlen[pipe];
+        in_place = (inb == outb);
+
+        if (vtls >= TLS1_1_VERSION) {
+            /*
+             * Note: The OpenSSL framework assumes that the IV field will be part
+             * of the output data. In order to chain HASH and CIPHER we need to
+             * present contiguous SGL to QAT, copy IV to output buffer now and
+             * skip it for chained operation.
+             */
+            if (inb != outb)
+                memcpy(outb, inb, ivlen);
+            memcpy(opd->pIv, inb, ivlen);
+            inb += ivlen;
+            buflen -= ivlen;
+            plen_adj = ivlen;
+        } else if (qctx->numpipes > 1 && TLS_HDR_SET(qctx)) {
+            WARN("[%s] Pipe %d tls hdr version < tls1.1\n", __func__, pipe);
+            error = 1;
+            break;
+        } else if (pipe == 0) {
+            memcpy(opd->pIv, EVP_CIPHER_CTX_iv(ctx), ivlen);
+        } else {
+            /* A segment of an input split above chains from the last block
+             * of the previous one. The input is copied to the payload
+             * buffers so it is still unchanged.
+             */
+            memcpy(opd->pIv, inb - ivlen, ivlen);
+        }
+
+        /* Without TLS header the whole segment is payload */
+        if (!TLS_HDR_SET(qctx))
+            plen = buflen - discardlen;
+
+        /* Calculate payload and padding len */
+        if (enc) {
+            /* For encryption, payload length is in the header.
+             * For non-TLS use case, plen has already been set above.
+             * For TLS Version > 1.1 the payload length also contains IV len.
+             */
+            if (vtls >= TLS1_VERSION)
+                plen = GET_TLS_PAYLOAD_LEN(tls_hdr) - plen_adj;
+
+            /* Compute the padding length using total buffer length, payload
+             * length, digest length and a byte to encode padding len.
+             */
+            pad_len = buflen - (plen + dlen) - 1;
+
+            /* If padlen is negative, then size of supplied output buffer
+             * is smaller than required.
+             */
+            if (((buflen - (qctx->etm ? dlen : 0)) % AES_BLOCK_SIZE) != 0 ||
+                pad_len < 0 || pad_len > TLS_MAX_PADDING_LENGTH) {
+                WARN("[%s] buffer len[%d] or pad_len[%d] incorrect\n", __func__,
+                     buflen, pad_len);
+                error = 1;
+                break;
+            }
+        } else if (qctx->etm) {
+            if (buflen - dlen <= 0 || (buflen - dlen) % AES_BLOCK_SIZE) {
+                WARN("[%s] buffer len[%d] incorrect\n", __func__, buflen);
+                error = 1;
+                break;
+            }
+        } else if (vtls >= TLS1_VERSION) {
+            /* Decrypt the last block of the buffer to get the pad_len.
+             * Calculate payload len using total length and padlen.
+             * NOTE: plen so calculated does not account for ivlen
+             *       if iv is appened for TLS Version >= 1.1
+             */
+            unsigned int tmp_padlen = TLS_MAX_PADDING_LENGTH + 1;
+            unsigned int maxpad;
+            int outl = 0;
+
+            if ((buflen - dlen) <= TLS_MAX_PADDING_LENGTH)
+                tmp_padlen = (((buflen - dlen) + (AES_BLOCK_SIZE - 1))
+                              / AES_BLOCK_SIZE) * AES_BLOCK_SIZE;
+            in_blk = inb + (buflen - tmp_padlen);
+
+            /* The decrypted blocks end the block of TLS_MAX_PADDING_LENGTH
+             * + 1 bytes checked for the padding, the bytes before them stay
+             * zeroed.
+             */
+            if (qctx->pad_ctx == NULL
+                || !EVP_DecryptInit_ex(qctx->pad_ctx, NULL, NULL, NULL,
+                                       in_blk - AES_BLOCK_SIZE)
+                || !EVP_DecryptUpdate(qctx->pad_ctx,
+                                      out_blk + sizeof(out_blk) - tmp_padlen,
+                                      &outl, in_blk, tmp_padlen)) {
+                WARN("[%s] Failed to decrypt the padding\n", __func__);
+                error = 1;
+                break;
+            }
+
+            pad_len = out_blk[sizeof(out_blk) - 1];
+            /* Determine the maximum amount of padding that could be present */
+            maxpad = buflen - (dlen + 1);
+            maxpad |=
+                (TLS_MAX_PADDING_LENGTH - maxpad) >> (sizeof(maxpad) * 8 - 8);
+            maxpad &= TLS_MAX_PADDING_LENGTH;
+
+            /* Check the padding in constant time */
+            pad_check &= qat_constant_time_tls_pad_check(out_blk, pad_len,
+                                                         maxpad);
+
+            /* Adjust the amount of data to digest to be the maximum by setting
+             * pad_len = 0 if the padding check failed or if the padding length
+             * is greater than the maximum padding allowed. This adjustment
+             * is done in constant time.
+             */
+            pad_check &= qat_constant_time_ge(maxpad, pad_len);
+            pad_len *= pad_check;
+            plen = buflen - (pad_len + 1 + dlen);
+        }
+
+        if (qctx->etm) {
+            /* The MAC follows the ciphertext and covers the header, the
+             * explicit IV and the ciphertext. The header and the IV are
+             * placed at the end of the first flatbuffer.
+             */
+            ctlen = buflen - dlen;
+            mac_data = d_fbuf[0].pData + d_fbuf[0].dataLenInBytes - plen_adj;
+            memcpy(mac_data, opd->pIv, plen_adj);
+            mac_data -= TLS_VIRT_HDR_SIZE;
+            memcpy(mac_data, tls_hdr, TLS_VIRT_HDR_SIZE);
+            SET_TLS_PAYLOAD_LEN(mac_data, (plen_adj + ctlen));
+
+            opd->messageLenToCipherInBytes = ctlen;
+            opd->hashStartSrcOffsetInBytes = mac_data - d_fbuf[0].pData;
+            opd->messageLenToHashInBytes = TLS_VIRT_HDR_SIZE + plen_adj +
+                                           ctlen;
+        } else {
+            ctlen = buflen;
+            opd->messageLenToCipherInBytes = buflen;
+            opd->hashStartSrcOffsetInBytes = QAT_BYTE_ALIGNMENT -
+                                             TLS_VIRT_HDR_SIZE;
+            opd->messageLenToHashInBytes = TLS_VIRT_HDR_SIZE + plen;
+
+            /* copy tls hdr in flatbuffer's last 13 bytes */
+            memcpy(d_fbuf[0].pData +
+                   (d_fbuf[0].dataLenInBytes - TLS_VIRT_HDR_SIZE),
+                   tls_hdr, TLS_VIRT_HDR_SIZE);
+            /* Update the value of payload before HMAC calculation */
+            SET_TLS_PAYLOAD_LEN((d_fbuf[0].pData +
+                                 (d_fbuf[0].dataLenInBytes -
+                                  TLS_VIRT_HDR_SIZE)), plen);
+        }
+        /* Without TLS header only the input is output, the IV chains
+         * from its last block.
+         */
+        if (discardlen)
+            ctlen = buflen - discardlen;
+
+        if (!qat_setup_payload(&qctx->qop[pipe], inb, buflen,
+                               buflen - discardlen, in_place)) {
+            error = 1;
+            break;
+        }
+
+        if (enc && qctx->etm) {
+            /* Add padding to input buffer at end of payload */
+            for (i = plen; i < buflen - dlen; i++)
+                d_fbuf[1].pData[i] = pad_len;
+        } else if (enc) {
+            /* Add padding to input buffer at end of digest */
+            for (i = plen + dlen; i < buflen; i++)
+                d_fbuf[1].pData[i] = pad_len;
+        } else {
+            /* store IV for next cbc operation */
+            if (vtls < TLS1_1_VERSION)
+                memcpy(EVP_CIPHER_CTX_iv_noconst(ctx),
+                       inb + ctlen - ivlen, ivlen);
+        }
+
+        /* Records go to the instances of the session in turn, the pipes
+         * complete in any order and are all waited for below.
+         */
+        inst = qctx->next_inst;
+        qctx->next_inst = (inst + 1) % (qctx->num_spread + 1);
+        opd->sessionCtx = inst == 0 ? qctx->session_ctx :
+                          qctx->spread_sess[inst - 1];
+        sts = qat_batch_perform_op(inst == 0 ? qctx->instanceHandle :
+                                   qctx->spread_inst[inst - 1],
+                                   qat_chained_callbackFn, &done, opd,
+                                   s_sgl, d_sgl,
+                                   &(qctx->session_data->verifyDigest));
+        if (sts != CPA_STATUS_SUCCESS) {
+            WARN("[%s] CpaCySymPerformOp failed sts=%d.\n", __func__, sts);
+            error = 1;
+            break;
+        }
+        /* Increment after successful submission */
+        done.num_submitted++;
+    } while (++pipe < qctx->numpipes);
+
+    /* If there has been an error during submission of the pipes
+     * indicate to the callback function not to wait for the entire
+     * pipeline.
+     */
+    if (error == 1)
+        done.num_pipes = pipe;
+
+    /* If there is nothing to wait for, do not pause or yield */
+    if (done.num_submitted == 0 || (done.num_submitted == done.num_processed))
+        goto end;
+
+    do {
+        if (done.opDone.job) {
+            /* If we get a failure on qat_pause_job then we will
+               not flag an error here and quit because we have
+               an asynchronous request in flight.
+               We don't want to start cleaning up data
+               structures that are still being used. If
+               qat_pause_job fails we will just yield and
+               loop around and try again until the request
+               completes and we can continue. */
+            if (qat_pkt_sample_pause_job(&sample, done.opDone.job) == 0)
+                pthread_yield();
+        } else {
+            pthread_yield();
+        }
+    } while (!done.opDone.flag);
+
+ end:
+    qctx->total_op += done.num_processed;
+    cleanupOpDonePipe(&done);
+
+    if (error == 0 && (done.opDone.verifyResult == CPA_TRUE))
+        retVal = 1;
+
+    pipe = 0;
+    do {
+        /* Nothing to copy when the record was processed in place */
+        if (retVal == 1 && qctx->qop[pipe].dst_fbuf[1].pData ==
+            qctx->qop[pipe].payload_buf) {
+            memcpy(qctx->p_out[pipe] + plen_adj,
+                   qctx->qop[pipe].dst_fbuf[1].pData,
+                   qctx->p_inlen[pipe] - discardlen - plen_adj);
+        }
+        /* With encrypt-then-MAC the padding is checked once the MAC has
+         * been verified so it needs no constant time processing.
+         */
+        if (retVal == 1 && qctx->etm && !enc &&
+            GET_TLS_VERSION(GET_TLS_HDR(qctx, pipe)) >= TLS1_VERSION &&
+            !qat_chained_etm_check_pad(qctx->p_out[pipe] + plen_adj,
+                                       qctx->p_inlen[pipe] - plen_adj - dlen))
+            pad_check = 0;
+    } while (++pipe < qctx->numpipes);
+
+    if (enc && vtls < TLS1_1_VERSION)
+        memcpy(EVP_CIPHER_CTX_iv_noconst(ctx), outb + ctlen - ivlen, ivlen);
+
+ cleanup:
+    /*Reset the AAD counter forcing that new AAD information is provided
+     * before each repeat invocation of this function.
+     */
+    qctx->aad_ctr = 0;
+
+    /* This function can be called again with the same evp_cipher_ctx. */
+    if (PIPELINE_SET(qctx) || nseg > 1) {
+        /* Number of pipes can grow between multiple invocation of this call.
+         * Record the maximum number of pipes used so that data structures can
+         * be allocated accordingly.
+         */
+        INIT_SEQ_CLEAR_FLAG(qctx, INIT_SEQ_PPL_AADCTR_SET);
+        INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_PPL_USED);
+        qctx->npipes_last_used = qctx->numpipes > qctx->npipes_last_used
+            ? qctx->numpipes : qctx->npipes_last_used;
+    }
+    /* The segments were pipes of this call only */
+    if (nseg > 1)
+        qctx->numpipes = 1;
+    qat_pkt_sample_end(&sample, retVal == 1);
+    return retVal & pad_check;
+}
+
+/******************************************************************************
+* function:
+*         qat_gcm_iv_inc(unsigned char *iv)
+*
+* @param iv     [IN]  - GCM IV made of a fixed field and a 64 bit counter
+*
+* description:
+*    This function increments the invocation counter held in the last 8 bytes
+*  of the IV as a big endian integer.
+*
+******************************************************************************/
+static void qat_gcm_iv_inc(unsigned char *iv)
+{
+    int i;
+
+    for (i = AEAD_IV_LEN - 1; i >= EVP_GCM_TLS_FIXED_IV_LEN; i--) {
+        if (++iv[i] != 0)
+            break;
+    }
+}
+
+/******************************************************************************
+* function:
+*         qat_aead_session_init(EVP_CIPHER_CTX *ctx, int aad_len)
+*
+* @param ctx     [IN]  - pointer to existing ctx
+* @param aad_len [IN]  - length of the AAD of the next operation
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    The AAD length and the direction are part of the QAT session for
+*  AES-GCM and ChaCha20-Poly1305. This function initialises the session for
+*  the given AAD length and the current direction, removing the previous
+*  session when either of them changed.
+*
+******************************************************************************/
+static int qat_aead_session_init(EVP_CIPHER_CTX *ctx, int aad_len)
+{
+    qat_chained_ctx *qctx = qat_chained_data(ctx);
+    CpaCySymSessionSetupData *ssd = qctx->session_data;
+    int enc = EVP_CIPHER_CTX_encrypting(ctx);
+    CpaStatus sts;
+
+    if (INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_SESSION_INIT)) {
+        if (qctx->sess_aad_len == aad_len && qctx->sess_enc == enc)
+            return 1;
+
+        sts = cpaCySymRemoveSession(qctx->instanceHandle, qctx->session_ctx);
+        if (sts != CPA_STATUS_SUCCESS) {
+            WARN("[%s] cpaCySymRemoveSession FAILED, sts = %d.!\n",
+                 __func__, sts);
+            return 0;
+        }
+        INIT_SEQ_CLEAR_FLAG(qctx, INIT_SEQ_QAT_SESSION_INIT);
+    }
+
+    ssd->hashSetupData.authModeSetupData.aadLenInBytes = aad_len;
+    if (enc) {
+        ssd->cipherSetupData.cipherDirection =
+            CPA_CY_SYM_CIPHER_DIRECTION_ENCRYPT;
+        ssd->algChainOrder = CPA_CY_SYM_ALG_CHAIN_ORDER_CIPHER_THEN_HASH;
+    } else {
+        ssd->cipherSetupData.cipherDirection =
+            CPA_CY_SYM_CIPHER_DIRECTION_DECRYPT;
+        ssd->algChainOrder = CPA_CY_SYM_ALG_CHAIN_ORDER_HASH_THEN_CIPHER;
+    }
+
+    sts = cpaCySymInitSession(qctx->instanceHandle, qat_chained_callbackFn,
+                              ssd, qctx->session_ctx);
+    if (sts != CPA_STATUS_SUCCESS) {
+        WARN("[%s] cpaCySymInitSession failed! Status = %d\n", __func__, sts);
+        qctx->sess_aad_len = -1;
+        return 0;
+    }
+
+    qctx->sess_aad_len = aad_len;
+    qctx->sess_enc = enc;
+    INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_QAT_SESSION_INIT);
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*         qat_aead_perform_op(qat_chained_ctx *qctx, QAT_PKT_SAMPLE *sample)
+*
+* @param qctx   [IN]  - pointer to the cipher context data
+* @param sample [IN]  - sample of the operation or NULL
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function submits the operations prepared for each pipe and waits
+*  for all of them to complete.
+*
+******************************************************************************/
+static int qat_aead_perform_op(qat_chained_ctx *qctx, QAT_PKT_SAMPLE *sample)
+{
+    struct op_done_pipe done;
+    CpaStatus sts;
+    int pipe = 0;
+    int error = 0;
+
+    if (initOpDonePipe(&done, qctx->numpipes) != 1)
+        return 0;
+
+    do {
+        sts = qat_batch_perform_op(qctx->instanceHandle,
+                                   qat_chained_callbackFn, &done,
+                                   &qctx->qop[pipe].op_data,
+                                   &qctx->qop[pipe].src_sgl,
+                                   &qctx->qop[pipe].src_sgl,
+                                   &(qctx->session_data->verifyDigest));
+        if (sts != CPA_STATUS_SUCCESS) {
+            WARN("[%s] CpaCySymPerformOp failed sts=%d.\n", __func__, sts);
+            error = 1;
+            break;
+        }
+        /* Increment after successful submission */
+        done.num_submitted++;
+    } while (++pipe < qctx->numpipes);
+
+    if (error == 1)
+        done.num_pipes = pipe;
+
+    /* If there is nothing to wait for, do not pause or yield */
+    if (done.num_submitted != 0 && done.num_submitted != done.num_processed) {
+        do {
+            if (done.opDone.job) {
+                /* The request is in flight, keep waiting for it even if
+                 * qat_pause_job fails.
+                 */
+                if (qat_pkt_sample_pause_job(sample, done.opDone.job) == 0)
+                    pthread_yield();
+            } else {
+                pthread_yield();
+            }
+        } while (!done.opDone.flag);
+    }
+
+    qctx->total_op += done.num_processed;
+    cleanupOpDonePipe(&done);
+
+    return (error == 0 && done.opDone.verifyResult == CPA_TRUE) ? 1 : 0;
+}
+
+/******************************************************************************
+* function:
+*         qat_aead_init(EVP_CIPHER_CTX *ctx, const unsigned char *inkey,
+*                      const unsigned char *iv, int enc)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param inkey  [IN]  - input key, may be NULL
+* @param iv     [IN]  - input IV, may be NULL
+* @param enc    [IN]  - encryption or decryption
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function is called for every EVP_CipherInit_ex() on the ctx. The
+*  key and the IV are set independently of each other. The QAT session is
+*  initialised on first use as it depends on the length of the AAD.
+*
+******************************************************************************/
+int qat_aead_init(EVP_CIPHER_CTX *ctx, const unsigned char *inkey,
+                 const unsigned char *iv, int enc)
+{
+    CpaCySymSessionSetupData *ssd = NULL;
+    CpaStatus sts = 0;
+    qat_chained_ctx *qctx = NULL;
+    int ckeylen;
+
+    if (ctx == NULL) {
+        WARN("[%s] ctx is NULL.\n", __func__);
+        return 0;
+    }
+
+    qctx = qat_chained_data(ctx);
+    if (qctx == NULL || qctx->sw_ctx == NULL) {
+        WARN("[%s] --- qctx is not initialised.\n", __func__);
+        return 0;
+    }
+
+    ckeylen = EVP_CIPHER_CTX_key_length(ctx);
+
+    if (inkey != NULL) {
+        if (!INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_CTX_INIT)) {
+            ssd = OPENSSL_malloc(sizeof(CpaCySymSessionSetupData));
+            if (ssd == NULL) {
+                WARN("OPENSSL_malloc() failed for session setup data.\n");
+                return 0;
+            }
+            qctx->session_data = ssd;
+
+            memcpy(ssd, &template_ssd, sizeof(template_ssd));
+            ssd->symOperation = CPA_CY_SYM_OP_ALGORITHM_CHAINING;
+            if (QAT_IS_CHACHAPOLY(EVP_CIPHER_CTX_nid(ctx))) {
+                ssd->cipherSetupData.cipherAlgorithm =
+                    CPA_CY_SYM_CIPHER_CHACHA;
+                ssd->hashSetupData.hashAlgorithm = CPA_CY_SYM_HASH_POLY;
+            } else {
+                ssd->cipherSetupData.cipherAlgorithm =
+                    CPA_CY_SYM_CIPHER_AES_GCM;
+                ssd->hashSetupData.hashAlgorithm = CPA_CY_SYM_HASH_AES_GCM;
+            }
+            ssd->hashSetupData.hashMode = CPA_CY_SYM_HASH_MODE_AUTH;
+            ssd->hashSetupData.digestResultLenInBytes = AEAD_TAG_LEN;
+            ssd->hashSetupData.authModeSetupData.authKey = NULL;
+            ssd->hashSetupData.authModeSetupData.authKeyLenInBytes = 0;
+            /* The tag is written to the header block of the pipe and is
+             * checked by the engine so that a short tag can be verified.
+             */
+            ssd->digestIsAppended = CPA_FALSE;
+            ssd->verifyDigest = CPA_FALSE;
+
+            ssd->cipherSetupData.pCipherKey = OPENSSL_malloc(ckeylen);
+            if (ssd->cipherSetupData.pCipherKey == NULL) {
+                WARN("[%s] --- unable to allocate memory for Cipher key.\n",
+                     __func__);
+                goto err;
+            }
+            ssd->cipherSetupData.cipherKeyLenInBytes = ckeylen;
+
+            /* Not every instance supports ChaCha20-Poly1305 */
+            qctx->instanceHandle = get_next_inst_with_cap(
+                QAT_IS_CHACHAPOLY(EVP_CIPHER_CTX_nid(ctx)) ?
+                QAT_SYM_CAP_CHACHAPOLY : 0);
+            if (qctx->instanceHandle == NULL) {
+                WARN("[%s] Failed to get QAT Instance Handle!.\n", __func__);
+                goto err;
+            }
+
+            qctx->session_ctx = qat_sess_ctx_alloc(qctx->instanceHandle, ssd,
+                                                   &qctx->session_ctx_size);
+            if (qctx->session_ctx == NULL)
+                goto err;
+
+            INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_QAT_CTX_INIT);
+        } else if (INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_SESSION_INIT)) {
+            /* New key, the session is set up again on next use */
+            sts = cpaCySymRemoveSession(qctx->instanceHandle,
+                                        qctx->session_ctx);
+            if (sts != CPA_STATUS_SUCCESS) {
+                WARN("[%s] cpaCySymRemoveSession FAILED, sts = %d.!\n",
+                     __func__, sts);
+                return 0;
+            }
+            INIT_SEQ_CLEAR_FLAG(qctx, INIT_SEQ_QAT_SESSION_INIT);
+        }
+        memcpy(qctx->session_data->cipherSetupData.pCipherKey, inkey,
+               ckeylen);
+        qctx->sess_aad_len = -1;
+    }
+
+    /* Keep the software context in step for the key and the direction */
+    if (!EVP_CipherInit_ex(qctx->sw_ctx, NULL, NULL, inkey, NULL, enc)) {
+        WARN("[%s] Failed to initialise software cipher ctx.\n", __func__);
+        return 0;
+    }
+
+    if (iv != NULL) {
+        memcpy(EVP_CIPHER_CTX_iv_noconst(ctx), iv, AEAD_IV_LEN);
+        memcpy(qctx->msg_iv, iv, AEAD_IV_LEN);
+        INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_AEAD_IV_SET);
+        INIT_SEQ_CLEAR_FLAG(qctx, INIT_SEQ_AEAD_IV_FIXED);
+    }
+
+    if (inkey != NULL || iv != NULL) {
+        /* Start a new message */
+        INIT_SEQ_CLEAR_FLAG(qctx, INIT_SEQ_AEAD_UPDATE_DONE |
+                                  INIT_SEQ_AEAD_SW_MSG);
+        qctx->aad_len = 0;
+    }
+
+    DEBUG_PPL("[%s:%p] qat aead ctx %p initialised\n", __func__, ctx, qctx);
+    return 1;
+
+ err:
+    QAT_CLEANSE_FREE_BUFF(ssd->cipherSetupData.pCipherKey, ckeylen);
+    qat_sess_ctx_free(qctx->session_ctx, qctx->session_ctx_size);
+    qctx->session_ctx = NULL;
+    OPENSSL_free(ssd);
+    qctx->session_data = NULL;
+    return 0;
+}
+
+/******************************************************************************
+* function:
+*    qat_aead_copy(EVP_CIPHER_CTX *ctx, EVP_CIPHER_CTX *out)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param out    [OUT] - destination ctx of the copy
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function copies the AEAD cipher ctx for EVP_CIPHER_CTX_copy(),
+*  including the state of the message in progress. The copy gets its own
+*  software context, AAD buffer, key and QAT session on the instance of ctx.
+*  A message partly processed by QAT is finished in software by both ctx.
+*
+******************************************************************************/
+static int qat_aead_copy(EVP_CIPHER_CTX *ctx, EVP_CIPHER_CTX *out)
+{
+    qat_chained_ctx *qctx = qat_chained_data(ctx);
+    qat_chained_ctx *out_qctx = NULL;
+
+    if (out == NULL || (out_qctx = qat_chained_data(out)) == NULL) {
+        WARN("[%s] out or its qctx is NULL\n", __func__);
+        return 0;
+    }
+
+    /* The destination holds a plain copy of qctx at this point */
+    qat_chained_copy_reset(out_qctx);
+
+    /* After a first update by QAT the state of the message is in the pipe
+     * buffer of ctx, the message is carried on in software by both ctx.
+     */
+    if (INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_AEAD_UPDATE_DONE) &&
+        !INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_AEAD_SW_MSG)) {
+        if (!qat_aead_sw_start(ctx))
+            return 0;
+        INIT_SEQ_SET_FLAG(out_qctx, INIT_SEQ_AEAD_SW_MSG);
+    }
+
+    if (qctx->sw_ctx != NULL) {
+        if ((out_qctx->sw_ctx = EVP_CIPHER_CTX_new()) == NULL ||
+            !EVP_CIPHER_CTX_copy(out_qctx->sw_ctx, qctx->sw_ctx)) {
+            WARN("[%s] Failed to copy software cipher ctx.\n", __func__);
+            return 0;
+        }
+    }
+
+    if (qctx->aad_buf != NULL) {
+        out_qctx->aad_buf = qaeCryptoMemAlloc(qctx->aad_buf_len, __FILE__,
+                                              __LINE__);
+        if (out_qctx->aad_buf == NULL) {
+            WARN("[%s] QMEM alloc failed for AAD\n", __func__);
+            return 0;
+        }
+        memcpy(out_qctx->aad_buf, qctx->aad_buf, qctx->aad_buf_len);
+        out_qctx->aad_buf_len = qctx->aad_buf_len;
+    }
+
+    if (!INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_CTX_INIT))
+        return 1;
+
+    if (!qat_chained_copy_session(qctx, out_qctx))
+        return 0;
+
+    DEBUG_PPL("[%s:%p] qat aead ctx %p copied to %p\n",
+              __func__, ctx, qctx, out_qctx);
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*    qat_aead_ctrl(EVP_CIPHER_CTX *ctx, int type, int arg, void *ptr)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param type   [IN]  - type of request
+* @param arg    [IN]  - size of the pointed to by ptr
+* @param ptr    [IN]  - input buffer contain the necessary parameters
+*
+* @retval x      The return value is dependent on the type of request being made
+*       EVP_CTRL_AEAD_TLS1_AAD return value is the length of the tag
+* @retval -1     function failed
+*
+* description:
+*    This function is the generic control interface of the AEAD ciphers. It
+*  handles the IV, the tag, the TLS AAD and the pipeline requests in the same
+*  way as the OpenSSL implementation.
+*
+******************************************************************************/
+int qat_aead_ctrl(EVP_CIPHER_CTX *ctx, int type, int arg, void *ptr)
+{
+    qat_chained_ctx *qctx = NULL;
+    unsigned char *iv = NULL;
+    unsigned char *hdr = NULL;
+    unsigned int len = 0;
+    int enc;
+
+    if (ctx == NULL) {
+        WARN("[%s] --- ctx parameter is NULL.\n", __func__);
+        return -1;
+    }
+
+    qctx = qat_chained_data(ctx);
+    if (qctx == NULL) {
+        WARN("[%s] --- qctx is NULL.\n", __func__);
+        return -1;
+    }
+
+    iv = EVP_CIPHER_CTX_iv_noconst(ctx);
+    enc = EVP_CIPHER_CTX_encrypting(ctx);
+
+    switch (type) {
+    case EVP_CTRL_INIT:
+        qctx->tag_len = -1;
+        qctx->numpipes = 1;
+        qctx->npipes_last_used = 1;
+        qctx->sess_aad_len = -1;
+        qctx->sw_ctx = EVP_CIPHER_CTX_new();
+        if (qctx->sw_ctx == NULL ||
+            qat_sw_cipher(EVP_CIPHER_CTX_nid(ctx)) == NULL ||
+            !EVP_CipherInit_ex(qctx->sw_ctx,
+                               qat_sw_cipher(EVP_CIPHER_CTX_nid(ctx)),
+                               NULL, NULL, NULL, enc)) {
+            WARN("[%s] Failed to create software cipher ctx.\n", __func__);
+            EVP_CIPHER_CTX_free(qctx->sw_ctx);
+            qctx->sw_ctx = NULL;
+            return 0;
+        }
+        return 1;
+
+    case EVP_CTRL_AEAD_SET_IVLEN:
+        /* The IV is always made of a fixed field and a 64 bit counter */
+        return arg == AEAD_IV_LEN ? 1 : 0;
+
+    case EVP_CTRL_AEAD_SET_TAG:
+        if (arg <= 0 || arg > AEAD_TAG_LEN || enc)
+            return 0;
+        memcpy(qctx->tag, ptr, arg);
+        qctx->tag_len = arg;
+        return 1;
+
+    case EVP_CTRL_AEAD_GET_TAG:
+        if (arg <= 0 || arg > AEAD_TAG_LEN || !enc ||
+            qctx->tag_len < 0)
+            return 0;
+        memcpy(ptr, qctx->tag, arg);
+        return 1;
+
+    case EVP_CTRL_GCM_SET_IV_FIXED:
+        if (QAT_IS_CHACHAPOLY(EVP_CIPHER_CTX_nid(ctx))) {
+            /* The whole IV is fixed, the nonce of each record is made by
+             * xoring it with the sequence number. The software context
+             * merges the nonce when given the AAD, so it gets the IV now.
+             */
+            if (arg != AEAD_IV_LEN ||
+                EVP_CIPHER_CTX_ctrl(qctx->sw_ctx, type, arg, ptr) <= 0)
+                return 0;
+            memcpy(iv, ptr, arg);
+            INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_AEAD_IV_FIXED);
+            return 1;
+        }
+        /* Special case: -1 length restores whole IV */
+        if (arg == -1) {
+            memcpy(iv, ptr, AEAD_IV_LEN);
+        } else {
+            /* Fixed field must be at least 4 bytes and invocation field
+             * at least 8.
+             */
+            if (arg < EVP_GCM_TLS_FIXED_IV_LEN ||
+                (AEAD_IV_LEN - arg) < EVP_GCM_TLS_EXPLICIT_IV_LEN)
+                return 0;
+            memcpy(iv, ptr, arg);
+            if (enc && RAND_bytes(iv + arg, AEAD_IV_LEN - arg) <= 0)
+                return 0;
+        }
+        INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_AEAD_IV_FIXED);
+        return 1;
+
+    case EVP_CTRL_GCM_IV_GEN:
+        if (QAT_IS_CHACHAPOLY(EVP_CIPHER_CTX_nid(ctx)))
+            return -1;
+        if (!INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_AEAD_IV_FIXED) ||
+            !INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_CTX_INIT))
+            return 0;
+        memcpy(qctx->msg_iv, iv, AEAD_IV_LEN);
+        if (arg <= 0 || arg > AEAD_IV_LEN)
+            arg = AEAD_IV_LEN;
+        memcpy(ptr, iv + AEAD_IV_LEN - arg, arg);
+        qat_gcm_iv_inc(iv);
+        break;
+
+    case EVP_CTRL_GCM_SET_IV_INV:
+        if (QAT_IS_CHACHAPOLY(EVP_CIPHER_CTX_nid(ctx)))
+            return -1;
+        if (!INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_AEAD_IV_FIXED) ||
+            !INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_CTX_INIT) || enc ||
+            arg <= 0 || arg > EVP_GCM_TLS_EXPLICIT_IV_LEN)
+            return 0;
+        memcpy(iv + AEAD_IV_LEN - arg, ptr, arg);
+        memcpy(qctx->msg_iv, iv, AEAD_IV_LEN);
+        break;
+
+    case EVP_CTRL_AEAD_TLS1_AAD:
+        if (arg != TLS_VIRT_HDR_SIZE || qctx->aad_ctr >= QAT_MAX_PIPELINES) {
+            WARN("[%s] Invalid argument for AEAD_TLS1_AAD.\n", __func__);
+            return -1;
+        }
+        hdr = (unsigned char *)GET_TLS_HDR(qctx, qctx->aad_ctr);
+        memcpy(hdr, ptr, TLS_VIRT_HDR_SIZE);
+
+        /* Correct the length in the stored header for the explicit IV
+         * and, when decrypting, the tag.
+         */
+        len = GET_TLS_PAYLOAD_LEN(hdr);
+        if (len < QAT_AEAD_TLS_EIV_LEN(EVP_CIPHER_CTX_nid(ctx)))
+            return -1;
+        len -= QAT_AEAD_TLS_EIV_LEN(EVP_CIPHER_CTX_nid(ctx));
+        if (!enc) {
+            if (len < AEAD_TAG_LEN)
+                return -1;
+            len -= AEAD_TAG_LEN;
+        }
+        SET_TLS_PAYLOAD_LEN(hdr, len);
+
+        qctx->aad_ctr++;
+        if (qctx->aad_ctr > 1)
+            INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_PPL_AADCTR_SET);
+        INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_TLS_HDR_SET);
+
+        /* The software context gets the unmodified header for the records
+         * processed in software.
+         */
+        if (EVP_CIPHER_CTX_ctrl(qctx->sw_ctx, type, arg, ptr) <= 0)
+            return -1;
+        return AEAD_TAG_LEN;
+
+    case EVP_CTRL_SET_PIPELINE_OUTPUT_BUFS:
+    case EVP_CTRL_SET_PIPELINE_INPUT_BUFS:
+    case EVP_CTRL_SET_PIPELINE_INPUT_LENS:
+        return qat_set_pipeline_ctrl(qctx, type, arg, ptr);
+
+    case EVP_CTRL_COPY:
+        return qat_aead_copy(ctx, (EVP_CIPHER_CTX *)ptr);
+
+    default:
+        return -1;
+    }
+
+    /* A new message is started with the IV in msg_iv */
+    INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_AEAD_IV_SET);
+    INIT_SEQ_CLEAR_FLAG(qctx, INIT_SEQ_AEAD_UPDATE_DONE | INIT_SEQ_AEAD_SW_MSG);
+    qctx->aad_len = 0;
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*    qat_aead_tls_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+*                       const unsigned char *in, size_t len)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param out   [OUT]  - output buffer for transform result
+* @param in     [IN]  - input buffer
+* @param len    [IN]  - length of input buffer
+*
+* @retval x      length of the record for encryption, length of the
+*                plaintext for AES-GCM decryption
+* @retval -1     function failed
+*
+* description:
+*    This function encrypts or decrypts TLS records. Each record is made of
+*  the explicit IV (AES-GCM only), the payload and the tag, the AAD has been
+*  supplied with EVP_CTRL_AEAD_TLS1_AAD. Records can be processed in
+*  pipelines.
+*
+******************************************************************************/
+static int qat_aead_tls_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+                              const unsigned char *in, size_t len)
+{
+    qat_chained_ctx *qctx = qat_chained_data(ctx);
+    unsigned char *iv = EVP_CIPHER_CTX_iv_noconst(ctx);
+    unsigned char *inb, *outb, *tag;
+    CpaCySymOpData *opd = NULL;
+    int enc = EVP_CIPHER_CTX_encrypting(ctx);
+    int chachapoly = QAT_IS_CHACHAPOLY(EVP_CIPHER_CTX_nid(ctx));
+    int eivlen = QAT_AEAD_TLS_EIV_LEN(EVP_CIPHER_CTX_nid(ctx));
+    QAT_PKT_SAMPLE sample = QAT_PKT_SAMPLE_INIT;
+    int retVal = -1;
+    int i;
+    int total = 0;
+    int plen = 0;
+    int pipe = 0;
+    int error = 0;
+
+    /* The fixed field of the IV must have been set */
+    if (!INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_AEAD_IV_FIXED)) {
+        WARN("[%s] IV not set for TLS records\n", __func__);
+        goto cleanup;
+    }
+
+    if (PIPELINE_SET(qctx)) {
+        /* All the aad data (tls header) should be present */
+        if (qctx->aad_ctr != qctx->numpipes) {
+            WARN("[%s] AAD data missing supplied %d of %d\n",
+                 __func__, qctx->aad_ctr, qctx->numpipes);
+            goto cleanup;
+        }
+    } else {
+        if (qctx->aad_ctr != 1) {
+            WARN("[%s] AAD data missing supplied %d of 1\n",
+                 __func__, qctx->aad_ctr);
+            goto cleanup;
+        }
+#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
+        if (qat_pkt_threshold_sw(EVP_CIPHER_CTX_nid(ctx), len, &sample)) {
+            /* The software ctx already has the AAD, give it the IV. The
+             * ChaCha20-Poly1305 nonce was set up along with the AAD.
+             */
+            if (!chachapoly &&
+                EVP_CIPHER_CTX_ctrl(qctx->sw_ctx, EVP_CTRL_GCM_SET_IV_FIXED,
+                                    -1, iv) <= 0)
+                goto cleanup;
+            retVal = EVP_Cipher(qctx->sw_ctx, out, in, len);
+            if (!chachapoly && enc && retVal >= 0)
+                qat_gcm_iv_inc(iv);
+            goto cleanup;
+        }
+#endif
+        CLEAR_PIPELINE(qctx);
+        qctx->p_in = (unsigned char **)&in;
+        qctx->p_out = &out;
+        qctx->p_inlen = &len;
+    }
+
+    for (pipe = 0; pipe < qctx->numpipes; pipe++) {
+        if (qctx->p_in[pipe] == NULL || qctx->p_out[pipe] == NULL ||
+            qctx->p_inlen[pipe] < eivlen + AEAD_TAG_LEN) {
+            WARN("[%s] Invalid record for pipe %d\n", __func__, pipe);
+            goto cleanup;
+        }
+    }
+
+    DEBUG_PPL("[%s:%p] Start AEAD operation with num pipes %d\n",
+              __func__, ctx, qctx->numpipes);
+
+    if (!qat_aead_session_init(ctx, TLS_VIRT_HDR_SIZE) ||
+        qat_setup_op_params(ctx) != 1)
+        goto cleanup;
+
+    for (pipe = 0; pipe < qctx->numpipes; pipe++) {
+        opd = &qctx->qop[pipe].op_data;
+        inb = qctx->p_in[pipe];
+        outb = qctx->p_out[pipe];
+        plen = qctx->p_inlen[pipe] - eivlen - AEAD_TAG_LEN;
+
+        if (chachapoly) {
+            /* The nonce is the IV xored with the sequence number, which
+             * starts the AAD. The record has no explicit IV.
+             */
+            memcpy(opd->pIv, iv, AEAD_IV_LEN);
+            for (i = 0; i < EVP_GCM_TLS_EXPLICIT_IV_LEN; i++)
+                opd->pIv[AEAD_IV_LEN - EVP_GCM_TLS_EXPLICIT_IV_LEN + i] ^=
+                    ((unsigned char *)GET_TLS_HDR(qctx, pipe))[i];
+        } else if (enc) {
+            /* The explicit IV is the invocation field of the IV */
+            memcpy(opd->pIv, iv, AEAD_IV_LEN);
+            memcpy(outb, iv + EVP_GCM_TLS_FIXED_IV_LEN,
+                   EVP_GCM_TLS_EXPLICIT_IV_LEN);
+            qat_gcm_iv_inc(iv);
+        } else {
+            memcpy(opd->pIv, iv, EVP_GCM_TLS_FIXED_IV_LEN);
+            memcpy(opd->pIv + EVP_GCM_TLS_FIXED_IV_LEN, inb,
+                   EVP_GCM_TLS_EXPLICIT_IV_LEN);
+        }
+
+        /* The AAD is at the start of the header block */
+        memcpy(qctx->qop[pipe].src_fbuf[0].pData, GET_TLS_HDR(qctx, pipe),
+               TLS_VIRT_HDR_SIZE);
+        opd->pAdditionalAuthData = qctx->qop[pipe].src_fbuf[0].pData;
+        opd->messageLenToCipherInBytes = plen;
+        opd->messageLenToHashInBytes = 0;
+
+        if (!qat_setup_payload(&qctx->qop[pipe],
+                               inb + eivlen, plen, plen,
+                               inb == outb))
+            goto cleanup;
+    }
+
+    if (!qat_aead_perform_op(qctx, &sample))
+        goto cleanup;
+
+    for (pipe = 0; pipe < qctx->numpipes; pipe++) {
+        inb = qctx->p_in[pipe];
+        outb = qctx->p_out[pipe];
+        plen = qctx->p_inlen[pipe] - eivlen - AEAD_TAG_LEN;
+        tag = qctx->qop[pipe].src_fbuf[0].pData + QAT_AEAD_TAG_OFFSET;
+
+        /* Nothing to copy when the record was processed in place */
+        if (qctx->qop[pipe].dst_fbuf[1].pData == qctx->qop[pipe].payload_buf)
+            memcpy(outb + eivlen, qctx->qop[pipe].payload_buf, plen);
+
+        if (enc) {
+            memcpy(outb + eivlen + plen, tag, AEAD_TAG_LEN);
+            total += qctx->p_inlen[pipe];
+        } else {
+            if (CRYPTO_memcmp(tag, inb + eivlen + plen, AEAD_TAG_LEN))
+                error = 1;
+            /* ChaCha20-Poly1305 returns the record length either way */
+            total += chachapoly ? qctx->p_inlen[pipe] : plen;
+        }
+    }
+
+    if (error) {
+        /* Do not release any plaintext when a record fails to verify */
+        for (pipe = 0; pipe < qctx->numpipes; pipe++)
+            OPENSSL_cleanse(qctx->p_out[pipe] + eivlen,
+                            qctx->p_inlen[pipe] - eivlen - AEAD_TAG_LEN);
+    } else {
+        retVal = total;
+    }
+
+ cleanup:
+    /* Reset the AAD counter forcing that new AAD information is provided
+     * before each repeat invocation of this function.
+     */
+    qctx->aad_ctr = 0;
+    INIT_SEQ_CLEAR_FLAG(qctx, INIT_SEQ_TLS_HDR_SET);
+
+    if (PIPELINE_SET(qctx)) {
+        INIT_SEQ_CLEAR_FLAG(qctx, INIT_SEQ_PPL_AADCTR_SET);
+        INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_PPL_USED);
+        qctx->npipes_last_used = qctx->numpipes > qctx->npipes_last_used
+            ? qctx->numpipes : qctx->npipes_last_used;
+    }
+    qat_pkt_sample_end(&sample, retVal >= 0);
+    return retVal;
+}
+
+/******************************************************************************
+* function:
+*    qat_aead_sw_start(EVP_CIPHER_CTX *ctx)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function moves the current message to the software context. The
+*  AAD is replayed and, when a payload has already been processed by QAT,
+*  its result is run through the software context in the other direction
+*  which brings the GHASH and the counter to the same state.
+*
+******************************************************************************/
+static int qat_aead_sw_start(EVP_CIPHER_CTX *ctx)
+{
+    qat_chained_ctx *qctx = qat_chained_data(ctx);
+    int enc = EVP_CIPHER_CTX_encrypting(ctx);
+    int outl = 0;
+    int len;
+
+    if (!EVP_CipherInit_ex(qctx->sw_ctx, NULL, NULL, NULL, qctx->msg_iv,
+                           enc))
+        return 0;
+
+    if (qctx->aad_len > 0 &&
+        !EVP_CipherUpdate(qctx->sw_ctx, NULL, &outl, qctx->aad_buf,
+                          qctx->aad_len))
+        return 0;
+
+    if (INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_AEAD_UPDATE_DONE)) {
+        /* The payload buffer holds the output of the previous update */
+        len = qctx->qop[0].dst_fbuf[1].dataLenInBytes;
+        if (!EVP_CipherInit_ex(qctx->sw_ctx, NULL, NULL, NULL, NULL, !enc)
+            || !EVP_CipherUpdate(qctx->sw_ctx, qctx->qop[0].payload_buf,
+                                 &outl, qctx->qop[0].payload_buf, len)
+            || !EVP_CipherInit_ex(qctx->sw_ctx, NULL, NULL, NULL, NULL, enc))
+            return 0;
+    }
+
+    INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_AEAD_SW_MSG);
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*    qat_aead_add_aad(qat_chained_ctx *qctx, const unsigned char *aad,
+*                    size_t len)
+*
+* @param qctx   [IN]  - pointer to the cipher context data
+* @param aad    [IN]  - AAD to add to the message
+* @param len    [IN]  - length of the AAD
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function appends AAD to the pinned AAD buffer of the message. The
+*  buffer is zero padded to a multiple of the AES block size as required by
+*  QAT.
+*
+******************************************************************************/
+static int qat_aead_add_aad(qat_chained_ctx *qctx, const unsigned char *aad,
+                           size_t len)
+{
+    unsigned int need = (qctx->aad_len + len + AES_BLOCK_SIZE - 1)
+                        & -AES_BLOCK_SIZE;
+    Cpa8U *buf = NULL;
+
+    if (need > qctx->aad_buf_len) {
+        buf = qaeCryptoMemAlloc(need, __FILE__, __LINE__);
+        if (buf == NULL) {
+            WARN("[%s] QMEM alloc failed for AAD\n", __func__);
+            return 0;
+        }
+        if (qctx->aad_len > 0)
+            memcpy(buf, qctx->aad_buf, qctx->aad_len);
+        QAT_CLEANSE_QMEMFREE_BUFF(qctx->aad_buf, qctx->aad_buf_len);
+        qctx->aad_buf = buf;
+        qctx->aad_buf_len = need;
+    }
+
+    memcpy(qctx->aad_buf + qctx->aad_len, aad, len);
+    qctx->aad_len += len;
+    memset(qctx->aad_buf + qctx->aad_len, 0, need - qctx->aad_len);
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*    qat_aead_final(EVP_CIPHER_CTX *ctx)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+*
+* @retval 0      function succeeded
+* @retval -1     function failed
+*
+* description:
+*    This function completes the message, it stores the tag when encrypting
+*  and verifies the tag set with EVP_CTRL_AEAD_SET_TAG when decrypting.
+*
+******************************************************************************/
+static int qat_aead_final(EVP_CIPHER_CTX *ctx)
+{
+    qat_chained_ctx *qctx = qat_chained_data(ctx);
+    unsigned char buf[AES_BLOCK_SIZE];
+    unsigned char *tag = NULL;
+    int enc = EVP_CIPHER_CTX_encrypting(ctx);
+    int retVal = -1;
+    int outl = 0;
+
+    if (!enc && qctx->tag_len <= 0)
+        goto end;
+
+    /* A message without payload is completed in software */
+    if (!INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_AEAD_UPDATE_DONE |
+                                    INIT_SEQ_AEAD_SW_MSG) &&
+        !qat_aead_sw_start(ctx))
+        goto end;
+
+    if (INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_AEAD_SW_MSG)) {
+        if (!enc && EVP_CIPHER_CTX_ctrl(qctx->sw_ctx, EVP_CTRL_AEAD_SET_TAG,
+                                        qctx->tag_len, qctx->tag) <= 0)
+            goto end;
+        if (!EVP_CipherFinal_ex(qctx->sw_ctx, buf, &outl))
+            goto end;
+        if (enc) {
+            if (EVP_CIPHER_CTX_ctrl(qctx->sw_ctx, EVP_CTRL_AEAD_GET_TAG,
+                                    AEAD_TAG_LEN, qctx->tag) <= 0)
+                goto end;
+            qctx->tag_len = AEAD_TAG_LEN;
+        }
+        retVal = 0;
+    } else {
+        tag = qctx->qop[0].src_fbuf[0].pData + QAT_AEAD_TAG_OFFSET;
+        if (enc) {
+            memcpy(qctx->tag, tag, AEAD_TAG_LEN);
+            qctx->tag_len = AEAD_TAG_LEN;
+            retVal = 0;
+        } else if (CRYPTO_memcmp(tag, qctx->tag, qctx->tag_len) == 0) {
+            retVal = 0;
+        }
+    }
+
+ end:
+    INIT_SEQ_CLEAR_FLAG(qctx, INIT_SEQ_AEAD_IV_SET | INIT_SEQ_AEAD_UPDATE_DONE |
+                              INIT_SEQ_AEAD_SW_MSG);
+    qctx->aad_len = 0;
+    return retVal;
+}
+
+/******************************************************************************
+* function:
+*    qat_aead_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+*                      const unsigned char *in, size_t len)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param out   [OUT]  - output buffer for transform result
+* @param in     [IN]  - input buffer
+* @param len    [IN]  - length of input buffer
+*
+* @retval x      number of bytes written to out
+* @retval -1     function failed
+*
+* description:
+*    This function performs the cryptographic transform according to the
+*  parameters setup during initialisation. TLS records are processed when
+*  the TLS AAD has been set. Otherwise the AAD is supplied with out set to
+*  NULL, the payload in a single update and the message is completed when
+*  in is NULL. A message whose AAD QAT cannot take, or with more than one
+*  payload update, is completed in software.
+*
+******************************************************************************/
+int qat_aead_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+                      const unsigned char *in, size_t len)
+{
+    qat_chained_ctx *qctx = NULL;
+    CpaCySymOpData *opd = NULL;
+    int outl = 0;
+
+    if (ctx == NULL) {
+        WARN("[%s] CTX parameter is NULL.\n", __func__);
+        return -1;
+    }
+
+    qctx = qat_chained_data(ctx);
+    if (qctx == NULL || !INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_CTX_INIT)) {
+        WARN("[%s] %s\n", __func__, qctx == NULL ? "QAT CTX NULL"
+             : "QAT Context not initialised");
+        return -1;
+    }
+
+    if (PIPELINE_INCOMPLETE_INIT(qctx)) {
+        WARN("[%s] Pipeline not initialised completely\n", __func__);
+        return -1;
+    }
+
+    if (TLS_HDR_SET(qctx))
+        return qat_aead_tls_cipher(ctx, out, in, len);
+
+    if (!INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_AEAD_IV_SET))
+        return -1;
+
+    if (in == NULL)
+        return qat_aead_final(ctx);
+
+    if (out == NULL) {
+        if (INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_AEAD_UPDATE_DONE |
+                                       INIT_SEQ_AEAD_SW_MSG))
+            return -1;
+        if (!qat_aead_add_aad(qctx, in, len))
+            return -1;
+        return len;
+    }
+
+    if (len == 0)
+        return 0;
+
+    if (!INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_AEAD_SW_MSG) &&
+        (INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_AEAD_UPDATE_DONE) ||
+         qctx->aad_len > QAT_AEAD_MAX_AAD_LEN
+#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
+         || len <=
+         qat_pkt_threshold_table_get_threshold(EVP_CIPHER_CTX_nid(ctx))
+#endif
+        ) && !qat_aead_sw_start(ctx))
+        return -1;
+
+    if (INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_AEAD_SW_MSG)) {
+        if (!EVP_CipherUpdate(qctx->sw_ctx, out, &outl, in, len))
+            return -1;
+        return outl;
+    }
+
+    CLEAR_PIPELINE(qctx);
+    if (!qat_aead_session_init(ctx, qctx->aad_len) ||
+        qat_setup_op_params(ctx) != 1)
+        return -1;
+
+    opd = &qctx->qop[0].op_data;
+    memcpy(opd->pIv, qctx->msg_iv, AEAD_IV_LEN);
+    opd->pAdditionalAuthData = qctx->aad_len > 0 ? qctx->aad_buf :
+                               qctx->qop[0].src_fbuf[0].pData;
+    opd->messageLenToCipherInBytes = len;
+    opd->messageLenToHashInBytes = 0;
+
+    /* The payload is always copied, its result is needed if the message
+     * has to be moved to software.
+     */
+    if (!qat_setup_payload(&qctx->qop[0], (unsigned char *)in, len, len, 0)
+        || !qat_aead_perform_op(qctx, NULL))
+        return -1;
+
+    memcpy(out, qctx->qop[0].payload_buf, len);
+    INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_AEAD_UPDATE_DONE);
+    return len;
+}
+
+/******************************************************************************
+* function:
+*    qat_aead_cleanup(EVP_CIPHER_CTX *ctx)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function will cleanup all allocated resources required to perfrom the
+*  cryptographic transform.
+*
+******************************************************************************/
+int qat_aead_cleanup(EVP_CIPHER_CTX *ctx)
+{
+    qat_chained_ctx *qctx = NULL;
+    CpaCySymSessionSetupData *ssd = NULL;
+    CpaStatus sts = 0;
+    int retVal = 1;
+
+    if (ctx == NULL) {
+        WARN("[%s] ctx parameter is NULL.\n", __func__);
+        return 0;
+    }
+
+    qctx = qat_chained_data(ctx);
+    if (qctx == NULL) {
+        WARN("[%s] qctx parameter is NULL.\n", __func__);
+        return 0;
+    }
+
+    EVP_CIPHER_CTX_free(qctx->sw_ctx);
+    qctx->sw_ctx = NULL;
+
+    /* ctx may be cleaned before it gets a chance to allocate qop */
+    qat_chained_ciphers_free_qop(&qctx->qop, &qctx->qop_len);
+    QAT_CLEANSE_QMEMFREE_BUFF(qctx->aad_buf, qctx->aad_buf_len);
+    qctx->aad_buf_len = 0;
+
+    ssd = qctx->session_data;
+    if (ssd) {
+        if (INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_SESSION_INIT)) {
+            sts = cpaCySymRemoveSession(qctx->instanceHandle,
+                                        qctx->session_ctx);
+            if (sts != CPA_STATUS_SUCCESS) {
+                WARN("[%s] cpaCySymRemoveSession FAILED, sts = %d.!\n",
+                     __func__, sts);
+                retVal = 0;
+            }
+        }
+        qat_sess_ctx_free(qctx->session_ctx, qctx->session_ctx_size);
+        qctx->session_ctx = NULL;
+        QAT_CLEANSE_FREE_BUFF(ssd->cipherSetupData.pCipherKey,
+                              ssd->cipherSetupData.cipherKeyLenInBytes);
+        OPENSSL_free(ssd);
+        qctx->session_data = NULL;
+    }
+
+    OPENSSL_cleanse(qctx->tag, sizeof(qctx->tag));
+    INIT_SEQ_CLEAR_ALL_FLAGS(qctx);
+    DEBUG_PPL("[%s:%p] EVP CTX cleaned up\n", __func__, ctx);
+    return retVal;
+}
+
+/******************************************************************************
+* function:
+*    qat_cipher_sw_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+*                            const unsigned char *in, size_t len)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param out   [OUT]  - output buffer
 * @param in     [IN]  - input buffer
 * @param len    [IN]  - length of input buffer
 *
+* @retval 1      function succeeded
 * @retval 0      function failed
+*
+* description:
+*    This function processes the data with the software implementation of
+*  the raw cipher. The IV, counter and partial block state of the ctx are
+*  shared with the QAT implementation so both can be used in turn.
+*
+******************************************************************************/
+static int qat_cipher_sw_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+                                   const unsigned char *in, size_t len)
+{
+    qat_cipher_ctx *qctx = qat_cipher_data(ctx);
+    const EVP_CIPHER *sw = qat_chained_cipher_sw_impl(EVP_CIPHER_CTX_nid(ctx));
+    int retVal;
+
+    EVP_CIPHER_CTX_set_cipher_data(ctx, qctx->sw_ctx_data);
+    retVal = EVP_CIPHER_meth_get_do_cipher(sw)(ctx, out, in, len);
+    EVP_CIPHER_CTX_set_cipher_data(ctx, qctx);
+
+    return retVal;
+}
+
+/******************************************************************************
+* function:
+*    qat_cipher_setup(qat_cipher_ctx *qctx, int mode,
+*                     const unsigned char *key, int keylen, int enc)
+*
+* @param qctx   [IN]  - pointer to the raw cipher ctx
+* @param mode   [IN]  - EVP_CIPH_CBC_MODE, EVP_CIPH_CTR_MODE or
+*                       EVP_CIPH_XTS_MODE
+* @param key    [IN]  - cipher key
+* @param keylen [IN]  - length of the key
+* @param enc    [IN]  - encryption or decryption
+*
 * @retval 1      function succeeded
+* @retval 0      function failed
 *
 * description:
-*    This function performs the cryptographic transform according to the
-*  parameters setup during initialisation.
+*    This function sets up the session data and the operation data of the
+*  raw cipher ctx for the key. The resources already allocated are reused,
+*  the QAT session is initialised on first use. On failure the resources
+*  are freed by qat_cipher_cleanup().
 *
 ******************************************************************************/
-int qat_chained_ciphers_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
-                                  const unsigned char *in, size_t len)
+static int qat_cipher_setup(qat_cipher_ctx *qctx, int mode,
+                            const unsigned char *key, int keylen, int enc)
 {
-    CpaStatus sts = 0;
-    CpaCySymOpData *opd = NULL;
-    CpaBufferList *s_sgl = NULL;
-    CpaBufferList *d_sgl = NULL;
-    CpaFlatBuffer *s_fbuf = NULL;
-    CpaFlatBuffer *d_fbuf = NULL;
-    int retVal = 0;
-    unsigned int pad_check = 1;
-    int pad_len = 0;
-    int plen = 0;
-    int plen_adj = 0;
-    struct op_done_pipe done;
-    qat_chained_ctx *qctx = NULL;
-    AES_KEY aes_key;
-    unsigned char *inb, *outb;
-    unsigned char ivec[AES_BLOCK_SIZE];
-    unsigned char out_blk[TLS_MAX_PADDING_LENGTH + 1] = { 0x0 };
-    const unsigned char *in_blk = NULL;
-    unsigned int ivlen = 0;
-    int dlen, vtls, enc, i, buflen;
-    int discardlen = 0;
-    char *tls_hdr = NULL;
-    int pipe = 0;
-    int error = 0;
+    CpaCySymSessionSetupData *ssd = NULL;
+    Cpa32U sctx_size = 0;
+    Cpa32U msize = 0;
+    CpaStatus sts;
 
-    if (ctx == NULL) {
-        WARN("[%s] CTX parameter is NULL.\n", __func__);
-        return 0;
+    if (INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_SESSION_INIT)) {
+        sts = cpaCySymRemoveSession(qctx->instanceHandle, qctx->session_ctx);
+        if (sts != CPA_STATUS_SUCCESS) {
+            WARN("[%s] cpaCySymRemoveSession FAILED, sts = %d.!\n",
+                 __func__, sts);
+            return 0;
+        }
+        INIT_SEQ_CLEAR_FLAG(qctx, INIT_SEQ_QAT_SESSION_INIT);
     }
 
-    qctx = qat_chained_data(ctx);
-    if (qctx == NULL || !INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_CTX_INIT)) {
-        WARN("[%s] %s\n", __func__, qctx == NULL ? "QAT CTX NULL"
-             : "QAT Context not initialised");
-        return 0;
+    ssd = qctx->session_data;
+    if (ssd == NULL) {
+        ssd = OPENSSL_malloc(sizeof(CpaCySymSessionSetupData));
+        if (ssd == NULL) {
+            WARN("[%s] Failed to allocate session setup data\n", __func__);
+            return 0;
+        }
+        memcpy(ssd, &template_ssd, sizeof(template_ssd));
+        ssd->symOperation = CPA_CY_SYM_OP_CIPHER;
+        ssd->cipherSetupData.pCipherKey = OPENSSL_malloc(keylen);
+        if (ssd->cipherSetupData.pCipherKey == NULL) {
+            WARN("[%s] Unable to allocate memory for Cipher key.\n",
+                 __func__);
+            OPENSSL_free(ssd);
+            return 0;
+        }
+        ssd->cipherSetupData.cipherKeyLenInBytes = (Cpa32U) keylen;
+        qctx->session_data = ssd;
     }
 
-    /* Pipeline initialisation requires multiple EVP_CIPHER_CTX_ctrl
-     * calls to set all required parameters. Check if all have been
-     * provided. For Pipeline, in and out buffers can be NULL as these
-     * are supplied through ctrl messages.
-     */
-    if (PIPELINE_INCOMPLETE_INIT(qctx) ||
-        (!PIPELINE_SET(qctx) && (in == NULL || out == NULL
-                                 || (len % AES_BLOCK_SIZE)))) {
-        WARN("[%s] %s \n", __func__,
-             PIPELINE_INCOMPLETE_INIT(qctx) ?
-             "Pipeline not initialised completely" : len % AES_BLOCK_SIZE
-             ? "Buffer Length not multiple of AES block size"
-             : "in/out buffer null");
-        return 0;
+    if (mode == EVP_CIPH_CBC_MODE)
+        ssd->cipherSetupData.cipherAlgorithm = CPA_CY_SYM_CIPHER_AES_CBC;
+    else if (mode == EVP_CIPH_CTR_MODE)
+        ssd->cipherSetupData.cipherAlgorithm = CPA_CY_SYM_CIPHER_AES_CTR;
+    else
+        ssd->cipherSetupData.cipherAlgorithm = CPA_CY_SYM_CIPHER_AES_XTS;
+    /* An XTS key is made of the data key followed by the tweak key */
+    memcpy(ssd->cipherSetupData.pCipherKey, key, keylen);
+    ssd->cipherSetupData.cipherDirection = enc ?
+        CPA_CY_SYM_CIPHER_DIRECTION_ENCRYPT :
+        CPA_CY_SYM_CIPHER_DIRECTION_DECRYPT;
+
+    if (qctx->instanceHandle == NULL) {
+        qctx->instanceHandle = get_next_inst();
+        if (qctx->instanceHandle == NULL) {
+            WARN("[%s] Failed to get QAT Instance Handle!.\n", __func__);
+            return 0;
+        }
     }
 
-    if (!INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_SESSION_INIT)) {
-        /* The qat session is initialized when HMAC key is set. In case
-         * HMAC key is not explicitly set, use default HMAC key of all zeros
-         * and initialise a qat session.
-         */
-        sts = cpaCySymInitSession(qctx->instanceHandle, qat_chained_callbackFn,
-                                  qctx->session_data, qctx->session_ctx);
+    if (qctx->session_ctx == NULL) {
+        sts = cpaCySymSessionCtxGetSize(qctx->instanceHandle, ssd,
+                                        &sctx_size);
         if (sts != CPA_STATUS_SUCCESS) {
-            WARN("[%s] cpaCySymInitSession failed! Status = %d\n",
-                 __func__, sts);
+            WARN("[%s] Failed to get SessionCtx size.\n", __func__);
+            return 0;
+        }
+        qctx->session_ctx = (CpaCySymSessionCtx)
+            qaeCryptoMemAlloc(sctx_size, __FILE__, __LINE__);
+        if (qctx->session_ctx == NULL) {
+            WARN("[%s] QMEM alloc failed for session ctx!\n", __func__);
             return 0;
         }
-        INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_QAT_SESSION_INIT);
     }
 
-    enc = EVP_CIPHER_CTX_encrypting(ctx);
-    ivlen = EVP_CIPHER_CTX_iv_length(ctx);
-    dlen = get_digest_len(EVP_CIPHER_CTX_nid(ctx));
-
-    /* Check and setup data structures for pipeline */
-    if (PIPELINE_SET(qctx)) {
-        /* All the aad data (tls header) should be present */
-        if (qctx->aad_ctr != qctx->numpipes) {
-            WARN("[%s] AAD data missing supplied %d of %d\n",
-                 __func__, qctx->aad_ctr, qctx->numpipes);
+    if (qctx->op_data.pIv == NULL) {
+        /* The metadata is sized for the longest buffer list */
+        if (cpaCyBufferListGetMetaSize(qctx->instanceHandle,
+                                       QAT_CIPHER_MAX_SGL_BUFS,
+                                       &msize) != CPA_STATUS_SUCCESS) {
+            WARN("[%s] --- cpaCyBufferListGetBufferSize failed.\n", __func__);
             return 0;
         }
-    } else {
-#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
-        if (len <=
-            qat_pkt_threshold_table_get_threshold(EVP_CIPHER_CTX_nid(ctx))) {
-            EVP_CIPHER_CTX_set_cipher_data(ctx, qctx->sw_ctx_data);
-            retVal = EVP_CIPHER_meth_get_do_cipher(GET_SW_CIPHER(ctx))
-                     (ctx, out, in, len);
-            EVP_CIPHER_CTX_set_cipher_data(ctx, qctx);
-            goto cleanup;
-        }
-#endif
-        /* When no TLS AAD information is supplied, for example: speed,
-         * the payload length for encrypt/decrypt is equal to buffer len
-         * and the HMAC is to be discarded. Set the fake AAD hdr to avoid
-         * decision points in code for this special case handling.
-         */
-        if (!TLS_HDR_SET(qctx)) {
-            tls_hdr = GET_TLS_HDR(qctx, 0);
-            /* Mark an invalid tls version */
-            tls_hdr[9] = tls_hdr[10] = 0;
-            /* Set the payload length equal to entire length
-             * of buffer i.e. there is no space for HMAC in
-             * buffer.
-             */
-            SET_TLS_PAYLOAD_LEN(tls_hdr, 0);
-            plen = len;
-            if (!enc) {
-                /* When decrypting donot verify computed digest
-                 * to stored digest as there is none in this case.
-                 */
-                qctx->session_data->verifyDigest = CPA_FALSE;
+        if (msize && qctx->sgl.pPrivateMetaData == NULL) {
+            qctx->sgl.pPrivateMetaData =
+                qaeCryptoMemAlloc(msize, __FILE__, __LINE__);
+            if (qctx->sgl.pPrivateMetaData == NULL) {
+                WARN("[%s] QMEM alloc failed for PrivateData\n", __func__);
+                return 0;
             }
-            /* Find the extra length for qat buffers to store the HMAC and
-             * padding which is later discarded when the result is copied out.
-             */
-            discardlen = ((len + dlen + AES_BLOCK_SIZE) & -AES_BLOCK_SIZE)
-                - len;
-            /* Pump-up the len by this amount */
-            len += discardlen;
         }
-        /* If the same ctx is being re-used for multiple invocation
-         * of this function without setting EVP_CTRL for number of pipes,
-         * the PIPELINE_SET is true from previous invocation. Clear Pipeline
-         * when add_ctr is 1. This means user wants to switch from pipeline mode
-         * to non-pipeline mode for the same ctx.
-         */
-        CLEAR_PIPELINE(qctx);
 
-        /* setting these helps avoid decision branches when
-         * pipelines are not used.
-         */
-        qctx->p_in = (unsigned char **)&in;
-        qctx->p_out = &out;
-        qctx->p_inlen = &len;
+        memcpy(&qctx->op_data, &template_opData, sizeof(template_opData));
+        qctx->op_data.sessionCtx = qctx->session_ctx;
+        qctx->op_data.cryptoStartSrcOffsetInBytes = 0;
+        qctx->op_data.hashStartSrcOffsetInBytes = 0;
+        qctx->op_data.ivLenInBytes = AES_IV_LEN;
+        qctx->op_data.pIv = qaeCryptoMemAlloc(AES_IV_LEN, __FILE__, __LINE__);
+        if (qctx->op_data.pIv == NULL) {
+            WARN("[%s] --- QMEM Mem Alloc failed for pIv.\n", __func__);
+            return 0;
+        }
     }
 
-    DEBUG_PPL("[%s:%p] Start Cipher operation with num pipes %d\n",
-              __func__, ctx, qctx->numpipes);
+    INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_QAT_CTX_INIT);
+    return 1;
+}
 
-    if ((qat_setup_op_params(ctx) != 1) ||
-        (initOpDonePipe(&done, qctx->numpipes) != 1))
+/******************************************************************************
+* function:
+*         qat_cipher_init(EVP_CIPHER_CTX *ctx, const unsigned char *inkey,
+*                         const unsigned char *iv, int enc)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param inkey  [IN]  - input key, may be NULL
+* @param iv     [IN]  - input IV, may be NULL
+* @param enc    [IN]  - encryption or decryption
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function initialises the raw AES-CBC, AES-CTR and AES-XTS ciphers.
+*  The software implementation is initialised first as it is used for small
+*  requests and partial blocks, and sets the IV of the ctx for XTS.
+*
+******************************************************************************/
+int qat_cipher_init(EVP_CIPHER_CTX *ctx, const unsigned char *inkey,
+                    const unsigned char *iv, int enc)
+{
+    qat_cipher_ctx *qctx = NULL;
+    const EVP_CIPHER *sw = NULL;
+    int retVal;
+
+    if (ctx == NULL) {
+        WARN("[%s] ctx is NULL\n", __func__);
         return 0;
+    }
 
-    do {
-        opd = &qctx->qop[pipe].op_data;
-        tls_hdr = GET_TLS_HDR(qctx, pipe);
-        vtls = GET_TLS_VERSION(tls_hdr);
-        s_fbuf = qctx->qop[pipe].src_fbuf;
-        d_fbuf = qctx->qop[pipe].dst_fbuf;
-        s_sgl = &qctx->qop[pipe].src_sgl;
-        d_sgl = &qctx->qop[pipe].src_sgl;
-        inb = &qctx->p_in[pipe][0];
-        outb = &qctx->p_out[pipe][0];
-        buflen = qctx->p_inlen[pipe];
+    qctx = qat_cipher_data(ctx);
+    if (qctx == NULL) {
+        WARN("[%s] qctx is NULL\n", __func__);
+        return 0;
+    }
 
-        if (vtls >= TLS1_1_VERSION) {
-            /*
-             * Note: The OpenSSL framework assumes that the IV field will be part
-             * of the output data. In order to chain HASH and CIPHER we need to
-             * present contiguous SGL to QAT, copy IV to output buffer now and
-             * skip it for chained operation.
-             */
-            if (inb != outb)
-                memcpy(outb, inb, ivlen);
-            memcpy(opd->pIv, inb, ivlen);
-            inb += ivlen;
-            buflen -= ivlen;
-            plen_adj = ivlen;
-        } else {
-            if (qctx->numpipes > 1) {
-                WARN("[%s] Pipe %d tls hdr version < tls1.1\n", __func__, pipe);
-                error = 1;
-                break;
-            }
-            memcpy(opd->pIv, EVP_CIPHER_CTX_iv(ctx), ivlen);
+    sw = qat_chained_cipher_sw_impl(EVP_CIPHER_CTX_nid(ctx));
+    if (qctx->sw_ctx_data == NULL) {
+        qctx->sw_ctx_data = OPENSSL_zalloc(EVP_CIPHER_impl_ctx_size(sw));
+        if (qctx->sw_ctx_data == NULL) {
+            WARN("[%s] Failed to allocate sw_ctx_data\n", __func__);
+            return 0;
         }
+    }
 
-        /* Calculate payload and padding len */
-        if (enc) {
-            /* For encryption, payload length is in the header.
-             * For non-TLS use case, plen has already been set above.
-             * For TLS Version > 1.1 the payload length also contains IV len.
-             */
-            if (vtls >= TLS1_VERSION)
-                plen = GET_TLS_PAYLOAD_LEN(tls_hdr) - plen_adj;
+    EVP_CIPHER_CTX_set_cipher_data(ctx, qctx->sw_ctx_data);
+    retVal = EVP_CIPHER_meth_get_init(sw)(ctx, inkey, iv, enc);
+    EVP_CIPHER_CTX_set_cipher_data(ctx, qctx);
+    if (retVal != 1) {
+        WARN("[%s] Software cipher init failed\n", __func__);
+        return 0;
+    }
+
+    if (inkey == NULL)
+        return 1;
+
+    return qat_cipher_setup(qctx, EVP_CIPHER_CTX_mode(ctx), inkey,
+                            EVP_CIPHER_CTX_key_length(ctx), enc);
+}
+
+/******************************************************************************
+* function:
+*    qat_cipher_ctrl(EVP_CIPHER_CTX *ctx, int type, int arg, void *ptr)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param type   [IN]  - type of request, only EVP_CTRL_COPY is supported
+* @param arg    [IN]  - unused
+* @param ptr    [OUT] - destination ctx of the copy
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+* @retval -1     the request is not supported
+*
+* description:
+*    This function copies the raw cipher ctx for EVP_CIPHER_CTX_copy(). The
+*  copy gets its own software context data and QAT session for the same
+*  key, the QAT resources of ctx are not shared.
+*
+******************************************************************************/
+int qat_cipher_ctrl(EVP_CIPHER_CTX *ctx, int type, int arg, void *ptr)
+{
+    qat_cipher_ctx *qctx = NULL;
+    qat_cipher_ctx *out_qctx = NULL;
+    EVP_CIPHER_CTX *out = (EVP_CIPHER_CTX *)ptr;
+    CpaCySymSessionSetupData *ssd = NULL;
+    const EVP_CIPHER *sw = NULL;
+    int retVal = 1;
+
+    if (ctx == NULL || (qctx = qat_cipher_data(ctx)) == NULL) {
+        WARN("[%s] ctx or qctx is NULL\n", __func__);
+        return 0;
+    }
+
+    if (type != EVP_CTRL_COPY)
+        return -1;
+
+    /* The destination holds a plain copy of qctx at this point */
+    out_qctx = qat_cipher_data(out);
+    memset(out_qctx, 0, sizeof(qat_cipher_ctx));
+
+    sw = qat_chained_cipher_sw_impl(EVP_CIPHER_CTX_nid(ctx));
+    if (qctx->sw_ctx_data != NULL) {
+        out_qctx->sw_ctx_data =
+            OPENSSL_memdup(qctx->sw_ctx_data, EVP_CIPHER_impl_ctx_size(sw));
+        if (out_qctx->sw_ctx_data == NULL) {
+            WARN("[%s] Failed to allocate sw_ctx_data\n", __func__);
+            return 0;
+        }
+        /* XTS fixes up the pointers to its key schedules */
+        if (EVP_CIPHER_flags(sw) & EVP_CIPH_CUSTOM_COPY) {
+            EVP_CIPHER_CTX_set_cipher_data(ctx, qctx->sw_ctx_data);
+            EVP_CIPHER_CTX_set_cipher_data(out, out_qctx->sw_ctx_data);
+            retVal = EVP_CIPHER_meth_get_ctrl(sw)(ctx, EVP_CTRL_COPY, 0, out);
+            EVP_CIPHER_CTX_set_cipher_data(ctx, qctx);
+            EVP_CIPHER_CTX_set_cipher_data(out, out_qctx);
+            if (retVal != 1)
+                return 0;
+        }
+    }
+
+    ssd = qctx->session_data;
+    if (ssd == NULL || !INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_CTX_INIT))
+        return 1;
+
+    return qat_cipher_setup(out_qctx, EVP_CIPHER_CTX_mode(ctx),
+                            ssd->cipherSetupData.pCipherKey,
+                            ssd->cipherSetupData.cipherKeyLenInBytes,
+                            ssd->cipherSetupData.cipherDirection ==
+                            CPA_CY_SYM_CIPHER_DIRECTION_ENCRYPT);
+}
 
-            /* Compute the padding length using total buffer length, payload
-             * length, digest length and a byte to encode padding len.
-             */
-            pad_len = buflen - (plen + dlen) - 1;
+/******************************************************************************
+* function:
+*    qat_cipher_cleanup(EVP_CIPHER_CTX *ctx)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function will cleanup all allocated resources required to perfrom
+*  the raw cipher operations.
+*
+******************************************************************************/
+int qat_cipher_cleanup(EVP_CIPHER_CTX *ctx)
+{
+    qat_cipher_ctx *qctx = NULL;
+    CpaCySymSessionSetupData *ssd = NULL;
+    CpaStatus sts = 0;
+    int retVal = 1;
+    unsigned int i;
 
-            /* If padlen is negative, then size of supplied output buffer
-             * is smaller than required.
-             */
-            if ((buflen % AES_BLOCK_SIZE) != 0 || pad_len < 0 ||
-                pad_len > TLS_MAX_PADDING_LENGTH) {
-                WARN("[%s] buffer len[%d] or pad_len[%d] incorrect\n", __func__,
-                     buflen, pad_len);
-                error = 1;
-                break;
-            }
-        } else if (vtls >= TLS1_VERSION) {
-            /* Decrypt the last block of the buffer to get the pad_len.
-             * Calculate payload len using total length and padlen.
-             * NOTE: plen so calculated does not account for ivlen
-             *       if iv is appened for TLS Version >= 1.1
-             */
-            unsigned int tmp_padlen = TLS_MAX_PADDING_LENGTH + 1;
-            unsigned int maxpad, res = 0xff;
-            size_t j;
-            uint8_t cmask, b;
+    if (ctx == NULL) {
+        WARN("[%s] ctx parameter is NULL.\n", __func__);
+        return 0;
+    }
 
-            if ((buflen - dlen) <= TLS_MAX_PADDING_LENGTH)
-                tmp_padlen = (((buflen - dlen) + (AES_BLOCK_SIZE - 1))
-                              / AES_BLOCK_SIZE) * AES_BLOCK_SIZE;
-            in_blk = inb + (buflen - tmp_padlen);
-            memcpy(ivec, in_blk - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+    qctx = qat_cipher_data(ctx);
+    if (qctx == NULL) {
+        WARN("[%s] qctx parameter is NULL.\n", __func__);
+        return 0;
+    }
 
-            AES_set_decrypt_key(qctx->session_data->cipherSetupData.pCipherKey,
-                                EVP_CIPHER_CTX_key_length(ctx) * 8, &aes_key);
-            AES_cbc_encrypt(in_blk, out_blk, tmp_padlen, &aes_key, ivec, 0);
+    /* The software context data holds the key schedule */
+    QAT_CLEANSE_FREE_BUFF(qctx->sw_ctx_data,
+                          EVP_CIPHER_impl_ctx_size(qat_chained_cipher_sw_impl
+                                                   (EVP_CIPHER_CTX_nid(ctx))));
 
-            pad_len = out_blk[tmp_padlen - 1];
-            /* Determine the maximum amount of padding that could be present */
-            maxpad = buflen - (dlen + 1);
-            maxpad |=
-                (TLS_MAX_PADDING_LENGTH - maxpad) >> (sizeof(maxpad) * 8 - 8);
-            maxpad &= TLS_MAX_PADDING_LENGTH;
+    for (i = 0; i < qctx->num_bufs; i++)
+        QAT_CLEANSE_QMEMFREE_BUFF(qctx->fbuf[i].pData,
+                                  QAT_CIPHER_SGL_BUF_SIZE);
+    qctx->num_bufs = 0;
+    QAT_QMEMFREE_BUFF(qctx->sgl.pPrivateMetaData);
+    QAT_QMEMFREE_BUFF(qctx->op_data.pIv);
 
-            /* Check the padding in constant time */
-            for (j = 0; j <= maxpad; j++) {
-                cmask = qat_constant_time_ge_8(pad_len, j);
-                b = out_blk[tmp_padlen - 1 - j];
-                res &= ~(cmask & (pad_len ^ b));
+    ssd = qctx->session_data;
+    if (ssd) {
+        if (INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_SESSION_INIT)) {
+            sts = cpaCySymRemoveSession(qctx->instanceHandle,
+                                        qctx->session_ctx);
+            if (sts != CPA_STATUS_SUCCESS) {
+                WARN("[%s] cpaCySymRemoveSession FAILED, sts = %d.!\n",
+                     __func__, sts);
+                retVal = 0;
             }
-            res = qat_constant_time_eq(0xff, res & 0xff);
-            pad_check &= (int)res;
-
-            /* Adjust the amount of data to digest to be the maximum by setting
-             * pad_len = 0 if the padding check failed or if the padding length
-             * is greater than the maximum padding allowed. This adjustment
-             * is done in constant time.
-             */
-            pad_check &= qat_constant_time_ge(maxpad, pad_len);
-            pad_len *= pad_check;
-            plen = buflen - (pad_len + 1 + dlen);
         }
+        QAT_CLEANSE_FREE_BUFF(ssd->cipherSetupData.pCipherKey,
+                              ssd->cipherSetupData.cipherKeyLenInBytes);
+        OPENSSL_free(ssd);
+        qctx->session_data = NULL;
+    }
+    QAT_QMEMFREE_BUFF(qctx->session_ctx);
 
-        opd->messageLenToCipherInBytes = buflen;
-        opd->messageLenToHashInBytes = TLS_VIRT_HDR_SIZE + plen;
+    INIT_SEQ_CLEAR_ALL_FLAGS(qctx);
+    return retVal;
+}
 
-        /* copy tls hdr in flatbuffer's last 13 bytes */
-        memcpy(d_fbuf[0].pData + (d_fbuf[0].dataLenInBytes - TLS_VIRT_HDR_SIZE),
-               tls_hdr, TLS_VIRT_HDR_SIZE);
-        /* Update the value of payload before HMAC calculation */
-        SET_TLS_PAYLOAD_LEN((d_fbuf[0].pData +
-                             (d_fbuf[0].dataLenInBytes - TLS_VIRT_HDR_SIZE)),
-                            plen);
+/******************************************************************************
+* function:
+*         qat_ctr_iv_add(unsigned char *iv, unsigned int nblocks)
+*
+* @param iv      [IN/OUT] - 128 bit big endian counter block
+* @param nblocks [IN]     - number of blocks processed
+*
+* description:
+*    This function advances the counter block past the processed blocks.
+*
+******************************************************************************/
+static void qat_ctr_iv_add(unsigned char *iv, unsigned int nblocks)
+{
+    unsigned long carry = nblocks;
+    int i;
 
-        FLATBUFF_ALLOC_AND_CHAIN(s_fbuf[1], d_fbuf[1], buflen);
-        if ((s_fbuf[1].pData) == NULL) {
-            WARN("[%s] --- src/dst buffer allocation.\n", __func__);
-            error = 1;
-            break;
-        }
+    for (i = AES_BLOCK_SIZE - 1; i >= 0 && carry != 0; i--) {
+        carry += iv[i];
+        iv[i] = (unsigned char)carry;
+        carry >>= QAT_BYTE_SHIFT;
+    }
+}
 
-        memcpy(d_fbuf[1].pData, inb, buflen - discardlen);
+/******************************************************************************
+* function:
+*    qat_cipher_perform_op(EVP_CIPHER_CTX *ctx, unsigned char *out,
+*                          const unsigned char *in, size_t len,
+*                          QAT_PKT_SAMPLE *sample)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param out   [OUT]  - output buffer
+* @param in     [IN]  - input buffer
+* @param len    [IN]  - length of input, whole blocks up to
+*                       QAT_CIPHER_MAX_REQ_LEN
+* @param sample [IN]  - sample of the operation or NULL
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function submits a single request for the data and waits for it
+*  to complete, pausing the async job if there is one. The data is copied
+*  through the flat buffers of the ctx unless it is processed in place in
+*  a pinned buffer. The IV of the ctx is then set for the next request.
+*
+******************************************************************************/
+static int qat_cipher_perform_op(EVP_CIPHER_CTX *ctx, unsigned char *out,
+                                 const unsigned char *in, size_t len,
+                                 QAT_PKT_SAMPLE *sample)
+{
+    qat_cipher_ctx *qctx = qat_cipher_data(ctx);
+    CpaCySymOpData *opd = &qctx->op_data;
+    unsigned char *iv = EVP_CIPHER_CTX_iv_noconst(ctx);
+    unsigned char next_iv[AES_BLOCK_SIZE];
+    int mode = EVP_CIPHER_CTX_mode(ctx);
+    CpaBoolean verify = CPA_FALSE;
+    struct op_done_pipe done;
+    unsigned int nbufs, i;
+    size_t off, buflen;
+    CpaStatus sts;
 
-        if (enc) {
-            /* Add padding to input buffer at end of digest */
-            for (i = plen + dlen; i < buflen; i++)
-                d_fbuf[1].pData[i] = pad_len;
-        } else {
-            /* store IV for next cbc operation */
-            if (vtls < TLS1_1_VERSION)
-                memcpy(EVP_CIPHER_CTX_iv_noconst(ctx),
-                       inb + (buflen - discardlen) - ivlen, ivlen);
+    if (!INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_SESSION_INIT)) {
+        sts = cpaCySymInitSession(qctx->instanceHandle,
+                                  qat_chained_callbackFn,
+                                  qctx->session_data, qctx->session_ctx);
+        if (sts != CPA_STATUS_SUCCESS) {
+            WARN("[%s] cpaCySymInitSession failed! Status = %d\n",
+                 __func__, sts);
+            return 0;
         }
+        INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_QAT_SESSION_INIT);
+    }
 
-        sts = myPerformOp(qctx->instanceHandle, &done, opd, s_sgl, d_sgl,
-                          &(qctx->session_data->verifyDigest));
-        if (sts != CPA_STATUS_SUCCESS) {
-            WARN("[%s] CpaCySymPerformOp failed sts=%d.\n", __func__, sts);
-            error = 1;
-            break;
+    if (in == out && qat_pinned_buf_contains(in, len)) {
+        qctx->pinned_fbuf.pData = out;
+        qctx->pinned_fbuf.dataLenInBytes = (Cpa32U) len;
+        qctx->sgl.pBuffers = &qctx->pinned_fbuf;
+        qctx->sgl.numBuffers = 1;
+        nbufs = 0;
+    } else {
+        nbufs = (len + QAT_CIPHER_SGL_BUF_SIZE - 1) / QAT_CIPHER_SGL_BUF_SIZE;
+        for (i = qctx->num_bufs; i < nbufs; i++) {
+            qctx->fbuf[i].pData = qaeCryptoMemAlloc(QAT_CIPHER_SGL_BUF_SIZE,
+                                                    __FILE__, __LINE__);
+            if (qctx->fbuf[i].pData == NULL) {
+                WARN("[%s] Unable to allocate memory for payload\n",
+                     __func__);
+                return 0;
+            }
+            qctx->num_bufs++;
         }
-        /* Increment after successful submission */
-        done.num_submitted++;
-    } while (++pipe < qctx->numpipes);
+        for (i = 0, off = 0; i < nbufs; i++, off += buflen) {
+            buflen = len - off < QAT_CIPHER_SGL_BUF_SIZE ?
+                     len - off : QAT_CIPHER_SGL_BUF_SIZE;
+            memcpy(qctx->fbuf[i].pData, in + off, buflen);
+            qctx->fbuf[i].dataLenInBytes = (Cpa32U) buflen;
+        }
+        qctx->sgl.pBuffers = qctx->fbuf;
+        qctx->sgl.numBuffers = nbufs;
+    }
 
-    /* If there has been an error during submission of the pipes
-     * indicate to the callback function not to wait for the entire
-     * pipeline.
+    /* The last ciphertext block is the next CBC IV, take it before an
+     * in place decryption overwrites it.
      */
-    if (error == 1)
-        done.num_pipes = pipe;
+    if (mode == EVP_CIPH_CBC_MODE && !EVP_CIPHER_CTX_encrypting(ctx))
+        memcpy(next_iv, in + len - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
 
-    /* If there is nothing to wait for, do not pause or yield */
-    if (done.num_submitted == 0 || (done.num_submitted == done.num_processed))
-        goto end;
+    memcpy(opd->pIv, iv, AES_IV_LEN);
+    opd->messageLenToCipherInBytes = (Cpa32U) len;
 
-    do {
-        if (done.opDone.job) {
-            /* If we get a failure on qat_pause_job then we will
-               not flag an error here and quit because we have
-               an asynchronous request in flight.
-               We don't want to start cleaning up data
-               structures that are still being used. If
-               qat_pause_job fails we will just yield and
-               loop around and try again until the request
-               completes and we can continue. */
-            if (qat_pause_job(done.opDone.job, 0) == 0)
-                pthread_yield();
-        } else {
-            pthread_yield();
-        }
-    } while (!done.opDone.flag);
+    if (initOpDonePipe(&done, 1) != 1)
+        return 0;
 
- end:
-    qctx->total_op += done.num_processed;
+    sts = myPerformOp(qctx->instanceHandle, &done, opd,
+                      &qctx->sgl, &qctx->sgl, &verify);
+    if (sts != CPA_STATUS_SUCCESS) {
+        WARN("[%s] CpaCySymPerformOp failed sts=%d.\n", __func__, sts);
+        done.num_pipes = 0;
+    } else {
+        /* Increment after successful submission */
+        done.num_submitted++;
+    }
+
+    /* If there is nothing to wait for, do not pause or yield */
+    if (done.num_submitted != 0 && done.num_submitted != done.num_processed) {
+        do {
+            if (done.opDone.job) {
+                /* The request is in flight, keep waiting for it even if
+                 * qat_pause_job fails.
+                 */
+                if (qat_pkt_sample_pause_job(sample, done.opDone.job) == 0)
+                    pthread_yield();
+            } else {
+                pthread_yield();
+            }
+        } while (!done.opDone.flag);
+    }
     cleanupOpDonePipe(&done);
 
-    if (error == 0 && (done.opDone.verifyResult == CPA_TRUE))
-        retVal = 1;
+    if (sts != CPA_STATUS_SUCCESS || done.opDone.verifyResult != CPA_TRUE)
+        return 0;
 
-    pipe = 0;
-    do {
-        if (retVal == 1) {
-            memcpy(qctx->p_out[pipe] + plen_adj,
-                   qctx->qop[pipe].dst_fbuf[1].pData,
-                   qctx->p_inlen[pipe] - discardlen - plen_adj);
+    for (i = 0, off = 0; i < nbufs; i++) {
+        memcpy(out + off, qctx->fbuf[i].pData,
+               qctx->fbuf[i].dataLenInBytes);
+        off += qctx->fbuf[i].dataLenInBytes;
+    }
+
+    if (mode == EVP_CIPH_CBC_MODE) {
+        if (EVP_CIPHER_CTX_encrypting(ctx))
+            memcpy(iv, out + len - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+        else
+            memcpy(iv, next_iv, AES_BLOCK_SIZE);
+    } else if (mode == EVP_CIPH_CTR_MODE) {
+        qat_ctr_iv_add(iv, len / AES_BLOCK_SIZE);
+    }
+    /* The XTS tweak is not carried over, each call is a data unit */
+
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*    qat_cipher_offload(EVP_CIPHER_CTX *ctx, unsigned char *out,
+*                       const unsigned char *in, size_t len,
+*                       QAT_PKT_SAMPLE *sample)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param out   [OUT]  - output buffer
+* @param in     [IN]  - input buffer
+* @param len    [IN]  - length of input buffer
+* @param sample [IN]  - sample of the operation
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function offloads the data above the small packet threshold.
+*  Large inputs are split into several requests of QAT_CIPHER_MAX_REQ_LEN
+*  bytes. CTR partial blocks and XTS data units that are not a whole number
+*  of blocks or too large for a single request are processed in software.
+*
+******************************************************************************/
+static int qat_cipher_offload(EVP_CIPHER_CTX *ctx, unsigned char *out,
+                              const unsigned char *in, size_t len,
+                              QAT_PKT_SAMPLE *sample)
+{
+    int mode = EVP_CIPHER_CTX_mode(ctx);
+    unsigned int num;
+    size_t n, tail = 0;
+
+    if (mode == EVP_CIPH_XTS_MODE) {
+        if (len % AES_BLOCK_SIZE != 0 || len > QAT_CIPHER_MAX_REQ_LEN)
+            return qat_cipher_sw_do_cipher(ctx, out, in, len);
+        return qat_cipher_perform_op(ctx, out, in, len, sample);
+    }
+
+    if (mode == EVP_CIPH_CTR_MODE) {
+        /* Use up the keystream block left by the previous call */
+        num = (unsigned int)EVP_CIPHER_CTX_num(ctx);
+        if (num != 0) {
+            n = AES_BLOCK_SIZE - num < len ? AES_BLOCK_SIZE - num : len;
+            if (!qat_cipher_sw_do_cipher(ctx, out, in, n))
+                return 0;
+            in += n;
+            out += n;
+            len -= n;
         }
-        qaeCryptoMemFree(qctx->qop[pipe].src_fbuf[1].pData);
-        qctx->qop[pipe].src_fbuf[1].pData = NULL;
-        qctx->qop[pipe].dst_fbuf[1].pData = NULL;
-    } while (++pipe < qctx->numpipes);
+        tail = len % AES_BLOCK_SIZE;
+        len -= tail;
+    }
 
-    if (enc && vtls < TLS1_1_VERSION)
-        memcpy(EVP_CIPHER_CTX_iv_noconst(ctx),
-               outb + buflen - discardlen - ivlen, ivlen);
+    while (len > 0) {
+        n = len < QAT_CIPHER_MAX_REQ_LEN ? len : QAT_CIPHER_MAX_REQ_LEN;
+        if (!qat_cipher_perform_op(ctx, out, in, n, sample))
+            return 0;
+        in += n;
+        out += n;
+        len -= n;
+    }
 
- cleanup:
-    /*Reset the AAD counter forcing that new AAD information is provided
-     * before each repeat invocation of this function.
-     */
-    qctx->aad_ctr = 0;
+    if (tail != 0)
+        return qat_cipher_sw_do_cipher(ctx, out, in, tail);
 
-    /* This function can be called again with the same evp_cipher_ctx. */
-    if (PIPELINE_SET(qctx)) {
-        /* Number of pipes can grow between multiple invocation of this call.
-         * Record the maximum number of pipes used so that data structures can
-         * be allocated accordingly.
-         */
-        INIT_SEQ_CLEAR_FLAG(qctx, INIT_SEQ_PPL_AADCTR_SET);
-        INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_PPL_USED);
-        qctx->npipes_last_used = qctx->numpipes > qctx->npipes_last_used
-            ? qctx->numpipes : qctx->npipes_last_used;
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*    qat_cipher_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+*                         const unsigned char *in, size_t len)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param out   [OUT]  - output buffer
+* @param in     [IN]  - input buffer
+* @param len    [IN]  - length of input buffer
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function performs the raw AES-CBC, AES-CTR and AES-XTS operations.
+*  The IV, or the counter and the unused part of its last keystream block
+*  for CTR, are carried over to the next call. Small inputs are processed
+*  in software, the others are offloaded by qat_cipher_offload().
+*
+******************************************************************************/
+int qat_cipher_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+                         const unsigned char *in, size_t len)
+{
+    qat_cipher_ctx *qctx = NULL;
+    QAT_PKT_SAMPLE sample = QAT_PKT_SAMPLE_INIT;
+    int ret;
+
+    if (ctx == NULL || (qctx = qat_cipher_data(ctx)) == NULL) {
+        WARN("[%s] ctx or qctx is NULL\n", __func__);
+        return 0;
     }
-    return retVal & pad_check;
+
+    if (!INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_CTX_INIT)) {
+        WARN("[%s] QAT Context not initialised\n", __func__);
+        return 0;
+    }
+
+#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
+    if (qat_pkt_threshold_sw(EVP_CIPHER_CTX_nid(ctx), len, &sample))
+        ret = qat_cipher_sw_do_cipher(ctx, out, in, len);
+    else
+#endif
+        ret = qat_cipher_offload(ctx, out, in, len, &sample);
+
+    qat_pkt_sample_end(&sample, ret);
+    return ret;
 }
@@ -49,14 +49,28 @@
 # include <openssl/engine.h>
 # include <openssl/crypto.h>
 # include <openssl/aes.h>
+# include <openssl/evp.h>
 
 # define AES_IV_LEN                 16
 # define AES_KEY_SIZE_256           32
 # define AES_KEY_SIZE_128           16
+# define AES_XTS_KEY_SIZE_256       (2 * AES_KEY_SIZE_256)
+# define AES_XTS_KEY_SIZE_128       (2 * AES_KEY_SIZE_128)
 # define QAT_BYTE_SHIFT             8
 # define HMAC_KEY_SIZE              64
+# define HMAC_SHA384_KEY_SIZE       128
+# define AES_256_CBC_HMAC_SHA384_SN "AES-256-CBC-HMAC-SHA384"
+# define AES_256_CBC_HMAC_SHA384_LN "aes-256-cbc-hmac-sha384"
 # define TLS_VIRT_HDR_SIZE          13
 # define TLS_MAX_PADDING_LENGTH     255
+# define CHACHAPOLY_KEY_SIZE        32
+# if !defined(OPENSSL_NO_CHACHA) && !defined(OPENSSL_NO_POLY1305)
+#  define QAT_CHACHAPOLY
+# endif
+/* Both AES-GCM and ChaCha20-Poly1305 use 12 byte IVs and 16 byte tags */
+# define AEAD_IV_LEN                (EVP_GCM_TLS_FIXED_IV_LEN + \
+                                     EVP_GCM_TLS_EXPLICIT_IV_LEN)
+# define AEAD_TAG_LEN               16
 
 /* Use these flags to mark stages in the
  * initialisation sequence for pipes.
@@ -65,6 +79,10 @@
 # define INIT_SEQ_HMAC_KEY_SET      0x0002
 # define INIT_SEQ_QAT_SESSION_INIT  0x0004
 # define INIT_SEQ_TLS_HDR_SET       0x0008
+# define INIT_SEQ_AEAD_IV_SET       0x0010
+# define INIT_SEQ_AEAD_IV_FIXED     0x0020
+# define INIT_SEQ_AEAD_UPDATE_DONE  0x0040
+# define INIT_SEQ_AEAD_SW_MSG       0x0080
 # define INIT_SEQ_PPL_IBUF_SET      0x0100
 # define INIT_SEQ_PPL_OBUF_SET      0x0200
 # define INIT_SEQ_PPL_BUF_LEN_SET   0x0400
@@ -73,6 +91,8 @@
 
 # define qat_chained_data(ctx) \
     ((qat_chained_ctx *)EVP_CIPHER_CTX_get_cipher_data(ctx))
+# define qat_cipher_data(ctx) \
+    ((qat_cipher_ctx *)EVP_CIPHER_CTX_get_cipher_data(ctx))
 
 # define QAT_COMMON_CIPHER_FLAG     EVP_CIPH_FLAG_DEFAULT_ASN1
 # define QAT_CBC_FLAGS              (QAT_COMMON_CIPHER_FLAG | \
@@ -80,7 +100,30 @@
                                      EVP_CIPH_CUSTOM_IV)
 # define QAT_CHAINED_FLAG           (QAT_CBC_FLAGS | \
                                      EVP_CIPH_FLAG_AEAD_CIPHER | \
-                                     EVP_CIPH_FLAG_PIPELINE)
+                                     EVP_CIPH_FLAG_PIPELINE | \
+                                     EVP_CIPH_CUSTOM_COPY)
+# define QAT_GCM_FLAGS              (QAT_COMMON_CIPHER_FLAG | \
+                                     EVP_CIPH_GCM_MODE | \
+                                     EVP_CIPH_CUSTOM_IV | \
+                                     EVP_CIPH_FLAG_CUSTOM_CIPHER | \
+                                     EVP_CIPH_ALWAYS_CALL_INIT | \
+                                     EVP_CIPH_CTRL_INIT | \
+                                     EVP_CIPH_FLAG_AEAD_CIPHER | \
+                                     EVP_CIPH_FLAG_PIPELINE | \
+                                     EVP_CIPH_CUSTOM_COPY)
+# define QAT_CHACHAPOLY_FLAGS       (EVP_CIPH_CUSTOM_IV | \
+                                     EVP_CIPH_FLAG_CUSTOM_CIPHER | \
+                                     EVP_CIPH_ALWAYS_CALL_INIT | \
+                                     EVP_CIPH_CTRL_INIT | \
+                                     EVP_CIPH_FLAG_AEAD_CIPHER | \
+                                     EVP_CIPH_FLAG_PIPELINE | \
+                                     EVP_CIPH_CUSTOM_COPY)
+# define QAT_RAW_CIPHER_FLAGS       (QAT_COMMON_CIPHER_FLAG | \
+                                     EVP_CIPH_CUSTOM_COPY)
+# define QAT_XTS_FLAGS              (QAT_RAW_CIPHER_FLAGS | \
+                                     EVP_CIPH_XTS_MODE | \
+                                     EVP_CIPH_CUSTOM_IV | \
+                                     EVP_CIPH_ALWAYS_CALL_INIT)
 
 # define INIT_SEQ_PPL_INIT_COMPLETE  (INIT_SEQ_PPL_IBUF_SET | \
                                       INIT_SEQ_PPL_OBUF_SET | \
@@ -118,9 +161,10 @@ int qat_ciphers(ENGINE *e, const EVP_CIPHER **cipher, const int **nids,
 extern CRYPTO_ONCE qat_pkt_threshold_table_once;
 extern CRYPTO_THREAD_LOCAL qat_pkt_threshold_table_key;
 void qat_pkt_threshold_table_make_key(void);
-LHASH_OF(PKT_THRESHOLD) *qat_create_pkt_threshold_table(void);
 void qat_free_pkt_threshold_table(void *);
 int qat_pkt_threshold_table_set_threshold(int nid, int threshold);
 int qat_pkt_threshold_table_get_threshold(int nid);
+void qat_pkt_threshold_table_set_adaptive(int adaptive);
+int qat_pkt_threshold_table_get_learned(char *buf, size_t len);
 # endif
 #endif                          /* QAT_CIPHERS_H */
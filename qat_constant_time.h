@@ -63,6 +63,13 @@
 #ifndef QAT_CONST_TIME_H
 # define QAT_CONST_TIME_H
 
+# ifdef __SSE2__
+#  include <emmintrin.h>
+# endif
+
+/* Length of the block ending a TLS record checked for its padding */
+# define QAT_TLS_PAD_BLK_LEN 256
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -101,6 +108,53 @@ static inline unsigned int qat_constant_time_eq(unsigned int a,
     return qat_constant_time_is_zero(a ^ b);
 }
 
+/*
+ * Check that the pad_len + 1 last bytes of the QAT_TLS_PAD_BLK_LEN bytes
+ * of blk are all equal to pad_len, ignoring the bytes more than maxpad
+ * bytes away from the last one. All the bytes of blk are read whatever
+ * pad_len is. Return all ones if the padding is correct and 0 otherwise.
+ */
+static inline unsigned int qat_constant_time_tls_pad_check(
+                                                   const unsigned char *blk,
+                                                   unsigned int pad_len,
+                                                   unsigned int maxpad)
+{
+# ifdef __SSE2__
+    const __m128i pad = _mm_set1_epi8((char)pad_len);
+    const __m128i max = _mm_set1_epi8((char)maxpad);
+    const __m128i step = _mm_set1_epi8(16);
+    /* Distance of each byte of a lane to the last byte of blk */
+    __m128i dist = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8,
+                                 7, 6, 5, 4, 3, 2, 1, 0);
+    __m128i bad = _mm_setzero_si128();
+    __m128i in_pad;
+    int i;
+
+    for (i = QAT_TLS_PAD_BLK_LEN - 16; i >= 0; i -= 16) {
+        /* Unsigned dist <= x computed as max(dist, x) == x */
+        in_pad = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(dist, pad), pad),
+                               _mm_cmpeq_epi8(_mm_max_epu8(dist, max), max));
+        bad = _mm_or_si128(bad,
+                           _mm_andnot_si128(_mm_cmpeq_epi8(
+                               _mm_loadu_si128((const __m128i *)(blk + i)),
+                               pad), in_pad));
+        dist = _mm_add_epi8(dist, step);
+    }
+
+    return qat_constant_time_is_zero((unsigned int)_mm_movemask_epi8(bad));
+# else
+    unsigned int j, res = 0;
+
+    for (j = 0; j < QAT_TLS_PAD_BLK_LEN; j++) {
+        res |= qat_constant_time_ge_8(pad_len, j)
+               & qat_constant_time_ge_8(maxpad, j)
+               & (pad_len ^ blk[QAT_TLS_PAD_BLK_LEN - 1 - j]);
+    }
+
+    return qat_constant_time_is_zero(res & 0xff);
+# endif
+}
+
 #ifdef __cplusplus
 }
 #endif
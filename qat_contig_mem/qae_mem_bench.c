@@ -0,0 +1,406 @@
+/***************************************************************************
+ *
+ * This file is provided under a dual BSD/GPLv2 license.  When using or
+ *   redistributing this file, you may do so under either license.
+ *
+ *   GPL LICENSE SUMMARY
+ *
+ *   Copyright(c) 2007-2012 Intel Corporation. All rights reserved.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of version 2 of the GNU General Public License as
+ *   published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *   The full GNU General Public License is included in this distribution
+ *   in the file called LICENSE.GPL.
+ *
+ *   Contact Information:
+ *   Intel Corporation
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2007,2008,2009,2010,2011,2012 Intel Corporation.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ *
+ ***************************************************************************/
+
+/*
+ * Benchmark and stress test of the pinned memory allocators.
+ *
+ * The program is linked with one of qae_mem_utils.c, multi_thread_qaememutils.c
+ * or cmn_mem_drv_inf.c and with qat_contig_mem_mock.c, so it runs on any
+ * Linux machine. It reports:
+ *   - alloc/free throughput for a range of sizes and thread counts,
+ *   - fragmentation under a random mix of sizes held live, as the pinned
+ *     memory taken from the (mocked) driver against the bytes in use,
+ *   - the cost of a virtual to physical address translation.
+ */
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "qae_mem_utils.h"
+#include "qat_contig_mem_mock.h"
+
+#define BENCH_MAX_THREADS     64
+#define BENCH_BATCH           64
+#define BENCH_LIVE_BUFFERS    256
+#define BENCH_V2P_BUFFERS     1024
+#define BENCH_MIN_SHIFT       6
+#define BENCH_MAX_SHIFT       15
+
+static const size_t bench_sizes[] = { 64, 256, 1024, 4096, 16384, 65536 };
+
+typedef struct _bench_thread {
+    pthread_t tid;
+    int id;
+    size_t size;
+    long iterations;
+    /* bytes held live at the end of the fragmentation test */
+    size_t live_bytes;
+    int failed;
+} bench_thread;
+
+static pthread_barrier_t bench_barrier;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* xorshift, good enough to pick sizes and slots */
+static inline unsigned int bench_rand(unsigned int *state)
+{
+    unsigned int x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/* log-uniform size between 2^BENCH_MIN_SHIFT and 2^BENCH_MAX_SHIFT */
+static size_t bench_rand_size(unsigned int *state)
+{
+    int shift = BENCH_MIN_SHIFT +
+                bench_rand(state) % (BENCH_MAX_SHIFT - BENCH_MIN_SHIFT);
+    size_t base = 1UL << shift;
+
+    return base + bench_rand(state) % base;
+}
+
+/******************************************************************************
+* function:
+*         throughput_thread(void *arg)
+*
+* description:
+*   Allocate and free batches of buffers of one size.
+*
+******************************************************************************/
+static void *throughput_thread(void *arg)
+{
+    bench_thread *t = (bench_thread *)arg;
+    void *bufs[BENCH_BATCH];
+    long i;
+    int j;
+
+    pthread_barrier_wait(&bench_barrier);
+    for (i = 0; i < t->iterations; i += BENCH_BATCH) {
+        for (j = 0; j < BENCH_BATCH; j++) {
+            bufs[j] = qaeCryptoMemAlloc(t->size, __FILE__, __LINE__);
+            if (bufs[j] == NULL) {
+                t->failed = 1;
+                break;
+            }
+            *(volatile char *)bufs[j] = (char)j;
+        }
+        while (j-- > 0)
+            qaeCryptoMemFree(bufs[j]);
+        if (t->failed)
+            break;
+    }
+    pthread_barrier_wait(&bench_barrier);
+    return NULL;
+}
+
+/******************************************************************************
+* function:
+*         fragmentation_thread(void *arg)
+*
+* description:
+*   Keep BENCH_LIVE_BUFFERS buffers of random sizes live, replacing a random
+*   one at each iteration.
+*
+******************************************************************************/
+static void *fragmentation_thread(void *arg)
+{
+    bench_thread *t = (bench_thread *)arg;
+    void *bufs[BENCH_LIVE_BUFFERS] = { NULL };
+    size_t sizes[BENCH_LIVE_BUFFERS] = { 0 };
+    unsigned int state = 0x9E3779B9 ^ (t->id + 1);
+    long i;
+    int j;
+
+    pthread_barrier_wait(&bench_barrier);
+    for (i = 0; i < t->iterations; i++) {
+        j = bench_rand(&state) % BENCH_LIVE_BUFFERS;
+        if (bufs[j] != NULL) {
+            qaeCryptoMemFree(bufs[j]);
+            t->live_bytes -= sizes[j];
+        }
+        sizes[j] = bench_rand_size(&state);
+        if ((bufs[j] = qaeCryptoMemAlloc(sizes[j], __FILE__, __LINE__))
+            == NULL) {
+            t->failed = 1;
+            break;
+        }
+        t->live_bytes += sizes[j];
+    }
+    pthread_barrier_wait(&bench_barrier);
+    /* the main thread samples the pinned memory at this point */
+    pthread_barrier_wait(&bench_barrier);
+    for (j = 0; j < BENCH_LIVE_BUFFERS; j++) {
+        if (bufs[j] != NULL)
+            qaeCryptoMemFree(bufs[j]);
+    }
+    return NULL;
+}
+
+/* start nthreads threads and return the time between the two barriers */
+static double bench_run(bench_thread *threads, int nthreads,
+                        void *(*fn)(void *), void (*sample)(void))
+{
+    double start, end;
+    int i;
+
+    pthread_barrier_init(&bench_barrier, NULL, nthreads + 1);
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i].tid, NULL, fn, &threads[i]) != 0) {
+            perror("# FAIL pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_barrier_wait(&bench_barrier);
+    start = bench_now();
+    pthread_barrier_wait(&bench_barrier);
+    end = bench_now();
+    if (sample != NULL) {
+        sample();
+        pthread_barrier_wait(&bench_barrier);
+    }
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i].tid, NULL);
+    pthread_barrier_destroy(&bench_barrier);
+    return end - start;
+}
+
+static size_t frag_pinned = 0;
+
+static void fragmentation_sample(void)
+{
+    size_t peak;
+
+    qat_contig_mem_mock_stats(&frag_pinned, &peak);
+}
+
+static int throughput_test(int max_threads, long iterations)
+{
+    bench_thread threads[BENCH_MAX_THREADS];
+    double secs;
+    int nthreads, i, s, failed = 0;
+
+    printf("\nalloc/free throughput (Mops/s, %ld allocations per thread)\n",
+           iterations);
+    printf("%8s", "size");
+    for (nthreads = 1; nthreads <= max_threads; nthreads <<= 1)
+        printf(" %7dthr", nthreads);
+    printf("\n");
+
+    for (s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+        printf("%8zu", bench_sizes[s]);
+        for (nthreads = 1; nthreads <= max_threads; nthreads <<= 1) {
+            memset(threads, 0, sizeof(threads));
+            for (i = 0; i < nthreads; i++) {
+                threads[i].id = i;
+                threads[i].size = bench_sizes[s];
+                threads[i].iterations = iterations;
+            }
+            secs = bench_run(threads, nthreads, throughput_thread, NULL);
+            for (i = 0; i < nthreads; i++)
+                failed |= threads[i].failed;
+            printf(" %10.2f", nthreads * (double)iterations / secs / 1e6);
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+    return failed;
+}
+
+static int fragmentation_test(int max_threads, long iterations)
+{
+    bench_thread threads[BENCH_MAX_THREADS];
+    size_t live, pinned_before, peak;
+    double secs;
+    int nthreads, i, failed = 0;
+
+    printf("\nfragmentation (%d live buffers of 64B-32KB per thread)\n",
+           BENCH_LIVE_BUFFERS);
+    printf("%8s %10s %12s %12s %8s\n", "threads", "Mops/s", "live KB",
+           "pinned KB", "ratio");
+
+    for (nthreads = 1; nthreads <= max_threads; nthreads <<= 1) {
+        memset(threads, 0, sizeof(threads));
+        for (i = 0; i < nthreads; i++) {
+            threads[i].id = i;
+            threads[i].iterations = iterations;
+        }
+        qat_contig_mem_mock_stats(&pinned_before, &peak);
+        secs = bench_run(threads, nthreads, fragmentation_thread,
+                         fragmentation_sample);
+        for (live = 0, i = 0; i < nthreads; i++) {
+            live += threads[i].live_bytes;
+            failed |= threads[i].failed;
+        }
+        printf("%8d %10.2f %12zu %12zu %8.2f\n", nthreads,
+               nthreads * (double)iterations / secs / 1e6, live / 1024,
+               frag_pinned / 1024, live ? (double)frag_pinned / live : 0.0);
+    }
+    return failed;
+}
+
+static int v2p_test(long iterations)
+{
+    void *bufs[BENCH_V2P_BUFFERS];
+    size_t sizes[BENCH_V2P_BUFFERS];
+    unsigned int state = 0x2545F491;
+    volatile CpaPhysicalAddr sink = 0;
+    CpaPhysicalAddr phys;
+    double start, secs;
+    long i;
+    int j, failed = 0;
+
+    for (j = 0; j < BENCH_V2P_BUFFERS; j++) {
+        sizes[j] = bench_rand_size(&state);
+        if ((bufs[j] = qaeCryptoMemAlloc(sizes[j], __FILE__, __LINE__))
+            == NULL)
+            return 1;
+    }
+
+    /* every byte of a buffer must translate to consecutive addresses */
+    for (j = 0; j < BENCH_V2P_BUFFERS; j++) {
+        phys = qaeCryptoMemV2P(bufs[j]);
+        if (phys == 0 ||
+            qaeCryptoMemV2P((char *)bufs[j] + sizes[j] - 1) !=
+            phys + sizes[j] - 1) {
+            printf("# FAIL V2P of buffer %p of %zu bytes\n", bufs[j],
+                   sizes[j]);
+            failed = 1;
+            break;
+        }
+    }
+
+    start = bench_now();
+    for (i = 0; i < iterations; i++) {
+        j = bench_rand(&state) % BENCH_V2P_BUFFERS;
+        sink += qaeCryptoMemV2P((char *)bufs[j] +
+                                bench_rand(&state) % sizes[j]);
+    }
+    secs = bench_now() - start;
+    printf("\nV2P: %.1f ns per translation\n", secs * 1e9 / iterations);
+
+    for (j = 0; j < BENCH_V2P_BUFFERS; j++)
+        qaeCryptoMemFree(bufs[j]);
+    return failed;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-t max_threads] [-n iterations]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+/******************************************************************************
+* function:
+*         main(int argc, char **argv)
+*
+* description:
+*   Entry point.
+*
+******************************************************************************/
+int main(int argc, char **argv)
+{
+    int max_threads = 8;
+    long iterations = 1000000;
+    int opt, failed = 0;
+
+    while ((opt = getopt(argc, argv, "t:n:")) != -1) {
+        switch (opt) {
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'n':
+            iterations = atol(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (max_threads < 1 || max_threads > BENCH_MAX_THREADS ||
+        iterations < BENCH_BATCH)
+        usage(argv[0]);
+
+    /* first so that the pinned memory is not inflated by other tests */
+    failed |= fragmentation_test(max_threads, iterations);
+    failed |= throughput_test(max_threads, iterations);
+    failed |= v2p_test(iterations);
+
+    if (failed)
+        printf("# FAIL Verify for QAT Contig Mem Benchmark.\n");
+    else
+        printf("# PASS Verify for QAT Contig Mem Benchmark.\n");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -62,7 +62,8 @@
 
 /* This example contiguous memory allocator is written as a slab allocator.
    The expectation is that allocations passed to it are for
-   multiples of PAGE_SIZE up to 2^5 pages. If you use a non-multiple
+   multiples of PAGE_SIZE up to QAT_CONTIG_MEM_MAX_ALLOC bytes, the
+   userspace slabs being 2^5 pages. If you use a non-multiple
    of PAGE_SIZE you need to be careful how you use mmap and how you
    locate the slab header. */
 
@@ -75,11 +76,13 @@
 #include <linux/cdev.h>
 #include <linux/device.h>
 #include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/numa.h>
+#include <linux/nodemask.h>
 
 #include "qat_contig_mem.h"
 
-#define PAGE_ORDER 5
-#define MAX_MEM_ALLOC (PAGE_SIZE * (2 << PAGE_ORDER) - sizeof(qat_contig_mem_config))
+#define MAX_MEM_ALLOC ((long) QAT_CONTIG_MEM_MAX_ALLOC)
 
 static int major;
 static unsigned long bytesToPageOrder(long int memSize);
@@ -113,6 +116,24 @@ typedef struct chr_drv_info_s {
 #define SUCCESS                 0
 #define FREE(ptr) kfree(ptr)
 
+#define ARENA_CHUNK_ORDER 5
+
+/**
+ *****************************************************************************
+ * @description
+ *      An arena is a set of QAT_CONTIG_MEM_ARENA_CHUNK_SIZE chunks reserved
+ *      for one open file descriptor. It is hung off filp->private_data and
+ *      is mapped in one go by qat_contig_mem_mmap_arena().
+ *
+ ****************************************************************************/
+typedef struct qat_contig_mem_arena_s {
+    int nr_chunks;
+    unsigned long chunks[0];
+} qat_contig_mem_arena_t;
+
+/* Serialises arena creation and release against mmap */
+static DEFINE_MUTEX(arena_lock);
+
 /******************************************************************************
 * function:
 *         qat_contig_mem_read(struct file *filp, char __user *buffer, size_t length,
@@ -153,11 +174,154 @@ static ssize_t qat_contig_mem_write(struct file *filp, const char __user * buff,
     return -EIO;
 }
 
+/******************************************************************************
+* function:
+*         node_get_free_pages(int node, unsigned int order)
+*
+* @param node  [IN] - NUMA node requested, QAT_CONTIG_MEM_ANY_NODE for none
+* @param order [IN] - page order of the allocation
+*
+* description:
+*   Allocate 2^order contiguous pages, preferably on the given node. Without
+*   a node the pages come from the node of the calling thread.
+*
+******************************************************************************/
+static unsigned long node_get_free_pages(int node, unsigned int order)
+{
+    struct page *page = NULL;
+
+    page = alloc_pages_node(node == QAT_CONTIG_MEM_ANY_NODE ?
+                            NUMA_NO_NODE : node, GFP_KERNEL, order);
+    if (page == NULL)
+        return 0;
+    return (unsigned long)page_address(page);
+}
+
+/******************************************************************************
+* function:
+*         node_is_valid(int node)
+*
+* @param node [IN] - NUMA node requested
+*
+* description:
+*   Check that a node passed in from userspace can be allocated from.
+*
+******************************************************************************/
+static int node_is_valid(int node)
+{
+    if (node == QAT_CONTIG_MEM_ANY_NODE)
+        return 1;
+    return node >= 0 && node < MAX_NUMNODES && node_online(node);
+}
+
 /*
  * driver open function
  */
 static int qat_contig_mem_open(struct inode *inp, struct file *fp)
 {
+    fp->private_data = NULL;
+    return 0;
+}
+
+/******************************************************************************
+* function:
+*         arena_free(qat_contig_mem_arena_t *arena)
+*
+* @param arena [IN] - arena to be released, may be NULL
+*
+* description:
+*   Give all the chunks of an arena back to the page allocator.
+*
+******************************************************************************/
+static void arena_free(qat_contig_mem_arena_t *arena)
+{
+    int i;
+
+    if (arena == NULL)
+        return;
+
+    for (i = 0; i < arena->nr_chunks; i++) {
+        if (arena->chunks[i])
+            free_pages(arena->chunks[i], ARENA_CHUNK_ORDER);
+    }
+    FREE(arena);
+}
+
+/******************************************************************************
+* function:
+*         arena_create(struct file *fp, qat_contig_mem_config *mem)
+*
+* @param fp  [IN]    - file the arena is attached to
+* @param mem [INOUT] - length holds the requested size on input, on output
+*                      it holds the size actually reserved
+*
+* description:
+*   Reserve a chunk-contiguous arena for this file descriptor. Every chunk
+*   gets a qat_contig_mem_config header written into its first bytes, in the
+*   same way as a QAT_CONTIG_MEM_MALLOC allocation, so that userspace can
+*   locate the physical address of any chunk from its own mapping.
+*
+******************************************************************************/
+static int arena_create(struct file *fp, qat_contig_mem_config *mem)
+{
+    qat_contig_mem_arena_t *arena = NULL;
+    qat_contig_mem_config *hdr = NULL;
+    int nr_chunks = 0;
+    int i;
+
+    if (mem->length <= 0 || !node_is_valid(mem->node)) {
+        printk("%s: invalid inputs in qat_contig_mem_config structure!\n",
+               __func__);
+        return -EINVAL;
+    }
+
+    nr_chunks = (mem->length + QAT_CONTIG_MEM_ARENA_CHUNK_SIZE - 1) /
+                QAT_CONTIG_MEM_ARENA_CHUNK_SIZE;
+    if (nr_chunks > QAT_CONTIG_MEM_ARENA_MAX_CHUNKS) {
+        printk("%s: arena requested (%d) greater than max arena (%d)\n",
+               __func__, mem->length,
+               QAT_CONTIG_MEM_ARENA_MAX_CHUNKS *
+               QAT_CONTIG_MEM_ARENA_CHUNK_SIZE);
+        return -EINVAL;
+    }
+
+    if (fp->private_data != NULL) {
+        printk("%s: arena already exists for this file\n", __func__);
+        return -EBUSY;
+    }
+
+    arena = kzalloc(sizeof(qat_contig_mem_arena_t) +
+                    nr_chunks * sizeof(unsigned long), GFP_KERNEL);
+    if (arena == NULL) {
+        printk("%s: kzalloc() failed\n", __func__);
+        return -ENOMEM;
+    }
+    arena->nr_chunks = nr_chunks;
+
+    for (i = 0; i < nr_chunks; i++) {
+        arena->chunks[i] = node_get_free_pages(mem->node, ARENA_CHUNK_ORDER);
+        if (arena->chunks[i] == 0) {
+            printk("%s: node_get_free_pages() failed for chunk %d\n",
+                   __func__, i);
+            arena_free(arena);
+            return -ENOMEM;
+        }
+        hdr = (qat_contig_mem_config *) arena->chunks[i];
+        hdr->signature = QAT_CONTIG_MEM_ALLOC_SIG;
+        hdr->virtualAddress = (uintptr_t) arena->chunks[i];
+        hdr->length = QAT_CONTIG_MEM_ARENA_CHUNK_SIZE;
+        hdr->physicalAddress =
+            (uintptr_t) virt_to_phys((void *)(arena->chunks[i]));
+        hdr->node = mem->node;
+    }
+
+    fp->private_data = arena;
+
+    mem->signature = QAT_CONTIG_MEM_ARENA_SIG;
+    mem->virtualAddress = (uintptr_t) QAT_CONTIG_MEM_ARENA_MMAP_OFFSET;
+    mem->length = nr_chunks * QAT_CONTIG_MEM_ARENA_CHUNK_SIZE;
+    mem->physicalAddress = ((qat_contig_mem_config *)
+                            arena->chunks[0])->physicalAddress;
     return 0;
 }
 
@@ -166,28 +330,38 @@ static int qat_contig_mem_open(struct inode *inp, struct file *fp)
  */
 static int qat_contig_mem_release(struct inode *inp, struct file *fp)
 {
+    mutex_lock(&arena_lock);
+    arena_free(fp->private_data);
+    fp->private_data = NULL;
+    mutex_unlock(&arena_lock);
     return 0;
 }
 
 /******************************************************************************
 * function:
-*         do_ioctl(qat_contig_mem_config *mem, unsigned int cmd, unsigned long arg)
+*         do_ioctl(struct file *fp, qat_contig_mem_config *mem,
+*                  unsigned int cmd, unsigned long arg)
 *
+* @param fp  [IN] - file the ioctl was issued on
 * @param mem [IN] - pointer to mem structure
 * @param cmd [IN] - ioctl number requested
 * @param arg [IN] - any arg needed by ioctl implementaion
 *
 * description:
 *   Callback for ioctl operations on the device node. This is our control path.
-*   We support two ioctls, QAT_MEM_MALLOC and QAT_MEM_FREE.
+*   We support QAT_MEM_MALLOC and QAT_MEM_FREE for individual allocations
+*   and QAT_CONTIG_MEM_ARENA_CREATE and QAT_CONTIG_MEM_ARENA_FREE for the
+*   per file descriptor arena.
 *
 ******************************************************************************/
-static int do_ioctl(qat_contig_mem_config * mem, unsigned int cmd, unsigned long arg)
+static int do_ioctl(struct file *fp, qat_contig_mem_config * mem,
+                    unsigned int cmd, unsigned long arg)
 {
+    int ret = 0;
 
     switch (cmd) {
     case QAT_CONTIG_MEM_MALLOC:
-        if (mem->length <= 0) {
+        if (mem->length <= 0 || !node_is_valid(mem->node)) {
             printk
                 ("%s: invalid inputs in qat_contig_mem_config structure!\n",
                  __func__);
@@ -201,10 +375,10 @@ static int do_ioctl(qat_contig_mem_config * mem, unsigned int cmd, unsigned long
             return -EINVAL;
         }
         mem->virtualAddress =
-            (uintptr_t) __get_free_pages(GFP_KERNEL,
-                                         bytesToPageOrder(mem->length));
+            (uintptr_t) node_get_free_pages(mem->node,
+                                            bytesToPageOrder(mem->length));
         if (mem->virtualAddress == (uintptr_t) 0) {
-            printk("%s: __get_free_pages() failed\n", __func__);
+            printk("%s: node_get_free_pages() failed\n", __func__);
             return -EINVAL;
         }
 
@@ -231,6 +405,28 @@ static int do_ioctl(qat_contig_mem_config * mem, unsigned int cmd, unsigned long
                    bytesToPageOrder(mem->length));
         break;
 
+    case QAT_CONTIG_MEM_ARENA_CREATE:
+        mutex_lock(&arena_lock);
+        ret = arena_create(fp, mem);
+        mutex_unlock(&arena_lock);
+        if (ret != 0)
+            return ret;
+
+        if (copy_to_user((void *)arg, mem, sizeof(*mem))) {
+            printk("%s: copy_to_user failed\n", __func__);
+            return -EFAULT;
+        }
+        break;
+
+    case QAT_CONTIG_MEM_ARENA_FREE:
+        /* As with QAT_CONTIG_MEM_FREE the caller must have unmapped the
+           arena before releasing it. */
+        mutex_lock(&arena_lock);
+        arena_free(fp->private_data);
+        fp->private_data = NULL;
+        mutex_unlock(&arena_lock);
+        break;
+
     default:
         printk("%s: unknown request\n", __func__);
         return -ENOTTY;
@@ -269,21 +465,86 @@ qat_contig_mem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
         return -EFAULT;
     }
 
-    return do_ioctl(&mem, cmd, arg);
+    return do_ioctl(file, &mem, cmd, arg);
+}
+
+/******************************************************************************
+* function:
+*         qat_contig_mem_mmap_arena(struct file *filp,
+*                                   struct vm_area_struct *vma)
+*
+* @param filp [IN]    - file owning the arena
+* @param vma  [INOUT] - struct containing details of the requested mmap
+*
+* description:
+*   Map every chunk of the arena owned by filp back to back. As with single
+*   allocations userspace passes in twice the arena size so that the start
+*   of the mapping can be aligned on a chunk boundary, which keeps the V2P
+*   lookup based on the chunk header working for arena memory.
+*
+******************************************************************************/
+static int qat_contig_mem_mmap_arena(struct file *filp,
+                                     struct vm_area_struct *vma)
+{
+    int ret = 0;
+    int i;
+    unsigned long arena_size = 0;
+    unsigned long start = 0;
+    qat_contig_mem_arena_t *arena = NULL;
+
+    mutex_lock(&arena_lock);
+    arena = filp->private_data;
+    if (arena == NULL) {
+        printk("%s: no arena has been created\n", __func__);
+        ret = -EINVAL;
+        goto exit;
+    }
+
+    arena_size = (unsigned long)arena->nr_chunks *
+                 QAT_CONTIG_MEM_ARENA_CHUNK_SIZE;
+    if (vma->vm_end - vma->vm_start <
+        arena_size * QAT_CONTIG_MEM_MMAP_ADJUSTMENT) {
+        printk("%s: mapping too small for arena\n", __func__);
+        ret = -EINVAL;
+        goto exit;
+    }
+
+    start = ALIGN(vma->vm_start, QAT_CONTIG_MEM_ARENA_CHUNK_SIZE);
+    vma->vm_start = start;
+    vma->vm_end = start + arena_size;
+
+    for (i = 0; i < arena->nr_chunks; i++) {
+        ret = remap_pfn_range(vma,
+                              start + i * QAT_CONTIG_MEM_ARENA_CHUNK_SIZE,
+                              virt_to_phys((void *)arena->chunks[i])
+                                  >> PAGE_SHIFT,
+                              QAT_CONTIG_MEM_ARENA_CHUNK_SIZE,
+                              vma->vm_page_prot);
+        if (ret != 0) {
+            printk("%s: remap_pfn_range failed for chunk %d, returned %d\n",
+                   __func__, i, ret);
+            break;
+        }
+    }
+
+ exit:
+    mutex_unlock(&arena_lock);
+    return ret;
 }
 
 /******************************************************************************
 * function:
 *         qat_contig_mem_mmap(struct file *filp, struct vm_area_struct *vma)
 *
-* @param filp [IN]    - unused
+* @param filp [IN]    - file the mapping is made on
 * @param vma  [INOUT] - struct containing details of the requested mmap, and
 *                       also the resulting offset
 *
 * description:
 *   Callback for mmap operations on the device node. This is identical to the
 *   /dev/kmem device on some Linux distros, but others have removed this for
-*   security reasons so we have to re-implement it.
+*   security reasons so we have to re-implement it. An offset of
+*   QAT_CONTIG_MEM_ARENA_MMAP_OFFSET maps the arena of this file instead.
 *
 ******************************************************************************/
 static int qat_contig_mem_mmap(struct file *filp, struct vm_area_struct *vma)
@@ -292,6 +553,10 @@ static int qat_contig_mem_mmap(struct file *filp, struct vm_area_struct *vma)
     unsigned long pfn;
     unsigned long offset = 0;
     unsigned long mmap_size = 0;
+
+    if (vma->vm_pgoff == QAT_CONTIG_MEM_ARENA_MMAP_OFFSET)
+        return qat_contig_mem_mmap_arena(filp, vma);
+
     /*
      * Convert the vm_pgoff page frame number to an address, then a physical
      * address, then convert it back to a page frame number. The final result
@@ -500,20 +765,11 @@ void unregister_mem_device_driver(void)
 ******************************************************************************/
 static unsigned long bytesToPageOrder(long int memSize)
 {
-    if (memSize <= PAGE_SIZE)
-        return 0;
-    else if (memSize <= PAGE_SIZE * 1 << 1)
-        return 1;
-    else if (memSize <= PAGE_SIZE * 1 << 2)
-        return 2;
-    else if (memSize <= PAGE_SIZE * 1 << 3)
-        return 3;
-    else if (memSize <= PAGE_SIZE * 1 << 4)
-        return 4;
-    else if (memSize <= PAGE_SIZE * 1 << 5)
-        return 5;
-    else
-        return -1;
+    unsigned long order = 0;
+
+    while ((PAGE_SIZE << order) < memSize)
+        order++;
+    return order;
 }
 
 /*
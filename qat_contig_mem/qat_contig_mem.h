@@ -73,12 +73,31 @@ typedef struct _qat_contig_mem_config {
     uintptr_t virtualAddress;
     int length;
     uintptr_t physicalAddress;
+    /* NUMA node to allocate from, QAT_CONTIG_MEM_ANY_NODE for no preference */
+    int node;
 } qat_contig_mem_config;
 
 # define QAT_CONTIG_MEM_MAGIC    0x95
 # define QAT_CONTIG_MEM_ALLOC_SIG 0xDEADBEEF
 # define QAT_CONTIG_MEM_MMAP_ADJUSTMENT 2
+# define QAT_CONTIG_MEM_ANY_NODE -1
+/* largest single allocation, a power of two number of pages */
+# define QAT_CONTIG_MEM_MAX_ALLOC 0x400000
 # define QAT_CONTIG_MEM_MALLOC  _IOWR(QAT_CONTIG_MEM_MAGIC, 0, qat_contig_mem_config)
 # define QAT_CONTIG_MEM_FREE    _IOW(QAT_CONTIG_MEM_MAGIC, 2, qat_contig_mem_config)
 
+/*
+ * Arena support: a number of fixed size chunks are reserved for the file
+ * descriptor in one ioctl and are then mapped with a single mmap at offset
+ * QAT_CONTIG_MEM_ARENA_MMAP_OFFSET. Each chunk is physically contiguous and
+ * starts with its own qat_contig_mem_config header. The arena is released
+ * with QAT_CONTIG_MEM_ARENA_FREE or when the file descriptor is closed.
+ */
+# define QAT_CONTIG_MEM_ARENA_SIG        0xA5E9A5E9
+# define QAT_CONTIG_MEM_ARENA_CHUNK_SIZE 0x20000
+# define QAT_CONTIG_MEM_ARENA_MAX_CHUNKS 8192
+# define QAT_CONTIG_MEM_ARENA_MMAP_OFFSET 0
+# define QAT_CONTIG_MEM_ARENA_CREATE _IOWR(QAT_CONTIG_MEM_MAGIC, 3, qat_contig_mem_config)
+# define QAT_CONTIG_MEM_ARENA_FREE   _IOW(QAT_CONTIG_MEM_MAGIC, 4, qat_contig_mem_config)
+
 #endif
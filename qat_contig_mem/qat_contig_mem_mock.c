@@ -0,0 +1,484 @@
+/***************************************************************************
+ *
+ * This file is provided under a dual BSD/GPLv2 license.  When using or
+ *   redistributing this file, you may do so under either license.
+ *
+ *   GPL LICENSE SUMMARY
+ *
+ *   Copyright(c) 2007-2012 Intel Corporation. All rights reserved.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of version 2 of the GNU General Public License as
+ *   published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *   The full GNU General Public License is included in this distribution
+ *   in the file called LICENSE.GPL.
+ *
+ *   Contact Information:
+ *   Intel Corporation
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2007,2008,2009,2010,2011,2012 Intel Corporation.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ *
+ ***************************************************************************/
+
+/*
+ * Userspace mock of the qat_contig_mem driver, see qat_contig_mem_mock.h.
+ *
+ * QAT_CONTIG_MEM_MALLOC only reserves a range of fake physical addresses,
+ * aligned on the size of the allocation as real pages of that order would
+ * be, and returns its start as the "kernel virtual address" used as the
+ * mmap offset. The memory itself is created by the mmap call, which maps
+ * anonymous memory at an address aligned on the allocation size, locks it
+ * and writes the qat_contig_mem_config header just as the driver does.
+ * Arenas work the same way with one header per chunk.
+ */
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "qat_contig_mem.h"
+#include "qat_contig_mem_mock.h"
+#ifdef QAT_CONTIG_MEM_MOCK_USDM
+# include "qae_mem.h"
+#endif
+
+#define MOCK_DEV_NAME   "/dev/qat_contig_mem"
+#define MOCK_PAGE_SIZE  4096UL
+#define MOCK_MAX_FDS    1024
+
+typedef struct _mock_fd {
+    int is_mock;
+    /* size of the arena created on this descriptor, 0 if none */
+    size_t arena_len;
+    uint64_t arena_phys;
+} mock_fd;
+
+static mock_fd mock_fds[MOCK_MAX_FDS];
+static pthread_mutex_t mock_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t mock_next_phys = QAT_CONTIG_MEM_MOCK_PHYS_BASE;
+static size_t mock_pinned = 0;
+static size_t mock_peak = 0;
+static int mock_mlock_warned = 0;
+
+static int (*real_open)(const char *, int, ...) = NULL;
+static int (*real_close)(int) = NULL;
+static int (*real_ioctl)(int, unsigned long, ...) = NULL;
+static void *(*real_mmap)(void *, size_t, int, int, int, off_t) = NULL;
+
+/* resolve the libc functions being replaced */
+static void mock_resolve(void)
+{
+    if (real_mmap != NULL)
+        return;
+    real_open = dlsym(RTLD_NEXT, "open");
+    real_close = dlsym(RTLD_NEXT, "close");
+    real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+    real_mmap = dlsym(RTLD_NEXT, "mmap");
+    if (real_open == NULL || real_close == NULL || real_ioctl == NULL ||
+        real_mmap == NULL) {
+        fprintf(stderr, "qat_contig_mem_mock: dlsym failed: %s\n", dlerror());
+        abort();
+    }
+}
+
+static inline int mock_is_fd(int fd)
+{
+    return fd >= 0 && fd < MOCK_MAX_FDS && mock_fds[fd].is_mock;
+}
+
+/* account for pinned memory, must be called with mock_lock held */
+static void mock_account(long delta)
+{
+    mock_pinned += delta;
+    if (mock_pinned > mock_peak)
+        mock_peak = mock_pinned;
+}
+
+/* reserve len bytes of fake physical memory aligned on align */
+static uint64_t mock_reserve_phys(size_t len, size_t align)
+{
+    uint64_t phys;
+
+    pthread_mutex_lock(&mock_lock);
+    phys = (mock_next_phys + align - 1) & ~((uint64_t)align - 1);
+    mock_next_phys = phys + len;
+    mock_account(len);
+    pthread_mutex_unlock(&mock_lock);
+    return phys;
+}
+
+static void mock_release_phys(size_t len)
+{
+    pthread_mutex_lock(&mock_lock);
+    mock_account(-(long)len);
+    pthread_mutex_unlock(&mock_lock);
+}
+
+/* round a length up to the power of two number of pages the driver uses */
+static size_t mock_order_size(size_t len)
+{
+    size_t size = MOCK_PAGE_SIZE;
+
+    while (size < len)
+        size <<= 1;
+    return size;
+}
+
+/*
+ * map len bytes of locked anonymous memory aligned on align, trimming the
+ * excess of a mapping of twice the size
+ */
+static unsigned char *mock_map_aligned(size_t len, size_t align)
+{
+    unsigned char *addr = NULL;
+    unsigned char *start = NULL;
+    size_t map_len = len + align;
+
+    addr = real_mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+        return MAP_FAILED;
+
+    start = (unsigned char *)(((uintptr_t)addr + align - 1) &
+                              ~((uintptr_t)align - 1));
+    if (start > addr)
+        munmap(addr, start - addr);
+    if (addr + map_len > start + len)
+        munmap(start + len, addr + map_len - (start + len));
+
+    if (mlock(start, len) != 0 && !mock_mlock_warned) {
+        mock_mlock_warned = 1;
+        fprintf(stderr, "qat_contig_mem_mock: mlock failed (%s), "
+                "memory is not pinned\n", strerror(errno));
+    }
+    return start;
+}
+
+static void mock_write_header(unsigned char *addr, uint64_t phys,
+                              size_t len)
+{
+    qat_contig_mem_config *hdr = (qat_contig_mem_config *)addr;
+
+    hdr->signature = QAT_CONTIG_MEM_ALLOC_SIG;
+    hdr->virtualAddress = (uintptr_t)phys;
+    hdr->length = (int)len;
+    hdr->physicalAddress = (uintptr_t)phys;
+    hdr->node = QAT_CONTIG_MEM_ANY_NODE;
+}
+
+int open(const char *pathname, int flags, ...)
+{
+    mode_t mode = 0;
+    va_list ap;
+    int fd;
+
+    mock_resolve();
+    if (flags & O_CREAT) {
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+
+    if (strcmp(pathname, MOCK_DEV_NAME) != 0)
+        return real_open(pathname, flags, mode);
+
+    /* a real descriptor keeps the numbering consistent */
+    if ((fd = real_open("/dev/null", O_RDWR)) < 0)
+        return fd;
+    if (fd >= MOCK_MAX_FDS) {
+        real_close(fd);
+        errno = EMFILE;
+        return -1;
+    }
+    memset(&mock_fds[fd], 0, sizeof(mock_fd));
+    mock_fds[fd].is_mock = 1;
+    return fd;
+}
+
+int close(int fd)
+{
+    mock_resolve();
+    if (mock_is_fd(fd)) {
+        /* like the driver, closing the file releases its arena */
+        if (mock_fds[fd].arena_len != 0)
+            mock_release_phys(mock_fds[fd].arena_len);
+        memset(&mock_fds[fd], 0, sizeof(mock_fd));
+    }
+    return real_close(fd);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+    qat_contig_mem_config *mem = NULL;
+    size_t len;
+    va_list ap;
+
+    va_start(ap, request);
+    mem = va_arg(ap, qat_contig_mem_config *);
+    va_end(ap);
+
+    mock_resolve();
+    if (!mock_is_fd(fd))
+        return real_ioctl(fd, request, mem);
+
+    switch (request) {
+    case QAT_CONTIG_MEM_MALLOC:
+        if (mem->length <= 0 || mem->length > QAT_CONTIG_MEM_MAX_ALLOC) {
+            errno = EINVAL;
+            return -1;
+        }
+        len = mock_order_size(mem->length);
+        mem->physicalAddress = (uintptr_t)mock_reserve_phys(len, len);
+        mem->virtualAddress = mem->physicalAddress;
+        mem->signature = QAT_CONTIG_MEM_ALLOC_SIG;
+        return 0;
+
+    case QAT_CONTIG_MEM_FREE:
+        if (mem->virtualAddress == 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        mock_release_phys(mock_order_size(mem->length));
+        return 0;
+
+    case QAT_CONTIG_MEM_ARENA_CREATE:
+        if (mem->length <= 0 ||
+            mem->length > QAT_CONTIG_MEM_ARENA_MAX_CHUNKS *
+                          QAT_CONTIG_MEM_ARENA_CHUNK_SIZE) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (mock_fds[fd].arena_len != 0) {
+            errno = EBUSY;
+            return -1;
+        }
+        len = (mem->length + QAT_CONTIG_MEM_ARENA_CHUNK_SIZE - 1) &
+              ~(QAT_CONTIG_MEM_ARENA_CHUNK_SIZE - 1);
+        mock_fds[fd].arena_len = len;
+        mock_fds[fd].arena_phys =
+            mock_reserve_phys(len, QAT_CONTIG_MEM_ARENA_CHUNK_SIZE);
+        mem->signature = QAT_CONTIG_MEM_ARENA_SIG;
+        mem->virtualAddress = QAT_CONTIG_MEM_ARENA_MMAP_OFFSET;
+        mem->length = (int)len;
+        mem->physicalAddress = (uintptr_t)mock_fds[fd].arena_phys;
+        return 0;
+
+    case QAT_CONTIG_MEM_ARENA_FREE:
+        if (mock_fds[fd].arena_len != 0)
+            mock_release_phys(mock_fds[fd].arena_len);
+        mock_fds[fd].arena_len = 0;
+        return 0;
+
+    default:
+        errno = ENOTTY;
+        return -1;
+    }
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd,
+           off_t offset)
+{
+    unsigned char *start = NULL;
+    size_t len, i;
+    uint64_t phys;
+
+    mock_resolve();
+    if (!mock_is_fd(fd))
+        return real_mmap(addr, length, prot, flags, fd, offset);
+
+    if (offset == QAT_CONTIG_MEM_ARENA_MMAP_OFFSET) {
+        len = mock_fds[fd].arena_len;
+        if (len == 0 || length < len * QAT_CONTIG_MEM_MMAP_ADJUSTMENT) {
+            errno = EINVAL;
+            return MAP_FAILED;
+        }
+        start = mock_map_aligned(len, QAT_CONTIG_MEM_ARENA_CHUNK_SIZE);
+        if (start == MAP_FAILED)
+            return MAP_FAILED;
+        for (i = 0; i < len; i += QAT_CONTIG_MEM_ARENA_CHUNK_SIZE)
+            mock_write_header(start + i, mock_fds[fd].arena_phys + i,
+                              QAT_CONTIG_MEM_ARENA_CHUNK_SIZE);
+        return start;
+    }
+
+    /* the offset is the address returned by QAT_CONTIG_MEM_MALLOC */
+    phys = (uint64_t)offset;
+    len = length > MOCK_PAGE_SIZE ? length / QAT_CONTIG_MEM_MMAP_ADJUSTMENT :
+                                    length;
+    start = mock_map_aligned(len, len);
+    if (start == MAP_FAILED)
+        return MAP_FAILED;
+    mock_write_header(start, phys, len);
+    return start;
+}
+
+void qat_contig_mem_mock_stats(size_t *pinned, size_t *peak)
+{
+    pthread_mutex_lock(&mock_lock);
+    *pinned = mock_pinned;
+    *peak = mock_peak;
+    pthread_mutex_unlock(&mock_lock);
+}
+
+#ifdef QAT_CONTIG_MEM_MOCK_USDM
+/*
+ * USDM mock: blocks are carved out of one large reservation with a free
+ * list per power of two size, so that V2P is a subtraction as with the
+ * page table lookup of the real component.
+ */
+# define MOCK_USDM_POOL_SIZE   (1UL << 32)
+# define MOCK_USDM_HDR_SIZE    64
+# define MOCK_USDM_MIN_SHIFT   6
+# define MOCK_USDM_NUM_CLASSES 27
+
+typedef struct _mock_usdm_block {
+    struct _mock_usdm_block *next;
+    int class_index;
+} mock_usdm_block;
+
+static unsigned char *mock_usdm_base = NULL;
+static size_t mock_usdm_used = 0;
+static mock_usdm_block *mock_usdm_free[MOCK_USDM_NUM_CLASSES];
+static pthread_mutex_t mock_usdm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void *qaeMemAllocNUMA(size_t size, int node, size_t phys_alignment_byte)
+{
+    mock_usdm_block *blk = NULL;
+    size_t class_size;
+    int i;
+
+    for (i = 0; i < MOCK_USDM_NUM_CLASSES; i++) {
+        class_size = 1UL << (i + MOCK_USDM_MIN_SHIFT);
+        if (size + MOCK_USDM_HDR_SIZE <= class_size)
+            break;
+    }
+    if (i == MOCK_USDM_NUM_CLASSES || phys_alignment_byte > MOCK_USDM_HDR_SIZE)
+        return NULL;
+
+    mock_resolve();
+    pthread_mutex_lock(&mock_usdm_lock);
+    if (mock_usdm_base == NULL) {
+        mock_usdm_base = real_mmap(NULL, MOCK_USDM_POOL_SIZE,
+                                   PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS |
+                                   MAP_NORESERVE, -1, 0);
+        if (mock_usdm_base == MAP_FAILED) {
+            mock_usdm_base = NULL;
+            goto exit;
+        }
+    }
+
+    if ((blk = mock_usdm_free[i]) != NULL) {
+        mock_usdm_free[i] = blk->next;
+    } else {
+        /* keep blocks aligned on their size, up to a page */
+        mock_usdm_used = (mock_usdm_used + (class_size < MOCK_PAGE_SIZE ?
+                                            class_size : MOCK_PAGE_SIZE) - 1)
+                         & ~((class_size < MOCK_PAGE_SIZE ?
+                              class_size : MOCK_PAGE_SIZE) - 1);
+        if (mock_usdm_used + class_size > MOCK_USDM_POOL_SIZE)
+            goto exit;
+        blk = (mock_usdm_block *)(mock_usdm_base + mock_usdm_used);
+        mock_usdm_used += class_size;
+        if (mlock(blk, class_size) != 0 && !mock_mlock_warned) {
+            mock_mlock_warned = 1;
+            fprintf(stderr, "qat_contig_mem_mock: mlock failed (%s), "
+                    "memory is not pinned\n", strerror(errno));
+        }
+    }
+    blk->class_index = i;
+    blk->next = NULL;
+
+    pthread_mutex_lock(&mock_lock);
+    mock_account(class_size);
+    pthread_mutex_unlock(&mock_lock);
+
+ exit:
+    pthread_mutex_unlock(&mock_usdm_lock);
+    return blk == NULL ? NULL : (unsigned char *)blk + MOCK_USDM_HDR_SIZE;
+}
+
+void qaeMemFreeNUMA(void **ptr)
+{
+    mock_usdm_block *blk = NULL;
+
+    if (ptr == NULL || *ptr == NULL)
+        return;
+    blk = (mock_usdm_block *)((unsigned char *)*ptr - MOCK_USDM_HDR_SIZE);
+
+    pthread_mutex_lock(&mock_usdm_lock);
+    blk->next = mock_usdm_free[blk->class_index];
+    mock_usdm_free[blk->class_index] = blk;
+    pthread_mutex_unlock(&mock_usdm_lock);
+
+    pthread_mutex_lock(&mock_lock);
+    mock_account(-(long)(1UL << (blk->class_index + MOCK_USDM_MIN_SHIFT)));
+    pthread_mutex_unlock(&mock_lock);
+    *ptr = NULL;
+}
+
+uint64_t qaeVirtToPhysNUMA(void *pVirtAddress)
+{
+    unsigned char *v = (unsigned char *)pVirtAddress;
+
+    if (mock_usdm_base == NULL || v < mock_usdm_base ||
+        v >= mock_usdm_base + MOCK_USDM_POOL_SIZE)
+        return 0;
+    return QAT_CONTIG_MEM_MOCK_PHYS_BASE + (uint64_t)(v - mock_usdm_base);
+}
+
+void qaeAtFork(void)
+{
+}
+#endif
@@ -78,6 +78,65 @@
 #include "qat_contig_mem.h"
 
 #define SEG_LEN 64
+#define ARENA_CHUNKS 4
+
+/******************************************************************************
+* function:
+*         arena_test(int qat_contig_memfd)
+*
+* @param qat_contig_memfd [IN] - open file descriptor for the driver
+*
+* description:
+*   Reserve a small arena, map it and check that every chunk carries a
+*   valid header.
+*
+******************************************************************************/
+static int arena_test(int qat_contig_memfd)
+{
+    qat_contig_mem_config qmcfg;
+    qat_contig_mem_config *hdr = NULL;
+    unsigned char *addr = MAP_FAILED;
+    int ret = EXIT_SUCCESS;
+    int i;
+
+    qmcfg.length = ARENA_CHUNKS * QAT_CONTIG_MEM_ARENA_CHUNK_SIZE;
+    qmcfg.node = QAT_CONTIG_MEM_ANY_NODE;
+    if (ioctl(qat_contig_memfd, QAT_CONTIG_MEM_ARENA_CREATE, &qmcfg) == -1) {
+        perror("# FAIL ioctl QAT_CONTIG_MEM_ARENA_CREATE");
+        return EXIT_FAILURE;
+    }
+
+    if ((addr =
+         mmap(NULL, qmcfg.length * QAT_CONTIG_MEM_MMAP_ADJUSTMENT,
+              PROT_READ | PROT_WRITE, MAP_SHARED, qat_contig_memfd,
+              QAT_CONTIG_MEM_ARENA_MMAP_OFFSET)) == MAP_FAILED) {
+        perror("# FAIL mmap arena");
+        ret = EXIT_FAILURE;
+        goto cleanup;
+    }
+    printf("arena of %d bytes mapped to %p\n", qmcfg.length, addr);
+
+    for (i = 0; i < ARENA_CHUNKS; i++) {
+        hdr = (qat_contig_mem_config *)
+              (addr + i * QAT_CONTIG_MEM_ARENA_CHUNK_SIZE);
+        if (hdr->signature != QAT_CONTIG_MEM_ALLOC_SIG ||
+            hdr->length != QAT_CONTIG_MEM_ARENA_CHUNK_SIZE) {
+            printf("# FAIL arena chunk %d has an invalid header\n", i);
+            ret = EXIT_FAILURE;
+        }
+    }
+
+ cleanup:
+    if (addr != MAP_FAILED && munmap(addr, qmcfg.length) == -1) {
+        perror("# FAIL munmap arena");
+        ret = EXIT_FAILURE;
+    }
+    if (ioctl(qat_contig_memfd, QAT_CONTIG_MEM_ARENA_FREE, &qmcfg) == -1) {
+        perror("# FAIL ioctl QAT_CONTIG_MEM_ARENA_FREE");
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
 
 /******************************************************************************
 * function:
@@ -101,6 +160,7 @@ int main(void)
         goto cleanup;
     }
     qmcfg.length = SEG_LEN;
+    qmcfg.node = QAT_CONTIG_MEM_ANY_NODE;
     if (ioctl(qat_contig_memfd, QAT_CONTIG_MEM_MALLOC, &qmcfg) == -1) {
         perror("# FAIL ioctl QAT_CONTIG_MEM_MALLOC");
         ret = EXIT_FAILURE;
@@ -120,6 +180,7 @@ int main(void)
            (void *)mem_to_free->virtualAddress, mem_to_free->length);
     strcpy(addr + sizeof(qat_contig_mem_config), "Hello world!");
     puts(addr + sizeof(qat_contig_mem_config));
+    ret = arena_test(qat_contig_memfd);
  cleanup:
     if (qat_contig_memfd != -1 && mem_to_free != NULL
         && ioctl(qat_contig_memfd, QAT_CONTIG_MEM_FREE, mem_to_free) == -1) {
@@ -96,7 +96,9 @@ DH_METHOD *qat_get_DH_methods(void)
     if ((qat_dh_method = DH_meth_new("QAT DH method", 0)) == NULL
         || DH_meth_set_generate_key(qat_dh_method, qat_dh_generate_key) == 0
         || DH_meth_set_compute_key(qat_dh_method, qat_dh_compute_key) == 0
-        || DH_meth_set_bn_mod_exp(qat_dh_method, qat_dh_mod_exp) == 0) {
+        || DH_meth_set_bn_mod_exp(qat_dh_method, qat_dh_mod_exp) == 0
+        || DH_meth_set_finish(qat_dh_method,
+                              DH_meth_get_finish(DH_OpenSSL())) == 0) {
         QATerr(QAT_F_QAT_GET_DH_METHODS, ERR_R_INTERNAL_ERROR);
         return NULL;
     }
@@ -143,6 +145,24 @@ void qat_dhCallbackFn(void *pCallbackTag, CpaStatus status, void *pOpData,
                           NULL, CPA_TRUE);
 }
 
+static CpaStatus qat_dh_phase1_submit(CpaInstanceHandle instanceHandle,
+                                      void *callbackTag, void *args)
+{
+    qat_asym_args *req = (qat_asym_args *)args;
+
+    return cpaCyDhKeyGenPhase1(instanceHandle, qat_dhCallbackFn, callbackTag,
+                               req->opData, req->out1);
+}
+
+static CpaStatus qat_dh_phase2_submit(CpaInstanceHandle instanceHandle,
+                                      void *callbackTag, void *args)
+{
+    qat_asym_args *req = (qat_asym_args *)args;
+
+    return cpaCyDhKeyGenPhase2Secret(instanceHandle, qat_dhCallbackFn,
+                                     callbackTag, req->opData, req->out1);
+}
+
 /******************************************************************************
 * function:
 *         qat_dh_generate_key(DH * dh)
@@ -160,14 +180,13 @@ int qat_dh_generate_key(DH *dh)
     const BIGNUM *g = NULL;
     BIGNUM *pub_key = NULL, *priv_key = NULL;
     const BIGNUM *temp_pub_key = NULL, *temp_priv_key = NULL;
-    CpaInstanceHandle instanceHandle;
+    QAT_ASYM_REQ *req = NULL;
     CpaCyDhPhase1KeyGenOpData *opData = NULL;
     CpaFlatBuffer *pPV = NULL;
-    int qatPerformOpRetries = 0;
-    useconds_t ulPollInterval = getQatPollInterval();
-    int iMsgRetry = getQatMsgRetryCount();
+    qat_asym_args args = { NULL, NULL, NULL, NULL };
+    CpaBoolean verify = CPA_FALSE;
     CpaStatus status;
-    struct op_done op_done;
+    BN_CTX *ctx = NULL;
     size_t buflen;
     const DH_METHOD *sw_dh_method = DH_OpenSSL();
 
@@ -199,16 +218,17 @@ int qat_dh_generate_key(DH *dh)
 
     DH_get0_key(dh, &temp_pub_key, &temp_priv_key);
 
-    opData = (CpaCyDhPhase1KeyGenOpData *)
-        OPENSSL_malloc(sizeof(CpaCyDhPhase1KeyGenOpData));
-    if (opData == NULL) {
+    buflen = BN_num_bytes(p);
+    req = qat_asym_req_get(QAT_ASYM_REQ_DH_PHASE1, sizeof(*opData), buflen,
+                           1, 0);
+    if (req == NULL) {
         QATerr(QAT_F_QAT_DH_GENERATE_KEY, ERR_R_MALLOC_FAILURE);
         return ok;
     }
-
-    opData->primeP.pData = NULL;
-    opData->baseG.pData = NULL;
-    opData->privateValueX.pData = NULL;
+    opData = req->op_data;
+    pPV = &req->result[0];
+    args.opData = opData;
+    args.out1 = pPV;
 
     if (temp_priv_key == NULL) {
         if ((priv_key = BN_new()) == NULL) {
@@ -255,19 +275,6 @@ int qat_dh_generate_key(DH *dh)
         }
     }
 
-    buflen = BN_num_bytes(p);
-    pPV = (CpaFlatBuffer *) OPENSSL_malloc(sizeof(CpaFlatBuffer));
-    if (pPV == NULL) {
-        QATerr(QAT_F_QAT_DH_GENERATE_KEY, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-    pPV->pData = qaeCryptoMemAlloc(buflen, __FILE__, __LINE__);
-    if (pPV->pData == NULL) {
-        QATerr(QAT_F_QAT_DH_GENERATE_KEY, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-    pPV->dataLenInBytes = (Cpa32U) buflen;
-
     if ((qat_BN_to_FB(&(opData->primeP), (BIGNUM *)p) != 1) ||
         (qat_BN_to_FB(&(opData->baseG), (BIGNUM *)g) != 1) ||
         (qat_BN_to_FB(&(opData->privateValueX), (BIGNUM *)priv_key) != 1)) {
@@ -275,84 +282,26 @@ int qat_dh_generate_key(DH *dh)
         goto err;
     }
 
-    initOpDone(&op_done);
-    if (op_done.job) {
-        if (qat_setup_async_event_notification(0) == 0) {
-            QATerr(QAT_F_QAT_DH_GENERATE_KEY, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
+    CRYPTO_QAT_LOG("KX - %s\n", __func__);
+    status = qat_perform_op(NULL, qat_dh_phase1_submit, &args, 1, &verify);
+    if (status == QAT_STATUS_EXPIRED) {
+        /* The request could not be submitted in time */
+        BN_set_flags(priv_key, BN_FLG_CONSTTIME);
+        if ((ctx = BN_CTX_new()) == NULL ||
+            !BN_mod_exp(pub_key, g, priv_key, p, ctx)) {
+            QATerr(QAT_F_QAT_DH_GENERATE_KEY, ERR_R_BN_LIB);
             goto err;
         }
-    }
-
-    CRYPTO_QAT_LOG("KX - %s\n", __func__);
-    do {
-        if ((instanceHandle = get_next_inst()) == NULL) {
+    } else {
+        if (status != CPA_STATUS_SUCCESS || verify != CPA_TRUE) {
             QATerr(QAT_F_QAT_DH_GENERATE_KEY, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
             goto err;
         }
 
-        CRYPTO_QAT_LOG("KX - %s\n", __func__);
-        status = cpaCyDhKeyGenPhase1(instanceHandle,
-                qat_dhCallbackFn,
-                &op_done, opData, pPV);
-
-        if (status == CPA_STATUS_RETRY) {
-            if (op_done.job == NULL) {
-                usleep(ulPollInterval +
-                        (qatPerformOpRetries %
-                         QAT_RETRY_BACKOFF_MODULO_DIVISOR));
-                qatPerformOpRetries++;
-                if (iMsgRetry != QAT_INFINITE_MAX_NUM_RETRIES) {
-                    if (qatPerformOpRetries >= iMsgRetry) {
-                        break;
-                    }
-                }
-            } else {
-                if ((qat_wake_job(op_done.job, 0) == 0) ||
-                    (qat_pause_job(op_done.job, 0) == 0)) {
-                    status = CPA_STATUS_FAIL;
-                    break;
-                }
-            }
-        }
-    }
-    while (status == CPA_STATUS_RETRY);
-
-    if (status != CPA_STATUS_SUCCESS) {
-        QATerr(QAT_F_QAT_DH_GENERATE_KEY, ERR_R_INTERNAL_ERROR);
-        cleanupOpDone(&op_done);
-        goto err;
-    }
-
-    do {
-        if(op_done.job) {
-            /* If we get a failure on qat_pause_job then we will
-               not flag an error here and quit because we have
-               an asynchronous request in flight.
-               We don't want to start cleaning up data
-               structures that are still being used. If
-               qat_pause_job fails we will just yield and
-               loop around and try again until the request
-               completes and we can continue. */
-            if (qat_pause_job(op_done.job, 0) == 0)
-                pthread_yield();
-        } else {
-            pthread_yield();
-        }
-    }
-    while (!op_done.flag);
-
-    cleanupOpDone(&op_done);
-
-    if (op_done.verifyResult != CPA_TRUE) {
-        QATerr(QAT_F_QAT_DH_GENERATE_KEY, ERR_R_INTERNAL_ERROR);
-        goto err;
+        /* Convert the flatbuffer result back to a BN */
+        BN_bin2bn(pPV->pData, pPV->dataLenInBytes, pub_key);
     }
 
-    /* Convert the flatbuffer result back to a BN */
-    BN_bin2bn(pPV->pData, pPV->dataLenInBytes, pub_key);
-
     if (!DH_set0_key(dh, pub_key, priv_key)) {
         QATerr(QAT_F_QAT_DH_GENERATE_KEY, ERR_R_INTERNAL_ERROR);
         goto err;
@@ -360,21 +309,13 @@ int qat_dh_generate_key(DH *dh)
 
     ok = 1;
  err:
-    if (pPV) {
-        if (pPV->pData) {
-            qaeCryptoMemFree(pPV->pData);
-        }
-        OPENSSL_free(pPV);
-    }
-
-    if (opData) {
-        if (opData->primeP.pData)
-            qaeCryptoMemFree(opData->primeP.pData);
-        if (opData->baseG.pData)
-            qaeCryptoMemFree(opData->baseG.pData);
-        QAT_CHK_CLNSE_QMFREE_FLATBUFF(opData->privateValueX);
-        OPENSSL_free(opData);
-    }
+    if (opData->primeP.pData)
+        qaeCryptoMemFree(opData->primeP.pData);
+    if (opData->baseG.pData)
+        qaeCryptoMemFree(opData->baseG.pData);
+    QAT_CHK_CLNSE_QMFREE_FLATBUFF(opData->privateValueX);
+    qat_asym_req_put(req);
+    BN_CTX_free(ctx);
 
     if (!ok) {
         if (generate_new_pub_key)
@@ -397,14 +338,12 @@ int qat_dh_compute_key(unsigned char *key, const BIGNUM *in_pub_key, DH *dh)
 {
     int ret = -1;
     int check_result;
-    CpaInstanceHandle instanceHandle;
+    QAT_ASYM_REQ *req = NULL;
     CpaCyDhPhase2SecretKeyGenOpData *opData = NULL;
     CpaFlatBuffer *pSecretKey = NULL;
-    int qatPerformOpRetries = 0;
-    useconds_t ulPollInterval = getQatPollInterval();
-    int iMsgRetry = getQatMsgRetryCount();
+    qat_asym_args args = { NULL, NULL, NULL, NULL };
+    CpaBoolean verify = CPA_FALSE;
     CpaStatus status;
-    struct op_done op_done;
     size_t buflen;
     int index = 1;
     const BIGNUM *p = NULL, *q = NULL;
@@ -449,29 +388,17 @@ int qat_dh_compute_key(unsigned char *key, const BIGNUM *in_pub_key, DH *dh)
         return -1;
     }
 
-    opData = (CpaCyDhPhase2SecretKeyGenOpData *)
-        OPENSSL_malloc(sizeof(CpaCyDhPhase2SecretKeyGenOpData));
-    if (opData == NULL) {
-        QATerr(QAT_F_QAT_DH_COMPUTE_KEY, ERR_R_MALLOC_FAILURE);
-        return ret;
-    }
-
-    opData->primeP.pData = NULL;
-    opData->remoteOctetStringPV.pData = NULL;
-    opData->privateValueX.pData = NULL;
-
     buflen = BN_num_bytes(p);
-    pSecretKey = (CpaFlatBuffer *) OPENSSL_malloc(sizeof(CpaFlatBuffer));
-    if (pSecretKey == NULL) {
+    req = qat_asym_req_get(QAT_ASYM_REQ_DH_PHASE2, sizeof(*opData), buflen,
+                           1, 0);
+    if (req == NULL) {
         QATerr(QAT_F_QAT_DH_COMPUTE_KEY, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-    pSecretKey->pData = qaeCryptoMemAlloc(buflen, __FILE__, __LINE__);
-    if (pSecretKey->pData == NULL) {
-        QATerr(QAT_F_QAT_DH_COMPUTE_KEY, ERR_R_MALLOC_FAILURE);
-        goto err;
+        return ret;
     }
-    pSecretKey->dataLenInBytes = (Cpa32U) buflen;
+    opData = req->op_data;
+    pSecretKey = &req->result[0];
+    args.opData = opData;
+    args.out1 = pSecretKey;
 
     if ((qat_BN_to_FB(&(opData->primeP), (BIGNUM *)p) != 1) ||
         (qat_BN_to_FB(&(opData->remoteOctetStringPV), (BIGNUM *)in_pub_key) != 1)
@@ -481,77 +408,17 @@ int qat_dh_compute_key(unsigned char *key, const BIGNUM *in_pub_key, DH *dh)
         goto err;
     }
 
-    initOpDone(&op_done);
-    if (op_done.job) {
-        if (qat_setup_async_event_notification(0) == 0) {
-            QATerr(QAT_F_QAT_DH_COMPUTE_KEY, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
-            goto err;
-        }
-    }
-
-    CRYPTO_QAT_LOG("KX - ?%s\n", __func__);
-    do {
-        if ((instanceHandle = get_next_inst()) == NULL) {
-            QATerr(QAT_F_QAT_DH_COMPUTE_KEY, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
-            goto err;
-        }
-
-        CRYPTO_QAT_LOG("KX - %s\n", __func__);
-        status = cpaCyDhKeyGenPhase2Secret(instanceHandle,
-                qat_dhCallbackFn,
-                &op_done, opData, pSecretKey);
-
-        if (status == CPA_STATUS_RETRY) {
-            if (!op_done.job) {
-                usleep(ulPollInterval +
-                        (qatPerformOpRetries %
-                         QAT_RETRY_BACKOFF_MODULO_DIVISOR));
-                qatPerformOpRetries++;
-                if (iMsgRetry != QAT_INFINITE_MAX_NUM_RETRIES) {
-                    if (qatPerformOpRetries >= iMsgRetry) {
-                        break;
-                    }
-                }
-            } else {
-                if ((qat_wake_job(op_done.job, 0) == 0) ||
-                    (qat_pause_job(op_done.job, 0) == 0)) {
-                    status = CPA_STATUS_FAIL;
-                    break;
-                }
-            }
-        }
-    }
-    while (status == CPA_STATUS_RETRY);
-
-    if (status != CPA_STATUS_SUCCESS) {
-        QATerr(QAT_F_QAT_DH_COMPUTE_KEY, ERR_R_INTERNAL_ERROR);
-        cleanupOpDone(&op_done);
+    CRYPTO_QAT_LOG("KX - %s\n", __func__);
+    status = qat_perform_op(NULL, qat_dh_phase2_submit, &args, 1, &verify);
+    if (status == QAT_STATUS_EXPIRED) {
+        /* The request could not be submitted in time */
+        qat_asym_set_sw_fallback(1);
+        ret = DH_meth_get_compute_key(sw_dh_method)(key, in_pub_key, dh);
+        qat_asym_set_sw_fallback(0);
         goto err;
     }
 
-    do {
-        if(op_done.job) {
-            /* If we get a failure on qat_pause_job then we will
-               not flag an error here and quit because we have
-               an asynchronous request in flight.
-               We don't want to start cleaning up data
-               structures that are still being used. If
-               qat_pause_job fails we will just yield and
-               loop around and try again until the request
-               completes and we can continue. */
-            if (qat_pause_job(op_done.job, 0) == 0)
-                pthread_yield();
-        } else {
-            pthread_yield();
-        }
-    }
-    while (!op_done.flag);
-
-    cleanupOpDone(&op_done);
-
-    if (op_done.verifyResult != CPA_TRUE) {
+    if (status != CPA_STATUS_SUCCESS || verify != CPA_TRUE) {
         QATerr(QAT_F_QAT_DH_COMPUTE_KEY, ERR_R_INTERNAL_ERROR);
         goto err;
     }
@@ -569,19 +436,12 @@ int qat_dh_compute_key(unsigned char *key, const BIGNUM *in_pub_key, DH *dh)
     ret = pSecretKey->dataLenInBytes;
 
  err:
-    if (pSecretKey) {
-        QAT_CHK_CLNSE_QMFREE_FLATBUFF(*pSecretKey);
-        OPENSSL_free(pSecretKey);
-    }
-
-    if (opData) {
-        if (opData->primeP.pData)
-            qaeCryptoMemFree(opData->primeP.pData);
-        if (opData->remoteOctetStringPV.pData)
-            qaeCryptoMemFree(opData->remoteOctetStringPV.pData);
-        QAT_CHK_CLNSE_QMFREE_FLATBUFF(opData->privateValueX);
-        OPENSSL_free(opData);
-    }
+    if (opData->primeP.pData)
+        qaeCryptoMemFree(opData->primeP.pData);
+    if (opData->remoteOctetStringPV.pData)
+        qaeCryptoMemFree(opData->remoteOctetStringPV.pData);
+    QAT_CHK_CLNSE_QMFREE_FLATBUFF(opData->privateValueX);
+    qat_asym_req_put(req);
 
     return (ret);
 }
@@ -602,6 +462,8 @@ int qat_dh_compute_key(unsigned char *key, const BIGNUM *in_pub_key, DH *dh)
 *
 * description:
 *   Overridden modular exponentiation function used in DH.
+*   It is done in software while the thread runs the software fallback of
+*   an expired request.
 *
 ******************************************************************************/
 int qat_dh_mod_exp(const DH *dh, BIGNUM *r, const BIGNUM *a,
@@ -610,5 +472,7 @@ int qat_dh_mod_exp(const DH *dh, BIGNUM *r, const BIGNUM *a,
 {
     DEBUG("%s been called \n", __func__);
     CRYPTO_QAT_LOG("KX - %s\n", __func__);
+    if (qat_asym_sw_fallback())
+        return BN_mod_exp_mont(r, a, p, m, ctx, m_ctx);
     return qat_mod_exp(r, a, p, m);
 }
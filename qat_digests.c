@@ -0,0 +1,768 @@
+/* ====================================================================
+ *
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016 Intel Corporation.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * ====================================================================
+ */
+
+/*****************************************************************************
+ * @file qat_digests.c
+ *
+ * This file contains the engine implementations for digest operations
+ *
+ *****************************************************************************/
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+#include <pthread.h>
+#ifdef USE_QAT_CONTIG_MEM
+# include "qae_mem_utils.h"
+#endif
+#ifdef USE_QAE_MEM
+# include "cmn_mem_drv_inf.h"
+#endif
+
+#include "qat_utils.h"
+#include "e_qat.h"
+#include "e_qat_err.h"
+
+#include "cpa.h"
+#include "cpa_types.h"
+#include "cpa_cy_sym.h"
+#include "qat_ciphers.h"
+#include "qat_digests.h"
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <string.h>
+
+static int qat_digest_init(EVP_MD_CTX *ctx);
+static int qat_digest_update(EVP_MD_CTX *ctx, const void *data, size_t count);
+static int qat_digest_final(EVP_MD_CTX *ctx, unsigned char *md);
+static int qat_digest_copy(EVP_MD_CTX *to, const EVP_MD_CTX *from);
+static int qat_digest_cleanup(EVP_MD_CTX *ctx);
+
+typedef struct _digest_info {
+    int nid;
+    EVP_MD *md;
+    CpaCySymHashAlgorithm hash_alg;
+} digest_info;
+
+static digest_info info[] = {
+    {NID_sha1, NULL, CPA_CY_SYM_HASH_SHA1},
+    {NID_sha256, NULL, CPA_CY_SYM_HASH_SHA256},
+    {NID_sha384, NULL, CPA_CY_SYM_HASH_SHA384},
+    {NID_sha512, NULL, CPA_CY_SYM_HASH_SHA512},
+};
+
+static const unsigned int num_dg = sizeof(info) / sizeof(digest_info);
+
+/* Qat digest function register */
+int qat_digest_nids[] = {
+    NID_sha1,
+    NID_sha256,
+    NID_sha384,
+    NID_sha512,
+};
+
+static const CpaCySymSessionSetupData template_ssd = {
+    .sessionPriority = CPA_CY_PRIORITY_NORMAL,
+    .symOperation = CPA_CY_SYM_OP_HASH,
+    .hashSetupData = {
+                      .hashAlgorithm = CPA_CY_SYM_HASH_SHA1,
+                      .hashMode = CPA_CY_SYM_HASH_MODE_PLAIN,
+                      .digestResultLenInBytes = 0,
+                      },
+    .digestIsAppended = CPA_FALSE,
+    .verifyDigest = CPA_FALSE,
+    .partialsNotRequired = CPA_FALSE,
+};
+
+static inline const EVP_MD *qat_digest_sw_impl(int nid)
+{
+    switch (nid) {
+    case NID_sha1:
+        return EVP_sha1();
+    case NID_sha256:
+        return EVP_sha256();
+    case NID_sha384:
+        return EVP_sha384();
+    case NID_sha512:
+        return EVP_sha512();
+    default:
+        return NULL;
+    }
+}
+
+static const EVP_MD *qat_create_digest_meth(int nid)
+{
+    const EVP_MD *sw = qat_digest_sw_impl(nid);
+    EVP_MD *md = NULL;
+
+    if (((md = EVP_MD_meth_new(nid, EVP_MD_pkey_type(sw))) == NULL)
+        || !EVP_MD_meth_set_result_size(md, EVP_MD_size(sw))
+        || !EVP_MD_meth_set_input_blocksize(md, EVP_MD_block_size(sw))
+        || !EVP_MD_meth_set_app_datasize(md, sizeof(qat_digest_ctx))
+        || !EVP_MD_meth_set_flags(md, EVP_MD_flags(sw))
+        || !EVP_MD_meth_set_init(md, qat_digest_init)
+        || !EVP_MD_meth_set_update(md, qat_digest_update)
+        || !EVP_MD_meth_set_final(md, qat_digest_final)
+        || !EVP_MD_meth_set_copy(md, qat_digest_copy)
+        || !EVP_MD_meth_set_cleanup(md, qat_digest_cleanup)) {
+        WARN("[%s]: Failed to create digest methods for nid %d\n",
+             __func__, nid);
+        EVP_MD_meth_free(md);
+        md = NULL;
+    }
+
+    return md;
+}
+
+void qat_create_digests(void)
+{
+    int i;
+
+    for (i = 0; i < num_dg; i++) {
+        if (info[i].md == NULL)
+            info[i].md = (EVP_MD *)qat_create_digest_meth(info[i].nid);
+    }
+}
+
+void qat_free_digests(void)
+{
+    int i;
+
+    for (i = 0; i < num_dg; i++) {
+        if (info[i].md != NULL) {
+            EVP_MD_meth_free(info[i].md);
+            info[i].md = NULL;
+        }
+    }
+}
+
+/******************************************************************************
+* function:
+*         qat_digests(ENGINE *e,
+*                     const EVP_MD **digest,
+*                     const int **nids,
+*                     int nid)
+*
+* @param e      [IN] - OpenSSL engine pointer
+* @param digest [IN] - digest structure pointer
+* @param nids   [IN] - digest function nids
+* @param nid    [IN] - digest operation id
+*
+* description:
+*   Qat engine digest operations registrar
+******************************************************************************/
+int qat_digests(ENGINE *e, const EVP_MD **digest, const int **nids, int nid)
+{
+    int i;
+
+    /* No specific digest => return a list of supported nids ... */
+    if (digest == NULL) {
+        *nids = qat_digest_nids;
+        return (sizeof(qat_digest_nids) / sizeof(qat_digest_nids[0]));
+    }
+
+    for (i = 0; i < num_dg; i++) {
+        if (nid == info[i].nid) {
+            if (info[i].md == NULL)
+                qat_create_digests();
+            *digest = info[i].md;
+            return 1;
+        }
+    }
+
+    *digest = NULL;
+    return 0;
+}
+
+/******************************************************************************
+* function:
+*         qat_digest_sw(int nid, const unsigned char *data, size_t len,
+*                       unsigned char *md)
+*
+* @param nid    [IN]  - digest nid
+* @param data   [IN]  - whole message
+* @param len    [IN]  - length of the message
+* @param md     [OUT] - digest of the message
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function hashes a message below the offload threshold on the CPU.
+*  The OpenSSL one shot functions use the SHA extensions when the CPU has
+*  them.
+*
+******************************************************************************/
+static int qat_digest_sw(int nid, const unsigned char *data, size_t len,
+                         unsigned char *md)
+{
+    switch (nid) {
+    case NID_sha1:
+        return SHA1(data, len, md) != NULL;
+    case NID_sha256:
+        return SHA256(data, len, md) != NULL;
+    case NID_sha384:
+        return SHA384(data, len, md) != NULL;
+    case NID_sha512:
+        return SHA512(data, len, md) != NULL;
+    default:
+        return 0;
+    }
+}
+
+/******************************************************************************
+* function:
+*         qat_digest_session_init(EVP_MD_CTX *ctx)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function initialises the hash session and the operation data on
+*  the first request of the ctx. They are kept until qat_digest_cleanup().
+*
+******************************************************************************/
+static int qat_digest_session_init(EVP_MD_CTX *ctx)
+{
+    qat_digest_ctx *qctx = qat_digest_data(ctx);
+    CpaCySymSessionSetupData ssd;
+    Cpa32U sctx_size = 0;
+    Cpa32U msize = 0;
+    CpaStatus sts;
+    int i, nid = EVP_MD_CTX_type(ctx);
+
+    memcpy(&ssd, &template_ssd, sizeof(template_ssd));
+    for (i = 0; i < num_dg; i++) {
+        if (nid == info[i].nid)
+            ssd.hashSetupData.hashAlgorithm = info[i].hash_alg;
+    }
+    ssd.hashSetupData.digestResultLenInBytes = EVP_MD_CTX_size(ctx);
+
+    if (qctx->instanceHandle == NULL) {
+        qctx->instanceHandle = get_next_inst();
+        if (qctx->instanceHandle == NULL) {
+            WARN("[%s] Failed to get QAT Instance Handle!.\n", __func__);
+            return 0;
+        }
+    }
+
+    if (qctx->session_ctx == NULL) {
+        sts = cpaCySymSessionCtxGetSize(qctx->instanceHandle, &ssd,
+                                        &sctx_size);
+        if (sts != CPA_STATUS_SUCCESS) {
+            WARN("[%s] Failed to get SessionCtx size.\n", __func__);
+            return 0;
+        }
+        qctx->session_ctx = (CpaCySymSessionCtx)
+            qaeCryptoMemAlloc(sctx_size, __FILE__, __LINE__);
+        if (qctx->session_ctx == NULL) {
+            WARN("[%s] QMEM alloc failed for session ctx!\n", __func__);
+            return 0;
+        }
+    }
+
+    if (qctx->sgl.pPrivateMetaData == NULL) {
+        if (cpaCyBufferListGetMetaSize(qctx->instanceHandle,
+                                       QAT_DIGEST_MAX_BUFS,
+                                       &msize) != CPA_STATUS_SUCCESS) {
+            WARN("[%s] --- cpaCyBufferListGetBufferSize failed.\n", __func__);
+            return 0;
+        }
+        if (msize) {
+            qctx->sgl.pPrivateMetaData =
+                qaeCryptoMemAlloc(msize, __FILE__, __LINE__);
+            if (qctx->sgl.pPrivateMetaData == NULL) {
+                WARN("[%s] QMEM alloc failed for PrivateData\n", __func__);
+                return 0;
+            }
+        }
+    }
+
+    if (qctx->op_data.pDigestResult == NULL) {
+        qctx->op_data.pDigestResult =
+            qaeCryptoMemAlloc(SHA512_DIGEST_LENGTH, __FILE__, __LINE__);
+        if (qctx->op_data.pDigestResult == NULL) {
+            WARN("[%s] QMEM alloc failed for digest result\n", __func__);
+            return 0;
+        }
+    }
+    qctx->op_data.sessionCtx = qctx->session_ctx;
+    qctx->op_data.hashStartSrcOffsetInBytes = 0;
+
+    sts = cpaCySymInitSession(qctx->instanceHandle, qat_crypto_callbackFn,
+                              &ssd, qctx->session_ctx);
+    if (sts != CPA_STATUS_SUCCESS) {
+        WARN("[%s] cpaCySymInitSession failed! Status = %d\n",
+             __func__, sts);
+        return 0;
+    }
+    INIT_SEQ_SET_FLAG(qctx, INIT_SEQ_QAT_SESSION_INIT);
+
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*         qat_digest_perform_op(EVP_MD_CTX *ctx, CpaCySymPacketType type)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param type   [IN]  - packet type of the staged data
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function sends the staged data to QAT and waits for the request
+*  to complete, pausing the async job if there is one. The partial packets
+*  of a message are submitted one at a time as the session carries the
+*  state of the hash from one to the next.
+*
+******************************************************************************/
+static int qat_digest_perform_op(EVP_MD_CTX *ctx, CpaCySymPacketType type)
+{
+    qat_digest_ctx *qctx = qat_digest_data(ctx);
+    CpaBoolean verify = CPA_FALSE;
+    struct op_done op_done;
+    size_t left = qctx->staged;
+    unsigned int i;
+    CpaStatus sts;
+
+    if (!INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_SESSION_INIT) &&
+        !qat_digest_session_init(ctx))
+        return 0;
+
+    for (i = 0; left > 0; i++) {
+        qctx->fbuf[i].dataLenInBytes = left < QAT_DIGEST_BUF_SIZE ?
+                                       left : QAT_DIGEST_BUF_SIZE;
+        left -= qctx->fbuf[i].dataLenInBytes;
+    }
+    qctx->sgl.pBuffers = qctx->fbuf;
+    qctx->sgl.numBuffers = i;
+    qctx->op_data.packetType = type;
+    qctx->op_data.messageLenToHashInBytes = (Cpa32U) qctx->staged;
+
+    /* Until the last partial packet completes the session is left in the
+     * middle of a message, even if the request fails.
+     */
+    if (type != CPA_CY_SYM_PACKET_TYPE_FULL)
+        qctx->partial = 1;
+
+    initOpDone(&op_done);
+    if (op_done.job) {
+        if (qat_setup_async_event_notification(0) == 0) {
+            WARN("[%s] Failed to setup async event notification\n",
+                 __func__);
+            cleanupOpDone(&op_done);
+            return 0;
+        }
+    }
+
+    sts = myPerformOp(qctx->instanceHandle, &op_done, &qctx->op_data,
+                      &qctx->sgl, &qctx->sgl, &verify);
+    if (sts != CPA_STATUS_SUCCESS) {
+        WARN("[%s] CpaCySymPerformOp failed sts=%d.\n", __func__, sts);
+        cleanupOpDone(&op_done);
+        return 0;
+    }
+
+    qat_wait_op(&op_done);
+
+    cleanupOpDone(&op_done);
+
+    if (op_done.verifyResult != CPA_TRUE) {
+        WARN("[%s] Hash request failed\n", __func__);
+        return 0;
+    }
+
+    if (type == CPA_CY_SYM_PACKET_TYPE_LAST_PARTIAL)
+        qctx->partial = 0;
+    qctx->staged = 0;
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*         qat_digest_init(EVP_MD_CTX *ctx)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function starts a new message. The session is set up again if
+*  the previous message was left partly hashed.
+*
+******************************************************************************/
+int qat_digest_init(EVP_MD_CTX *ctx)
+{
+    qat_digest_ctx *qctx = qat_digest_data(ctx);
+    CpaStatus sts;
+
+    if (qctx == NULL) {
+        WARN("[%s] qctx is NULL\n", __func__);
+        return 0;
+    }
+
+    if (qctx->partial) {
+        sts = cpaCySymRemoveSession(qctx->instanceHandle, qctx->session_ctx);
+        if (sts != CPA_STATUS_SUCCESS) {
+            WARN("[%s] cpaCySymRemoveSession FAILED, sts = %d.!\n",
+                 __func__, sts);
+            return 0;
+        }
+        INIT_SEQ_CLEAR_FLAG(qctx, INIT_SEQ_QAT_SESSION_INIT);
+        qctx->partial = 0;
+    }
+    qctx->staged = 0;
+    qctx->pinned = 0;
+
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*         qat_digest_threshold(int nid)
+*
+* @param nid    [IN]  - nid of the digest
+*
+* @retval size up to which a message is hashed on the CPU
+*
+******************************************************************************/
+static size_t qat_digest_threshold(int nid)
+{
+#ifndef OPENSSL_ENABLE_QAT_SMALL_PACKET_CIPHER_OFFLOADS
+    int threshold = qat_pkt_threshold_table_get_threshold(nid);
+
+    return threshold > 0 ? (size_t)threshold : 0;
+#else
+    return 0;
+#endif
+}
+
+/******************************************************************************
+* function:
+*         qat_digest_stage_pinned(EVP_MD_CTX *ctx, const unsigned char *in,
+*                                 size_t count)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param in     [IN]  - data to hash
+* @param count  [IN]  - length of data
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function copies the data to the pinned staging buffers. When they
+*  are full and more data follows they are sent as a partial packet, the
+*  size of the staging buffers being a whole number of blocks.
+*
+******************************************************************************/
+static int qat_digest_stage_pinned(EVP_MD_CTX *ctx, const unsigned char *in,
+                                   size_t count)
+{
+    qat_digest_ctx *qctx = qat_digest_data(ctx);
+    unsigned int i;
+    size_t off, n;
+
+    while (count > 0) {
+        if (qctx->staged == QAT_DIGEST_MAX_STAGED &&
+            !qat_digest_perform_op(ctx, CPA_CY_SYM_PACKET_TYPE_PARTIAL))
+            return 0;
+
+        i = qctx->staged / QAT_DIGEST_BUF_SIZE;
+        off = qctx->staged % QAT_DIGEST_BUF_SIZE;
+        if (i == qctx->num_bufs) {
+            qctx->fbuf[i].pData = qaeCryptoMemAlloc(QAT_DIGEST_BUF_SIZE,
+                                                    __FILE__, __LINE__);
+            if (qctx->fbuf[i].pData == NULL) {
+                WARN("[%s] Unable to allocate memory for staging buffer\n",
+                     __func__);
+                return 0;
+            }
+            qctx->num_bufs++;
+        }
+
+        n = QAT_DIGEST_BUF_SIZE - off < count ?
+            QAT_DIGEST_BUF_SIZE - off : count;
+        memcpy(qctx->fbuf[i].pData + off, in, n);
+        qctx->staged += n;
+        in += n;
+        count -= n;
+    }
+
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*         qat_digest_pin(EVP_MD_CTX *ctx)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function moves the message staged on the heap to the pinned
+*  staging buffers, once it is known to be offloaded.
+*
+******************************************************************************/
+static int qat_digest_pin(EVP_MD_CTX *ctx)
+{
+    qat_digest_ctx *qctx = qat_digest_data(ctx);
+    size_t len = qctx->staged;
+
+    qctx->staged = 0;
+    qctx->pinned = 1;
+    return qat_digest_stage_pinned(ctx, qctx->sw_buf, len);
+}
+
+/******************************************************************************
+* function:
+*         qat_digest_update(EVP_MD_CTX *ctx, const void *data, size_t count)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param data   [IN]  - data to hash
+* @param count  [IN]  - length of data
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function stages the data. As long as the message is not above
+*  the small packet offload threshold it is copied to a heap buffer, so
+*  that the messages hashed on the CPU take no pinned memory. Past the
+*  threshold it is moved to the pinned staging buffers.
+*
+******************************************************************************/
+int qat_digest_update(EVP_MD_CTX *ctx, const void *data, size_t count)
+{
+    qat_digest_ctx *qctx = qat_digest_data(ctx);
+    unsigned char *buf = NULL;
+    size_t threshold;
+
+    if (count == 0)
+        return 1;
+
+    if (!qctx->pinned) {
+        threshold = qat_digest_threshold(EVP_MD_CTX_type(ctx));
+        if (qctx->staged + count <= threshold) {
+            if (qctx->sw_buf_size < threshold) {
+                buf = OPENSSL_clear_realloc(qctx->sw_buf, qctx->sw_buf_size,
+                                            threshold);
+                if (buf == NULL) {
+                    WARN("[%s] Unable to allocate memory for staging buffer\n",
+                         __func__);
+                    return 0;
+                }
+                qctx->sw_buf = buf;
+                qctx->sw_buf_size = threshold;
+            }
+            memcpy(qctx->sw_buf + qctx->staged, data, count);
+            qctx->staged += count;
+            return 1;
+        }
+        if (!qat_digest_pin(ctx))
+            return 0;
+    }
+
+    return qat_digest_stage_pinned(ctx, data, count);
+}
+
+/******************************************************************************
+* function:
+*         qat_digest_final(EVP_MD_CTX *ctx, unsigned char *md)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+* @param md     [OUT] - digest of the message
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function completes the message. A message that was entirely
+*  staged and is not above the small packet offload threshold is hashed on
+*  the CPU, as is an empty one. Otherwise the staged data is sent as the
+*  last partial packet, or as a full packet if none was sent before.
+*
+******************************************************************************/
+int qat_digest_final(EVP_MD_CTX *ctx, unsigned char *md)
+{
+    qat_digest_ctx *qctx = qat_digest_data(ctx);
+    int nid = EVP_MD_CTX_type(ctx);
+
+    if (!qctx->partial && qctx->staged <= qat_digest_threshold(nid)) {
+        if (!qat_digest_sw(nid, qctx->pinned ? qctx->fbuf[0].pData :
+                           qctx->sw_buf, qctx->staged, md))
+            return 0;
+        qctx->staged = 0;
+        qctx->pinned = 0;
+        return 1;
+    }
+
+    /* The threshold may have been lowered since the message was staged */
+    if (!qctx->pinned && !qat_digest_pin(ctx))
+        return 0;
+
+    if (!qat_digest_perform_op(ctx, qctx->partial ?
+                               CPA_CY_SYM_PACKET_TYPE_LAST_PARTIAL :
+                               CPA_CY_SYM_PACKET_TYPE_FULL))
+        return 0;
+    qctx->pinned = 0;
+
+    memcpy(md, qctx->op_data.pDigestResult, EVP_MD_CTX_size(ctx));
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*         qat_digest_copy(EVP_MD_CTX *to, const EVP_MD_CTX *from)
+*
+* @param to     [OUT] - destination ctx
+* @param from   [IN]  - source ctx
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function copies the staged data of the message to the new ctx,
+*  which sets up its own session when it is first used. The state of a
+*  message already partly hashed, i.e. of which more than
+*  QAT_DIGEST_MAX_STAGED bytes were passed, is held in the session of from.
+*  It cannot be duplicated, and as the data already sent is not kept the
+*  message cannot be hashed in software either, so the copy fails.
+*
+******************************************************************************/
+int qat_digest_copy(EVP_MD_CTX *to, const EVP_MD_CTX *from)
+{
+    qat_digest_ctx *qctx = qat_digest_data(to);
+    const qat_digest_ctx *from_qctx = qat_digest_data(from);
+    unsigned int i;
+    size_t left;
+
+    /* to holds a plain copy of from at this point */
+    memset(qctx, 0, sizeof(qat_digest_ctx));
+
+    if (from_qctx->partial) {
+        WARN("[%s] Cannot copy a partly hashed message\n", __func__);
+        return 0;
+    }
+
+    if (!from_qctx->pinned) {
+        if (from_qctx->sw_buf != NULL) {
+            qctx->sw_buf = OPENSSL_malloc(from_qctx->sw_buf_size);
+            if (qctx->sw_buf == NULL) {
+                WARN("[%s] Unable to allocate memory for staging buffer\n",
+                     __func__);
+                return 0;
+            }
+            qctx->sw_buf_size = from_qctx->sw_buf_size;
+            memcpy(qctx->sw_buf, from_qctx->sw_buf, from_qctx->staged);
+        }
+        qctx->staged = from_qctx->staged;
+        return 1;
+    }
+
+    left = from_qctx->staged;
+    for (i = 0; left > 0; i++) {
+        qctx->fbuf[i].pData = qaeCryptoMemAlloc(QAT_DIGEST_BUF_SIZE,
+                                                __FILE__, __LINE__);
+        if (qctx->fbuf[i].pData == NULL) {
+            WARN("[%s] Unable to allocate memory for staging buffer\n",
+                 __func__);
+            return 0;
+        }
+        qctx->num_bufs++;
+        memcpy(qctx->fbuf[i].pData, from_qctx->fbuf[i].pData,
+               left < QAT_DIGEST_BUF_SIZE ? left : QAT_DIGEST_BUF_SIZE);
+        left -= left < QAT_DIGEST_BUF_SIZE ? left : QAT_DIGEST_BUF_SIZE;
+    }
+    qctx->staged = from_qctx->staged;
+    qctx->pinned = 1;
+
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*         qat_digest_cleanup(EVP_MD_CTX *ctx)
+*
+* @param ctx    [IN]  - pointer to existing ctx
+*
+* @retval 1      function succeeded
+* @retval 0      function failed
+*
+* description:
+*    This function frees the session and the buffers of the ctx. It is
+*  called by OpenSSL after each EVP_DigestFinal_ex().
+*
+******************************************************************************/
+int qat_digest_cleanup(EVP_MD_CTX *ctx)
+{
+    qat_digest_ctx *qctx = qat_digest_data(ctx);
+    CpaStatus sts;
+    int retVal = 1;
+    unsigned int i;
+
+    if (qctx == NULL)
+        return 1;
+
+    if (INIT_SEQ_IS_FLAG_SET(qctx, INIT_SEQ_QAT_SESSION_INIT)) {
+        sts = cpaCySymRemoveSession(qctx->instanceHandle, qctx->session_ctx);
+        if (sts != CPA_STATUS_SUCCESS) {
+            WARN("[%s] cpaCySymRemoveSession FAILED, sts = %d.!\n",
+                 __func__, sts);
+            retVal = 0;
+        }
+    }
+    QAT_QMEMFREE_BUFF(qctx->session_ctx);
+    QAT_QMEMFREE_BUFF(qctx->sgl.pPrivateMetaData);
+    QAT_CLEANSE_QMEMFREE_BUFF(qctx->op_data.pDigestResult,
+                              SHA512_DIGEST_LENGTH);
+    /* The staging buffers may hold secrets such as HMAC keys */
+    for (i = 0; i < qctx->num_bufs; i++)
+        QAT_CLEANSE_QMEMFREE_BUFF(qctx->fbuf[i].pData, QAT_DIGEST_BUF_SIZE);
+    OPENSSL_clear_free(qctx->sw_buf, qctx->sw_buf_size);
+
+    memset(qctx, 0, sizeof(qat_digest_ctx));
+    return retVal;
+}
@@ -168,6 +168,24 @@ void qat_dsaVerifyCallbackFn(void *pCallbackTag, CpaStatus status,
                           NULL, bDsaVerifyStatus);
 }
 
+static CpaStatus qat_dsa_sign_submit(CpaInstanceHandle instanceHandle,
+                                     void *callbackTag, void *args)
+{
+    qat_asym_args *req = (qat_asym_args *)args;
+
+    return cpaCyDsaSignRS(instanceHandle, qat_dsaSignCallbackFn, callbackTag,
+                          req->opData, req->pStatus, req->out1, req->out2);
+}
+
+static CpaStatus qat_dsa_verify_submit(CpaInstanceHandle instanceHandle,
+                                       void *callbackTag, void *args)
+{
+    qat_asym_args *req = (qat_asym_args *)args;
+
+    return cpaCyDsaVerify(instanceHandle, qat_dsaVerifyCallbackFn,
+                          callbackTag, req->opData, req->pStatus);
+}
+
 /******************************************************************************
 * function:
 *         qat_dsa_bn_mod_exp(DSA *dsa, BIGNUM *r, const BIGNUM *a,
@@ -184,6 +202,8 @@ void qat_dsaVerifyCallbackFn(void *pCallbackTag, CpaStatus status,
 *
 * description:
 *   Overridden modular exponentiation function used in DSA.
+*   It is done in software while the thread runs the software fallback of
+*   an expired request.
 *
 ******************************************************************************/
 int qat_dsa_bn_mod_exp(DSA *dsa, BIGNUM *r, const BIGNUM *a, const BIGNUM *p,
@@ -191,6 +211,8 @@ int qat_dsa_bn_mod_exp(DSA *dsa, BIGNUM *r, const BIGNUM *a, const BIGNUM *p,
 {
     DEBUG("%s been called \n", __func__);
     CRYPTO_QAT_LOG("AU - %s\n", __func__);
+    if (qat_asym_sw_fallback())
+        return BN_mod_exp_mont(r, a, p, m, ctx, m_ctx);
     return qat_mod_exp(r, a, p, m);
 }
 
@@ -214,15 +236,13 @@ DSA_SIG *qat_dsa_do_sign(const unsigned char *dgst, int dlen,
     DSA_SIG *sig = NULL;
     CpaFlatBuffer *pResultR = NULL;
     CpaFlatBuffer *pResultS = NULL;
-    CpaInstanceHandle instanceHandle;
+    QAT_ASYM_REQ *req = NULL;
     CpaCyDsaRSSignOpData *opData = NULL;
     CpaBoolean bDsaSignStatus;
+    qat_asym_args args = { NULL, NULL, NULL, &bDsaSignStatus };
+    CpaBoolean verify = CPA_FALSE;
     CpaStatus status;
     size_t buflen;
-    struct op_done op_done;
-    int qatPerformOpRetries = 0;
-    useconds_t ulPollInterval = getQatPollInterval();
-    int iMsgRetry = getQatMsgRetryCount();
     const DSA_METHOD *default_dsa_method = DSA_OpenSSL();
 
 
@@ -253,20 +273,20 @@ DSA_SIG *qat_dsa_do_sign(const unsigned char *dgst, int dlen,
         return DSA_meth_get_sign(default_dsa_method)(dgst, dlen, dsa);
     }
 
-    opData = (CpaCyDsaRSSignOpData *)
-        OPENSSL_malloc(sizeof(CpaCyDsaRSSignOpData));
-    if (opData == NULL) {
+    buflen = BN_num_bytes(q);
+    req = qat_asym_req_get(QAT_ASYM_REQ_DSA_SIGN, sizeof(*opData), buflen,
+                           2, 1);
+    if (req == NULL) {
         QATerr(QAT_F_QAT_DSA_DO_SIGN, ERR_R_MALLOC_FAILURE);
         return sig;
     }
-
-    memset(opData, 0, sizeof(CpaCyDsaRSSignOpData));
-
-    if ((ctx = BN_CTX_new()) == NULL) {
-        QATerr(QAT_F_QAT_DSA_DO_SIGN, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-
+    opData = req->op_data;
+    pResultR = &req->result[0];
+    pResultS = &req->result[1];
+    args.opData = opData;
+    args.out1 = pResultR;
+    args.out2 = pResultS;
+    ctx = req->ctx;
     BN_CTX_start(ctx);
 
     if ((k = BN_CTX_get(ctx)) == NULL) {
@@ -289,30 +309,6 @@ DSA_SIG *qat_dsa_do_sign(const unsigned char *dgst, int dlen,
     }
     while (BN_is_zero(k));
 
-    buflen = BN_num_bytes(q);
-    pResultR = (CpaFlatBuffer *) OPENSSL_malloc(sizeof(CpaFlatBuffer));
-    if (!pResultR) {
-        QATerr(QAT_F_QAT_DSA_DO_SIGN, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-    pResultR->pData = qaeCryptoMemAlloc(buflen, __FILE__, __LINE__);
-    if (!pResultR->pData) {
-        QATerr(QAT_F_QAT_DSA_DO_SIGN, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-    pResultR->dataLenInBytes = (Cpa32U) buflen;
-    pResultS = (CpaFlatBuffer *) OPENSSL_malloc(sizeof(CpaFlatBuffer));
-    if (!pResultS) {
-        QATerr(QAT_F_QAT_DSA_DO_SIGN, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-    pResultS->pData = qaeCryptoMemAlloc(buflen, __FILE__, __LINE__);
-    if (!pResultS->pData) {
-        QATerr(QAT_F_QAT_DSA_DO_SIGN, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-    pResultS->dataLenInBytes = (Cpa32U) buflen;
-
     DSA_get0_key(dsa, &pub_key, &priv_key);
 
     if ((qat_BN_to_FB(&(opData->P), p) != 1) ||
@@ -347,84 +343,18 @@ DSA_SIG *qat_dsa_do_sign(const unsigned char *dgst, int dlen,
         goto err;
     }
 
-    initOpDone(&op_done);
-    if (op_done.job) {
-        if (qat_setup_async_event_notification(0) == 0) {
-            QATerr(QAT_F_QAT_DSA_DO_SIGN, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
-            DSA_SIG_free(sig);
-            sig = NULL;
-            goto err;
-        }
-    }
     CRYPTO_QAT_LOG("AU - %s\n", __func__);
-
-    do {
-        if ((instanceHandle = get_next_inst()) == NULL) {
-            QATerr(QAT_F_QAT_DSA_DO_SIGN, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
-            DSA_SIG_free(sig);
-            sig = NULL;
-            goto err;
-        }
-
-        CRYPTO_QAT_LOG("AU - %s\n", __func__);
-        status = cpaCyDsaSignRS(instanceHandle,
-                qat_dsaSignCallbackFn,
-                &op_done,
-                opData,
-                &bDsaSignStatus, pResultR, pResultS);
-
-        if (status == CPA_STATUS_RETRY) {
-            if (op_done.job == NULL) {
-                usleep(ulPollInterval +
-                        (qatPerformOpRetries %
-                         QAT_RETRY_BACKOFF_MODULO_DIVISOR));
-                qatPerformOpRetries++;
-                if (iMsgRetry != QAT_INFINITE_MAX_NUM_RETRIES) {
-                    if (qatPerformOpRetries >= iMsgRetry) {
-                        break;
-                    }
-                }
-            } else {
-                if ((qat_wake_job(op_done.job, 0) == 0) ||
-                    (qat_pause_job(op_done.job, 0) == 0)) {
-                    status = CPA_STATUS_FAIL;
-                    break;
-                }
-            }
-        }
-    }
-    while (status == CPA_STATUS_RETRY);
-
-    if (status != CPA_STATUS_SUCCESS) {
-        QATerr(QAT_F_QAT_DSA_DO_SIGN, ERR_R_INTERNAL_ERROR);
-        cleanupOpDone(&op_done);
+    status = qat_perform_op(NULL, qat_dsa_sign_submit, &args, 1, &verify);
+    if (status == QAT_STATUS_EXPIRED) {
+        /* The request could not be submitted in time */
         DSA_SIG_free(sig);
-        sig = NULL;
+        qat_asym_set_sw_fallback(1);
+        sig = DSA_meth_get_sign(default_dsa_method)(dgst, dlen, dsa);
+        qat_asym_set_sw_fallback(0);
         goto err;
     }
 
-    do {
-        if(op_done.job) {
-           /* If we get a failure on qat_pause_job then we will
-               not flag an error here and quit because we have
-               an asynchronous request in flight.
-               We don't want to start cleaning up data
-               structures that are still being used. If
-               qat_pause_job fails we will just yield and
-               loop around and try again until the request
-               completes and we can continue. */
-            if (qat_pause_job(op_done.job, 0) == 0)
-                pthread_yield();
-        } else {
-            pthread_yield();
-        }
-    } while (!op_done.flag);
-
-    cleanupOpDone(&op_done);
-
-    if (op_done.verifyResult != CPA_TRUE) {
+    if (status != CPA_STATUS_SUCCESS || verify != CPA_TRUE) {
         QATerr(QAT_F_QAT_DSA_DO_SIGN, ERR_R_INTERNAL_ERROR);
         DSA_SIG_free(sig);
         sig = NULL;
@@ -435,31 +365,17 @@ DSA_SIG *qat_dsa_do_sign(const unsigned char *dgst, int dlen,
     BN_bin2bn(pResultR->pData, pResultR->dataLenInBytes, r);
     BN_bin2bn(pResultS->pData, pResultS->dataLenInBytes, s);
  err:
-    if (pResultR) {
-        QAT_CHK_QMFREE_FLATBUFF(*pResultR);
-        OPENSSL_free(pResultR);
-    }
-    if (pResultS) {
-        QAT_CHK_QMFREE_FLATBUFF(*pResultS);
-        OPENSSL_free(pResultS);
-    }
-
-    if (opData) {
-        QAT_CHK_QMFREE_FLATBUFF(opData->P);
-        QAT_CHK_QMFREE_FLATBUFF(opData->Q);
-        QAT_CHK_QMFREE_FLATBUFF(opData->G);
-        QAT_CHK_QMFREE_FLATBUFF(opData->Z);
-        QAT_CHK_CLNSE_QMFREE_FLATBUFF(opData->X);
-        QAT_CHK_CLNSE_QMFREE_FLATBUFF(opData->K);
-        OPENSSL_free(opData);
-    }
-
-    if (ctx) {
-        if (k)
-            BN_clear(k);
-        BN_CTX_end(ctx);
-        BN_CTX_free(ctx);
-    }
+    QAT_CHK_QMFREE_FLATBUFF(opData->P);
+    QAT_CHK_QMFREE_FLATBUFF(opData->Q);
+    QAT_CHK_QMFREE_FLATBUFF(opData->G);
+    QAT_CHK_QMFREE_FLATBUFF(opData->Z);
+    QAT_CHK_CLNSE_QMFREE_FLATBUFF(opData->X);
+    QAT_CHK_CLNSE_QMFREE_FLATBUFF(opData->K);
+
+    if (k)
+        BN_clear(k);
+    BN_CTX_end(ctx);
+    qat_asym_req_put(req);
     return sig;
 }
 
@@ -499,14 +415,12 @@ int qat_dsa_do_verify(const unsigned char *dgst, int dgst_len,
     const BIGNUM *g = NULL;
     const BIGNUM *pub_key = NULL, *priv_key = NULL;
     int ret = -1, i = 0;
-    CpaInstanceHandle instanceHandle;
+    QAT_ASYM_REQ *req = NULL;
     CpaCyDsaVerifyOpData *opData = NULL;
     CpaBoolean bDsaVerifyStatus;
+    qat_asym_args args = { NULL, NULL, NULL, &bDsaVerifyStatus };
+    CpaBoolean verify = CPA_FALSE;
     CpaStatus status;
-    struct op_done op_done;
-    int qatPerformOpRetries = 0;
-    useconds_t ulPollInterval = getQatPollInterval();
-    int iMsgRetry = getQatMsgRetryCount();
     const DSA_METHOD *default_dsa_method = DSA_OpenSSL();
 
     DEBUG("[%s] --- called.\n", __func__);
@@ -543,20 +457,14 @@ int qat_dsa_do_verify(const unsigned char *dgst, int dgst_len,
         return ret;
     }
 
-    opData = (CpaCyDsaVerifyOpData *)
-        OPENSSL_malloc(sizeof(CpaCyDsaVerifyOpData));
-    if (opData == NULL) {
+    req = qat_asym_req_get(QAT_ASYM_REQ_DSA_VERIFY, sizeof(*opData), 0, 0, 1);
+    if (req == NULL) {
         QATerr(QAT_F_QAT_DSA_DO_VERIFY, ERR_R_MALLOC_FAILURE);
         return ret;
     }
-
-    memset(opData, 0, sizeof(CpaCyDsaVerifyOpData));
-
-    if ((ctx = BN_CTX_new()) == NULL) {
-        QATerr(QAT_F_QAT_DSA_DO_VERIFY, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-
+    opData = req->op_data;
+    args.opData = opData;
+    ctx = req->ctx;
     BN_CTX_start(ctx);
 
     if ((z = BN_CTX_get(ctx)) == NULL) {
@@ -602,94 +510,35 @@ int qat_dsa_do_verify(const unsigned char *dgst, int dgst_len,
         goto err;
     }
 
-    initOpDone(&op_done);
-    if (op_done.job) {
-        if (qat_setup_async_event_notification(0) == 0) {
-            QATerr(QAT_F_QAT_DSA_DO_VERIFY, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
-            goto err;
-        }
-    }
-
     CRYPTO_QAT_LOG("AU - %s\n", __func__);
-    do {
-        if ((instanceHandle = get_next_inst()) == NULL) {
-            QATerr(QAT_F_QAT_DSA_DO_VERIFY, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
-            goto err;
-        }
-
-        CRYPTO_QAT_LOG("AU - %s\n", __func__);
-        status = cpaCyDsaVerify(instanceHandle,
-                qat_dsaVerifyCallbackFn,
-                &op_done, opData, &bDsaVerifyStatus);
-
-        if (status == CPA_STATUS_RETRY) {
-            if (op_done.job == NULL) {
-                usleep(ulPollInterval +
-                        (qatPerformOpRetries %
-                         QAT_RETRY_BACKOFF_MODULO_DIVISOR));
-                qatPerformOpRetries++;
-                if (iMsgRetry != QAT_INFINITE_MAX_NUM_RETRIES) {
-                    if (qatPerformOpRetries >= iMsgRetry) {
-                        break;
-                    }
-                }
-            } else {
-                if ((qat_wake_job(op_done.job, 0) == 0) ||
-                    (qat_pause_job(op_done.job, 0) == 0)) {
-                    status = CPA_STATUS_FAIL;
-                    break;
-                }
-            }
-        }
-    } while (status == CPA_STATUS_RETRY);
+    status = qat_perform_op(NULL, qat_dsa_verify_submit, &args, 1, &verify);
+    if (status == QAT_STATUS_EXPIRED) {
+        /* The request could not be submitted in time */
+        qat_asym_set_sw_fallback(1);
+        ret = DSA_meth_get_verify(default_dsa_method)(dgst, dgst_len, sig,
+                                                      dsa);
+        qat_asym_set_sw_fallback(0);
+        goto err;
+    }
 
     if (status != CPA_STATUS_SUCCESS) {
         QATerr(QAT_F_QAT_DSA_DO_VERIFY, ERR_R_INTERNAL_ERROR);
-        cleanupOpDone(&op_done);
         goto err;
     }
 
-    do {
-        if(op_done.job) {
-            /* If we get a failure on qat_pause_job then we will
-               not flag an error here and quit because we have
-               an asynchronous request in flight.
-               We don't want to start cleaning up data
-               structures that are still being used. If
-               qat_pause_job fails we will just yield and
-               loop around and try again until the request
-               completes and we can continue. */
-            if (qat_pause_job(op_done.job, 0) == 0)
-                pthread_yield();
-        } else {
-            pthread_yield();
-        }
-    }
-    while (!op_done.flag);
-
-    if (op_done.verifyResult == CPA_TRUE)
+    if (verify == CPA_TRUE)
         ret = 1;
 
-    cleanupOpDone(&op_done);
-
  err:
-    if (opData) {
-        QAT_CHK_QMFREE_FLATBUFF(opData->P);
-        QAT_CHK_QMFREE_FLATBUFF(opData->Q);
-        QAT_CHK_QMFREE_FLATBUFF(opData->G);
-        QAT_CHK_QMFREE_FLATBUFF(opData->Y);
-        QAT_CHK_QMFREE_FLATBUFF(opData->Z);
-        QAT_CHK_QMFREE_FLATBUFF(opData->R);
-        QAT_CHK_QMFREE_FLATBUFF(opData->S);
-        OPENSSL_free(opData);
-    }
-
-    if (ctx) {
-        BN_CTX_end(ctx);
-        BN_CTX_free(ctx);
-    }
+    QAT_CHK_QMFREE_FLATBUFF(opData->P);
+    QAT_CHK_QMFREE_FLATBUFF(opData->Q);
+    QAT_CHK_QMFREE_FLATBUFF(opData->G);
+    QAT_CHK_QMFREE_FLATBUFF(opData->Y);
+    QAT_CHK_QMFREE_FLATBUFF(opData->Z);
+    QAT_CHK_QMFREE_FLATBUFF(opData->R);
+    QAT_CHK_QMFREE_FLATBUFF(opData->S);
+    BN_CTX_end(ctx);
+    qat_asym_req_put(req);
 
     return (ret);
 }
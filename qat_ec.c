@@ -234,6 +234,16 @@ void qat_ecCallbackFn(void *pCallbackTag, CpaStatus status, void *pOpData,
                           NULL, multiplyStatus);
 }
 
+static CpaStatus qat_ec_point_multiply_submit(CpaInstanceHandle instanceHandle,
+                                              void *callbackTag, void *args)
+{
+    qat_asym_args *req = (qat_asym_args *)args;
+
+    return cpaCyEcPointMultiply(instanceHandle, qat_ecCallbackFn, callbackTag,
+                                req->opData, req->pStatus, req->out1,
+                                req->out2);
+}
+
 int qat_ecdh_compute_key(unsigned char **outX, size_t *outlenX,
                          unsigned char **outY, size_t *outlenY,
                          const EC_POINT *pub_key, const EC_KEY *ecdh)
@@ -247,16 +257,15 @@ int qat_ecdh_compute_key(unsigned char **outX, size_t *outlenX,
     size_t buflen;
     PFUNC_COMP_KEY comp_key_pfunc = NULL;
 
-    CpaInstanceHandle instanceHandle;
+    EC_POINT *point = NULL;
+    QAT_ASYM_REQ *req = NULL;
     CpaCyEcPointMultiplyOpData *opData = NULL;
     CpaBoolean bEcStatus;
     CpaFlatBuffer *pResultX = NULL;
     CpaFlatBuffer *pResultY = NULL;
-    int qatPerformOpRetries = 0;
-    useconds_t ulPollInterval = getQatPollInterval();
-    int iMsgRetry = getQatMsgRetryCount();
+    qat_asym_args args = { NULL, NULL, NULL, &bEcStatus };
+    CpaBoolean verify = CPA_FALSE;
     CpaStatus status;
-    struct op_done op_done;
 
     DEBUG("%s been called \n", __func__);
 
@@ -282,30 +291,26 @@ int qat_ecdh_compute_key(unsigned char **outX, size_t *outlenX,
         return (*comp_key_pfunc)(outX, outlenX, pub_key, ecdh);
     }
 
-    opData = (CpaCyEcPointMultiplyOpData *)
-        OPENSSL_malloc(sizeof(CpaCyEcPointMultiplyOpData));
-    if (opData == NULL) {
+    buflen = (EC_GROUP_get_degree(group) + 7) / 8;
+    req = qat_asym_req_get(QAT_ASYM_REQ_EC_POINT_MUL, sizeof(*opData),
+                           buflen, 2, 1);
+    if (req == NULL) {
         QATerr(QAT_F_QAT_ECDH_COMPUTE_KEY, ERR_R_MALLOC_FAILURE);
         return ret;
     }
 
-    opData->k.pData = NULL;
-    opData->xg.pData = NULL;
-    opData->yg.pData = NULL;
-    opData->a.pData = NULL;
-    opData->b.pData = NULL;
-    opData->q.pData = NULL;
-
-    /* To instruct the Quickassist API not to use co-factor */
-    opData->h.pData = NULL;
-    opData->h.dataLenInBytes = 0;
+    /* The op data comes zeroed, with an empty co-factor h to instruct the
+     * Quickassist API not to use it.
+     */
+    opData = req->op_data;
+    pResultX = &req->result[0];
+    pResultY = &req->result[1];
+    args.opData = opData;
+    args.out1 = pResultX;
+    args.out2 = pResultY;
 
     /* Populate the parameters required for EC point multiply */
-    if ((ctx = BN_CTX_new()) == NULL) {
-        QATerr(QAT_F_QAT_ECDH_COMPUTE_KEY, ERR_R_INTERNAL_ERROR);
-        goto err;
-    }
-
+    ctx = req->ctx;
     BN_CTX_start(ctx);
     if ((p = BN_CTX_get(ctx)) == NULL) {
         QATerr(QAT_F_QAT_ECDH_COMPUTE_KEY, ERR_R_INTERNAL_ERROR);
@@ -328,30 +333,6 @@ int qat_ecdh_compute_key(unsigned char **outX, size_t *outlenX,
         goto err;
     }
 
-    buflen = (EC_GROUP_get_degree(group) + 7) / 8;
-    pResultX = (CpaFlatBuffer *) OPENSSL_malloc(sizeof(CpaFlatBuffer));
-    if (pResultX == NULL) {
-        QATerr(QAT_F_QAT_ECDH_COMPUTE_KEY, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-    pResultX->pData = qaeCryptoMemAlloc(buflen, __FILE__, __LINE__);
-    if (pResultX->pData == NULL) {
-        QATerr(QAT_F_QAT_ECDH_COMPUTE_KEY, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-    pResultX->dataLenInBytes = (Cpa32U) buflen;
-    pResultY = (CpaFlatBuffer *) OPENSSL_malloc(sizeof(CpaFlatBuffer));
-    if (!pResultY) {
-        QATerr(QAT_F_QAT_ECDH_COMPUTE_KEY, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-    pResultY->pData = qaeCryptoMemAlloc(buflen, __FILE__, __LINE__);
-    if (pResultY->pData == NULL) {
-        QATerr(QAT_F_QAT_ECDH_COMPUTE_KEY, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-    pResultY->dataLenInBytes = (Cpa32U) buflen;
-
     if ((qat_BN_to_FB(&(opData->k), (BIGNUM *)priv_key)) != 1) {
         QATerr(QAT_F_QAT_ECDH_COMPUTE_KEY, ERR_R_INTERNAL_ERROR);
         goto err;
@@ -408,85 +389,33 @@ int qat_ecdh_compute_key(unsigned char **outX, size_t *outlenX,
         goto err;
     }
 
-    initOpDone(&op_done);
-    if (op_done.job) {
-        if (qat_setup_async_event_notification(0) == 0) {
-            QATerr(QAT_F_QAT_ECDH_COMPUTE_KEY, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
-            goto err;
-        }
-    }
     CRYPTO_QAT_LOG("KX - %s\n", __func__);
 
     /* Invoke the crypto engine API for EC Point Multiply */
-    do {
-        if ((instanceHandle = get_next_inst()) == NULL) {
-            QATerr(QAT_F_QAT_ECDH_COMPUTE_KEY, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
+    status = qat_perform_op(NULL, qat_ec_point_multiply_submit, &args, 1,
+                            &verify);
+    if (status == QAT_STATUS_EXPIRED) {
+        /* The request could not be submitted in time, multiply in
+         * software into the result buffers.
+         */
+        if ((point = EC_POINT_new(group)) == NULL ||
+            !EC_POINT_mul(group, point, NULL, pub_key, priv_key, ctx) ||
+            (opData->fieldType == CPA_CY_EC_FIELD_TYPE_PRIME ?
+             !EC_POINT_get_affine_coordinates_GFp(group, point, xg, yg, ctx) :
+             !EC_POINT_get_affine_coordinates_GF2m(group, point, xg, yg,
+                                                   ctx)) ||
+            BN_bn2binpad(xg, pResultX->pData,
+                         pResultX->dataLenInBytes) < 0 ||
+            BN_bn2binpad(yg, pResultY->pData,
+                         pResultY->dataLenInBytes) < 0) {
+            QATerr(QAT_F_QAT_ECDH_COMPUTE_KEY, ERR_R_EC_LIB);
             goto err;
         }
-
-        CRYPTO_QAT_LOG("KX - %s\n", __func__);
-        status = cpaCyEcPointMultiply(instanceHandle,
-                                      qat_ecCallbackFn,
-                                      &op_done,
-                                      opData,
-                                      &bEcStatus, pResultX, pResultY);
-
-        if (status == CPA_STATUS_RETRY) {
-            if (op_done.job == NULL) {
-                usleep(ulPollInterval +
-                       (qatPerformOpRetries %
-                        QAT_RETRY_BACKOFF_MODULO_DIVISOR));
-                qatPerformOpRetries++;
-                if (iMsgRetry != QAT_INFINITE_MAX_NUM_RETRIES) {
-                    if (qatPerformOpRetries >= iMsgRetry) {
-                        break;
-                    }
-                }
-            } else {
-                if ((qat_wake_job(op_done.job, 0) == 0) ||
-                    (qat_pause_job(op_done.job, 0) == 0)) {
-                    status = CPA_STATUS_FAIL;
-                    break;
-                }
-            }
-        }
-    }
-    while (status == CPA_STATUS_RETRY );
-
-    if (status != CPA_STATUS_SUCCESS) {
-        QATerr(QAT_F_QAT_ECDH_COMPUTE_KEY, ERR_R_INTERNAL_ERROR);
-        cleanupOpDone(&op_done);
-        goto err;
-    }
-
-    do {
-        if(op_done.job) {
-            /* If we get a failure on qat_pause_job then we will
-               not flag an error here and quit because we have
-               an asynchronous request in flight.
-               We don't want to start cleaning up data
-               structures that are still being used. If
-               qat_pause_job fails we will just yield and
-               loop around and try again until the request
-               completes and we can continue. */
-            if (qat_pause_job(op_done.job, 0) == 0)
-                pthread_yield();
-        } else {
-            pthread_yield();
-        }
-    }
-    while (!op_done.flag);
-
-    if (op_done.verifyResult != CPA_TRUE) {
+    } else if (status != CPA_STATUS_SUCCESS || verify != CPA_TRUE) {
         QATerr(QAT_F_QAT_ECDH_COMPUTE_KEY, ERR_R_INTERNAL_ERROR);
-        cleanupOpDone(&op_done);
         goto err;
     }
 
-    cleanupOpDone(&op_done);
-
     /* KDF, is done in the caller now just copy out bytes */
     if (outX != NULL) {
         *outlenX = pResultX->dataLenInBytes;
@@ -513,26 +442,15 @@ int qat_ecdh_compute_key(unsigned char **outX, size_t *outlenX,
     ret = *outlenX;
 
  err:
-    if (pResultX) {
-        QAT_CHK_CLNSE_QMFREE_FLATBUFF(*pResultX);
-        OPENSSL_free(pResultX);
-    }
-    if (pResultY) {
-        QAT_CHK_CLNSE_QMFREE_FLATBUFF(*pResultY);
-        OPENSSL_free(pResultY);
-    }
     QAT_CHK_CLNSE_QMFREE_FLATBUFF(opData->k);
     QAT_CHK_QMFREE_FLATBUFF(opData->xg);
     QAT_CHK_QMFREE_FLATBUFF(opData->yg);
     QAT_CHK_QMFREE_FLATBUFF(opData->a);
     QAT_CHK_QMFREE_FLATBUFF(opData->b);
     QAT_CHK_QMFREE_FLATBUFF(opData->q);
-    if (opData)
-        OPENSSL_free(opData);
-    if (ctx) {
-        BN_CTX_end(ctx);
-        BN_CTX_free(ctx);
-    }
+    EC_POINT_free(point);
+    BN_CTX_end(ctx);
+    qat_asym_req_put(req);
     return (ret);
 }
 
@@ -755,6 +673,25 @@ void qat_ecdsaVerifyCallbackFn(void *pCallbackTag, CpaStatus status,
 }
 
 
+static CpaStatus qat_ecdsa_sign_submit(CpaInstanceHandle instanceHandle,
+                                       void *callbackTag, void *args)
+{
+    qat_asym_args *req = (qat_asym_args *)args;
+
+    return cpaCyEcdsaSignRS(instanceHandle, qat_ecdsaSignCallbackFn,
+                            callbackTag, req->opData, req->pStatus,
+                            req->out1, req->out2);
+}
+
+static CpaStatus qat_ecdsa_verify_submit(CpaInstanceHandle instanceHandle,
+                                         void *callbackTag, void *args)
+{
+    qat_asym_args *req = (qat_asym_args *)args;
+
+    return cpaCyEcdsaVerify(instanceHandle, qat_ecdsaVerifyCallbackFn,
+                            callbackTag, req->opData, req->pStatus);
+}
+
 int qat_ecdsa_sign(int type, const unsigned char *dgst, int dlen,
                           unsigned char *sig, unsigned int *siglen,
                           const BIGNUM *kinv, const BIGNUM *r, EC_KEY *eckey)
@@ -789,15 +726,14 @@ ECDSA_SIG *qat_ecdsa_do_sign(const unsigned char *dgst, int dgst_len,
 
     CpaFlatBuffer *pResultR = NULL;
     CpaFlatBuffer *pResultS = NULL;
-    CpaInstanceHandle instanceHandle;
+    QAT_ASYM_REQ *req = NULL;
     CpaCyEcdsaSignRSOpData *opData = NULL;
     CpaBoolean bEcdsaSignStatus;
+    qat_asym_args args = { NULL, NULL, NULL, &bEcdsaSignStatus };
+    CpaBoolean verify = CPA_FALSE;
     CpaStatus status;
     size_t buflen;
-    struct op_done op_done;
-    int qatPerformOpRetries = 0;
-    useconds_t ulPollInterval = getQatPollInterval();
-    int iMsgRetry = getQatMsgRetryCount();
+    PFUNC_SIGN_SIG sign_sig_pfunc = NULL;
     const EC_POINT *ec_point = NULL;
 
     DEBUG("[%s] --- called.\n", __func__);
@@ -816,14 +752,21 @@ ECDSA_SIG *qat_ecdsa_do_sign(const unsigned char *dgst, int dgst_len,
         return ret;
     }
 
-    opData = (CpaCyEcdsaSignRSOpData *)
-        OPENSSL_malloc(sizeof(CpaCyEcdsaSignRSOpData));
-    if (opData == NULL) {
+    buflen = EC_GROUP_get_degree(group);
+    req = qat_asym_req_get(QAT_ASYM_REQ_ECDSA_SIGN, sizeof(*opData),
+                           buflen, 2, 1);
+    if (req == NULL) {
         QATerr(QAT_F_QAT_ECDSA_DO_SIGN, ERR_R_MALLOC_FAILURE);
         return ret;
     }
-
-    memset(opData, 0, sizeof(CpaCyEcdsaSignRSOpData));
+    opData = req->op_data;
+    pResultR = &req->result[0];
+    pResultS = &req->result[1];
+    args.opData = opData;
+    args.out1 = pResultR;
+    args.out2 = pResultS;
+    ctx = req->ctx;
+    BN_CTX_start(ctx);
 
     if ((ret = ECDSA_SIG_new()) == NULL) {
         QATerr(QAT_F_QAT_ECDSA_DO_SIGN, ERR_R_MALLOC_FAILURE);
@@ -838,13 +781,6 @@ ECDSA_SIG *qat_ecdsa_do_sign(const unsigned char *dgst, int dgst_len,
         goto err;
     }
 
-    if ((ctx = BN_CTX_new()) == NULL) {
-        QATerr(QAT_F_QAT_ECDSA_DO_SIGN, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-
-    BN_CTX_start(ctx);
-
     if ((p = BN_CTX_get(ctx)) == NULL) {
         QATerr(QAT_F_QAT_ECDSA_DO_SIGN, ERR_R_INTERNAL_ERROR);
         goto err;
@@ -991,104 +927,23 @@ ECDSA_SIG *qat_ecdsa_do_sign(const unsigned char *dgst, int dgst_len,
 
     }
 
-    buflen = EC_GROUP_get_degree(group);
-    pResultR = (CpaFlatBuffer *) OPENSSL_malloc(sizeof(CpaFlatBuffer));
-    if (pResultR == NULL) {
-        QATerr(QAT_F_QAT_ECDSA_DO_SIGN, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-    pResultR->pData = qaeCryptoMemAlloc(buflen, __FILE__, __LINE__);
-    if (pResultR->pData == NULL) {
-        QATerr(QAT_F_QAT_ECDSA_DO_SIGN, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-    pResultR->dataLenInBytes = (Cpa32U) buflen;
-    pResultS = (CpaFlatBuffer *) OPENSSL_malloc(sizeof(CpaFlatBuffer));
-    if (pResultS == NULL) {
-        QATerr(QAT_F_QAT_ECDSA_DO_SIGN, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-    pResultS->pData = qaeCryptoMemAlloc(buflen, __FILE__, __LINE__);
-    if (pResultS->pData == NULL) {
-        QATerr(QAT_F_QAT_ECDSA_DO_SIGN, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-    pResultS->dataLenInBytes = (Cpa32U) buflen;
-
     /* perform ECDSA sign */
-    initOpDone(&op_done);
-    if (op_done.job) {
-        if (qat_setup_async_event_notification(0) == 0) {
-            QATerr(QAT_F_QAT_ECDSA_DO_SIGN, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
-            goto err;
-        }
-    }
-
     CRYPTO_QAT_LOG("AU - %s\n", __func__);
-    do {
-        if ((instanceHandle = get_next_inst()) == NULL) {
-            QATerr(QAT_F_QAT_ECDSA_DO_SIGN, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
-            goto err;
-        }
-
-        CRYPTO_QAT_LOG("AU - %s\n", __func__);
-        status = cpaCyEcdsaSignRS(instanceHandle,
-                qat_ecdsaSignCallbackFn,
-                &op_done,
-                opData,
-                &bEcdsaSignStatus, pResultR, pResultS);
-
-        if (status == CPA_STATUS_RETRY) {
-            if (op_done.job == NULL) {
-                usleep(ulPollInterval +
-                        (qatPerformOpRetries %
-                         QAT_RETRY_BACKOFF_MODULO_DIVISOR));
-                qatPerformOpRetries++;
-                if (iMsgRetry != QAT_INFINITE_MAX_NUM_RETRIES) {
-                    if (qatPerformOpRetries >= iMsgRetry) {
-                        break;
-                    }
-                }
-            } else {
-                if ((qat_wake_job(op_done.job, 0) == 0) ||
-                    (qat_pause_job(op_done.job, 0) == 0)) {
-                    status = CPA_STATUS_FAIL;
-                    break;
-                }
-            }
-        }
-    }
-    while (status == CPA_STATUS_RETRY);
-
-    if (status != CPA_STATUS_SUCCESS) {
-        QATerr(QAT_F_QAT_ECDSA_DO_SIGN, ERR_R_INTERNAL_ERROR);
-        cleanupOpDone(&op_done);
+    status = qat_perform_op(NULL, qat_ecdsa_sign_submit, &args, 1, &verify);
+    if (status == QAT_STATUS_EXPIRED) {
+        /* The request could not be submitted in time */
+        EC_KEY_METHOD_get_sign((EC_KEY_METHOD *) EC_KEY_OpenSSL(), NULL, NULL,
+                               &sign_sig_pfunc);
+        ECDSA_SIG_free(ret);
+        ret = NULL;
+        if (sign_sig_pfunc != NULL &&
+            (ret = (*sign_sig_pfunc)(dgst, dgst_len, in_kinv, in_r,
+                                     eckey)) != NULL)
+            ok = 1;
         goto err;
     }
 
-    do {
-        if(op_done.job) {
-            /* If we get a failure on qat_pause_job then we will
-               not flag an error here and quit because we have
-               an asynchronous request in flight.
-               We don't want to start cleaning up data
-               structures that are still being used. If
-               qat_pause_job fails we will just yield and
-               loop around and try again until the request
-               completes and we can continue. */
-            if (qat_pause_job(op_done.job, 0) == 0)
-                pthread_yield();
-        } else {
-            pthread_yield();
-        }
-    }
-    while (!op_done.flag);
-
-    cleanupOpDone(&op_done);
-
-    if (op_done.verifyResult != CPA_TRUE) {
+    if (status != CPA_STATUS_SUCCESS || verify != CPA_TRUE) {
         QATerr(QAT_F_QAT_ECDSA_DO_SIGN, ERR_R_INTERNAL_ERROR);
         goto err;
     }
@@ -1105,32 +960,21 @@ ECDSA_SIG *qat_ecdsa_do_sign(const unsigned char *dgst, int dgst_len,
         ret = NULL;
     }
 
-    if (pResultR) {
-        QAT_CHK_QMFREE_FLATBUFF(*pResultR);
-        OPENSSL_free(pResultR);
-    }
-    if (pResultS) {
-        QAT_CHK_QMFREE_FLATBUFF(*pResultS);
-        OPENSSL_free(pResultS);
-    }
-
-    if (opData) {
-        QAT_CHK_QMFREE_FLATBUFF(opData->n);
-        QAT_CHK_QMFREE_FLATBUFF(opData->m);
-        QAT_CHK_QMFREE_FLATBUFF(opData->xg);
-        QAT_CHK_QMFREE_FLATBUFF(opData->yg);
-        QAT_CHK_QMFREE_FLATBUFF(opData->a);
-        QAT_CHK_QMFREE_FLATBUFF(opData->b);
-        QAT_CHK_QMFREE_FLATBUFF(opData->q);
-        QAT_CHK_CLNSE_QMFREE_FLATBUFF(opData->k);
-        QAT_CHK_CLNSE_QMFREE_FLATBUFF(opData->d);
-        OPENSSL_free(opData);
-    }
+    QAT_CHK_QMFREE_FLATBUFF(opData->n);
+    QAT_CHK_QMFREE_FLATBUFF(opData->m);
+    QAT_CHK_QMFREE_FLATBUFF(opData->xg);
+    QAT_CHK_QMFREE_FLATBUFF(opData->yg);
+    QAT_CHK_QMFREE_FLATBUFF(opData->a);
+    QAT_CHK_QMFREE_FLATBUFF(opData->b);
+    QAT_CHK_QMFREE_FLATBUFF(opData->q);
+    QAT_CHK_CLNSE_QMFREE_FLATBUFF(opData->k);
+    QAT_CHK_CLNSE_QMFREE_FLATBUFF(opData->d);
 
-    if (ctx) {
-        BN_CTX_end(ctx);
-        BN_CTX_free(ctx);
-    }
+    /* The BN_CTX is kept with the request, clear the nonce it held */
+    if (k != NULL)
+        BN_clear(k);
+    BN_CTX_end(ctx);
+    qat_asym_req_put(req);
     return ret;
 }
 
@@ -1180,14 +1024,13 @@ int qat_ecdsa_do_verify(const unsigned char *dgst, int dgst_len,
     const EC_POINT *ec_point;
     const BIGNUM *sig_r = NULL, *sig_s = NULL;
 
-    CpaInstanceHandle instanceHandle;
+    QAT_ASYM_REQ *req = NULL;
     CpaCyEcdsaVerifyOpData *opData = NULL;
     CpaBoolean bEcdsaVerifyStatus;
+    qat_asym_args args = { NULL, NULL, NULL, &bEcdsaVerifyStatus };
+    CpaBoolean verify = CPA_FALSE;
     CpaStatus status;
-    struct op_done op_done;
-    int qatPerformOpRetries = 0;
-    useconds_t ulPollInterval = getQatPollInterval();
-    int iMsgRetry = getQatMsgRetryCount();
+    PFUNC_VERIFY_SIG verify_sig_pfunc = NULL;
 
     DEBUG("%s been called \n", __func__);
 
@@ -1203,20 +1046,14 @@ int qat_ecdsa_do_verify(const unsigned char *dgst, int dgst_len,
         return ret;
     }
 
-    opData = (CpaCyEcdsaVerifyOpData *)
-        OPENSSL_malloc(sizeof(CpaCyEcdsaVerifyOpData));
-    if (opData == NULL) {
+    req = qat_asym_req_get(QAT_ASYM_REQ_ECDSA_VERIFY, sizeof(*opData), 0, 0, 1);
+    if (req == NULL) {
         QATerr(QAT_F_QAT_ECDSA_DO_VERIFY, ERR_R_MALLOC_FAILURE);
         return ret;
     }
-
-    memset(opData, 0, sizeof(CpaCyEcdsaVerifyOpData));
-
-    if ((ctx = BN_CTX_new()) == NULL) {
-        QATerr(QAT_F_QAT_ECDSA_DO_VERIFY, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-
+    opData = req->op_data;
+    args.opData = opData;
+    ctx = req->ctx;
     BN_CTX_start(ctx);
 
     if ((p = BN_CTX_get(ctx)) == NULL) {
@@ -1371,99 +1208,39 @@ int qat_ecdsa_do_verify(const unsigned char *dgst, int dgst_len,
     }
 
     /* perform ECDSA verify */
-    initOpDone(&op_done);
-    if (op_done.job) {
-        if (qat_setup_async_event_notification(0) == 0) {
-            QATerr(QAT_F_QAT_ECDSA_DO_VERIFY, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
-            goto err;
-        }
-    }
-
     CRYPTO_QAT_LOG("AU - %s\n", __func__);
-    do {
-        if ((instanceHandle = get_next_inst()) == NULL) {
-            QATerr(QAT_F_QAT_ECDSA_DO_VERIFY, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
-            goto err;
-        }
-
-        CRYPTO_QAT_LOG("AU - %s\n", __func__);
-        status = cpaCyEcdsaVerify(instanceHandle,
-                                  qat_ecdsaVerifyCallbackFn,
-                                  &op_done, opData, &bEcdsaVerifyStatus);
-
-        if (status == CPA_STATUS_RETRY) {
-            if (op_done.job == NULL) {
-                usleep(ulPollInterval +
-                       (qatPerformOpRetries %
-                        QAT_RETRY_BACKOFF_MODULO_DIVISOR));
-                qatPerformOpRetries++;
-                if (iMsgRetry != QAT_INFINITE_MAX_NUM_RETRIES) {
-                    if (qatPerformOpRetries >= iMsgRetry) {
-                        break;
-                    }
-                }
-            } else {
-                if ((qat_wake_job(op_done.job, 0) == 0) ||
-                    (qat_pause_job(op_done.job, 0) == 0)) {
-                    status = CPA_STATUS_FAIL;
-                    break;
-                }
-            }
-        }
+    status = qat_perform_op(NULL, qat_ecdsa_verify_submit, &args, 1, &verify);
+    if (status == QAT_STATUS_EXPIRED) {
+        /* The request could not be submitted in time */
+        EC_KEY_METHOD_get_verify((EC_KEY_METHOD *) EC_KEY_OpenSSL(), NULL,
+                                 &verify_sig_pfunc);
+        if (verify_sig_pfunc != NULL)
+            ret = (*verify_sig_pfunc)(dgst, dgst_len, sig, eckey);
+        goto err;
     }
-    while (status == CPA_STATUS_RETRY);
 
     if (status != CPA_STATUS_SUCCESS) {
         QATerr(QAT_F_QAT_ECDSA_DO_VERIFY, ERR_R_INTERNAL_ERROR);
-        cleanupOpDone(&op_done);
         goto err;
     }
 
-    do {
-        if(op_done.job) {
-            /* If we get a failure on qat_pause_job then we will
-               not flag an error here and quit because we have
-               an asynchronous request in flight.
-               We don't want to start cleaning up data
-               structures that are still being used. If
-               qat_pause_job fails we will just yield and
-               loop around and try again until the request
-               completes and we can continue. */
-            if (qat_pause_job(op_done.job, 0) == 0)
-                pthread_yield();
-        } else {
-            pthread_yield();
-        }
-    }
-    while (!op_done.flag);
-
-    cleanupOpDone(&op_done);
-
-    if (op_done.verifyResult == CPA_TRUE)
+    if (verify == CPA_TRUE)
         ret = 1;
 
  err:
-    if (opData) {
-        QAT_CHK_QMFREE_FLATBUFF(opData->r);
-        QAT_CHK_QMFREE_FLATBUFF(opData->s);
-        QAT_CHK_QMFREE_FLATBUFF(opData->n);
-        QAT_CHK_QMFREE_FLATBUFF(opData->m);
-        QAT_CHK_QMFREE_FLATBUFF(opData->xg);
-        QAT_CHK_QMFREE_FLATBUFF(opData->yg);
-        QAT_CHK_QMFREE_FLATBUFF(opData->a);
-        QAT_CHK_QMFREE_FLATBUFF(opData->b);
-        QAT_CHK_QMFREE_FLATBUFF(opData->q);
-        QAT_CHK_QMFREE_FLATBUFF(opData->xp);
-        QAT_CHK_QMFREE_FLATBUFF(opData->yp);
-        OPENSSL_free(opData);
-    }
-
-    if (ctx) {
-        BN_CTX_end(ctx);
-        BN_CTX_free(ctx);
-    }
+    QAT_CHK_QMFREE_FLATBUFF(opData->r);
+    QAT_CHK_QMFREE_FLATBUFF(opData->s);
+    QAT_CHK_QMFREE_FLATBUFF(opData->n);
+    QAT_CHK_QMFREE_FLATBUFF(opData->m);
+    QAT_CHK_QMFREE_FLATBUFF(opData->xg);
+    QAT_CHK_QMFREE_FLATBUFF(opData->yg);
+    QAT_CHK_QMFREE_FLATBUFF(opData->a);
+    QAT_CHK_QMFREE_FLATBUFF(opData->b);
+    QAT_CHK_QMFREE_FLATBUFF(opData->q);
+    QAT_CHK_QMFREE_FLATBUFF(opData->xp);
+    QAT_CHK_QMFREE_FLATBUFF(opData->yp);
+    BN_CTX_end(ctx);
+    qat_asym_req_put(req);
     return ret;
 }
 
@@ -54,6 +54,7 @@
 #include "openssl/kdf.h"
 #include "openssl/evp.h"
 #include "openssl/ssl.h"
+#include "openssl/hmac.h"
 #include "qat_prf.h"
 #include "qat_utils.h"
 #include "qat_asym_common.h"
@@ -77,15 +78,26 @@
 # endif
 #endif
 
+#ifdef OPENSSL_DISABLE_QAT_PRF
+# undef QAT_HKDF
+#endif
+
 /* MAXBUF must be multiple of 64 to maintain the userLabel
  * aligned to 64B. See comment in QAT_TLS1_PRF_CTX
  */
 #define QAT_TLS1_PRF_MAXBUF 1024
 #define QAT_TLS1_PRF_SEED1_MAXBUF 256
+#define QAT_HKDF_INFO_MAXBUF 1024
+/* Length, label and context of the longest TLS 1.3 HkdfLabel */
+#define QAT_HKDF_LABEL_MAXBUF (2 + 1 + 255 + 1 + 255)
+#define QAT_HKDF_TLS13_IV_LEN 12
 
 /* PRF nid */
 int qat_prf_nids[] = {
-    EVP_PKEY_TLS1_PRF
+    EVP_PKEY_TLS1_PRF,
+#ifdef QAT_HKDF
+    EVP_PKEY_HKDF,
+#endif
 };
 
 #ifndef OPENSSL_DISABLE_QAT_PRF
@@ -113,6 +125,56 @@ static int qat_prf_tls_derive(EVP_PKEY_CTX *ctx, unsigned char *key,
 static int qat_tls1_prf_ctrl(EVP_PKEY_CTX *ctx, int type, int p1, void *p2);
 #endif /* OPENSSL_DISABLE_QAT_PRF */
 
+#ifdef QAT_HKDF
+/* QAT HKDF pkey context structure */
+typedef struct {
+    /* Digest and mode (EVP_PKEY_HKDEF_MODE_*) of the derivation */
+    const EVP_MD *md;
+    int mode;
+    unsigned char *salt;
+    size_t saltlen;
+    unsigned char *key;
+    size_t keylen;
+    unsigned char info[QAT_HKDF_INFO_MAXBUF];
+    size_t infolen;
+    /* TLS 1.3 labels expanded from the same secret in one request */
+    unsigned char label[QAT_HKDF_MAX_LABELS][QAT_HKDF_LABEL_MAXBUF];
+    size_t label_len[QAT_HKDF_MAX_LABELS];
+    unsigned int sublabels[QAT_HKDF_MAX_LABELS];
+    unsigned int num_labels;
+    /* AEAD of the TLS 1.3 cipher suite, NULL to select it from the md */
+    const EVP_CIPHER *cipher;
+} QAT_HKDF_CTX;
+
+static int qat_hkdf_init(EVP_PKEY_CTX *ctx);
+static void qat_hkdf_cleanup(EVP_PKEY_CTX *ctx);
+static int qat_hkdf_derive_init(EVP_PKEY_CTX *ctx);
+static int qat_hkdf_derive(EVP_PKEY_CTX *ctx, unsigned char *key,
+                           size_t *olen);
+static int qat_hkdf_ctrl(EVP_PKEY_CTX *ctx, int type, int p1, void *p2);
+static int qat_hkdf_ctrl_str(EVP_PKEY_CTX *ctx, const char *type,
+                             const char *value);
+
+static EVP_PKEY_METHOD *_hidden_hkdf_pmeth = NULL;
+
+static EVP_PKEY_METHOD *qat_hkdf_pmeth(void)
+{
+    if (_hidden_hkdf_pmeth)
+        return _hidden_hkdf_pmeth;
+    if ((_hidden_hkdf_pmeth = EVP_PKEY_meth_new(EVP_PKEY_HKDF, 0)) == NULL) {
+        QATerr(QAT_F_QAT_HKDF_PMETH, ERR_R_INTERNAL_ERROR);
+        return NULL;
+    }
+    EVP_PKEY_meth_set_init(_hidden_hkdf_pmeth, qat_hkdf_init);
+    EVP_PKEY_meth_set_cleanup(_hidden_hkdf_pmeth, qat_hkdf_cleanup);
+    EVP_PKEY_meth_set_derive(_hidden_hkdf_pmeth, qat_hkdf_derive_init,
+                             qat_hkdf_derive);
+    EVP_PKEY_meth_set_ctrl(_hidden_hkdf_pmeth, qat_hkdf_ctrl,
+                           qat_hkdf_ctrl_str);
+    return _hidden_hkdf_pmeth;
+}
+#endif /* QAT_HKDF */
+
 static EVP_PKEY_METHOD *_hidden_prf_pmeth = NULL;
 
 static EVP_PKEY_METHOD *qat_prf_pmeth(void)
@@ -165,11 +227,22 @@ int qat_PRF_pkey_methods(ENGINE *e, EVP_PKEY_METHOD **pmeth,
 {
     if (pmeth == NULL) {
         *nids = qat_prf_nids;
-        return 1;
+        return sizeof(qat_prf_nids) / sizeof(qat_prf_nids[0]);
     }
 
-    if (pmeth)
+    switch (nid) {
+    case EVP_PKEY_TLS1_PRF:
         *pmeth = qat_prf_pmeth();
+        break;
+#ifdef QAT_HKDF
+    case EVP_PKEY_HKDF:
+        *pmeth = qat_hkdf_pmeth();
+        break;
+#endif
+    default:
+        *pmeth = NULL;
+        return 0;
+    }
 
     return 1;
 }
@@ -343,6 +416,32 @@ void qat_prf_cb(void *pCallbackTag, CpaStatus status,
 }
 
 
+typedef struct {
+    CpaCyKeyGenTlsOpData *op_data;
+    CpaCySymHashAlgorithm hash_algo;
+    CpaFlatBuffer *generated_key;
+} qat_prf_args;
+
+static CpaStatus qat_prf_tls_submit(CpaInstanceHandle instanceHandle,
+                                    void *callbackTag, void *args)
+{
+    qat_prf_args *req = (qat_prf_args *)args;
+
+    DEBUG("Calling cpaCyKeyGenTls \n");
+    return cpaCyKeyGenTls(instanceHandle, qat_prf_cb, callbackTag,
+                          req->op_data, req->generated_key);
+}
+
+static CpaStatus qat_prf_tls2_submit(CpaInstanceHandle instanceHandle,
+                                     void *callbackTag, void *args)
+{
+    qat_prf_args *req = (qat_prf_args *)args;
+
+    DEBUG("Calling cpaCyKeyGenTls2 \n");
+    return cpaCyKeyGenTls2(instanceHandle, qat_prf_cb, callbackTag,
+                           req->op_data, req->hash_algo, req->generated_key);
+}
+
 /******************************************************************************
 * function:
 *         qat_get_hash_algorithm(
@@ -583,104 +682,909 @@ int qat_prf_tls_derive(EVP_PKEY_CTX *ctx, unsigned char *key,
         goto err;
     }
 
-    struct op_done op_done;
-    int qatPerformOpRetries = 0;
-    int iMsgRetry = getQatMsgRetryCount();
-    unsigned long int ulPollInterval = getQatPollInterval();
+    CpaBoolean verify = CPA_FALSE;
+    qat_prf_args args = { &prf_op_data, hash_algo, generated_key };
 
     DEBUG_PRF_OP_DATA(&prf_op_data);
 
-    initOpDone(&op_done);
-    if (op_done.job) {
-        if (qat_setup_async_event_notification(0) == 0) {
+    /* Call the function of CPA according the to the version of TLS */
+    status = qat_perform_op(instance_handle,
+                            EVP_MD_type(qat_prf_ctx->md) != NID_md5_sha1 ?
+                            qat_prf_tls2_submit : qat_prf_tls_submit,
+                            &args, 0, &verify);
+    if (CPA_STATUS_SUCCESS != status || verify != CPA_TRUE) {
+        WARN("[%s] Key generation failed, status=%d\n", __func__, status);
         QATerr(QAT_F_QAT_PRF_TLS_DERIVE, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
-            goto err;
+        goto err;
+    }
+
+    DUMPL("Generated key", generated_key->pData, key_length);
+    memcpy(key, generated_key->pData, key_length);
+    ret = 1;
+
+ err:
+
+    /* Free the memory  */
+    if (NULL != generated_key) {
+        if (NULL != generated_key->pData) {
+            OPENSSL_cleanse(generated_key->pData, key_length);
+            qaeCryptoMemFree(generated_key->pData);
         }
+        qaeCryptoMemFree(generated_key);
     }
+    return ret;
+}
+#endif /* OPENSSL_DISABLE_QAT_PRF */
 
-    do {
-        /* Call the function of CPA according the to the version of TLS */
-        if (EVP_MD_type(qat_prf_ctx->md) != NID_md5_sha1) {
-            DEBUG("Calling cpaCyKeyGenTls2 \n");
-            status =
-                cpaCyKeyGenTls2(instance_handle, qat_prf_cb,
-                        &op_done, &prf_op_data, hash_algo,
-                        generated_key);
-        } else {
-            DEBUG("Calling cpaCyKeyGenTls \n");
-            status =
-                cpaCyKeyGenTls(instance_handle, qat_prf_cb, &op_done,
-                        &prf_op_data, generated_key);
+#ifdef QAT_HKDF
+/******************************************************************************
+* function:
+*        qat_hkdf_init(EVP_PKEY_CTX *ctx)
+*
+* @param ctx   [IN] - PKEY Context structure pointer
+*
+* @retval      1 on success, 0 on failure
+*
+* description:
+*   Qat HKDF init function
+******************************************************************************/
+int qat_hkdf_init(EVP_PKEY_CTX *ctx)
+{
+    QAT_HKDF_CTX *qat_hkdf_ctx = NULL;
+
+    qat_hkdf_ctx = OPENSSL_zalloc(sizeof(*qat_hkdf_ctx));
+    if (qat_hkdf_ctx == NULL) {
+        WARN("[%s] Cannot allocate qat_hkdf_ctx\n", __func__);
+        return 0;
+    }
+
+    qat_hkdf_ctx->mode = EVP_PKEY_HKDEF_MODE_EXTRACT_AND_EXPAND;
+    EVP_PKEY_CTX_set_data(ctx, qat_hkdf_ctx);
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*         qat_hkdf_cleanup(EVP_PKEY_CTX *ctx)
+*
+* @param ctx    [IN] - PKEY Context structure pointer
+*
+* description:
+*   Clear the QAT specific data stored in qat_hkdf_ctx
+******************************************************************************/
+void qat_hkdf_cleanup(EVP_PKEY_CTX *ctx)
+{
+    QAT_HKDF_CTX *qat_hkdf_ctx = NULL;
+
+    if (ctx == NULL) {
+        WARN("[%s] Error: ctx (type EVP_PKEY_CTX) is NULL \n", __func__);
+        return;
+    }
+
+    qat_hkdf_ctx = (QAT_HKDF_CTX *) EVP_PKEY_CTX_get_data(ctx);
+    if (qat_hkdf_ctx == NULL) {
+        WARN("[%s] Error: qat_hkdf_ctx is NULL\n", __func__);
+        return;
+    }
+
+    OPENSSL_free(qat_hkdf_ctx->salt);
+    OPENSSL_clear_free(qat_hkdf_ctx->key, qat_hkdf_ctx->keylen);
+    OPENSSL_clear_free(qat_hkdf_ctx, sizeof(*qat_hkdf_ctx));
+    EVP_PKEY_CTX_set_data(ctx, NULL);
+}
+
+/******************************************************************************
+* function:
+*         qat_hkdf_derive_init(EVP_PKEY_CTX *ctx)
+*
+* @param ctx    [IN] - PKEY Context structure pointer
+*
+* @retval       1 on success, 0 on failure
+*
+* description:
+*   Reset the parameters of the derivation as OpenSSL does, so that the info
+*   and the queued labels of a previous derivation are not reused.
+******************************************************************************/
+int qat_hkdf_derive_init(EVP_PKEY_CTX *ctx)
+{
+    QAT_HKDF_CTX *qat_hkdf_ctx = (QAT_HKDF_CTX *) EVP_PKEY_CTX_get_data(ctx);
+
+    if (qat_hkdf_ctx == NULL) {
+        WARN("[%s] Error: qat_hkdf_ctx cannot be NULL\n", __func__);
+        return 0;
+    }
+
+    OPENSSL_free(qat_hkdf_ctx->salt);
+    OPENSSL_clear_free(qat_hkdf_ctx->key, qat_hkdf_ctx->keylen);
+    OPENSSL_cleanse(qat_hkdf_ctx, sizeof(*qat_hkdf_ctx));
+    qat_hkdf_ctx->salt = NULL;
+    qat_hkdf_ctx->key = NULL;
+    qat_hkdf_ctx->md = NULL;
+    qat_hkdf_ctx->cipher = NULL;
+    qat_hkdf_ctx->mode = EVP_PKEY_HKDEF_MODE_EXTRACT_AND_EXPAND;
+    return 1;
+}
+
+/******************************************************************************
+* function:
+*         qat_hkdf_label_valid(const unsigned char *label, int len)
+*
+* @param label  [IN] - Encoded HkdfLabel
+* @param len    [IN] - Length of the encoding
+*
+* @retval       1 if the encoding is consistent with len, 0 otherwise
+*
+* description:
+*   Check an HkdfLabel made of a 2 byte output length followed by the label
+*   and the context, each preceded by its 1 byte length.
+******************************************************************************/
+static int qat_hkdf_label_valid(const unsigned char *label, int len)
+{
+    if (len < 4 || 3 + label[2] >= len)
+        return 0;
+    return len == 4 + label[2] + label[3 + label[2]];
+}
+
+/******************************************************************************
+* function:
+*        qat_hkdf_ctrl(EVP_PKEY_CTX *ctx,
+*                      int type,
+*                      int p1,
+*                      void *p2)
+*
+* @param ctx    [IN] - PKEY Context structure pointer
+* @param type   [IN] - Type
+* @param p1     [IN] - Length/Size
+* @param *p2    [IN] - Data
+*
+* @retval       1 on success, 0 on failure, -2 for an unsupported control
+*
+* description:
+*   Qat HKDF control function. The standard HKDF controls behave as in
+*   OpenSSL, the EVP_PKEY_CTRL_QAT_HKDF_* controls queue the TLS 1.3
+*   labels derived together.
+******************************************************************************/
+int qat_hkdf_ctrl(EVP_PKEY_CTX *ctx, int type, int p1, void *p2)
+{
+    QAT_HKDF_CTX *qat_hkdf_ctx = (QAT_HKDF_CTX *) EVP_PKEY_CTX_get_data(ctx);
+    unsigned int n;
+
+    if (qat_hkdf_ctx == NULL) {
+         WARN("[%s] Error: qat_hkdf_ctx cannot be NULL\n", __func__);
+         return 0;
+    }
+
+    switch (type) {
+    case EVP_PKEY_CTRL_HKDF_MD:
+        if (p2 == NULL)
+            return 0;
+        qat_hkdf_ctx->md = p2;
+        return 1;
+
+    case EVP_PKEY_CTRL_HKDF_MODE:
+        if (p1 != EVP_PKEY_HKDEF_MODE_EXTRACT_AND_EXPAND &&
+            p1 != EVP_PKEY_HKDEF_MODE_EXTRACT_ONLY &&
+            p1 != EVP_PKEY_HKDEF_MODE_EXPAND_ONLY)
+            return 0;
+        qat_hkdf_ctx->mode = p1;
+        return 1;
+
+    case EVP_PKEY_CTRL_HKDF_SALT:
+        if (p1 == 0 || p2 == NULL)
+            return 1;
+        if (p1 < 0)
+            return 0;
+        OPENSSL_free(qat_hkdf_ctx->salt);
+        qat_hkdf_ctx->salt = OPENSSL_memdup(p2, p1);
+        if (qat_hkdf_ctx->salt == NULL) {
+            qat_hkdf_ctx->saltlen = 0;
+            return 0;
         }
+        qat_hkdf_ctx->saltlen = p1;
+        return 1;
 
-        if (status == CPA_STATUS_RETRY) {
-            if (op_done.job == NULL) {
-                usleep(ulPollInterval +
-                       (qatPerformOpRetries %
-                        QAT_RETRY_BACKOFF_MODULO_DIVISOR));
-                qatPerformOpRetries++;
-                if (iMsgRetry != QAT_INFINITE_MAX_NUM_RETRIES) {
-                    if (qatPerformOpRetries >= iMsgRetry) {
-                        break;
-                    }
-                }
-            } else {
-                if ((qat_wake_job(op_done.job, 0) == 0) ||
-                    (qat_pause_job(op_done.job, 0) == 0)) {
-                    status = CPA_STATUS_FAIL;
-                    break;
-                }
+    case EVP_PKEY_CTRL_HKDF_KEY:
+        if (p1 < 0 || (p1 > 0 && p2 == NULL))
+            return 0;
+        OPENSSL_clear_free(qat_hkdf_ctx->key, qat_hkdf_ctx->keylen);
+        qat_hkdf_ctx->keylen = 0;
+        /* Keep a buffer for zero length keys, the key must be set */
+        qat_hkdf_ctx->key = OPENSSL_zalloc(p1 ? p1 : 1);
+        if (qat_hkdf_ctx->key == NULL)
+            return 0;
+        if (p1 > 0)
+            memcpy(qat_hkdf_ctx->key, p2, p1);
+        qat_hkdf_ctx->keylen = p1;
+        return 1;
+
+    case EVP_PKEY_CTRL_HKDF_INFO:
+        if (p1 == 0 || p2 == NULL)
+            return 1;
+        if (p1 < 0 || p1 > (int)(QAT_HKDF_INFO_MAXBUF - qat_hkdf_ctx->infolen))
+            return 0;
+        memcpy(qat_hkdf_ctx->info + qat_hkdf_ctx->infolen, p2, p1);
+        qat_hkdf_ctx->infolen += p1;
+        return 1;
+
+    case EVP_PKEY_CTRL_QAT_HKDF_LABEL:
+        if (p2 == NULL) {
+            qat_hkdf_ctx->num_labels = 0;
+            return 1;
+        }
+        n = qat_hkdf_ctx->num_labels;
+        if (n >= QAT_HKDF_MAX_LABELS || !qat_hkdf_label_valid(p2, p1)) {
+            WARN("[%s] Error: too many labels or invalid HkdfLabel\n",
+                 __func__);
+            return 0;
+        }
+        memcpy(qat_hkdf_ctx->label[n], p2, p1);
+        qat_hkdf_ctx->label_len[n] = p1;
+        qat_hkdf_ctx->sublabels[n] = 0;
+        qat_hkdf_ctx->num_labels++;
+        return 1;
+
+    case EVP_PKEY_CTRL_QAT_HKDF_SUBLABELS:
+        if (qat_hkdf_ctx->num_labels == 0 ||
+            (p1 & ~(QAT_HKDF_SUBLABEL_KEY | QAT_HKDF_SUBLABEL_IV |
+                    QAT_HKDF_SUBLABEL_FINISHED)) != 0)
+            return 0;
+        qat_hkdf_ctx->sublabels[qat_hkdf_ctx->num_labels - 1] = p1;
+        return 1;
+
+    case EVP_PKEY_CTRL_QAT_HKDF_CIPHER:
+        qat_hkdf_ctx->cipher = p2;
+        return 1;
+
+    default:
+        return -2;
+    }
+}
+
+/******************************************************************************
+* function:
+*        qat_hkdf_ctrl_str(EVP_PKEY_CTX *ctx,
+*                          const char *type,
+*                          const char *value)
+*
+* @param ctx    [IN] - PKEY Context structure pointer
+* @param type   [IN] - Name of the parameter
+* @param value  [IN] - Value of the parameter
+*
+* @retval       1 on success, 0 on failure, -2 for an unsupported parameter
+*
+* description:
+*   Qat HKDF string control function, accepting the same parameters as the
+*   OpenSSL HKDF: md, mode, salt, key and info, the last three also in hex
+*   as hexsalt, hexkey and hexinfo.
+******************************************************************************/
+int qat_hkdf_ctrl_str(EVP_PKEY_CTX *ctx, const char *type, const char *value)
+{
+    int mode;
+
+    if (value == NULL) {
+        WARN("[%s] Error: value cannot be NULL\n", __func__);
+        return 0;
+    }
+
+    if (strcmp(type, "mode") == 0) {
+        if (strcmp(value, "EXTRACT_AND_EXPAND") == 0)
+            mode = EVP_PKEY_HKDEF_MODE_EXTRACT_AND_EXPAND;
+        else if (strcmp(value, "EXTRACT_ONLY") == 0)
+            mode = EVP_PKEY_HKDEF_MODE_EXTRACT_ONLY;
+        else if (strcmp(value, "EXPAND_ONLY") == 0)
+            mode = EVP_PKEY_HKDEF_MODE_EXPAND_ONLY;
+        else
+            return 0;
+        return EVP_PKEY_CTX_ctrl(ctx, -1, EVP_PKEY_OP_DERIVE,
+                                 EVP_PKEY_CTRL_HKDF_MODE, mode, NULL);
+    }
+
+    if (strcmp(type, "md") == 0)
+        return EVP_PKEY_CTX_md(ctx, EVP_PKEY_OP_DERIVE,
+                               EVP_PKEY_CTRL_HKDF_MD, value);
+
+    if (strcmp(type, "salt") == 0)
+        return EVP_PKEY_CTX_str2ctrl(ctx, EVP_PKEY_CTRL_HKDF_SALT, value);
+
+    if (strcmp(type, "hexsalt") == 0)
+        return EVP_PKEY_CTX_hex2ctrl(ctx, EVP_PKEY_CTRL_HKDF_SALT, value);
+
+    if (strcmp(type, "key") == 0)
+        return EVP_PKEY_CTX_str2ctrl(ctx, EVP_PKEY_CTRL_HKDF_KEY, value);
+
+    if (strcmp(type, "hexkey") == 0)
+        return EVP_PKEY_CTX_hex2ctrl(ctx, EVP_PKEY_CTRL_HKDF_KEY, value);
+
+    if (strcmp(type, "info") == 0)
+        return EVP_PKEY_CTX_str2ctrl(ctx, EVP_PKEY_CTRL_HKDF_INFO, value);
+
+    if (strcmp(type, "hexinfo") == 0)
+        return EVP_PKEY_CTX_hex2ctrl(ctx, EVP_PKEY_CTRL_HKDF_INFO, value);
+
+    return -2;
+}
+
+/******************************************************************************
+* function:
+*         qat_hkdf_key_len(QAT_HKDF_CTX *qat_hkdf_ctx)
+*
+* @param qat_hkdf_ctx [IN] - HKDF context
+*
+* @retval             Length of the sublabel key
+*
+* description:
+*   Return the key length of the TLS 1.3 AEAD, which defaults to AES-128-GCM
+*   with SHA256 and to AES-256-GCM with SHA384.
+******************************************************************************/
+static size_t qat_hkdf_key_len(QAT_HKDF_CTX *qat_hkdf_ctx)
+{
+    if (qat_hkdf_ctx->cipher != NULL)
+        return EVP_CIPHER_key_length(qat_hkdf_ctx->cipher);
+    return EVP_MD_type(qat_hkdf_ctx->md) == NID_sha384 ? 32 : 16;
+}
+
+/******************************************************************************
+* function:
+*         qat_hkdf_out_len(QAT_HKDF_CTX *qat_hkdf_ctx)
+*
+* @param qat_hkdf_ctx [IN] - HKDF context
+*
+* @retval             Length of the derived data, 0 if set by the caller
+*
+* description:
+*   Return the length of the PRK of an extract, or of the secrets and
+*   sublabels of the queued labels concatenated in the order they were
+*   queued. The sublabels of a label follow its secret in KEY, IV, FINISHED
+*   order.
+******************************************************************************/
+static size_t qat_hkdf_out_len(QAT_HKDF_CTX *qat_hkdf_ctx)
+{
+    size_t md_size = EVP_MD_size(qat_hkdf_ctx->md);
+    size_t len = 0;
+    unsigned int i;
+
+    if (qat_hkdf_ctx->num_labels == 0)
+        return qat_hkdf_ctx->mode == EVP_PKEY_HKDEF_MODE_EXTRACT_ONLY ?
+               md_size : 0;
+
+    for (i = 0; i < qat_hkdf_ctx->num_labels; i++) {
+        len += md_size;
+        if (qat_hkdf_ctx->sublabels[i] & QAT_HKDF_SUBLABEL_KEY)
+            len += qat_hkdf_key_len(qat_hkdf_ctx);
+        if (qat_hkdf_ctx->sublabels[i] & QAT_HKDF_SUBLABEL_IV)
+            len += QAT_HKDF_TLS13_IV_LEN;
+        if (qat_hkdf_ctx->sublabels[i] & QAT_HKDF_SUBLABEL_FINISHED)
+            len += md_size;
+    }
+    return len;
+}
+
+/******************************************************************************
+* function:
+*         qat_hkdf_sw_expand(const EVP_MD *md,
+*                            const unsigned char *prk, size_t prklen,
+*                            const unsigned char *info, size_t infolen,
+*                            unsigned char *out, size_t outlen)
+*
+* @param md      [IN]  - Digest
+* @param prk     [IN]  - Pseudorandom key
+* @param prklen  [IN]  - Length of prk
+* @param info    [IN]  - Context information
+* @param infolen [IN]  - Length of info
+* @param out     [OUT] - Output keying material
+* @param outlen  [IN]  - Length of out
+*
+* @retval        1 on success, 0 on failure
+*
+* description:
+*   Software HKDF-Expand as defined by RFC 5869.
+******************************************************************************/
+static int qat_hkdf_sw_expand(const EVP_MD *md,
+                              const unsigned char *prk, size_t prklen,
+                              const unsigned char *info, size_t infolen,
+                              unsigned char *out, size_t outlen)
+{
+    HMAC_CTX *hmac = NULL;
+    unsigned char prev[EVP_MAX_MD_SIZE];
+    size_t md_size = EVP_MD_size(md), done = 0, copy;
+    unsigned char i;
+    int ret = 0;
+
+    if (outlen == 0 || outlen > 255 * md_size)
+        return 0;
+
+    if ((hmac = HMAC_CTX_new()) == NULL ||
+        !HMAC_Init_ex(hmac, prk, prklen, md, NULL))
+        goto end;
+
+    for (i = 1; done < outlen; i++) {
+        if (i > 1 && (!HMAC_Init_ex(hmac, NULL, 0, NULL, NULL) ||
+                      !HMAC_Update(hmac, prev, md_size)))
+            goto end;
+        if (!HMAC_Update(hmac, info, infolen) ||
+            !HMAC_Update(hmac, &i, 1) ||
+            !HMAC_Final(hmac, prev, NULL))
+            goto end;
+        copy = outlen - done < md_size ? outlen - done : md_size;
+        memcpy(out + done, prev, copy);
+        done += copy;
+    }
+    ret = 1;
+
+ end:
+    OPENSSL_cleanse(prev, sizeof(prev));
+    HMAC_CTX_free(hmac);
+    return ret;
+}
+
+/******************************************************************************
+* function:
+*         qat_hkdf_sw_expand_label(const EVP_MD *md,
+*                                  const unsigned char *secret,
+*                                  const char *label,
+*                                  unsigned char *out, size_t outlen)
+*
+* @param md      [IN]  - Digest
+* @param secret  [IN]  - Traffic secret of the digest size
+* @param label   [IN]  - TLS 1.3 label without the "tls13 " prefix
+* @param out     [OUT] - Derived value
+* @param outlen  [IN]  - Length of out
+*
+* @retval        1 on success, 0 on failure
+*
+* description:
+*   Software HKDF-Expand-Label with an empty context, as used for the
+*   sublabels derived from a traffic secret.
+******************************************************************************/
+static int qat_hkdf_sw_expand_label(const EVP_MD *md,
+                                    const unsigned char *secret,
+                                    const char *label,
+                                    unsigned char *out, size_t outlen)
+{
+    static const char prefix[] = "tls13 ";
+    unsigned char info[2 + 1 + 32 + 1];
+    size_t label_len = strlen(label), pos = 0;
+
+    info[pos++] = (unsigned char)(outlen >> QAT_BYTE_SHIFT);
+    info[pos++] = (unsigned char)outlen;
+    info[pos++] = (unsigned char)(sizeof(prefix) - 1 + label_len);
+    memcpy(info + pos, prefix, sizeof(prefix) - 1);
+    pos += sizeof(prefix) - 1;
+    memcpy(info + pos, label, label_len);
+    pos += label_len;
+    info[pos++] = 0;
+
+    return qat_hkdf_sw_expand(md, secret, EVP_MD_size(md), info, pos,
+                              out, outlen);
+}
+
+/******************************************************************************
+* function:
+*         qat_hkdf_sw_derive(QAT_HKDF_CTX *qat_hkdf_ctx,
+*                            unsigned char *key, size_t keylen)
+*
+* @param qat_hkdf_ctx [IN]  - HKDF context
+* @param key          [OUT] - Derived data
+* @param keylen       [IN]  - Length of key
+*
+* @retval             1 on success, 0 on failure
+*
+* description:
+*   Derive in software what the hardware cannot, with the same output
+*   layout as qat_hkdf_hw_derive.
+******************************************************************************/
+static int qat_hkdf_sw_derive(QAT_HKDF_CTX *qat_hkdf_ctx,
+                              unsigned char *key, size_t keylen)
+{
+    const EVP_MD *md = qat_hkdf_ctx->md;
+    const unsigned char *secret = qat_hkdf_ctx->key;
+    size_t secretlen = qat_hkdf_ctx->keylen;
+    size_t md_size = EVP_MD_size(md), key_len = qat_hkdf_key_len(qat_hkdf_ctx);
+    unsigned char prk[EVP_MAX_MD_SIZE];
+    unsigned char *out = key;
+    unsigned int prklen = 0, i;
+    int ret = 0;
+
+    if (qat_hkdf_ctx->mode != EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) {
+        if (HMAC(md, qat_hkdf_ctx->salt != NULL ? qat_hkdf_ctx->salt :
+                 (const unsigned char *)"", qat_hkdf_ctx->saltlen,
+                 qat_hkdf_ctx->key, qat_hkdf_ctx->keylen, prk, &prklen) == NULL)
+            goto end;
+        if (qat_hkdf_ctx->mode == EVP_PKEY_HKDEF_MODE_EXTRACT_ONLY) {
+            memcpy(key, prk, prklen);
+            ret = 1;
+            goto end;
+        }
+        secret = prk;
+        secretlen = prklen;
+    }
+
+    if (qat_hkdf_ctx->num_labels == 0) {
+        ret = qat_hkdf_sw_expand(md, secret, secretlen, qat_hkdf_ctx->info,
+                                 qat_hkdf_ctx->infolen, key, keylen);
+        goto end;
+    }
+
+    for (i = 0; i < qat_hkdf_ctx->num_labels; i++) {
+        unsigned char *label_secret = out;
+
+        if (!qat_hkdf_sw_expand(md, secret, secretlen, qat_hkdf_ctx->label[i],
+                                qat_hkdf_ctx->label_len[i], out, md_size))
+            goto end;
+        out += md_size;
+        if (qat_hkdf_ctx->sublabels[i] & QAT_HKDF_SUBLABEL_KEY) {
+            if (!qat_hkdf_sw_expand_label(md, label_secret, "key", out,
+                                          key_len))
+                goto end;
+            out += key_len;
+        }
+        if (qat_hkdf_ctx->sublabels[i] & QAT_HKDF_SUBLABEL_IV) {
+            if (!qat_hkdf_sw_expand_label(md, label_secret, "iv", out,
+                                          QAT_HKDF_TLS13_IV_LEN))
+                goto end;
+            out += QAT_HKDF_TLS13_IV_LEN;
+        }
+        if (qat_hkdf_ctx->sublabels[i] & QAT_HKDF_SUBLABEL_FINISHED) {
+            if (!qat_hkdf_sw_expand_label(md, label_secret, "finished", out,
+                                          md_size))
+                goto end;
+            out += md_size;
+        }
+    }
+    ret = 1;
+
+ end:
+    OPENSSL_cleanse(prk, sizeof(prk));
+    return ret;
+}
+
+/******************************************************************************
+* function:
+*         qat_hkdf_cipher_suite(QAT_HKDF_CTX *qat_hkdf_ctx,
+*                               CpaCyKeyHKDFCipherSuite *cipher_suite)
+*
+* @param qat_hkdf_ctx [IN]  - HKDF context
+* @param cipher_suite [OUT] - TLS 1.3 cipher suite in CPA format
+*
+* @retval             1 if the digest and AEAD form a TLS 1.3 cipher suite
+*                     known to the hardware, 0 otherwise
+*
+* description:
+*   The hardware takes the digest and the sublabel key length from the
+*   cipher suite.
+******************************************************************************/
+static int qat_hkdf_cipher_suite(QAT_HKDF_CTX *qat_hkdf_ctx,
+                                 CpaCyKeyHKDFCipherSuite *cipher_suite)
+{
+    int cipher_nid = qat_hkdf_ctx->cipher != NULL ?
+                     EVP_CIPHER_nid(qat_hkdf_ctx->cipher) : NID_undef;
+
+    switch (EVP_MD_type(qat_hkdf_ctx->md)) {
+    case NID_sha256:
+        if (cipher_nid == NID_undef || cipher_nid == NID_aes_128_gcm)
+            *cipher_suite = CPA_CY_HKDF_TLS_AES_128_GCM_SHA256;
+        else if (cipher_nid == NID_chacha20_poly1305)
+            *cipher_suite = CPA_CY_HKDF_TLS_CHACHA20_POLY1305_SHA256;
+        else if (cipher_nid == NID_aes_128_ccm)
+            *cipher_suite = CPA_CY_HKDF_TLS_AES_128_CCM_SHA256;
+        else
+            return 0;
+        return 1;
+    case NID_sha384:
+        if (cipher_nid != NID_undef && cipher_nid != NID_aes_256_gcm)
+            return 0;
+        *cipher_suite = CPA_CY_HKDF_TLS_AES_256_GCM_SHA384;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/******************************************************************************
+* function:
+*         qat_hkdf_offloadable(QAT_HKDF_CTX *qat_hkdf_ctx, size_t keylen)
+*
+* @param qat_hkdf_ctx [IN] - HKDF context
+* @param keylen       [IN] - Length of the derived data
+*
+* @retval             1 if the derivation can be done by the hardware
+*
+* description:
+*   The hardware HKDF supports the TLS 1.3 digests, inputs up to the
+*   sizes of CpaCyKeyGenHKDFOpData, labels deriving a secret of the digest
+*   size and output keying material of up to one digest.
+******************************************************************************/
+static int qat_hkdf_offloadable(QAT_HKDF_CTX *qat_hkdf_ctx, size_t keylen)
+{
+    CpaCyKeyHKDFCipherSuite cipher_suite;
+    size_t md_size = EVP_MD_size(qat_hkdf_ctx->md);
+    unsigned int i;
+
+    if (!qat_hkdf_cipher_suite(qat_hkdf_ctx, &cipher_suite) ||
+        qat_hkdf_ctx->keylen > CPA_CY_HKDF_KEY_MAX_SECRET_SZ ||
+        qat_hkdf_ctx->saltlen > CPA_CY_HKDF_KEY_MAX_HMAC_SZ)
+        return 0;
+
+    if (qat_hkdf_ctx->num_labels == 0 &&
+        qat_hkdf_ctx->mode != EVP_PKEY_HKDEF_MODE_EXTRACT_ONLY &&
+        (qat_hkdf_ctx->infolen > CPA_CY_HKDF_KEY_MAX_INFO_SZ ||
+         keylen > md_size))
+        return 0;
+
+    for (i = 0; i < qat_hkdf_ctx->num_labels; i++) {
+        if (qat_hkdf_ctx->label_len[i] > CPA_CY_HKDF_KEY_MAX_LABEL_SZ ||
+            ((size_t)qat_hkdf_ctx->label[i][0] << QAT_BYTE_SHIFT |
+             qat_hkdf_ctx->label[i][1]) != md_size)
+            return 0;
+    }
+
+    return qat_sym_cap_supported(QAT_SYM_CAP_HKDF);
+}
+
+typedef struct {
+    CpaCyKeyGenHKDFOpData *op_data;
+    CpaCyKeyHKDFCipherSuite cipher_suite;
+    CpaFlatBuffer *generated_key;
+} qat_hkdf_args;
+
+static CpaStatus qat_hkdf_submit(CpaInstanceHandle instanceHandle,
+                                 void *callbackTag, void *args)
+{
+    qat_hkdf_args *req = (qat_hkdf_args *)args;
+
+    DEBUG("Calling cpaCyKeyGenTls3 \n");
+    return cpaCyKeyGenTls3(instanceHandle, qat_prf_cb, callbackTag,
+                           req->op_data, req->cipher_suite,
+                           req->generated_key);
+}
+
+/******************************************************************************
+* function:
+*         qat_hkdf_hw_derive(QAT_HKDF_CTX *qat_hkdf_ctx,
+*                            unsigned char *key, size_t keylen)
+*
+* @param qat_hkdf_ctx [IN]  - HKDF context
+* @param key          [OUT] - Derived data
+* @param keylen       [IN]  - Length of key
+*
+* @retval             1 on success, 0 on failure, -1 if the request could
+*                     not be submitted before its deadline
+*
+* description:
+*   Perform the whole derivation, including every queued label and
+*   sublabel, with a single cpaCyKeyGenTls3 request.
+*   The hardware returns each value at the start of a slot of the digest
+*   size: the PRK first when the operation extracts, then the output keying
+*   material or, for every label, its secret followed by the requested
+*   sublabels.
+******************************************************************************/
+static int qat_hkdf_hw_derive(QAT_HKDF_CTX *qat_hkdf_ctx,
+                              unsigned char *key, size_t keylen)
+{
+    int ret = 0;
+    CpaCyKeyGenHKDFOpData *hkdf_op_data = NULL;
+    CpaFlatBuffer *generated_key = NULL;
+    CpaCyKeyHKDFCipherSuite cipher_suite;
+    CpaStatus status = CPA_STATUS_FAIL;
+    CpaInstanceHandle instance_handle = NULL;
+    size_t md_size = EVP_MD_size(qat_hkdf_ctx->md);
+    size_t key_len = qat_hkdf_key_len(qat_hkdf_ctx);
+    size_t nslots = 1, offset = 0;
+    unsigned int i, extract;
+    unsigned char *out = key;
+
+    if (!qat_hkdf_cipher_suite(qat_hkdf_ctx, &cipher_suite)) {
+        QATerr(QAT_F_QAT_HKDF_HW_DERIVE, ERR_R_INTERNAL_ERROR);
+        return 0;
+    }
+
+    hkdf_op_data = qaeCryptoMemAlloc(sizeof(*hkdf_op_data), __FILE__,
+                                     __LINE__);
+    if (hkdf_op_data == NULL) {
+        QATerr(QAT_F_QAT_HKDF_HW_DERIVE, ERR_R_MALLOC_FAILURE);
+        return 0;
+    }
+    memset(hkdf_op_data, 0, sizeof(*hkdf_op_data));
+
+    /* ---- HKDF Op Data ---- */
+    extract = qat_hkdf_ctx->mode != EVP_PKEY_HKDEF_MODE_EXPAND_ONLY;
+    if (qat_hkdf_ctx->num_labels != 0) {
+        hkdf_op_data->hkdfKeyOp = extract ?
+                                  CPA_CY_HKDF_KEY_EXTRACT_EXPAND_LABEL :
+                                  CPA_CY_HKDF_KEY_EXPAND_LABEL;
+        hkdf_op_data->numLabels = qat_hkdf_ctx->num_labels;
+        nslots = extract;
+        for (i = 0; i < qat_hkdf_ctx->num_labels; i++) {
+            memcpy(hkdf_op_data->label[i].label, qat_hkdf_ctx->label[i],
+                   qat_hkdf_ctx->label_len[i]);
+            hkdf_op_data->label[i].labelLen = qat_hkdf_ctx->label_len[i];
+            nslots++;
+            if (qat_hkdf_ctx->sublabels[i] & QAT_HKDF_SUBLABEL_KEY) {
+                hkdf_op_data->label[i].sublabelFlag |= CPA_CY_HKDF_SUBLABEL_KEY;
+                nslots++;
+            }
+            if (qat_hkdf_ctx->sublabels[i] & QAT_HKDF_SUBLABEL_IV) {
+                hkdf_op_data->label[i].sublabelFlag |= CPA_CY_HKDF_SUBLABEL_IV;
+                nslots++;
+            }
+            if (qat_hkdf_ctx->sublabels[i] & QAT_HKDF_SUBLABEL_FINISHED) {
+                hkdf_op_data->label[i].sublabelFlag |=
+                    CPA_CY_HKDF_SUBLABEL_FINISHED;
+                nslots++;
             }
         }
+    } else if (qat_hkdf_ctx->mode == EVP_PKEY_HKDEF_MODE_EXTRACT_ONLY) {
+        hkdf_op_data->hkdfKeyOp = CPA_CY_HKDF_KEY_EXTRACT;
+        extract = 0;
+    } else {
+        hkdf_op_data->hkdfKeyOp = extract ? CPA_CY_HKDF_KEY_EXTRACT_EXPAND :
+                                            CPA_CY_HKDF_KEY_EXPAND;
+        memcpy(hkdf_op_data->info, qat_hkdf_ctx->info, qat_hkdf_ctx->infolen);
+        hkdf_op_data->infoLen = qat_hkdf_ctx->infolen;
+        nslots += extract;
+    }
 
-    } while (status == CPA_STATUS_RETRY);
+    memcpy(hkdf_op_data->secret, qat_hkdf_ctx->key, qat_hkdf_ctx->keylen);
+    hkdf_op_data->secretLen = qat_hkdf_ctx->keylen;
+    if (qat_hkdf_ctx->salt != NULL)
+        memcpy(hkdf_op_data->seed, qat_hkdf_ctx->salt, qat_hkdf_ctx->saltlen);
+    hkdf_op_data->seedLen = qat_hkdf_ctx->saltlen;
 
-    if (CPA_STATUS_SUCCESS != status) {
-        QATerr(QAT_F_QAT_PRF_TLS_DERIVE, ERR_R_INTERNAL_ERROR);
-        cleanupOpDone(&op_done);
+    /* ---- Generated Key ---- */
+    generated_key =
+        (CpaFlatBuffer *) qaeCryptoMemAlloc(sizeof(CpaFlatBuffer), __FILE__,
+                                            __LINE__);
+    if (NULL == generated_key) {
+        QATerr(QAT_F_QAT_HKDF_HW_DERIVE, ERR_R_MALLOC_FAILURE);
         goto err;
     }
 
-    do {
-        if(op_done.job) {
-            /* If we get a failure on qat_pause_job then we will
-               not flag an error here and quit because we have
-               an asynchronous request in flight.
-               We don't want to start cleaning up data
-               structures that are still being used. If
-               qat_pause_job fails we will just yield and
-               loop around and try again until the request
-               completes and we can continue. */
-            if (qat_pause_job(op_done.job, 0) == 0)
-                pthread_yield();
-        } else {
-            pthread_yield();
-        }
+    generated_key->dataLenInBytes = nslots * md_size;
+    generated_key->pData =
+        (Cpa8U *) qaeCryptoMemAlloc(generated_key->dataLenInBytes, __FILE__,
+                                    __LINE__);
+    if (NULL == generated_key->pData) {
+        QATerr(QAT_F_QAT_HKDF_HW_DERIVE, ERR_R_MALLOC_FAILURE);
+        goto err;
+    }
+
+    /* ---- Perform the operation ---- */
+    if (NULL == (instance_handle = get_next_inst_with_cap(QAT_SYM_CAP_HKDF))) {
+        QATerr(QAT_F_QAT_HKDF_HW_DERIVE, ERR_R_INTERNAL_ERROR);
+        goto err;
     }
-    while (!op_done.flag);
 
-    cleanupOpDone(&op_done);
+    CpaBoolean verify = CPA_FALSE;
+    qat_hkdf_args args = { hkdf_op_data, cipher_suite, generated_key };
 
-    if (op_done.verifyResult != CPA_TRUE) {
-        QATerr(QAT_F_QAT_PRF_TLS_DERIVE, ERR_R_INTERNAL_ERROR);
+    status = qat_perform_op(instance_handle, qat_hkdf_submit, &args, 1,
+                            &verify);
+    if (status == QAT_STATUS_EXPIRED) {
+        /* The request could not be submitted in time */
+        ret = -1;
         goto err;
     }
 
-    DUMPL("Generated key", generated_key->pData, key_length);
-    memcpy(key, generated_key->pData, key_length);
+    if (CPA_STATUS_SUCCESS != status || verify != CPA_TRUE) {
+        QATerr(QAT_F_QAT_HKDF_HW_DERIVE, ERR_R_INTERNAL_ERROR);
+        goto err;
+    }
+
+    /* ---- Unpack the slots, skipping the PRK of an extract ---- */
+    offset = extract ? md_size : 0;
+    if (qat_hkdf_ctx->num_labels == 0) {
+        memcpy(key, generated_key->pData + offset, keylen);
+    } else {
+        for (i = 0; i < qat_hkdf_ctx->num_labels; i++) {
+            memcpy(out, generated_key->pData + offset, md_size);
+            out += md_size;
+            offset += md_size;
+            if (qat_hkdf_ctx->sublabels[i] & QAT_HKDF_SUBLABEL_KEY) {
+                memcpy(out, generated_key->pData + offset, key_len);
+                out += key_len;
+                offset += md_size;
+            }
+            if (qat_hkdf_ctx->sublabels[i] & QAT_HKDF_SUBLABEL_IV) {
+                memcpy(out, generated_key->pData + offset,
+                       QAT_HKDF_TLS13_IV_LEN);
+                out += QAT_HKDF_TLS13_IV_LEN;
+                offset += md_size;
+            }
+            if (qat_hkdf_ctx->sublabels[i] & QAT_HKDF_SUBLABEL_FINISHED) {
+                memcpy(out, generated_key->pData + offset, md_size);
+                out += md_size;
+                offset += md_size;
+            }
+        }
+    }
+    DUMPL("Generated key", key, keylen);
     ret = 1;
 
  err:
-
     /* Free the memory  */
     if (NULL != generated_key) {
         if (NULL != generated_key->pData) {
-            OPENSSL_cleanse(generated_key->pData, key_length);
+            OPENSSL_cleanse(generated_key->pData,
+                            generated_key->dataLenInBytes);
             qaeCryptoMemFree(generated_key->pData);
         }
         qaeCryptoMemFree(generated_key);
     }
+    OPENSSL_cleanse(hkdf_op_data, sizeof(*hkdf_op_data));
+    qaeCryptoMemFree(hkdf_op_data);
     return ret;
 }
-#endif /* OPENSSL_DISABLE_QAT_PRF */
+
+/******************************************************************************
+* function:
+*         qat_hkdf_derive(EVP_PKEY_CTX *ctx,
+*                         unsigned char *key,
+*                         size_t *olen)
+*
+* @param ctx    [IN]     - PKEY Context structure pointer
+* @param key    [OUT]    - Ptr to the key that will be generated
+* @param olen   [IN/OUT] - Length of the key
+*
+* @retval       1 on success, 0 on failure
+*
+* description:
+*   HKDF derive function. The length of an extract or of the queued labels
+*   is fixed and returned in olen, and can be queried with a NULL key.
+*   Derivations the hardware does not support, or that cannot be submitted
+*   before their deadline, are done in software.
+******************************************************************************/
+int qat_hkdf_derive(EVP_PKEY_CTX *ctx, unsigned char *key, size_t *olen)
+{
+    QAT_HKDF_CTX *qat_hkdf_ctx = NULL;
+    size_t outlen;
+    int ret;
+
+    if (NULL == ctx || NULL == olen) {
+        QATerr(QAT_F_QAT_HKDF_DERIVE, ERR_R_PASSED_NULL_PARAMETER);
+        return 0;
+    }
+
+    qat_hkdf_ctx = (QAT_HKDF_CTX *) EVP_PKEY_CTX_get_data(ctx);
+    if (qat_hkdf_ctx == NULL || qat_hkdf_ctx->md == NULL ||
+        qat_hkdf_ctx->key == NULL) {
+        WARN("[%s] Error: digest or key not set\n", __func__);
+        QATerr(QAT_F_QAT_HKDF_DERIVE, ERR_R_INTERNAL_ERROR);
+        return 0;
+    }
+
+    if (qat_hkdf_ctx->num_labels != 0 &&
+        qat_hkdf_ctx->mode == EVP_PKEY_HKDEF_MODE_EXTRACT_ONLY) {
+        WARN("[%s] Error: labels cannot be expanded by an extract\n",
+             __func__);
+        QATerr(QAT_F_QAT_HKDF_DERIVE, ERR_R_INTERNAL_ERROR);
+        return 0;
+    }
+
+    outlen = qat_hkdf_out_len(qat_hkdf_ctx);
+    if (key == NULL) {
+        if (outlen == 0) {
+            QATerr(QAT_F_QAT_HKDF_DERIVE, ERR_R_PASSED_NULL_PARAMETER);
+            return 0;
+        }
+        *olen = outlen;
+        return 1;
+    }
+    if (outlen != 0) {
+        if (*olen < outlen) {
+            WARN("[%s] Error: output buffer too small\n", __func__);
+            QATerr(QAT_F_QAT_HKDF_DERIVE, ERR_R_INTERNAL_ERROR);
+            return 0;
+        }
+        *olen = outlen;
+    }
+
+    if (qat_hkdf_offloadable(qat_hkdf_ctx, *olen)) {
+        ret = qat_hkdf_hw_derive(qat_hkdf_ctx, key, *olen);
+        if (ret != -1)
+            return ret;
+    }
+
+    DEBUG("[%s] HKDF derivation done in software\n", __func__);
+    return qat_hkdf_sw_derive(qat_hkdf_ctx, key, *olen);
+}
+#endif /* QAT_HKDF */
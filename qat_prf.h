@@ -49,6 +49,34 @@
 
 # include <openssl/engine.h>
 # include <openssl/ossl_typ.h>
+# include <openssl/kdf.h>
+
+# ifndef EVP_PKEY_CTRL_HKDF_MODE
+/* Same values as OpenSSL 1.1.1 so the HKDF mode can be selected on 1.1.0 */
+#  define EVP_PKEY_CTRL_HKDF_MODE                (EVP_PKEY_ALG_CTRL + 7)
+#  define EVP_PKEY_HKDEF_MODE_EXTRACT_AND_EXPAND 0
+#  define EVP_PKEY_HKDEF_MODE_EXTRACT_ONLY       1
+#  define EVP_PKEY_HKDEF_MODE_EXPAND_ONLY        2
+# endif
+
+/*
+ * QAT engine HKDF controls used to derive several TLS 1.3 labels from the
+ * same secret in a single request:
+ * - EVP_PKEY_CTRL_QAT_HKDF_LABEL queues an encoded HkdfLabel (p2, p1 bytes),
+ *   a NULL p2 empties the queue.
+ * - EVP_PKEY_CTRL_QAT_HKDF_SUBLABELS requests the QAT_HKDF_SUBLABEL_* values
+ *   (p1) to be derived from the secret of the last queued label.
+ * - EVP_PKEY_CTRL_QAT_HKDF_CIPHER selects the TLS 1.3 AEAD (p2) which sets
+ *   the length of the sublabel key.
+ */
+# define EVP_PKEY_CTRL_QAT_HKDF_LABEL           (EVP_PKEY_ALG_CTRL + 0x100)
+# define EVP_PKEY_CTRL_QAT_HKDF_SUBLABELS       (EVP_PKEY_ALG_CTRL + 0x101)
+# define EVP_PKEY_CTRL_QAT_HKDF_CIPHER          (EVP_PKEY_ALG_CTRL + 0x102)
+
+# define QAT_HKDF_SUBLABEL_KEY                  0x0001
+# define QAT_HKDF_SUBLABEL_IV                   0x0002
+# define QAT_HKDF_SUBLABEL_FINISHED             0x0008
+# define QAT_HKDF_MAX_LABELS                    4
 
 int qat_PRF_pkey_methods(ENGINE *e, EVP_PKEY_METHOD **pmeth, const int **nids,
                          int nid);
@@ -114,7 +114,9 @@ RSA_METHOD *qat_get_RSA_methods(void)
         || RSA_meth_set_priv_enc(qat_rsa_method, qat_rsa_priv_enc) == 0
         || RSA_meth_set_priv_dec(qat_rsa_method, qat_rsa_priv_dec) == 0
         || RSA_meth_set_mod_exp(qat_rsa_method, qat_rsa_mod_exp) == 0
-        || RSA_meth_set_bn_mod_exp(qat_rsa_method, qat_bn_mod_exp) == 0) {
+        || RSA_meth_set_bn_mod_exp(qat_rsa_method, qat_bn_mod_exp) == 0
+        || RSA_meth_set_finish(qat_rsa_method,
+                               RSA_meth_get_finish(RSA_PKCS1_OpenSSL())) == 0) {
         QATerr(QAT_F_QAT_GET_RSA_METHODS, ERR_R_INTERNAL_ERROR);
         return NULL;
     }
@@ -342,6 +344,19 @@ typedef struct rsa_op_data {
 #define NO_PADDING 0
 #define PADDING    1
 
+/* The op data and the key it points at share one pooled request, whose
+ * result buffer is the output buffer of the operation.
+ */
+typedef struct rsa_dec_req {
+    CpaCyRsaDecryptOpData op;
+    CpaCyRsaPrivateKey key;
+} rsa_dec_req_t;
+
+typedef struct rsa_enc_req {
+    CpaCyRsaEncryptOpData op;
+    CpaCyRsaPublicKey key;
+} rsa_enc_req_t;
+
 static void
 rsa_decrypt_op_buf_free(CpaCyRsaDecryptOpData * dec_op_data,
                         CpaFlatBuffer * out_buf, int padding)
@@ -358,39 +373,33 @@ rsa_decrypt_op_buf_free(CpaCyRsaDecryptOpData * dec_op_data,
             QAT_CHK_CLNSE_QMFREE_FLATBUFF(key->exponent1Dp);
             QAT_CHK_CLNSE_QMFREE_FLATBUFF(key->exponent2Dq);
             QAT_CHK_CLNSE_QMFREE_FLATBUFF(key->coefficientQInv);
-            OPENSSL_free(dec_op_data->pRecipientPrivateKey);
         }
-        OPENSSL_free(dec_op_data);
+        /* out_buf is part of the request */
+        qat_asym_req_put(qat_asym_req_of(dec_op_data));
     }
+}
 
-    if (out_buf) {
-        if (out_buf->pData)
-            qaeCryptoMemFree(out_buf->pData);
-        OPENSSL_free(out_buf);
-    }
+static CpaStatus qat_rsa_decrypt_submit(CpaInstanceHandle instanceHandle,
+                                        void *callbackTag, void *args)
+{
+    qat_asym_args *req = (qat_asym_args *)args;
+
+    return cpaCyRsaDecrypt(instanceHandle, qat_rsaCallbackFn, callbackTag,
+                           req->opData, req->out1);
 }
 
+/* Returns 1 on success, 0 on failure and -1 if the request expired before
+ * it could be submitted, the operation can then be done in software.
+ */
 int
 qat_rsa_decrypt(CpaCyRsaDecryptOpData * dec_op_data,
                 CpaFlatBuffer * output_buf)
 {
     /* Used for RSA Decrypt and RSA Sign */
-    struct op_done op_done;
-    CpaStatus sts = CPA_STATUS_FAIL;
-    int qatPerformOpRetries = 0;
-    CpaInstanceHandle instanceHandle = NULL;
-
-    int iMsgRetry = getQatMsgRetryCount();
-    useconds_t ulPollInterval = getQatPollInterval();
-
-    initOpDone(&op_done);
-    if (op_done.job) {
-        if (qat_setup_async_event_notification(0) == 0) {
-            QATerr(QAT_F_QAT_RSA_DECRYPT, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
-            return 0;
-        }
-    }
+    qat_asym_args req = { dec_op_data, output_buf, NULL, NULL };
+    CpaBoolean verify = CPA_FALSE;
+    CpaStatus sts;
+
     /*
      * cpaCyRsaDecrypt() is the function called for RSA verify in API, the
      * DecOpData [IN] contains both private key value and input file (hash)
@@ -398,66 +407,19 @@ qat_rsa_decrypt(CpaCyRsaDecryptOpData * dec_op_data,
      * message, the sts value return 0 if successful
      */
     CRYPTO_QAT_LOG("RSA - %s\n", __func__);
-    do {
-        if (NULL == (instanceHandle = get_next_inst())) {
-            WARN("instanceHandle is NULL\n");
-            QATerr(QAT_F_QAT_RSA_DECRYPT, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
-            return 0;
-        }
-        sts = cpaCyRsaDecrypt(instanceHandle, qat_rsaCallbackFn, &op_done,
-                              dec_op_data, output_buf);
-        if (sts == CPA_STATUS_RETRY) {
-            if (op_done.job == NULL) {
-                usleep(ulPollInterval +
-                       (qatPerformOpRetries % QAT_RETRY_BACKOFF_MODULO_DIVISOR));
-                qatPerformOpRetries++;
-                if (iMsgRetry != QAT_INFINITE_MAX_NUM_RETRIES) {
-                    if (qatPerformOpRetries >= iMsgRetry) {
-                        break;
-                    }
-                }
-            } else {
-                if ((qat_wake_job(op_done.job, 0) == 0) ||
-                    (qat_pause_job(op_done.job, 0) == 0)) {
-                    sts = CPA_STATUS_FAIL;
-                    break;
-                }
-            }
-        }
-    }
-    while (sts == CPA_STATUS_RETRY);
+    sts = qat_perform_op(NULL, qat_rsa_decrypt_submit, &req, 1, &verify);
+    if (sts == QAT_STATUS_EXPIRED)
+        return -1;
 
     if (sts != CPA_STATUS_SUCCESS) {
-        fprintf(stderr,"[%s] --- cpaCyRsaDecrypt failed, sts=%d.\n", __func__, sts);
+        WARN("[%s] --- cpaCyRsaDecrypt failed, sts=%d.\n", __func__, sts);
         QATerr(QAT_F_QAT_RSA_DECRYPT, ERR_R_INTERNAL_ERROR);
-        cleanupOpDone(&op_done);
         return 0;
     }
 
-    do {
-        if(op_done.job) {
-            /* If we get a failure on qat_pause_job then we will
-               not flag an error here and quit because we have
-               an asynchronous request in flight.
-               We don't want to start cleaning up data
-               structures that are still being used. If
-               qat_pause_job fails we will just yield and
-               loop around and try again until the request
-               completes and we can continue. */
-            if (qat_pause_job(op_done.job, 0) == 0)
-                pthread_yield();
-        } else {
-            pthread_yield();
-        }
-    }
-    while (!op_done.flag);
-
-    cleanupOpDone(&op_done);
-
-    if (op_done.verifyResult != CPA_TRUE) {
-        fprintf(stderr,"[%s] --- cpaCyRsaDecrypt failed, verifyResult=%d.\n",
-                __func__, op_done.verifyResult);
+    if (verify != CPA_TRUE) {
+        WARN("[%s] --- cpaCyRsaDecrypt failed, verifyResult=%d.\n",
+             __func__, verify);
         QATerr(QAT_F_QAT_RSA_DECRYPT, ERR_R_INTERNAL_ERROR);
         return 0;
     }
@@ -472,6 +434,8 @@ build_decrypt_op_buf(int flen, const unsigned char *from, unsigned char *to,
                      CpaFlatBuffer ** output_buffer, int alloc_pad)
 {
     int rsa_len = 0;
+    QAT_ASYM_REQ *req = NULL;
+    rsa_dec_req_t *dec_req = NULL;
     CpaCyRsaPrivateKey *cpa_prv_key = NULL;
     const BIGNUM *p = NULL;
     const BIGNUM *q = NULL;
@@ -495,27 +459,25 @@ build_decrypt_op_buf(int flen, const unsigned char *from, unsigned char *to,
         return 0;
     }
 
-    cpa_prv_key =
-        (CpaCyRsaPrivateKey *) OPENSSL_zalloc(sizeof(CpaCyRsaPrivateKey));
-    if (NULL == cpa_prv_key) {
-        WARN("[%s] --- Private Key zalloc failed!\n", __func__);
-        QATerr(QAT_F_BUILD_DECRYPT_OP_BUF, ERR_R_MALLOC_FAILURE);
-        return 0;
-    }
-
     DEBUG("[%s] --- flen =%d, padding = %d \n", __func__, flen, padding);
     /* output signature should have same length as RSA(128) */
     rsa_len = RSA_size(rsa);
 
-    /* output and input data MUST allocate memory for sign process */
-    /* memory allocation for DecOpdata[IN] */
-    *dec_op_data = OPENSSL_zalloc(sizeof(CpaCyRsaDecryptOpData));
-    if (NULL == *dec_op_data) {
-        WARN("[%s] --- OpData zalloc failed!\n", __func__);
+    /*
+     * DecOpdata[IN], the private key and the outputBuffer which should be
+     * big enough to contain RSA_size come together in one request
+     */
+    req = qat_asym_req_get(QAT_ASYM_REQ_RSA_DECRYPT, sizeof(rsa_dec_req_t),
+                           rsa_len, 1, 0);
+    if (NULL == req) {
+        WARN("[%s] --- Request allocation failed!\n", __func__);
         QATerr(QAT_F_BUILD_DECRYPT_OP_BUF, ERR_R_MALLOC_FAILURE);
-        OPENSSL_free(cpa_prv_key);
         return 0;
     }
+    dec_req = req->op_data;
+    cpa_prv_key = &dec_req->key;
+    *dec_op_data = &dec_req->op;
+    *output_buffer = &req->result[0];
 
     /* Setup the DecOpData structure */
     (*dec_op_data)->pRecipientPrivateKey = cpa_prv_key;
@@ -557,27 +519,6 @@ build_decrypt_op_buf(int flen, const unsigned char *from, unsigned char *to,
     else
         (*dec_op_data)->inputData.dataLenInBytes = flen;
 
-    *output_buffer = OPENSSL_malloc(sizeof(CpaFlatBuffer));
-    if (NULL == *output_buffer) {
-        WARN("[%s] --- OutputBuffer malloc failed!\n", __func__);
-        QATerr(QAT_F_BUILD_DECRYPT_OP_BUF, ERR_R_MALLOC_FAILURE);
-        return 0;
-    }
-
-    /*
-     * Memory allocation for DecOpdata[IN] the size of outputBuffer
-     * should big enough to contain RSA_size
-     */
-    (*output_buffer)->pData =
-        (Cpa8U *) qaeCryptoMemAlloc(rsa_len, __FILE__, __LINE__);
-
-    if (NULL == (*output_buffer)->pData) {
-        WARN("[%s] --- OutputBuffer Data malloc failed!\n", __func__);
-        QATerr(QAT_F_BUILD_DECRYPT_OP_BUF, ERR_R_MALLOC_FAILURE);
-        return 0;
-    }
-    (*output_buffer)->dataLenInBytes = rsa_len;
-
     return 1;
 }
 
@@ -592,41 +533,35 @@ rsa_encrypt_op_buf_free(CpaCyRsaEncryptOpData * enc_op_data,
             if (enc_op_data->pPublicKey->publicExponentE.pData)
                 qaeCryptoMemFree(enc_op_data->pPublicKey->
                                  publicExponentE.pData);
-            OPENSSL_free(enc_op_data->pPublicKey);
         }
         if (enc_op_data->inputData.pData)
             qaeCryptoMemFree(enc_op_data->inputData.pData);
-        OPENSSL_free(enc_op_data);
+        /* out_buf is part of the request */
+        qat_asym_req_put(qat_asym_req_of(enc_op_data));
     }
+}
 
-    if (out_buf) {
-        if (out_buf->pData)
-            qaeCryptoMemFree(out_buf->pData);
-        OPENSSL_free(out_buf);
-    }
+static CpaStatus qat_rsa_encrypt_submit(CpaInstanceHandle instanceHandle,
+                                        void *callbackTag, void *args)
+{
+    qat_asym_args *req = (qat_asym_args *)args;
+
+    return cpaCyRsaEncrypt(instanceHandle, qat_rsaCallbackFn, callbackTag,
+                           req->opData, req->out1);
 }
 
+/* Returns 1 on success, 0 on failure and -1 if the request expired before
+ * it could be submitted.
+ */
 int
 qat_rsa_encrypt(CpaCyRsaEncryptOpData * enc_op_data,
                 CpaFlatBuffer * output_buf)
 {
     /* Used for RSA Encrypt and RSA Verify */
-    struct op_done op_done;
-    CpaStatus sts = CPA_STATUS_FAIL;
-    int qatPerformOpRetries = 0;
-    CpaInstanceHandle instanceHandle = NULL;
-
-    int iMsgRetry = getQatMsgRetryCount();
-    useconds_t ulPollInterval = getQatPollInterval();
-
-    initOpDone(&op_done);
-    if (op_done.job) {
-        if (qat_setup_async_event_notification(0) == 0) {
-            QATerr(QAT_F_QAT_RSA_ENCRYPT, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
-            return 0;
-        }
-    }
+    qat_asym_args req = { enc_op_data, output_buf, NULL, NULL };
+    CpaBoolean verify = CPA_FALSE;
+    CpaStatus sts;
+
     /*
      * cpaCyRsaEncrypt() is the function called for RSA verify in API, the
      * DecOpData [IN] contains both private key value and input file (hash)
@@ -634,66 +569,19 @@ qat_rsa_encrypt(CpaCyRsaEncryptOpData * enc_op_data,
      * message, the sts value return 0 if successful
      */
     CRYPTO_QAT_LOG("RSA - %s\n", __func__);
-    do {
-        if (NULL == (instanceHandle = get_next_inst())) {
-            WARN("instanceHandle is NULL\n");
-            QATerr(QAT_F_QAT_RSA_ENCRYPT, ERR_R_INTERNAL_ERROR);
-            cleanupOpDone(&op_done);
-            return 0;
-        }
-
-        sts = cpaCyRsaEncrypt(instanceHandle, qat_rsaCallbackFn, &op_done,
-                              enc_op_data, output_buf);
-        if (sts == CPA_STATUS_RETRY) {
-            if (op_done.job == NULL) {
-                usleep(ulPollInterval +
-                       (qatPerformOpRetries % QAT_RETRY_BACKOFF_MODULO_DIVISOR));
-                qatPerformOpRetries++;
-                if (iMsgRetry != QAT_INFINITE_MAX_NUM_RETRIES) {
-                    if (qatPerformOpRetries >= iMsgRetry) {
-                        break;
-                    }
-                }
-            } else {
-                if ((qat_wake_job(op_done.job, 0) == 0) ||
-                    (qat_pause_job(op_done.job, 0) == 0)) {
-                    sts = CPA_STATUS_FAIL;
-                    break;
-                }
-            }
-        }
-    }
-    while (sts == CPA_STATUS_RETRY );
+    sts = qat_perform_op(NULL, qat_rsa_encrypt_submit, &req, 1, &verify);
+    if (sts == QAT_STATUS_EXPIRED)
+        return -1;
 
     if (sts != CPA_STATUS_SUCCESS) {
         WARN("[%s] --- cpaCyRsaEncrypt failed, sts=%d.\n", __func__, sts);
         QATerr(QAT_F_QAT_RSA_ENCRYPT, ERR_R_INTERNAL_ERROR);
-        cleanupOpDone(&op_done);
         return 0;
     }
 
-    do {
-        if(op_done.job) {
-            /* If we get a failure on qat_pause_job then we will
-               not flag an error here and quit because we have
-               an asynchronous request in flight.
-               We don't want to start cleaning up data
-               structures that are still being used. If
-               qat_pause_job fails we will just yield and
-               loop around and try again until the request
-               completes and we can continue. */
-            if (qat_pause_job(op_done.job, 0) == 0)
-                pthread_yield();
-        } else {
-            pthread_yield();
-        }
-    } while (!op_done.flag);
-
-    cleanupOpDone(&op_done);
-
-    if (op_done.verifyResult != CPA_TRUE) {
+    if (verify != CPA_TRUE) {
         WARN("[%s] --- cpaCyRsaEncrypt failed, verifyResult=%d.\n",
-             __func__, op_done.verifyResult);
+             __func__, verify);
         QATerr(QAT_F_QAT_RSA_ENCRYPT, ERR_R_INTERNAL_ERROR);
         return 0;
     }
@@ -707,6 +595,8 @@ build_encrypt_op(int flen, const unsigned char *from, unsigned char *to,
                  CpaCyRsaEncryptOpData ** enc_op_data,
                  CpaFlatBuffer ** output_buffer, int alloc_pad)
 {
+    QAT_ASYM_REQ *req = NULL;
+    rsa_enc_req_t *enc_req = NULL;
     CpaCyRsaPublicKey *cpa_pub_key = NULL;
     int rsa_len = 0;
     const BIGNUM *n = NULL;
@@ -728,24 +618,23 @@ build_encrypt_op(int flen, const unsigned char *from, unsigned char *to,
         return 0;
     }
 
-    cpa_pub_key = OPENSSL_zalloc(sizeof(CpaCyRsaPublicKey));
-    if (NULL == cpa_pub_key) {
-        WARN("[%s] --- Public Key zalloc failed!\n", __func__);
-        QATerr(QAT_F_BUILD_ENCRYPT_OP, ERR_R_MALLOC_FAILURE);
-        return 0;
-    }
-
     rsa_len = RSA_size(rsa);
 
-    /* Output and input data MUST allocate memory for RSA verify process */
-    /* Memory allocation for EncOpData[IN] */
-    *enc_op_data = OPENSSL_zalloc(sizeof(CpaCyRsaEncryptOpData));
-    if (NULL == *enc_op_data) {
-        WARN("[%s] --- OpData zalloc failed!\n", __func__);
+    /*
+     * EncOpData[IN], the public key and the outputBuffer[OUT] of the size
+     * of rsa size come together in one request
+     */
+    req = qat_asym_req_get(QAT_ASYM_REQ_RSA_ENCRYPT, sizeof(rsa_enc_req_t),
+                           rsa_len, 1, 0);
+    if (NULL == req) {
+        WARN("[%s] --- Request allocation failed!\n", __func__);
         QATerr(QAT_F_BUILD_ENCRYPT_OP, ERR_R_MALLOC_FAILURE);
-        OPENSSL_free(cpa_pub_key);
         return 0;
     }
+    enc_req = req->op_data;
+    cpa_pub_key = &enc_req->key;
+    *enc_op_data = &enc_req->op;
+    *output_buffer = &req->result[0];
 
     /* Setup the Encrypt operation Data structure */
     (*enc_op_data)->pPublicKey = cpa_pub_key;
@@ -781,30 +670,6 @@ build_encrypt_op(int flen, const unsigned char *from, unsigned char *to,
     else
         (*enc_op_data)->inputData.dataLenInBytes = flen;
 
-    /*
-     * Memory allocation for outputBuffer[OUT] OutputBuffer size initialize
-     * as the size of rsa size
-     */
-    (*output_buffer) =
-        (CpaFlatBuffer *) OPENSSL_malloc(sizeof(CpaFlatBuffer));
-    if (NULL == (*output_buffer)) {
-        WARN("[%s] --- OutputBuffer malloc failed!\n", __func__);
-        QATerr(QAT_F_BUILD_ENCRYPT_OP, ERR_R_MALLOC_FAILURE);
-        return 0;
-    }
-
-    /*
-     * outputBuffer size should large enough to hold the Hash value but
-     * smaller than (RSA_size(rsa)-11)
-     */
-    (*output_buffer)->dataLenInBytes = rsa_len;
-    (*output_buffer)->pData = qaeCryptoMemAlloc(rsa_len, __FILE__, __LINE__);
-    if (NULL == (*output_buffer)->pData) {
-        WARN("[%s] --- OutputBuffer pData malloc failed!\n", __func__);
-        QATerr(QAT_F_BUILD_ENCRYPT_OP, ERR_R_MALLOC_FAILURE);
-        return 0;;
-    }
-
     return 1;
 }
 
@@ -833,6 +698,7 @@ qat_rsa_priv_enc(int flen, const unsigned char *from, unsigned char *to,
     CpaCyRsaDecryptOpData *dec_op_data = NULL;
     CpaFlatBuffer *output_buffer = NULL;
     int sts = 1;
+    int ret;
 
     DEBUG("[%s] --- called.\n", __func__);
 
@@ -864,7 +730,13 @@ qat_rsa_priv_enc(int flen, const unsigned char *from, unsigned char *to,
         goto exit;
     }
 
-    if (1 != qat_rsa_decrypt(dec_op_data, output_buffer)) {
+    if ((ret = qat_rsa_decrypt(dec_op_data, output_buffer)) == -1) {
+        /* The request could not be submitted in time */
+        rsa_decrypt_op_buf_free(dec_op_data, output_buffer, PADDING);
+        return RSA_meth_get_priv_enc(RSA_PKCS1_OpenSSL())
+                                     (flen, from, to, rsa, padding);
+    }
+    if (ret != 1) {
         /* set output all 0xff if failed */
         DEBUG("[%s] --- cpaCyRsaDecrypt failed! \n", __func__);
         sts = 0;
@@ -912,6 +784,7 @@ int qat_rsa_priv_dec(int flen, const unsigned char *from,
     int rsa_len = 0;
     int output_len = 0;
     int sts = 1;
+    int ret;
     CpaCyRsaDecryptOpData *dec_op_data = NULL;
     CpaFlatBuffer *output_buffer = NULL;
 
@@ -940,7 +813,13 @@ int qat_rsa_priv_dec(int flen, const unsigned char *from,
         goto exit;
     }
 
-    if (1 != qat_rsa_decrypt(dec_op_data, output_buffer)) {
+    if ((ret = qat_rsa_decrypt(dec_op_data, output_buffer)) == -1) {
+        /* The request could not be submitted in time */
+        rsa_decrypt_op_buf_free(dec_op_data, output_buffer, NO_PADDING);
+        return RSA_meth_get_priv_dec(RSA_PKCS1_OpenSSL())
+                                     (flen, from, to, rsa, padding);
+    }
+    if (ret != 1) {
         WARN("[%s] --- RsaDecrypt failed.\n", __func__);
         sts = 0;
         goto exit;
@@ -996,6 +875,7 @@ int qat_rsa_pub_enc(int flen, const unsigned char *from,
     CpaCyRsaEncryptOpData *enc_op_data = NULL;
     CpaFlatBuffer *output_buffer = NULL;
     int sts = 1;
+    int ret;
 
     DEBUG("[%s] --- called.\n", __func__);
 
@@ -1022,7 +902,13 @@ int qat_rsa_pub_enc(int flen, const unsigned char *from,
         goto exit;
     }
 
-    if (1 != qat_rsa_encrypt(enc_op_data, output_buffer)) {
+    if ((ret = qat_rsa_encrypt(enc_op_data, output_buffer)) == -1) {
+        /* The request could not be submitted in time */
+        rsa_encrypt_op_buf_free(enc_op_data, output_buffer, PADDING);
+        return RSA_meth_get_pub_enc(RSA_PKCS1_OpenSSL())
+                                     (flen, from, to, rsa, padding);
+    }
+    if (ret != 1) {
         /* set output all 0xff if failed */
         DEBUG("[%s] --- cpaCyRsaEncrypt failed! \n", __func__);
         sts = 0;
@@ -1075,6 +961,7 @@ qat_rsa_pub_dec(int flen, const unsigned char *from, unsigned char *to,
     CpaCyRsaEncryptOpData *enc_op_data = NULL;
     CpaFlatBuffer *output_buffer = NULL;
     int sts = 1;
+    int ret;
 
     DEBUG("[%s] --- called.\n", __func__);
 
@@ -1102,7 +989,13 @@ qat_rsa_pub_dec(int flen, const unsigned char *from, unsigned char *to,
         goto exit;
     }
 
-    if (1 != qat_rsa_encrypt(enc_op_data, output_buffer)) {
+    if ((ret = qat_rsa_encrypt(enc_op_data, output_buffer)) == -1) {
+        /* The request could not be submitted in time */
+        rsa_encrypt_op_buf_free(enc_op_data, output_buffer, NO_PADDING);
+        return RSA_meth_get_pub_dec(RSA_PKCS1_OpenSSL())
+                                     (flen, from, to, rsa, padding);
+    }
+    if (ret != 1) {
         WARN("[%s] --- RsaEncrypt failed.\n", __func__);
         sts = 0;
         goto exit;
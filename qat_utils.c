@@ -44,11 +44,34 @@
  *****************************************************************************/
 
 #include <stdio.h>
+#include <string.h>
 #include <pthread.h>
 #include "cpa.h"
+#ifdef USE_QAT_CONTIG_MEM
+# include "qae_mem_utils.h"
+#endif
+#ifdef USE_QAE_MEM
+# include "cmn_mem_drv_inf.h"
+#endif
 #include "qat_utils.h"
 #include "e_qat.h"
 
+#include <openssl/crypto.h>
+
+/* Buffers handed out through the pinned memory functions, sorted by address */
+typedef struct qat_pinned_buf_t {
+    unsigned char *base;
+    size_t len;
+} qat_pinned_buf;
+
+static qat_pinned_buf *qat_pinned_bufs = NULL;
+static int qat_pinned_buf_count = 0;
+static int qat_pinned_buf_capacity = 0;
+/* bounds of the registered buffers to reject other memory without a search */
+static unsigned char *qat_pinned_buf_min = NULL;
+static unsigned char *qat_pinned_buf_max = NULL;
+static pthread_rwlock_t qat_pinned_buf_lock = PTHREAD_RWLOCK_INITIALIZER;
+
 #ifdef QAT_TESTS_LOG
 
 FILE *cryptoQatLogger = NULL;
@@ -197,3 +220,165 @@ void dumpRequest(const CpaInstanceHandle instanceHandle,
              CPA_TRUE ? "CPA_TRUE" : "CPA_FALSE"));
 }
 #endif
+
+/******************************************************************************
+* function:
+*         qat_pinned_buf_find(const void *ptr)
+*
+* @param ptr [IN] - address to look up
+*
+* @retval int, index of the buffer containing ptr, -1 if there is none
+*
+* description:
+*   Binary search of the registered pinned buffers. Must be called with
+*   qat_pinned_buf_lock held.
+*
+******************************************************************************/
+static int qat_pinned_buf_find(const void *ptr)
+{
+    const unsigned char *p = (const unsigned char *)ptr;
+    int lo = 0;
+    int hi = qat_pinned_buf_count - 1;
+    int mid;
+
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (p < qat_pinned_bufs[mid].base)
+            hi = mid - 1;
+        else if (p >= qat_pinned_bufs[mid].base + qat_pinned_bufs[mid].len)
+            lo = mid + 1;
+        else
+            return mid;
+    }
+    return -1;
+}
+
+/* recompute the bounds of the registered buffers, lock held */
+static void qat_pinned_buf_update_bounds(void)
+{
+    qat_pinned_buf *last = NULL;
+
+    if (qat_pinned_buf_count == 0) {
+        qat_pinned_buf_min = NULL;
+        qat_pinned_buf_max = NULL;
+        return;
+    }
+    last = &qat_pinned_bufs[qat_pinned_buf_count - 1];
+    qat_pinned_buf_min = qat_pinned_bufs[0].base;
+    qat_pinned_buf_max = last->base + last->len;
+}
+
+/******************************************************************************
+* function:
+*         qat_pinned_buf_alloc(size_t size)
+*
+* @param size [IN] - size of the buffer in bytes
+*
+* @retval void *, pointer to the buffer or NULL on failure
+*
+* description:
+*   Allocate a buffer of pinned memory and register it so that the ciphers
+*   can use it directly as the source and destination of a request.
+*
+******************************************************************************/
+void *qat_pinned_buf_alloc(size_t size)
+{
+    qat_pinned_buf *bufs = NULL;
+    unsigned char *ptr = NULL;
+    int i;
+
+    if (size == 0)
+        return NULL;
+
+    if ((ptr = qaeCryptoMemAlloc(size, __FILE__, __LINE__)) == NULL) {
+        WARN("[%s] Unable to allocate %zu bytes of pinned memory\n",
+             __func__, size);
+        return NULL;
+    }
+
+    pthread_rwlock_wrlock(&qat_pinned_buf_lock);
+    if (qat_pinned_buf_count == qat_pinned_buf_capacity) {
+        bufs = OPENSSL_realloc(qat_pinned_bufs, (qat_pinned_buf_capacity + 64)
+                               * sizeof(qat_pinned_buf));
+        if (bufs == NULL) {
+            pthread_rwlock_unlock(&qat_pinned_buf_lock);
+            WARN("[%s] Unable to register pinned buffer\n", __func__);
+            qaeCryptoMemFree(ptr);
+            return NULL;
+        }
+        qat_pinned_bufs = bufs;
+        qat_pinned_buf_capacity += 64;
+    }
+
+    for (i = qat_pinned_buf_count;
+         i > 0 && qat_pinned_bufs[i - 1].base > ptr; i--)
+        qat_pinned_bufs[i] = qat_pinned_bufs[i - 1];
+    qat_pinned_bufs[i].base = ptr;
+    qat_pinned_bufs[i].len = size;
+    qat_pinned_buf_count++;
+    qat_pinned_buf_update_bounds();
+    pthread_rwlock_unlock(&qat_pinned_buf_lock);
+    return ptr;
+}
+
+/******************************************************************************
+* function:
+*         qat_pinned_buf_free(void *ptr)
+*
+* @param ptr [IN] - buffer returned by qat_pinned_buf_alloc()
+*
+* description:
+*   Unregister and free a buffer of pinned memory.
+*
+******************************************************************************/
+void qat_pinned_buf_free(void *ptr)
+{
+    int i;
+
+    if (ptr == NULL)
+        return;
+
+    pthread_rwlock_wrlock(&qat_pinned_buf_lock);
+    if ((i = qat_pinned_buf_find(ptr)) < 0 ||
+        qat_pinned_bufs[i].base != ptr) {
+        pthread_rwlock_unlock(&qat_pinned_buf_lock);
+        WARN("[%s] %p is not a pinned buffer\n", __func__, ptr);
+        return;
+    }
+    memmove(&qat_pinned_bufs[i], &qat_pinned_bufs[i + 1],
+            (qat_pinned_buf_count - i - 1) * sizeof(qat_pinned_buf));
+    qat_pinned_buf_count--;
+    qat_pinned_buf_update_bounds();
+    pthread_rwlock_unlock(&qat_pinned_buf_lock);
+    qaeCryptoMemFree(ptr);
+}
+
+/******************************************************************************
+* function:
+*         qat_pinned_buf_contains(const void *ptr, size_t len)
+*
+* @param ptr [IN] - start of the memory to check
+* @param len [IN] - length of the memory to check
+*
+* @retval 1 if the memory lies within a single pinned buffer, 0 otherwise
+*
+* description:
+*   Check whether memory can be passed to QAT without being copied. The
+*   virtual to physical translation is only attempted once the memory is
+*   known to be pinned as it reads the slab header of the address.
+*
+******************************************************************************/
+int qat_pinned_buf_contains(const void *ptr, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)ptr;
+    int i, found = 0;
+
+    pthread_rwlock_rdlock(&qat_pinned_buf_lock);
+    if (qat_pinned_buf_count > 0 && p >= qat_pinned_buf_min &&
+        p < qat_pinned_buf_max && (i = qat_pinned_buf_find(p)) >= 0 &&
+        len <= (size_t)(qat_pinned_bufs[i].base + qat_pinned_bufs[i].len - p))
+        found = 1;
+    pthread_rwlock_unlock(&qat_pinned_buf_lock);
+
+    return found && qaeCryptoMemV2P((void *)p) != 0;
+}
@@ -126,4 +126,8 @@ void dumpRequest(const CpaInstanceHandle instanceHandle, void *pCallbackTag,
 #  define WARN(...)
 # endif
 
+void *qat_pinned_buf_alloc(size_t size);
+void qat_pinned_buf_free(void *ptr);
+int qat_pinned_buf_contains(const void *ptr, size_t len);
+
 #endif                          /* QAT_UTILS_H */